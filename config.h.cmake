@@ -19,6 +19,8 @@
 #cmakedefine OPENSYNC_TRACE
 
 #cmakedefine HAVE_FLOCK
+#cmakedefine HAVE_EVENTFD
+#cmakedefine HAVE_MEMFD_CREATE
 #cmakedefine HAVE_SOLARIS
 
 #define OPENSYNC_TESTDATA "${CMAKE_CURRENT_SOURCE_DIR}/tests/data"
@@ -165,6 +165,8 @@ OSyncArchive *osync_archive_new(const char *filename, OSyncError **error)
 		goto error_and_free;
 	}
 
+	archive->data_mutex = g_mutex_new();
+
 	osync_trace(TRACE_EXIT, "%s: %p", __func__, archive);
 	return archive;
 
@@ -198,6 +200,10 @@ void osync_archive_unref(OSyncArchive *archive)
 		}
 		
 		osync_free(archive->db);
+
+		if (archive->data_mutex)
+			g_mutex_free(archive->data_mutex);
+
 		osync_free(archive);
 
 		osync_trace(TRACE_EXIT, "%s", __func__);
@@ -214,6 +220,8 @@ osync_bool osync_archive_save_data(OSyncArchive *archive, osync_mappingid id, co
 	osync_assert(data);
 	osync_assert(size);
 
+	g_mutex_lock(archive->data_mutex);
+
 	if (!osync_archive_create(archive->db, objtype, error))
 		goto error;
 
@@ -230,10 +238,13 @@ osync_bool osync_archive_save_data(OSyncArchive *archive, osync_mappingid id, co
 
 	osync_free(query);
 
+	g_mutex_unlock(archive->data_mutex);
+
 	osync_trace(TRACE_EXIT, "%s", __func__);
 	return TRUE;
 
  error:
+	g_mutex_unlock(archive->data_mutex);
 	osync_trace(TRACE_EXIT_ERROR, "%s: %s", __func__, osync_error_print(error));
 	return FALSE;
 }
@@ -251,8 +262,10 @@ int osync_archive_load_data(OSyncArchive *archive, const char *uid, const char *
 	osync_assert(data);
 	osync_assert(size);
 
+	g_mutex_lock(archive->data_mutex);
+
 	if (!osync_archive_create(archive->db, objtype, error))
-		goto error;
+		goto error_unlock;
 
 	escaped_uid = osync_db_sql_escape(uid);
 	escaped_objtype = osync_db_sql_escape(objtype);
@@ -266,6 +279,8 @@ int osync_archive_load_data(OSyncArchive *archive, const char *uid, const char *
 	osync_free(query);
 	osync_free(escaped_uid);
 
+	g_mutex_unlock(archive->data_mutex);
+
 	if (ret < 0) {
 		goto error;
 	} else if (ret == 0) {
@@ -275,7 +290,9 @@ int osync_archive_load_data(OSyncArchive *archive, const char *uid, const char *
 
 	osync_trace(TRACE_EXIT, "%s", __func__);
 	return 1;
-	
+
+ error_unlock:
+	g_mutex_unlock(archive->data_mutex);
  error:
 	osync_trace(TRACE_EXIT_ERROR, "%s: %s", __func__, osync_error_print(error));
 	return -1;
@@ -44,7 +44,8 @@ struct OSyncArchive {
 	int ref_count;
 	/**  */
 	OSyncDB *db;
-	/**  */
+	/** Serializes the access to the archived data of the object engines */
+	GMutex *data_mutex;
 };
 
 /*@}*/
@@ -30,6 +30,8 @@
 #include "opensync-helper.h"
 #include "helper/opensync_hashtable_internals.h"
 
+#include "data/opensync_change_internals.h"
+
 #include "opensync-ipc.h"
 #include "ipc/opensync_serializer_internals.h"
 #include "ipc/opensync_message_internals.h"
@@ -56,6 +58,24 @@ typedef struct callContext {
 	OSyncChange *change;
 } callContext;
 
+typedef struct commitBatch commitBatch;
+
+typedef struct commitBatchEntry {
+	commitBatch *batch;
+	OSyncChange *change;
+	OSyncError *error;
+} commitBatchEntry;
+
+/* All changes of one OSYNC_MESSAGE_COMMIT_CHANGES message, which
+ * get replied together once every single context got replied */
+struct commitBatch {
+	OSyncClient *client;
+	OSyncMessage *message;
+	unsigned int num_changes;
+	int pending;
+	commitBatchEntry *entries;
+};
+
 static OSyncContext *_create_context(OSyncClient *client, OSyncMessage *message, OSyncContextCallbackFn callback, OSyncChange *change, OSyncError **error)
 {
 	OSyncContext *context = NULL;
@@ -312,6 +332,76 @@ error:
 	return FALSE;
 }
 
+/* The change batch lock has to be held by the caller */
+static void _osync_client_discard_changes_locked(OSyncClient *client)
+{
+	if (client->change_batch_timeout) {
+		g_source_destroy(client->change_batch_timeout);
+		g_source_unref(client->change_batch_timeout);
+		client->change_batch_timeout = NULL;
+	}
+
+	if (client->change_batch) {
+		osync_message_unref(client->change_batch);
+		client->change_batch = NULL;
+	}
+
+	client->change_batch_count = 0;
+}
+
+/* Sends the batch of reported changes. The change batch lock has to be held by the caller */
+static osync_bool _osync_client_flush_changes_locked(OSyncClient *client, OSyncError **error)
+{
+	OSyncMessage *batch = client->change_batch;
+
+	if (!batch)
+		return TRUE;
+
+	osync_message_ref(batch);
+	_osync_client_discard_changes_locked(client);
+
+	/* Terminates the list of changes */
+	if (!osync_message_write_int(batch, 0, error))
+		goto error;
+
+	if (!osync_queue_send_message(client->outgoing, NULL, batch, error))
+		goto error;
+
+	osync_message_unref(batch);
+	return TRUE;
+
+ error:
+	osync_message_unref(batch);
+	return FALSE;
+}
+
+static osync_bool _osync_client_flush_changes(OSyncClient *client, OSyncError **error)
+{
+	osync_bool ret = FALSE;
+
+	g_mutex_lock(client->change_batch_lock);
+	ret = _osync_client_flush_changes_locked(client, error);
+	g_mutex_unlock(client->change_batch_lock);
+
+	return ret;
+}
+
+static gboolean _osync_client_change_batch_timeout(gpointer user_data)
+{
+	OSyncClient *client = user_data;
+	OSyncError *locerror = NULL;
+
+	osync_trace(TRACE_ENTRY, "%s(%p)", __func__, user_data);
+
+	if (!_osync_client_flush_changes(client, &locerror)) {
+		osync_client_error_shutdown(client, locerror);
+		osync_error_unref(&locerror);
+	}
+
+	osync_trace(TRACE_EXIT, "%s", __func__);
+	return FALSE;
+}
+
 static void _osync_client_get_changes_callback(void *data, OSyncError *error)
 {
 	OSyncError *locerror = NULL;
@@ -325,6 +415,10 @@ static void _osync_client_get_changes_callback(void *data, OSyncError *error)
 	message = baton->message;
 	client = baton->client;
 
+	/* All changes have to arrive before the reply */
+	if (!_osync_client_flush_changes(client, &locerror))
+		goto error;
+
 	if (!osync_error_is_set(&error)) {
 		reply = osync_message_new_reply(message, &locerror);
 		//Send get_changes specific reply data
@@ -365,30 +459,52 @@ static void _osync_client_change_callback(OSyncChange *change, void *data)
 	callContext *baton = NULL;
 	OSyncError *locerror = NULL;
 	OSyncClient *client = NULL;
-	OSyncMessage *message = NULL;
 
 	baton = data;
 	osync_trace(TRACE_ENTRY, "%s(%p, %p)", __func__, change, data);
 	
 	client = baton->client;
-	message = osync_message_new(OSYNC_MESSAGE_NEW_CHANGE, 0, &locerror);
-	if (!message)
-		goto error;
 
-	if (!osync_marshal_change(message, change, &locerror))
-		goto error_free_message;
+	/* Plugins might report changes from their own threads */
+	g_mutex_lock(client->change_batch_lock);
 
-	if (!osync_queue_send_message(client->outgoing, NULL, message, &locerror))
-		goto error_free_message;
-	
-	osync_message_unref(message);
+	if (!client->change_batch) {
+		client->change_batch = osync_message_new(OSYNC_MESSAGE_NEW_CHANGES, 0, &locerror);
+		if (!client->change_batch)
+			goto error_discard_batch;
+
+		osync_queue_prepare_message(client->outgoing, client->change_batch);
+
+		if (client->change_batch_msec) {
+			client->change_batch_timeout = g_timeout_source_new(client->change_batch_msec);
+			g_source_set_callback(client->change_batch_timeout, _osync_client_change_batch_timeout, client, NULL);
+			g_source_attach(client->change_batch_timeout, client->context);
+		}
+	}
+
+	/* Every change is preceded by a non-zero int, the list ends with a 0 */
+	if (!osync_message_write_int(client->change_batch, 1, &locerror))
+		goto error_discard_batch;
+
+	if (!osync_marshal_change(client->change_batch, change, &locerror))
+		goto error_discard_batch;
+
+	client->change_batch_count++;
+	if (client->change_batch_count >= client->change_batch_size
+	    || osync_message_get_message_size(client->change_batch) >= client->change_batch_bytes) {
+		if (!_osync_client_flush_changes_locked(client, &locerror))
+			goto error_unlock;
+	}
+
+	g_mutex_unlock(client->change_batch_lock);
 	
 	osync_trace(TRACE_EXIT, "%s", __func__);
 	return;
 	
- error_free_message:
-	osync_message_unref(message);
- error:
+ error_discard_batch:
+	_osync_client_discard_changes_locked(client);
+ error_unlock:
+	g_mutex_unlock(client->change_batch_lock);
 	_free_baton(baton);
 	osync_client_error_shutdown(client, locerror);
 	osync_error_unref(&locerror);
@@ -456,40 +572,35 @@ static void _osync_client_uid_update_callback(const char *olduid, const char *ne
 	return;
 }
 
-static void _osync_client_ignored_conflict_callback(OSyncChange *change, void *data)
+/* Sends a change which got read on request of the engine */
+static osync_bool _osync_client_send_read_change(OSyncClient *client, OSyncChange *change, OSyncError **error)
 {
-	callContext *baton = NULL;
-	OSyncError *locerror = NULL;
-	OSyncClient *client = NULL;
 	OSyncMessage *message = NULL;
 
-	baton = data;
-	osync_trace(TRACE_ENTRY, "%s(%p, %p)", __func__, change, data);
+	osync_trace(TRACE_ENTRY, "%s(%p, %p, %p)", __func__, client, change, error);
 	
-	client = baton->client;
-	message = osync_message_new(OSYNC_MESSAGE_READ_CHANGE, 0, &locerror);
+	message = osync_message_new(OSYNC_MESSAGE_READ_CHANGE, 0, error);
 	if (!message)
 		goto error;
 
-	if (!osync_marshal_change(message, change, &locerror))
+	osync_queue_prepare_message(client->outgoing, message);
+
+	if (!osync_marshal_change(message, change, error))
 		goto error_free_message;
 
-	if (!osync_queue_send_message(client->outgoing, NULL, message, &locerror))
+	if (!osync_queue_send_message(client->outgoing, NULL, message, error))
 		goto error_free_message;
 	
 	osync_message_unref(message);
 	
 	osync_trace(TRACE_EXIT, "%s", __func__);
-	return;
+	return TRUE;
 	
  error_free_message:
 	osync_message_unref(message);
  error:
-	_free_baton(baton);
-	osync_client_error_shutdown(client, locerror);
-	osync_error_unref(&locerror);
-	osync_trace(TRACE_EXIT, "%s", __func__);
-	return;
+	osync_trace(TRACE_EXIT_ERROR, "%s: %s", __func__, osync_error_print(error));
+	return FALSE;
 }
 
 static void _osync_client_read_callback(void *data, OSyncError *error)
@@ -506,16 +617,21 @@ static void _osync_client_read_callback(void *data, OSyncError *error)
 	message = baton->message;
 	client = baton->client;
 
-	osync_trace(TRACE_INTERNAL, "ignored chnaged: %p", baton->change);
+	osync_trace(TRACE_INTERNAL, "read change: %p", baton->change);
 
 	if (!osync_error_is_set(&error)) {
+		/* The read change goes out ahead of the reply. Once the
+		 * engine gets the reply, it also got the data of the change. */
+		if (!_osync_client_send_read_change(client, baton->change, &locerror))
+			goto error;
+
 		reply = osync_message_new_reply(message, &locerror);
 		if (!reply)
 			goto error;
 
 		//Send get_changes specific reply data
 		if (!osync_message_write_string(reply, osync_change_get_uid(baton->change), &locerror))
-			goto error;
+			goto error_free_message;
 	} else {
 		reply = osync_message_new_errorreply(message, error, &locerror);
 	}
@@ -527,8 +643,6 @@ static void _osync_client_read_callback(void *data, OSyncError *error)
 	if (!osync_queue_send_message(client->outgoing, NULL, reply, &locerror))
 		goto error_free_message;
 
-	_osync_client_ignored_conflict_callback(baton->change, baton);
-
 	_free_baton(baton);
 
 	osync_message_unref(reply);
@@ -565,6 +679,8 @@ static void _osync_client_commit_change_callback(void *data, OSyncError *error)
 		if (!reply)
 			goto error;
 
+		osync_queue_prepare_message(client->outgoing, reply);
+
 		//Send get_changes specific reply data
 		if (!osync_message_write_string(reply, osync_change_get_uid(baton->change), &locerror))
 			goto error_free_message;
@@ -595,6 +711,102 @@ static void _osync_client_commit_change_callback(void *data, OSyncError *error)
 	return;
 }
 
+static void _free_commit_batch(commitBatch *batch)
+{
+	unsigned int i;
+
+	for (i = 0; i < batch->num_changes; i++) {
+		if (batch->entries[i].change)
+			osync_change_unref(batch->entries[i].change);
+
+		if (batch->entries[i].error)
+			osync_error_unref(&batch->entries[i].error);
+	}
+
+	osync_client_unref(batch->client);
+	osync_message_unref(batch->message);
+
+	osync_free(batch->entries);
+	osync_free(batch);
+}
+
+static void _osync_client_commit_changes_callback(void *data, OSyncError *error)
+{
+	OSyncError *locerror = NULL;
+	commitBatchEntry *entry = NULL;
+	commitBatch *batch = NULL;
+	OSyncClient *client = NULL;
+	OSyncMessage *reply = NULL;
+	unsigned int i;
+
+	osync_trace(TRACE_ENTRY, "%s(%p, %p)", __func__, data, error);
+	entry = data;
+	batch = entry->batch;
+	client = batch->client;
+
+	if (osync_error_is_set(&error)) {
+		osync_error_ref(&error);
+		entry->error = error;
+	}
+
+	/* Contexts might get replied from several threads */
+	if (!g_atomic_int_dec_and_test(&batch->pending)) {
+		osync_trace(TRACE_EXIT, "%s: Waiting for other changes", __func__);
+		return;
+	}
+
+	osync_client_ref(client);
+
+	reply = osync_message_new_reply(batch->message, &locerror);
+	if (!reply)
+		goto error;
+
+	osync_queue_prepare_message(client->outgoing, reply);
+
+	/* Every change gets a 0 followed by its uid, or a 1 followed by its error */
+	for (i = 0; i < batch->num_changes; i++) {
+		entry = &batch->entries[i];
+
+		if (!entry->error) {
+			if (!osync_message_write_int(reply, 0, &locerror))
+				goto error_free_message;
+
+			if (!osync_message_write_string(reply, osync_change_get_uid(entry->change), &locerror))
+				goto error_free_message;
+		} else {
+			if (!osync_message_write_int(reply, 1, &locerror))
+				goto error_free_message;
+
+			if (!osync_marshal_error(reply, entry->error, &locerror))
+				goto error_free_message;
+		}
+	}
+	osync_trace(TRACE_INTERNAL, "Reply id %lli", osync_message_get_id(reply));
+
+	_free_commit_batch(batch);
+	batch = NULL;
+
+	if (!osync_queue_send_message(client->outgoing, NULL, reply, &locerror))
+		goto error_free_message;
+
+	osync_message_unref(reply);
+	osync_client_unref(client);
+
+	osync_trace(TRACE_EXIT, "%s", __func__);
+	return;
+
+ error_free_message:
+	osync_message_unref(reply);
+ error:
+	if (batch)
+		_free_commit_batch(batch);
+	osync_client_error_shutdown(client, locerror);
+	osync_client_unref(client);
+	osync_error_unref(&locerror);
+	osync_trace(TRACE_EXIT, "%s", __func__);
+	return;
+}
+
 static void _osync_client_committed_all_callback(void *data, OSyncError *error)
 {
 	OSyncError *locerror = NULL;
@@ -693,6 +905,8 @@ static osync_bool _osync_client_handle_initialize(OSyncClient *client, OSyncMess
 	char *configdir = NULL;
 	char *formatdir = NULL;
 	int haspluginconfig = 0;
+	int wire_version = OSYNC_QUEUE_WIRE_VERSION_PLAIN;
+	osync_bool has_wire_version = FALSE;
 	OSyncPluginConfig *config = NULL;
 	OSyncQueue *outgoing = NULL;
 	OSyncList *r = NULL;
@@ -762,12 +976,16 @@ static osync_bool _osync_client_handle_initialize(OSyncClient *client, OSyncMess
 		osync_plugin_ref(client->plugin);
 	}
 	
-	client->format_env = osync_format_env_new(error);
-	if (!client->format_env)
-		goto error;
+	if (client->shared_format_env) {
+		client->format_env = osync_format_env_ref(client->shared_format_env);
+	} else {
+		client->format_env = osync_format_env_new(error);
+		if (!client->format_env)
+			goto error;
 	
-	if (!osync_format_env_load_plugins(client->format_env, formatdir, error))
-		goto error;
+		if (!osync_format_env_load_plugins(client->format_env, formatdir, error))
+			goto error;
+	}
 	
 	client->plugin_info = osync_plugin_info_new(error);
 	if (!client->plugin_info)
@@ -791,6 +1009,19 @@ static osync_bool _osync_client_handle_initialize(OSyncClient *client, OSyncMess
 	}
 #endif	
 
+	/* Engines which know about wire versions append the one they want.
+	 * Accept it up to the newest version we know */
+	if (osync_message_get_remaining_size(message)) {
+		if (!osync_message_read_int(message, &wire_version, error))
+			goto error;
+
+		has_wire_version = TRUE;
+		if (wire_version > OSYNC_QUEUE_WIRE_VERSION)
+			wire_version = OSYNC_QUEUE_WIRE_VERSION;
+		if (wire_version < OSYNC_QUEUE_WIRE_VERSION_PLAIN)
+			wire_version = OSYNC_QUEUE_WIRE_VERSION_PLAIN;
+	}
+
 	/* Enable active sinks */
 
 	if (config)
@@ -865,8 +1096,15 @@ static osync_bool _osync_client_handle_initialize(OSyncClient *client, OSyncMess
 	if (!osync_marshal_objtype_sinks(reply, client, FALSE, error))
 		goto error_free_message;
 
+	/* Older engines neither ask for nor expect a wire version */
+	if (has_wire_version && !osync_message_write_int(reply, wire_version, error))
+		goto error_free_message;
+
 	if (!osync_queue_send_message(client->outgoing, NULL, reply, error))
 		goto error_free_message;
+
+	/* The reply is still plain, the engine switches after reading it */
+	osync_queue_set_wire_version(client->outgoing, wire_version);
 	
 	osync_message_unref(reply);
 		
@@ -1221,7 +1459,7 @@ static osync_bool _osync_client_handle_disconnect(OSyncClient *client, OSyncMess
 
 static osync_bool _osync_client_handle_get_changes(OSyncClient *client, OSyncMessage *message, OSyncError **error)
 {
-	int slowsync;
+	int slowsync, change_stubs = FALSE;
 	char *objtype = NULL;
 	OSyncMessage *reply = NULL;
 	OSyncObjTypeSink *sink = NULL;
@@ -1232,10 +1470,14 @@ static osync_bool _osync_client_handle_get_changes(OSyncClient *client, OSyncMes
 	osync_message_read_string(message, &objtype, error);
 	osync_message_read_int(message, &slowsync, error);
 
+	/* Older engines don't ask for change stubs */
+	if (!osync_error_is_set(error) && osync_message_get_remaining_size(message))
+		osync_message_read_int(message, &change_stubs, error);
+
 	if (osync_error_is_set(error))
 		goto error;
 
-	osync_trace(TRACE_INTERNAL, "Searching sink for %s (slowsync: %i)", objtype, slowsync);
+	osync_trace(TRACE_INTERNAL, "Searching sink for %s (slowsync: %i, change stubs: %i)", objtype, slowsync, change_stubs);
 	
 	if (objtype) {
 		sink = osync_plugin_info_find_objtype(client->plugin_info, objtype);
@@ -1266,6 +1508,7 @@ static osync_bool _osync_client_handle_get_changes(OSyncClient *client, OSyncMes
 		osync_context_set_changes_callback(context, _osync_client_change_callback);
 		
 		osync_plugin_info_set_sink(client->plugin_info, sink);
+		osync_objtype_sink_set_change_stubs(sink, change_stubs);
 
 		osync_objtype_sink_get_changes(sink, client->plugin_info, slowsync, context);
 	
@@ -1358,6 +1601,14 @@ static osync_bool _osync_client_handle_commit_change(OSyncClient *client, OSyncM
 	
 	if (!osync_demarshal_change(message, &change, client->format_env, error))
 		goto error;
+
+	/* The plugin may steal or replace the data it commits, so it must not
+	 * get the object the engine shares between several members. Its own
+	 * object only copies the buffer once the plugin writes it. */
+	if (!osync_change_own_data(change, error)) {
+		osync_change_unref(change);
+		goto error;
+	}
 		
 	osync_trace(TRACE_INTERNAL, "Change %p", change);
 	
@@ -1391,6 +1642,117 @@ static osync_bool _osync_client_handle_commit_change(OSyncClient *client, OSyncM
 	return FALSE;
 }
 
+static osync_bool _osync_client_handle_commit_changes(OSyncClient *client, OSyncMessage *message, OSyncError **error)
+{
+	OSyncChange **changes = NULL;
+	OSyncContext **contexts = NULL;
+	OSyncObjTypeSink *sink = NULL;
+	commitBatch *batch = NULL;
+	const char *objtype = NULL;
+	int num_changes = 0;
+	int i;
+
+	osync_trace(TRACE_ENTRY, "%s(%p, %p, %p)", __func__, client, message, error);
+
+	if (!osync_message_read_int(message, &num_changes, error))
+		goto error;
+
+	if (num_changes <= 0) {
+		osync_error_set(error, OSYNC_ERROR_GENERIC, "Invalid number of changes to commit: %i", num_changes);
+		goto error;
+	}
+
+	/* Both arrays get NULL terminated */
+	changes = osync_try_malloc0(sizeof(OSyncChange *) * (num_changes + 1), error);
+	if (!changes)
+		goto error;
+
+	contexts = osync_try_malloc0(sizeof(OSyncContext *) * (num_changes + 1), error);
+	if (!contexts)
+		goto error_free_changes;
+
+	for (i = 0; i < num_changes; i++) {
+		if (!osync_demarshal_change(message, &changes[i], client->format_env, error))
+			goto error_free_changes;
+
+		if (!osync_change_own_data(changes[i], error))
+			goto error_free_changes;
+
+		/* The engine only batches changes of the same sink */
+		if (!objtype) {
+			objtype = osync_data_get_objtype(osync_change_get_data(changes[i]));
+		} else if (strcmp(objtype, osync_data_get_objtype(osync_change_get_data(changes[i])))) {
+			osync_error_set(error, OSYNC_ERROR_GENERIC, "Mixed objtypes in one commit batch");
+			goto error_free_changes;
+		}
+	}
+
+	osync_trace(TRACE_INTERNAL, "Searching sink for %s", objtype);
+
+	sink = osync_plugin_info_find_objtype(client->plugin_info, objtype);
+	if (!sink) {
+		osync_error_set(error, OSYNC_ERROR_GENERIC, "Unable to find sink for %s", objtype);
+		goto error_free_changes;
+	}
+
+	batch = osync_try_malloc0(sizeof(commitBatch), error);
+	if (!batch)
+		goto error_free_changes;
+
+	batch->entries = osync_try_malloc0(sizeof(commitBatchEntry) * num_changes, error);
+	if (!batch->entries)
+		goto error_free_batch;
+
+	batch->client = osync_client_ref(client);
+	batch->message = message;
+	osync_message_ref(message);
+	batch->num_changes = num_changes;
+	batch->pending = num_changes;
+
+	for (i = 0; i < num_changes; i++) {
+		batch->entries[i].batch = batch;
+		batch->entries[i].change = osync_change_ref(changes[i]);
+
+		contexts[i] = osync_context_new(error);
+		if (!contexts[i])
+			goto error_free_contexts;
+
+		osync_context_set_callback(contexts[i], _osync_client_commit_changes_callback, &batch->entries[i]);
+	}
+
+	osync_plugin_info_set_sink(client->plugin_info, sink);
+	osync_objtype_sink_commit_changes(sink, client->plugin_info, changes, contexts);
+
+	/* The batch might already be freed at this point */
+	for (i = 0; i < num_changes; i++) {
+		osync_context_unref(contexts[i]);
+		osync_change_unref(changes[i]);
+	}
+
+	osync_free(contexts);
+	osync_free(changes);
+
+	osync_trace(TRACE_EXIT, "%s", __func__);
+	return TRUE;
+
+ error_free_contexts:
+	for (i = 0; i < num_changes && contexts[i]; i++)
+		osync_context_unref(contexts[i]);
+	_free_commit_batch(batch);
+	batch = NULL;
+ error_free_batch:
+	if (batch)
+		osync_free(batch);
+ error_free_changes:
+	for (i = 0; i < num_changes && changes[i]; i++)
+		osync_change_unref(changes[i]);
+	osync_free(contexts);
+	osync_free(changes);
+ error:
+	osync_trace(TRACE_EXIT_ERROR, "%s: %s", __func__, osync_error_print(error));
+	return FALSE;
+}
+
 static osync_bool _osync_client_handle_committed_all(OSyncClient *client, OSyncMessage *message, OSyncError **error)
 {
 	char *objtype = NULL;
@@ -1528,6 +1890,7 @@ static void _osync_client_message_handler(OSyncMessage *message, void *user_data
 	case OSYNC_MESSAGE_REPLY:
 	case OSYNC_MESSAGE_ERRORREPLY:
 	case OSYNC_MESSAGE_NEW_CHANGE:
+	case OSYNC_MESSAGE_NEW_CHANGES:
 	case OSYNC_MESSAGE_SYNCHRONIZE:
 	case OSYNC_MESSAGE_ENGINE_CHANGED:
 	case OSYNC_MESSAGE_MAPPING_CHANGED:
@@ -1579,6 +1942,11 @@ static void _osync_client_message_handler(OSyncMessage *message, void *user_data
 		if (!_osync_client_handle_commit_change(client, message, &error))
 			goto error;
 		break;
+
+	case OSYNC_MESSAGE_COMMIT_CHANGES:
+		if (!_osync_client_handle_commit_changes(client, message, &error))
+			goto error;
+		break;
 			
 	case OSYNC_MESSAGE_SYNC_DONE:
 		if (!_osync_client_handle_sync_done(client, message, &error))
@@ -1699,6 +2067,14 @@ OSyncClient *osync_client_new(OSyncError **error)
 	
 	client->ref_count = 1;
 	client->context = g_main_context_new();
+
+	if (!g_thread_supported ())
+		g_thread_init (NULL);
+
+	client->change_batch_lock = g_mutex_new();
+	client->change_batch_size = OSYNC_CLIENT_CHANGE_BATCH_SIZE;
+	client->change_batch_bytes = OSYNC_CLIENT_CHANGE_BATCH_BYTES;
+	client->change_batch_msec = OSYNC_CLIENT_CHANGE_BATCH_TIMEOUT;
 	
 	osync_trace(TRACE_EXIT, "%s: %p", __func__, client);
 	return client;
@@ -1743,6 +2119,12 @@ void osync_client_unref(OSyncClient *client)
 		
 		if (client->thread)
 			osync_thread_unref(client->thread);
+
+		if (client->shared_format_env)
+			osync_format_env_unref(client->shared_format_env);
+
+		_osync_client_discard_changes_locked(client);
+		g_mutex_free(client->change_batch_lock);
 		
 		osync_free(client);
 		
@@ -1750,6 +2132,28 @@ void osync_client_unref(OSyncClient *client)
 	}
 }
 
+void osync_client_set_change_batch(OSyncClient *client, unsigned int size, unsigned int bytes, unsigned int timeout)
+{
+	osync_return_if_fail(client);
+
+	g_mutex_lock(client->change_batch_lock);
+	client->change_batch_size = size ? size : 1;
+	client->change_batch_bytes = bytes;
+	client->change_batch_msec = timeout;
+	g_mutex_unlock(client->change_batch_lock);
+}
+
+void osync_client_set_format_env(OSyncClient *client, OSyncFormatEnv *env)
+{
+	osync_return_if_fail(client);
+	osync_return_if_fail(env);
+
+	if (client->shared_format_env)
+		osync_format_env_unref(client->shared_format_env);
+
+	client->shared_format_env = osync_format_env_ref(env);
+}
+
 void osync_client_set_plugin(OSyncClient *client, OSyncPlugin *plugin)
 {
 	osync_return_if_fail(client);
@@ -33,4 +33,36 @@ osync_bool osync_client_connect_pipes(OSyncClient *client, OSyncError **error);
 
 OSyncPluginInfo *osync_client_get_plugin_info(OSyncClient *client);
 
+/** @brief Default maximum number of changes per OSYNC_MESSAGE_NEW_CHANGES */
+#define OSYNC_CLIENT_CHANGE_BATCH_SIZE 128
+/** @brief Default message size in bytes at which a batch of changes gets sent */
+#define OSYNC_CLIENT_CHANGE_BATCH_BYTES (256 * 1024)
+/** @brief Default time in milliseconds a reported change waits at most in a batch */
+#define OSYNC_CLIENT_CHANGE_BATCH_TIMEOUT 50
+
+/** @brief Sets how the changes reported by get_changes get batched
+ *
+ * A batch gets sent once it holds size changes, reached bytes in size, or
+ * its first change waited timeout milliseconds. A batch is always sent
+ * before the reply of get_changes. A size of 1 sends every change on its own.
+ *
+ * @param client The client
+ * @param size The maximum number of changes per message
+ * @param bytes The message size in bytes at which the batch gets sent
+ * @param timeout Milliseconds a change waits at most, 0 only sends full batches
+ */
+OSYNC_TEST_EXPORT void osync_client_set_change_batch(OSyncClient *client, unsigned int size, unsigned int bytes, unsigned int timeout);
+
+/**
+ * @brief Let the client use the format env of the engine
+ *
+ * Only possible if the client runs as thread of the engine. The formats
+ * are then not loaded again, and changes can be passed between engine
+ * and plugin without copying their data.
+ *
+ * @param client The client
+ * @param env The format env of the engine
+ */
+void osync_client_set_format_env(OSyncClient *client, OSyncFormatEnv *env);
+
 #endif /*OPENSYNC_CLIENT_INTERNALS_H_*/
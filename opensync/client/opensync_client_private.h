@@ -32,9 +32,20 @@ struct OSyncClient {
 	OSyncPluginInfo *plugin_info;
 	OSyncPluginEnv *plugin_env;
 	OSyncFormatEnv *format_env;
+	/* Format env of the engine if the client runs in its process */
+	OSyncFormatEnv *shared_format_env;
 	void *plugin_data;
 	OSyncThread *thread;
 
+	/* Changes reported by get_changes which are not sent yet */
+	GMutex *change_batch_lock;
+	OSyncMessage *change_batch;
+	GSource *change_batch_timeout;
+	unsigned int change_batch_count;
+	unsigned int change_batch_size;
+	unsigned int change_batch_bytes;
+	unsigned int change_batch_msec;
+
 	/* pipe path for the queue */
 	char *pipe_path;
 };
@@ -22,6 +22,7 @@
 #include "opensync_internals.h"
 
 #include "opensync-data.h"
+#include "data/opensync_change_internals.h"
 
 #include "opensync-ipc.h"
 #include "ipc/opensync_message_internals.h"
@@ -87,6 +88,8 @@ typedef struct callContext {
 	
 	commit_change_cb commit_change_callback;
 	void *commit_change_callback_data;
+	void **commit_changes_callback_data;
+	unsigned int num_commit_changes;
 	
 	committed_all_cb committed_all_callback;
 	void *committed_all_callback_data;
@@ -259,9 +262,19 @@ static void _osync_client_proxy_init_handler(OSyncMessage *message, void *user_d
 	
 	if (osync_message_get_cmd(message) == OSYNC_MESSAGE_REPLY) {
 
+		int wire_version = OSYNC_QUEUE_WIRE_VERSION_PLAIN;
+
 		if (!osync_demarshal_objtype_sinks(message, proxy, &locerror))
 			goto error;
 
+		/* The wire format the client agreed on. Older clients don't
+		 * append it and keep talking plain */
+		if (osync_message_get_remaining_size(message)
+				&& !osync_message_read_int(message, &wire_version, &locerror))
+			goto error;
+
+		osync_queue_set_wire_version(proxy->outgoing, wire_version);
+
 		ctx->init_callback(proxy, ctx->init_callback_data, NULL);
 	} else if (osync_message_get_cmd(message) == OSYNC_MESSAGE_ERRORREPLY) {
 
@@ -745,6 +758,75 @@ static void _osync_client_proxy_commit_change_handler(OSyncMessage *message, voi
 	return;
 }
 
+static void _free_commit_changes_context(callContext *ctx)
+{
+	osync_free(ctx->commit_changes_callback_data);
+	osync_free(ctx);
+}
+
+static void _osync_client_proxy_commit_changes_handler(OSyncMessage *message, void *user_data)
+{
+	callContext *ctx = user_data;
+	OSyncClientProxy *proxy = ctx->proxy;
+	OSyncError *error = NULL;
+	OSyncError *locerror = NULL;
+	unsigned int i = 0;
+	int failed = 0;
+	
+	osync_trace(TRACE_ENTRY, "%s(%p, %p)", __func__, message, user_data);
+	
+	if (osync_message_get_cmd(message) == OSYNC_MESSAGE_REPLY) {
+		char *uid = NULL;
+
+		/* One result for every change of the batch */
+		for (i = 0; i < ctx->num_commit_changes; i++) {
+			if (!osync_message_read_int(message, &failed, &locerror))
+				goto error;
+
+			if (!failed) {
+				if (!osync_message_read_string(message, &uid, &locerror))
+					goto error;
+
+				ctx->commit_change_callback(proxy, ctx->commit_changes_callback_data[i], uid, NULL);
+				osync_free(uid);
+			} else {
+				if (!osync_demarshal_error(message, &error, &locerror))
+					goto error;
+
+				ctx->commit_change_callback(proxy, ctx->commit_changes_callback_data[i], NULL, error);
+				osync_error_unref(&error);
+			}
+		}
+	} else if (osync_message_get_cmd(message) == OSYNC_MESSAGE_ERRORREPLY) {
+
+		if (!osync_demarshal_error(message, &error, &locerror))
+			goto error;
+
+		for (i = 0; i < ctx->num_commit_changes; i++)
+			ctx->commit_change_callback(proxy, ctx->commit_changes_callback_data[i], NULL, error);
+
+		osync_error_unref(&error);
+	} else {
+		osync_error_set(&locerror, OSYNC_ERROR_GENERIC, "Unexpected reply");
+		goto error;
+	}
+	
+	_free_commit_changes_context(ctx);
+	
+	osync_trace(TRACE_EXIT, "%s", __func__);
+	return;
+	
+ error:
+	/* Changes which got no result yet, fail with the reply error */
+	for (; i < ctx->num_commit_changes; i++)
+		ctx->commit_change_callback(proxy, ctx->commit_changes_callback_data[i], NULL, locerror);
+
+	_free_commit_changes_context(ctx);
+	osync_trace(TRACE_EXIT_ERROR, "%s: %s", __func__, osync_error_print(&locerror));
+	osync_error_unref(&locerror);
+	return;
+}
+
 static void _osync_client_proxy_committed_all_handler(OSyncMessage *message, void *user_data)
 {
 	callContext *ctx = user_data;
@@ -817,12 +899,31 @@ static void _osync_client_proxy_sync_done_handler(OSyncMessage *message, void *u
 	return;
 }
 
+/* A reported change without data is a stub only if stubs were asked for */
+static void _osync_client_proxy_mark_stub(OSyncClientProxy *proxy, OSyncChange *change)
+{
+	OSyncObjTypeSink *sink = NULL;
+	OSyncData *data = NULL;
+
+	if (osync_change_get_changetype(change) == OSYNC_CHANGE_TYPE_DELETED)
+		return;
+
+	data = osync_change_get_data(change);
+	if (!data || osync_data_has_data(data))
+		return;
+
+	sink = osync_client_proxy_find_objtype_sink(proxy, osync_data_get_objtype(data));
+	if (sink && osync_objtype_sink_get_change_stubs(sink))
+		osync_change_set_stub(change, TRUE);
+}
+
 static void _osync_client_proxy_message_handler(OSyncMessage *message, void *user_data)
 {
 	OSyncClientProxy *proxy = user_data;
 	OSyncError *error = NULL;
 	OSyncChange *change = NULL;
 	char *objtype = NULL, *olduid = NULL, *newuid = NULL;
+	int more = 0;
 
 	osync_trace(TRACE_ENTRY, "%s(%p, %p)", __func__, message, user_data);
 	
@@ -840,12 +941,43 @@ static void _osync_client_proxy_message_handler(OSyncMessage *message, void *use
 			
 		if (!osync_demarshal_change(message, &change, proxy->formatenv, &error))
 			goto error;
+
+		if (osync_message_get_command(message) == OSYNC_MESSAGE_NEW_CHANGE)
+			_osync_client_proxy_mark_stub(proxy, change);
 			
 		proxy->change_callback(proxy, proxy->change_callback_data, change);
 			
 		osync_change_unref(change);
 		break;
 
+	case OSYNC_MESSAGE_NEW_CHANGES:
+
+		osync_assert(proxy->change_callback);
+
+		if (proxy->error) {
+			osync_trace(TRACE_INTERNAL, "WARNING: Proxy error taintend! Ignoring incoming changes!");
+			break;
+		}
+
+		/* A non-zero int precedes every change, a 0 terminates the batch */
+		if (!osync_message_read_int(message, &more, &error))
+			goto error;
+
+		while (more) {
+			if (!osync_demarshal_change(message, &change, proxy->formatenv, &error))
+				goto error;
+
+			_osync_client_proxy_mark_stub(proxy, change);
+
+			proxy->change_callback(proxy, proxy->change_callback_data, change);
+
+			osync_change_unref(change);
+
+			if (!osync_message_read_int(message, &more, &error))
+				goto error;
+		}
+		break;
+
 	case OSYNC_MESSAGE_MAPPING_CHANGED:
 
 		osync_assert(proxy->uid_update_callback);
@@ -908,6 +1040,9 @@ OSyncClientProxy *osync_client_proxy_new(OSyncFormatEnv *formatenv, OSyncMember
 		goto error;
 	proxy->ref_count = 1;
 	proxy->type = OSYNC_START_TYPE_UNKNOWN;
+	proxy->commit_batch_size = OSYNC_CLIENT_PROXY_COMMIT_BATCH_SIZE;
+	proxy->credit_window = OSYNC_QUEUE_CREDIT_WINDOW;
+	proxy->wire_version = OSYNC_QUEUE_WIRE_VERSION_PLAIN;
 	proxy->formatenv = osync_format_env_ref(formatenv);
 	
 	/* TODO: Is member optional parameter? */
@@ -957,6 +1092,9 @@ void osync_client_proxy_unref(OSyncClientProxy *proxy)
 		if (proxy->formatenv)
 			osync_format_env_unref(proxy->formatenv);
 
+		if (proxy->queue_stats)
+			osync_free(proxy->queue_stats);
+
 		if (proxy->error)
 			osync_error_unref(&proxy->error);
 		
@@ -989,12 +1127,56 @@ void osync_client_proxy_set_uid_update_callback(OSyncClientProxy *proxy, uid_upd
 	proxy->uid_update_callback_data = userdata;
 }
 
+void osync_client_proxy_set_credit_window(OSyncClientProxy *proxy, unsigned int window)
+{
+	osync_assert(proxy);
+	proxy->credit_window = window;
+}
+
+void osync_client_proxy_set_change_stubs(OSyncClientProxy *proxy, osync_bool stubs)
+{
+	osync_assert(proxy);
+	proxy->change_stubs = stubs;
+}
+
+void osync_client_proxy_set_wire_version(OSyncClientProxy *proxy, unsigned int version)
+{
+	osync_assert(proxy);
+	osync_assert(version >= OSYNC_QUEUE_WIRE_VERSION_PLAIN && version <= OSYNC_QUEUE_WIRE_VERSION);
+	proxy->wire_version = version;
+}
+
 OSyncMember *osync_client_proxy_get_member(OSyncClientProxy *proxy)
 {
 	osync_assert(proxy);
 	return proxy->member;
 }
 
+static osync_bool _osync_client_proxy_new_process_queues(OSyncQueue **read_queue, OSyncQueue **write_queue, OSyncError **error)
+{
+	OSyncError *ring_error = NULL;
+
+	/* Shared memory rings save the copies through the kernel,
+	 * anonymous pipes are the fallback */
+	if (osync_queue_new_shm_rings(read_queue, write_queue, &ring_error))
+		return TRUE;
+
+	osync_trace(TRACE_INTERNAL, "Using pipes: %s", osync_error_print(&ring_error));
+	osync_error_unref(&ring_error);
+
+	return osync_queue_new_pipes(read_queue, write_queue, error);
+}
+
+static char *_osync_client_proxy_queue_arg(OSyncQueue *queue)
+{
+	char *arg = osync_queue_get_shm_spec(queue);
+
+	if (!arg)
+		arg = osync_strdup_printf("%i", osync_queue_get_fd(queue));
+
+	return arg;
+}
+
 osync_bool osync_client_proxy_spawn(OSyncClientProxy *proxy, OSyncStartType type, const char *path, const char* external_command, OSyncError **error)
 {
 	OSyncQueue *read1 = NULL;
@@ -1027,6 +1209,9 @@ osync_bool osync_client_proxy_spawn(OSyncClientProxy *proxy, OSyncStartType type
 			proxy->client = osync_client_new(error);
 			if (!proxy->client)
 				goto error_free_pipe2;
+
+			/* The client shares our formats, so changes don't need a copy */
+			osync_client_set_format_env(proxy->client, proxy->formatenv);
 			
 			/* We now connect to our incoming queue */
 			if (!osync_queue_connect(read1, OSYNC_QUEUE_RECEIVER, error))
@@ -1048,9 +1233,9 @@ osync_bool osync_client_proxy_spawn(OSyncClientProxy *proxy, OSyncStartType type
 			if (!osync_client_run(proxy->client, error))
 				goto error_free_pipe2;
 		} else {
-			if (!osync_queue_new_pipes(&read1, &write1, error))
+			if (!_osync_client_proxy_new_process_queues(&read1, &write1, error))
 				goto error;
-			if (!osync_queue_new_pipes(&read2, &write2, error))
+			if (!_osync_client_proxy_new_process_queues(&read2, &write2, error))
 				goto error_free_pipe1;
 			proxy->outgoing = osync_queue_ref(write1);
 			proxy->incoming = osync_queue_ref(read2);
@@ -1073,8 +1258,14 @@ osync_bool osync_client_proxy_spawn(OSyncClientProxy *proxy, OSyncStartType type
 					osync_trace(TRACE_INTERNAL, "About to exec osplugin");
 					//char *memberstring = g_strdup_printf("%i", osync_member_get_id(proxy->member));
 					//execlp("osplugin", "osplugin", osync_group_get_configdir(osync_member_get_group(osync_proxy_get_member(proxy)), memberstring, NULL);
-					readfd = osync_strdup_printf("%i", osync_queue_get_fd(read1));
-					writefd = osync_strdup_printf("%i", osync_queue_get_fd(write2));
+					/* The rings of the other queues and members stay closed */
+					if (!osync_queue_set_shm_inheritable(read1, error) || !osync_queue_set_shm_inheritable(write2, error)) {
+						osync_trace(TRACE_INTERNAL, "%s", osync_error_print(error));
+						exit(1);
+					}
+
+					readfd = _osync_client_proxy_queue_arg(read1);
+					writefd = _osync_client_proxy_queue_arg(write2);
 					execlp(OSPLUGIN, "osplugin", "-f", readfd, writefd, NULL);
 
 					if (errno == ENOENT) {
@@ -1121,6 +1312,9 @@ osync_bool osync_client_proxy_spawn(OSyncClientProxy *proxy, OSyncStartType type
 		/* and the to the outgoing queue */
 		if (!osync_queue_connect(proxy->outgoing, OSYNC_QUEUE_SENDER, error))
 			goto error;
+
+		/* Bound the messages the client sends ahead of our dispatching */
+		osync_queue_set_credit_window(proxy->incoming, proxy->outgoing, proxy->credit_window);
 	} else {
 		name = osync_strdup_printf("%s%cpluginpipe", path, G_DIR_SEPARATOR);
 	
@@ -1235,8 +1429,16 @@ osync_bool osync_client_proxy_shutdown(OSyncClientProxy *proxy, OSyncError **err
 		//	goto error;
 	}
 			
+	/* Keep the counters of the connection for the engine */
+	if (!proxy->queue_stats)
+		proxy->queue_stats = osync_try_malloc0(sizeof(OSyncQueueStats), NULL);
+	if (proxy->queue_stats)
+		osync_client_proxy_get_stats(proxy, proxy->queue_stats);
+
 	osync_queue_unref(proxy->incoming);
 	osync_queue_unref(proxy->outgoing);
+	proxy->incoming = NULL;
+	proxy->outgoing = NULL;
 	
 	osync_trace(TRACE_EXIT, "%s", __func__);
 	return TRUE;
@@ -1246,6 +1448,18 @@ osync_bool osync_client_proxy_shutdown(OSyncClientProxy *proxy, OSyncError **err
 	return FALSE;
 }
 
+/**
+ * @brief Check if passed resource is valid.
+ * 
+ *	This check looks for:
+ *	 - are all format plugins in the format-sinks available
+ *	 - ... 
+ *
+ * @param proxy Pointer to OSyncClientProxy
+ * @param resource Pointer to resource to check
+ * @param error The error which will hold the info of an invalid resource 
+ * @return TRUE if valid, FALSE otherwise.
+ */
 static osync_bool osync_client_proxy_check_resource(OSyncClientProxy *proxy, OSyncPluginResource *resource, OSyncError **error)
 {
 	OSyncList *format_sinks = osync_plugin_resource_get_objformat_sinks(resource);
@@ -1348,6 +1562,10 @@ osync_bool osync_client_proxy_initialize(OSyncClientProxy *proxy, initialize_cb
 
 	osync_message_write_int(message, memberid, error);
 #endif	
+
+	/* Appended last, so older clients are able to ignore it */
+	if (!osync_message_write_int(message, proxy->wire_version, error))
+		goto error_free_message;
 	
 	osync_message_set_handler(message, _osync_client_proxy_init_handler, ctx);
 	
@@ -1360,6 +1578,8 @@ osync_bool osync_client_proxy_initialize(OSyncClientProxy *proxy, initialize_cb
 		/* We now connect to our incoming queue */
 		if (!osync_queue_connect(proxy->incoming, OSYNC_QUEUE_RECEIVER, error))
 			goto error;
+
+		osync_queue_set_credit_window(proxy->incoming, proxy->outgoing, proxy->credit_window);
 	}
 	
 	osync_trace(TRACE_EXIT, "%s", __func__);
@@ -1697,6 +1917,8 @@ osync_bool osync_client_proxy_read(OSyncClientProxy *proxy, read_cb callback, vo
 	if (!message)
 		goto error_free_context;
 	
+	osync_queue_prepare_message(proxy->outgoing, message);
+
 	osync_message_set_handler(message, _osync_client_proxy_read_handler, ctx);
 
 	if (!osync_marshal_change(message, change, error))
@@ -1725,6 +1947,7 @@ osync_bool osync_client_proxy_get_changes(OSyncClientProxy *proxy, get_changes_c
 	callContext *ctx = NULL;
 	OSyncObjTypeSink *sink = NULL;
 	OSyncMessage *message = NULL;
+	osync_bool change_stubs = FALSE;
 
 	osync_trace(TRACE_ENTRY, "%s(%p, %p, %p, %s, %i, %p)", __func__, proxy, callback, userdata, __NULLSTR(objtype), slowsync, error);
 	
@@ -1735,9 +1958,14 @@ osync_bool osync_client_proxy_get_changes(OSyncClientProxy *proxy, get_changes_c
 		goto error;
 	
 	sink = osync_client_proxy_find_objtype_sink(proxy, objtype);
-	if (sink)
+	if (sink) {
 		timeout = osync_objtype_sink_get_getchanges_timeout_or_default(sink); 
 
+		/* Stubs only work if the data can get read later */
+		change_stubs = proxy->change_stubs && osync_objtype_sink_get_function_read(sink);
+		osync_objtype_sink_set_change_stubs(sink, change_stubs);
+	}
+
 	ctx->proxy = proxy;
 	ctx->get_changes_callback = callback;
 	ctx->get_changes_callback_data = userdata;
@@ -1750,6 +1978,8 @@ osync_bool osync_client_proxy_get_changes(OSyncClientProxy *proxy, get_changes_c
 
 	osync_message_write_string(message, objtype, error);
 	osync_message_write_int(message, slowsync, error);
+	/* Appended last, so older clients are able to ignore it */
+	osync_message_write_int(message, change_stubs, error);
 
 	if (osync_error_is_set(error))
 		goto error_free_message;
@@ -1800,6 +2030,8 @@ osync_bool osync_client_proxy_commit_change(OSyncClientProxy *proxy, commit_chan
 	if (!message)
 		goto error_free_context;
 	
+	osync_queue_prepare_message(proxy->outgoing, message);
+
 	osync_message_set_handler(message, _osync_client_proxy_commit_change_handler, ctx);
 
 	if (!osync_marshal_change(message, change, error))
@@ -1822,6 +2054,115 @@ osync_bool osync_client_proxy_commit_change(OSyncClientProxy *proxy, commit_chan
 	return FALSE;
 }
 
+osync_bool osync_client_proxy_commit_changes(OSyncClientProxy *proxy, commit_change_cb callback, void **userdata, OSyncChange **changes, unsigned int num_changes, OSyncError **error)
+{
+	int timeout = 0;
+	unsigned int i;
+	callContext *ctx = NULL;
+	OSyncObjTypeSink *sink = NULL;
+	OSyncMessage *message = NULL;
+
+	osync_trace(TRACE_ENTRY, "%s(%p, %p, %p, %p, %u, %p)", __func__, proxy, callback, userdata, changes, num_changes, error);
+	osync_assert(proxy);
+	osync_assert(changes);
+	osync_assert(num_changes);
+
+	timeout = OSYNC_CLIENT_PROXY_TIMEOUT_COMMIT;
+
+	ctx = osync_try_malloc0(sizeof(callContext), error);
+	if (!ctx)
+		goto error;
+
+	ctx->commit_changes_callback_data = osync_try_malloc0(sizeof(void *) * num_changes, error);
+	if (!ctx->commit_changes_callback_data)
+		goto error_free_context;
+
+	/* All changes of a batch belong to the same sink */
+	sink = osync_client_proxy_find_objtype_sink(proxy, osync_change_get_objtype(changes[0]));
+	if (sink)
+		timeout = osync_objtype_sink_get_commit_timeout_or_default(sink); 
+
+	/* The timeout of the sink is per change, the plugin commits the
+	 * whole batch before it replies */
+	timeout *= num_changes;
+	
+	ctx->proxy = proxy;
+	ctx->commit_change_callback = callback;
+	ctx->num_commit_changes = num_changes;
+	memcpy(ctx->commit_changes_callback_data, userdata, sizeof(void *) * num_changes);
+	
+	message = osync_message_new(OSYNC_MESSAGE_COMMIT_CHANGES, 0, error);
+	if (!message)
+		goto error_free_context;
+	
+	osync_queue_prepare_message(proxy->outgoing, message);
+
+	osync_message_set_handler(message, _osync_client_proxy_commit_changes_handler, ctx);
+
+	if (!osync_message_write_int(message, num_changes, error))
+		goto error_free_message;
+
+	for (i = 0; i < num_changes; i++) {
+		if (!osync_marshal_change(message, changes[i], error))
+			goto error_free_message;
+	}
+	
+	if (!osync_queue_send_message_with_timeout(proxy->outgoing, proxy->incoming, message, timeout, error))
+		goto error_free_message;
+	
+	osync_message_unref(message);
+	
+	osync_trace(TRACE_EXIT, "%s", __func__);
+	return TRUE;
+
+ error_free_message:
+	osync_message_unref(message);
+ error_free_context:
+	_free_commit_changes_context(ctx);
+ error:
+	osync_trace(TRACE_EXIT_ERROR, "%s: %s", __func__, osync_error_print(error));
+	return FALSE;
+}
+
+void osync_client_proxy_set_commit_batch_size(OSyncClientProxy *proxy, unsigned int size)
+{
+	osync_assert(proxy);
+	proxy->commit_batch_size = size;
+}
+
+osync_bool osync_client_proxy_get_stats(OSyncClientProxy *proxy, OSyncQueueStats *stats)
+{
+	OSyncQueueStats queue_stats;
+
+	osync_assert(proxy);
+	osync_assert(stats);
+
+	memset(stats, 0, sizeof(OSyncQueueStats));
+
+	/* Not spawned yet or already shut down */
+	if (!proxy->incoming || !proxy->outgoing) {
+		if (!proxy->queue_stats)
+			return FALSE;
+
+		*stats = *proxy->queue_stats;
+		return TRUE;
+	}
+
+	/* Replies and their latencies are counted by the incoming queue */
+	osync_queue_get_stats(proxy->outgoing, &queue_stats);
+	osync_queue_stats_merge(stats, &queue_stats);
+	osync_queue_get_stats(proxy->incoming, &queue_stats);
+	osync_queue_stats_merge(stats, &queue_stats);
+
+	return TRUE;
+}
+
+unsigned int osync_client_proxy_get_commit_batch_size(OSyncClientProxy *proxy)
+{
+	osync_assert(proxy);
+	return proxy->commit_batch_size;
+}
+
 osync_bool osync_client_proxy_committed_all(OSyncClientProxy *proxy, committed_all_cb callback, void *userdata, const char *objtype, OSyncError **error)
 {
 	int timeout = 0;
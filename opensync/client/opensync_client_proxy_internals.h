@@ -42,9 +42,13 @@ OSYNC_TEST_EXPORT OSyncClientProxy *osync_client_proxy_ref(OSyncClientProxy *pro
 OSYNC_TEST_EXPORT void osync_client_proxy_unref(OSyncClientProxy *proxy);
 
 void osync_client_proxy_set_context(OSyncClientProxy *proxy, GMainContext *ctx);
-void osync_client_proxy_set_change_callback(OSyncClientProxy *proxy, change_cb cb, void *userdata);
+OSYNC_TEST_EXPORT void osync_client_proxy_set_change_callback(OSyncClientProxy *proxy, change_cb cb, void *userdata);
 void osync_client_proxy_set_uid_update_callback(OSyncClientProxy *proxy, uid_update_cb cb, void *userdata);
+void osync_client_proxy_set_credit_window(OSyncClientProxy *proxy, unsigned int window);
+void osync_client_proxy_set_change_stubs(OSyncClientProxy *proxy, osync_bool stubs);
+OSYNC_TEST_EXPORT void osync_client_proxy_set_wire_version(OSyncClientProxy *proxy, unsigned int version);
 OSyncMember *osync_client_proxy_get_member(OSyncClientProxy *proxy);
+OSYNC_TEST_EXPORT osync_bool osync_client_proxy_get_stats(OSyncClientProxy *proxy, OSyncQueueStats *stats);
 
 OSYNC_TEST_EXPORT osync_bool osync_client_proxy_spawn(OSyncClientProxy *proxy, OSyncStartType type, const char *path, const char* external_command, OSyncError **error);
 OSYNC_TEST_EXPORT osync_bool osync_client_proxy_shutdown(OSyncClientProxy *proxy, OSyncError **error);
@@ -70,8 +74,11 @@ OSYNC_TEST_EXPORT osync_bool osync_client_proxy_connect_done(OSyncClientProxy *p
 OSYNC_TEST_EXPORT osync_bool osync_client_proxy_disconnect(OSyncClientProxy *proxy, disconnect_cb callback, void *userdata, const char *objtype, OSyncError **error);
 
 osync_bool osync_client_proxy_read(OSyncClientProxy *proxy, read_cb callback, void *userdata, OSyncChange *change, OSyncError **error);
-osync_bool osync_client_proxy_get_changes(OSyncClientProxy *proxy, get_changes_cb callback, void *userdata, const char *objtype, osync_bool slowsync, OSyncError **error);
+OSYNC_TEST_EXPORT osync_bool osync_client_proxy_get_changes(OSyncClientProxy *proxy, get_changes_cb callback, void *userdata, const char *objtype, osync_bool slowsync, OSyncError **error);
 osync_bool osync_client_proxy_commit_change(OSyncClientProxy *proxy, commit_change_cb callback, void *userdata, OSyncChange *change, OSyncError **error);
+osync_bool osync_client_proxy_commit_changes(OSyncClientProxy *proxy, commit_change_cb callback, void **userdata, OSyncChange **changes, unsigned int num_changes, OSyncError **error);
+OSYNC_TEST_EXPORT void osync_client_proxy_set_commit_batch_size(OSyncClientProxy *proxy, unsigned int size);
+unsigned int osync_client_proxy_get_commit_batch_size(OSyncClientProxy *proxy);
 osync_bool osync_client_proxy_committed_all(OSyncClientProxy *proxy, committed_all_cb callback, void *userdata, const char *objtype, OSyncError **error);
 
 osync_bool osync_client_proxy_sync_done(OSyncClientProxy *proxy, sync_done_cb callback, void *userdata, const char *objtype, OSyncError **error);
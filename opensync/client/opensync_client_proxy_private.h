@@ -37,6 +37,9 @@
 #define OSYNC_CLIENT_PROXY_TIMEOUT_READ		OSYNC_CLIENT_PROXY_TIMEOUT_DEFAULT 
 #define OSYNC_CLIENT_PROXY_TIMEOUT_WRITE	OSYNC_CLIENT_PROXY_TIMEOUT_DEFAULT 
 
+/** Default number of changes which get committed with one OSYNC_MESSAGE_COMMIT_CHANGES */
+#define OSYNC_CLIENT_PROXY_COMMIT_BATCH_SIZE	64
+
 	typedef struct OSyncClientProxyTimeouts {
 		unsigned int initialize;
 		unsigned int finalize;
@@ -56,6 +59,21 @@
 		/** Function specific timeouts */
 		OSyncClientProxyTimeouts timeout;
 
+		/** Maximal number of changes committed with one message */
+		unsigned int commit_batch_size;
+
+		/** Number of messages the client can send ahead of our dispatching */
+		unsigned int credit_window;
+
+		/** Wire format version requested from the client on initialize */
+		unsigned int wire_version;
+
+		/** Let the client report changes without data */
+		osync_bool change_stubs;
+
+		/** Counters of the queues, kept once they got shut down */
+		OSyncQueueStats *queue_stats;
+
 		/** OSyncClient object isn't initialized at all! Only with start type threaded. */
 		OSyncClient *client;
 
@@ -81,18 +99,4 @@
 
 void osync_client_proxy_set_error(OSyncClientProxy *proxy, OSyncError *error);
 
-/**
- * @brief Check if passed resource is valid.
- * 
- *	This check looks for:
- *	 - are all format plugins in the format-sinks available
- *	 - ... 
- *
- * @param proxy Pointer to OSyncClientProxy
- * @param resource Pointer to resource to check
- * @param error The error which will hold the info of an invalid resource 
- * @return TRUE if valid, FALSE otherwise.
- */
-static osync_bool osync_client_proxy_check_resource(OSyncClientProxy *proxy, OSyncPluginResource *resource, OSyncError **error);
-
 #endif /*OSYNC_CLIENT_PROXY_PRIVATE_H_*/
@@ -40,6 +40,16 @@ static void usage (int ecode)
 	exit (ecode);
 }
 
+static OSyncQueue *_osplugin_queue_new(const char *arg, OSyncError **error)
+{
+	/* Queues on a shared memory ring are passed as a descriptor with
+	 * several file descriptors, plain pipes as a single one */
+	if (strchr(arg, ':'))
+		return osync_queue_new_from_shm_spec(arg, error);
+
+	return osync_queue_new_from_fd(atoi(arg), error);
+}
+
 /** The setup process for the client is as follows:
  * 
  * 3 cases:
@@ -57,8 +67,8 @@ int main(int argc, char **argv)
 	osync_bool usePipes = FALSE;
 	OSyncError *error = NULL;
 	char *pipe_path = NULL;
-	int read_fd = 0;
-	int write_fd = 0;
+	const char *read_arg = NULL;
+	const char *write_arg = NULL;
 	OSyncQueue *incoming = NULL;
 	OSyncQueue *outgoing = NULL;
 	OSyncClient *client = NULL;
@@ -75,18 +85,18 @@ int main(int argc, char **argv)
 		usePipes = TRUE;
 		/* We cannot preserve the knowledge about the fds through the execve call.
 		 * Therefore, we pass the fd numbers through the args */
-		read_fd = atoi(argv[2]);
-		write_fd = atoi(argv[3]);
+		read_arg = argv[2];
+		write_arg = argv[3];
 	} else
 		pipe_path = argv[1];
 	
 	if (usePipes) {
 		/* We are using anonymous pipes. */
-		incoming = osync_queue_new_from_fd(read_fd, &error);
+		incoming = _osplugin_queue_new(read_arg, &error);
 		if (!incoming)
 			goto error;
 		
-		outgoing = osync_queue_new_from_fd(write_fd, &error);
+		outgoing = _osplugin_queue_new(write_arg, &error);
 		if (!outgoing)
 			goto error;
 		
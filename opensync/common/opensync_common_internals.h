@@ -25,6 +25,7 @@ OPENSYNC_BEGIN_DECLS
 
 #include "common/opensync_memory_internals.h"
 #include "common/opensync_thread_internals.h"
+#include "common/opensync_wakeup_internals.h"
 #include "common/opensync_xml_internals.h"
 
 OPENSYNC_END_DECLS
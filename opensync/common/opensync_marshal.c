@@ -22,11 +22,327 @@
 #include "opensync_internals.h"
 
 #include "opensync_marshal.h"
+#include "opensync_marshal_internals.h"
 #include "opensync_marshal_private.h"
 
+/* Freed marshals in size classes of OSYNC_MARSHAL_POOL_MIN_SIZE << (2 * n).
+ * Messages get created and freed by different threads, so the pool is
+ * shared and protected by a lock instead of being cached per thread. */
+static GStaticMutex pool_lock = G_STATIC_MUTEX_INIT;
+static GSList *pool[OSYNC_MARSHAL_POOL_CLASSES];
+static unsigned int pool_size = 0;
+
+static OSyncMarshal *_osync_marshal_pool_get(unsigned int size)
+{
+	OSyncMarshal *marshal = NULL;
+	unsigned int class_size = OSYNC_MARSHAL_POOL_MIN_SIZE;
+	int c;
+
+	/* The smallest class which fits size */
+	for (c = 0; c < OSYNC_MARSHAL_POOL_CLASSES && class_size < size; c++)
+		class_size <<= 2;
+
+	if (c == OSYNC_MARSHAL_POOL_CLASSES)
+		return NULL;
+
+	g_static_mutex_lock(&pool_lock);
+	if (pool[c]) {
+		marshal = pool[c]->data;
+		pool[c] = g_slist_delete_link(pool[c], pool[c]);
+		pool_size -= marshal->buffer_alloc;
+	}
+	g_static_mutex_unlock(&pool_lock);
+
+	if (marshal)
+		return marshal;
+
+	/* Allocate the full class size, so the buffer
+	 * goes back into the same class later on */
+	marshal = osync_try_malloc0(sizeof(OSyncMarshal), NULL);
+	if (!marshal)
+		return NULL;
+
+	marshal->buffer = g_byte_array_sized_new(class_size);
+	marshal->buffer_alloc = class_size;
+
+	return marshal;
+}
+
+static osync_bool _osync_marshal_pool_put(OSyncMarshal *marshal)
+{
+	unsigned int alloc = MAX(marshal->buffer_alloc, marshal->buffer->len);
+	unsigned int class_size = OSYNC_MARSHAL_POOL_MIN_SIZE;
+	osync_bool pooled = FALSE;
+	int c;
+
+	if (alloc < class_size)
+		return FALSE;
+
+	/* The largest class the buffer is known to fit */
+	for (c = 0; c < OSYNC_MARSHAL_POOL_CLASSES - 1 && (class_size << 2) <= alloc; c++)
+		class_size <<= 2;
+
+	/* Buffers which grew way beyond the largest class are not kept */
+	if (alloc >= (class_size << 2))
+		return FALSE;
+
+	/* The buffer keeps its memory, so it counts with its real size */
+	g_byte_array_set_size(marshal->buffer, 0);
+	marshal->buffer_alloc = alloc;
+
+	g_static_mutex_lock(&pool_lock);
+	if (pool_size + alloc <= OSYNC_MARSHAL_POOL_LIMIT) {
+		pool[c] = g_slist_prepend(pool[c], marshal);
+		pool_size += alloc;
+		pooled = TRUE;
+	}
+	g_static_mutex_unlock(&pool_lock);
+
+	return pooled;
+}
+
+unsigned int osync_marshal_pool_get_size(void)
+{
+	unsigned int size;
+
+	g_static_mutex_lock(&pool_lock);
+	size = pool_size;
+	g_static_mutex_unlock(&pool_lock);
+
+	return size;
+}
+
+void osync_marshal_pool_flush(void)
+{
+	GSList *marshals = NULL;
+	GSList *m = NULL;
+	int c;
+
+	g_static_mutex_lock(&pool_lock);
+	for (c = 0; c < OSYNC_MARSHAL_POOL_CLASSES; c++) {
+		marshals = g_slist_concat(marshals, pool[c]);
+		pool[c] = NULL;
+	}
+	pool_size = 0;
+	g_static_mutex_unlock(&pool_lock);
+
+	for (m = marshals; m; m = m->next) {
+		OSyncMarshal *marshal = m->data;
+		if (marshal->segments)
+			osync_free(marshal->segments);
+		g_byte_array_free(marshal->buffer, TRUE);
+		osync_free(marshal);
+	}
+	g_slist_free(marshals);
+}
+
+static void _osync_marshal_release_segments(OSyncMarshal *marshal)
+{
+	unsigned int i;
+
+	for (i = 0; i < marshal->num_segments; i++) {
+		OSyncMarshalSegment *segment = &marshal->segments[i];
+		if (segment->release)
+			segment->release(segment->owner);
+	}
+
+	marshal->num_segments = 0;
+	marshal->segments_size = 0;
+}
+
+static void _osync_marshal_flatten(OSyncMarshal *marshal)
+{
+	GByteArray *flat = NULL;
+	unsigned int pos = 0;
+	unsigned int i;
+
+	if (!marshal->num_segments)
+		return;
+
+	flat = g_byte_array_sized_new(marshal->buffer->len + marshal->segments_size);
+
+	for (i = 0; i < marshal->num_segments; i++) {
+		OSyncMarshalSegment *segment = &marshal->segments[i];
+		g_byte_array_append(flat, marshal->buffer->data + pos, segment->offset - pos);
+		g_byte_array_append(flat, (const guint8 *)segment->data, segment->size);
+		pos = segment->offset;
+	}
+	g_byte_array_append(flat, marshal->buffer->data + pos, marshal->buffer->len - pos);
+
+	g_byte_array_free(marshal->buffer, TRUE);
+	marshal->buffer = flat;
+	marshal->buffer_alloc = flat->len;
+
+	_osync_marshal_release_segments(marshal);
+}
+
+static void _osync_marshal_write_varint(OSyncMarshal *marshal, unsigned long long int value)
+{
+	guint8 bytes[10];
+	unsigned int n = 0;
+
+	do {
+		bytes[n] = value & 0x7f;
+		value >>= 7;
+		if (value)
+			bytes[n] |= 0x80;
+		n++;
+	} while (value);
+
+	g_byte_array_append(marshal->buffer, bytes, n);
+}
+
+static osync_bool _osync_marshal_read_varint(OSyncMarshal *marshal, unsigned long long int *value, OSyncError **error)
+{
+	unsigned long long int result = 0;
+	unsigned int shift = 0;
+	guint8 byte;
+
+	do {
+		if (marshal->buffer_read_pos >= marshal->buffer->len || shift > 63) {
+			osync_error_set(error, OSYNC_ERROR_GENERIC, "Malformed variable length integer in marshal");
+			return FALSE;
+		}
+
+		byte = marshal->buffer->data[marshal->buffer_read_pos++];
+		result |= (unsigned long long int)(byte & 0x7f) << shift;
+		shift += 7;
+	} while (byte & 0x80);
+
+	*value = result;
+	return TRUE;
+}
+
+/* Signed values are zigzag encoded, so small negative
+ * numbers stay short as well */
+#define ZIGZAG_ENCODE(v) ((((unsigned long long int) (v)) << 1) ^ (unsigned long long int) ((v) >> 63))
+#define ZIGZAG_DECODE(v) ((long long int) ((v) >> 1) ^ -((long long int) ((v) & 1)))
+
+OSyncMarshalStrings *osync_marshal_strings_new(OSyncError **error)
+{
+	OSyncMarshalStrings *strings = osync_try_malloc0(sizeof(OSyncMarshalStrings), error);
+	if (!strings)
+		return NULL;
+
+	strings->ref_count = 1;
+	strings->lock = g_mutex_new();
+	strings->ids = g_hash_table_new(g_str_hash, g_str_equal);
+	strings->strings = g_ptr_array_new();
+
+	return strings;
+}
+
+OSyncMarshalStrings *osync_marshal_strings_ref(OSyncMarshalStrings *strings)
+{
+	osync_assert(strings);
+
+	g_atomic_int_inc(&(strings->ref_count));
+
+	return strings;
+}
+
+void osync_marshal_strings_unref(OSyncMarshalStrings *strings)
+{
+	unsigned int i;
+
+	osync_assert(strings);
+
+	if (g_atomic_int_dec_and_test(&(strings->ref_count))) {
+		g_hash_table_destroy(strings->ids);
+
+		for (i = 0; i < strings->strings->len; i++)
+			osync_free(g_ptr_array_index(strings->strings, i));
+		g_ptr_array_free(strings->strings, TRUE);
+
+		g_mutex_free(strings->lock);
+
+		osync_free(strings);
+	}
+}
+
+unsigned int osync_marshal_strings_intern(OSyncMarshalStrings *strings, const char *value)
+{
+	gpointer id = NULL;
+	char *copy = NULL;
+
+	osync_assert(strings);
+	osync_assert(value);
+
+	g_mutex_lock(strings->lock);
+
+	id = g_hash_table_lookup(strings->ids, value);
+	if (!id) {
+		copy = osync_strdup(value);
+		g_ptr_array_add(strings->strings, copy);
+		id = GUINT_TO_POINTER(strings->strings->len);
+		g_hash_table_insert(strings->ids, copy, id);
+	}
+
+	g_mutex_unlock(strings->lock);
+
+	return GPOINTER_TO_UINT(id);
+}
+
+osync_bool osync_marshal_strings_add(OSyncMarshalStrings *strings, unsigned int id, const char *value, OSyncError **error)
+{
+	char *copy = NULL;
+
+	osync_assert(strings);
+	osync_assert(value);
+
+	g_mutex_lock(strings->lock);
+
+	if (id != strings->strings->len + 1) {
+		osync_error_set(error, OSYNC_ERROR_GENERIC, "Expected string id %u, got %u", strings->strings->len + 1, id);
+		g_mutex_unlock(strings->lock);
+		return FALSE;
+	}
+
+	copy = osync_strdup(value);
+	g_ptr_array_add(strings->strings, copy);
+	g_hash_table_insert(strings->ids, copy, GUINT_TO_POINTER(id));
+
+	g_mutex_unlock(strings->lock);
+
+	return TRUE;
+}
+
+const char *osync_marshal_strings_lookup(OSyncMarshalStrings *strings, unsigned int id)
+{
+	const char *value = NULL;
+
+	osync_assert(strings);
+
+	g_mutex_lock(strings->lock);
+	if (id > 0 && id <= strings->strings->len)
+		value = g_ptr_array_index(strings->strings, id - 1);
+	g_mutex_unlock(strings->lock);
+
+	return value;
+}
+
+unsigned int osync_marshal_strings_get_count(OSyncMarshalStrings *strings)
+{
+	unsigned int count;
+
+	osync_assert(strings);
+
+	g_mutex_lock(strings->lock);
+	count = strings->strings->len;
+	g_mutex_unlock(strings->lock);
+
+	return count;
+}
+
 OSyncMarshal *osync_marshal_sized_new(unsigned int size, OSyncError **error)
 {
-	OSyncMarshal *marshal = osync_try_malloc0(sizeof(OSyncMarshal), error);
+	OSyncMarshal *marshal = _osync_marshal_pool_get(size);
+	if (marshal) {
+		marshal->ref_count = 1;
+		return marshal;
+	}
+
+	marshal = osync_try_malloc0(sizeof(OSyncMarshal), error);
 	if (!marshal)
 		return NULL;
 
@@ -36,6 +352,7 @@ OSyncMarshal *osync_marshal_sized_new(unsigned int size, OSyncError **error)
 		marshal->buffer = g_byte_array_sized_new( size );
 	else
 		marshal->buffer = g_byte_array_new();
+	marshal->buffer_alloc = size;
 
 	marshal->buffer_read_pos = 0;
 
@@ -58,6 +375,23 @@ void osync_marshal_unref(OSyncMarshal *marshal)
 {
 	if (g_atomic_int_dec_and_test(&(marshal->ref_count))) {
 		
+		_osync_marshal_release_segments(marshal);
+
+		if (marshal->strings)
+			osync_marshal_strings_unref(marshal->strings);
+
+		/* Reset everything but the allocations for the next user */
+		marshal->strings = NULL;
+		marshal->compact = FALSE;
+		marshal->max_string_id = 0;
+		marshal->buffer_read_pos = 0;
+
+		if (_osync_marshal_pool_put(marshal))
+			return;
+
+		if (marshal->segments)
+			osync_free(marshal->segments);
+
 		g_byte_array_free(marshal->buffer, TRUE);
 		
 		osync_free(marshal);
@@ -67,12 +401,13 @@ void osync_marshal_unref(OSyncMarshal *marshal)
 unsigned int osync_marshal_get_marshal_size(OSyncMarshal *marshal)
 {
 	osync_assert(marshal);
-	return marshal->buffer->len;
+	return marshal->buffer->len + marshal->segments_size;
 }
 
 osync_bool osync_marshal_set_marshal_size(OSyncMarshal *marshal, unsigned int size, OSyncError **error)
 {
 	osync_assert(marshal);
+	_osync_marshal_flatten(marshal);
 	marshal->buffer->len = size;
 
 	return TRUE;
@@ -81,6 +416,8 @@ osync_bool osync_marshal_set_marshal_size(OSyncMarshal *marshal, unsigned int si
 osync_bool osync_marshal_get_buffer(OSyncMarshal *marshal, char **data, unsigned int *size, OSyncError **error)
 {
 	osync_assert(marshal);
+
+	_osync_marshal_flatten(marshal);
 	
 	if (data)
 		*data = (char *)marshal->buffer->data;
@@ -91,8 +428,71 @@ osync_bool osync_marshal_get_buffer(OSyncMarshal *marshal, char **data, unsigned
 	return TRUE;
 }
 
+void osync_marshal_set_compact(OSyncMarshal *marshal, OSyncMarshalStrings *strings)
+{
+	osync_assert(marshal);
+	osync_assert(!osync_marshal_get_marshal_size(marshal));
+
+	if (strings)
+		osync_marshal_strings_ref(strings);
+	if (marshal->strings)
+		osync_marshal_strings_unref(marshal->strings);
+
+	marshal->strings = strings;
+	marshal->compact = TRUE;
+}
+
+osync_bool osync_marshal_is_compact(OSyncMarshal *marshal)
+{
+	osync_assert(marshal);
+	return marshal->compact;
+}
+
+unsigned int osync_marshal_get_remaining_size(OSyncMarshal *marshal)
+{
+	osync_assert(marshal);
+	return osync_marshal_get_marshal_size(marshal) - marshal->buffer_read_pos;
+}
+
+unsigned int osync_marshal_get_max_string_id(OSyncMarshal *marshal)
+{
+	osync_assert(marshal);
+	return marshal->max_string_id;
+}
+
+unsigned int osync_marshal_get_max_chunks(OSyncMarshal *marshal)
+{
+	osync_assert(marshal);
+	return marshal->num_segments * 2 + 1;
+}
+
+void osync_marshal_foreach_chunk(OSyncMarshal *marshal, OSyncMarshalChunkFn func, void *user_data)
+{
+	unsigned int pos = 0;
+	unsigned int i;
+
+	osync_assert(marshal);
+	osync_assert(func);
+
+	for (i = 0; i < marshal->num_segments; i++) {
+		OSyncMarshalSegment *segment = &marshal->segments[i];
+		if (segment->offset > pos)
+			func((const char *)marshal->buffer->data + pos, segment->offset - pos, user_data);
+		func(segment->data, segment->size, user_data);
+		pos = segment->offset;
+	}
+
+	if (marshal->buffer->len > pos)
+		func((const char *)marshal->buffer->data + pos, marshal->buffer->len - pos, user_data);
+}
+
 osync_bool osync_marshal_write_int(OSyncMarshal *marshal, int value, OSyncError **error)
 {
+	if (marshal->compact) {
+		_osync_marshal_write_varint(marshal, ZIGZAG_ENCODE((long long int) value));
+		return TRUE;
+	}
+
 	g_byte_array_append( marshal->buffer, (unsigned char*)&value, sizeof( int ) );
 
 	return TRUE;
@@ -100,6 +500,11 @@ osync_bool osync_marshal_write_int(OSyncMarshal *marshal, int value, OSyncError
 
 osync_bool osync_marshal_write_uint(OSyncMarshal *marshal, unsigned int value, OSyncError **error)
 {
+	if (marshal->compact) {
+		_osync_marshal_write_varint(marshal, value);
+		return TRUE;
+	}
+
 	g_byte_array_append( marshal->buffer, (unsigned char*)&value, sizeof( unsigned int ) );
 
 	return TRUE;
@@ -107,6 +512,11 @@ osync_bool osync_marshal_write_uint(OSyncMarshal *marshal, unsigned int value, O
 
 osync_bool osync_marshal_write_long_long_int(OSyncMarshal *marshal, long long int value, OSyncError **error)
 {
+	if (marshal->compact) {
+		_osync_marshal_write_varint(marshal, ZIGZAG_ENCODE(value));
+		return TRUE;
+	}
+
 	g_byte_array_append( marshal->buffer, (unsigned char*)&value, sizeof( long long int ) );
 
 	return TRUE;
@@ -119,7 +529,8 @@ osync_bool osync_marshal_write_string(OSyncMarshal *marshal, const char *value,
 	if (value)
 		length = strlen(value) + 1;
 
-	g_byte_array_append( marshal->buffer, (unsigned char*)&length, sizeof( unsigned int ) );
+	if (!osync_marshal_write_uint(marshal, length, error))
+		return FALSE;
 
 	if (value)
 		g_byte_array_append( marshal->buffer, (unsigned char*)value, length );
@@ -152,8 +563,79 @@ error:
 	return FALSE;
 }
 
+osync_bool osync_marshal_write_interned_string(OSyncMarshal *marshal, const char *value, OSyncError **error)
+{
+	unsigned int id = 0;
+
+	if (!marshal->compact || !marshal->strings)
+		return osync_marshal_write_string(marshal, value, error);
+
+	if (value)
+		id = osync_marshal_strings_intern(marshal->strings, value);
+
+	if (id > marshal->max_string_id)
+		marshal->max_string_id = id;
+
+	return osync_marshal_write_uint(marshal, id, error);
+}
+
+osync_bool osync_marshal_write_buffer_ref(OSyncMarshal *marshal, const void *value, unsigned int size, void *owner, OSyncMarshalReleaseFn release, OSyncError **error)
+{
+	OSyncMarshalSegment *segment = NULL;
+
+	if (size < OSYNC_MARSHAL_SEGMENT_MIN_SIZE) {
+		osync_bool ret = osync_marshal_write_buffer(marshal, value, size, error);
+		if (release)
+			release(owner);
+		return ret;
+	}
+
+	if (marshal->num_segments == marshal->segments_alloc) {
+		unsigned int alloc = marshal->segments_alloc ? marshal->segments_alloc * 2 : 4;
+		OSyncMarshalSegment *segments = osync_try_malloc0(alloc * sizeof(OSyncMarshalSegment), error);
+		if (!segments)
+			goto error;
+
+		if (marshal->segments) {
+			memcpy(segments, marshal->segments, marshal->num_segments * sizeof(OSyncMarshalSegment));
+			osync_free(marshal->segments);
+		}
+
+		marshal->segments = segments;
+		marshal->segments_alloc = alloc;
+	}
+
+	if (!osync_marshal_write_uint(marshal, size, error))
+		goto error;
+
+	segment = &marshal->segments[marshal->num_segments++];
+	segment->offset = marshal->buffer->len;
+	segment->data = value;
+	segment->size = size;
+	segment->owner = owner;
+	segment->release = release;
+	marshal->segments_size += size;
+
+	return TRUE;
+
+error:
+	if (release)
+		release(owner);
+	return FALSE;
+}
+
 osync_bool osync_marshal_read_int(OSyncMarshal *marshal, int *value, OSyncError **error)
 {
+	_osync_marshal_flatten(marshal);
+
+	if (marshal->compact) {
+		unsigned long long int encoded;
+		if (!_osync_marshal_read_varint(marshal, &encoded, error))
+			return FALSE;
+		*value = (int) ZIGZAG_DECODE(encoded);
+		return TRUE;
+	}
+
 	osync_assert(marshal->buffer->len >= marshal->buffer_read_pos + sizeof(int));
 	
 	memcpy(value, &(marshal->buffer->data[ marshal->buffer_read_pos ]), sizeof(int));
@@ -164,6 +646,16 @@ osync_bool osync_marshal_read_int(OSyncMarshal *marshal, int *value, OSyncError
 
 osync_bool osync_marshal_read_uint(OSyncMarshal *marshal, unsigned int *value, OSyncError **error)
 {
+	_osync_marshal_flatten(marshal);
+
+	if (marshal->compact) {
+		unsigned long long int encoded;
+		if (!_osync_marshal_read_varint(marshal, &encoded, error))
+			return FALSE;
+		*value = (unsigned int) encoded;
+		return TRUE;
+	}
+
 	osync_assert(marshal->buffer->len >= marshal->buffer_read_pos + sizeof(unsigned int));
 	
 	memcpy(value, &(marshal->buffer->data[ marshal->buffer_read_pos ]), sizeof(unsigned int));
@@ -174,6 +666,16 @@ osync_bool osync_marshal_read_uint(OSyncMarshal *marshal, unsigned int *value, O
 
 osync_bool osync_marshal_read_long_long_int(OSyncMarshal *marshal, long long int *value, OSyncError **error)
 {
+	_osync_marshal_flatten(marshal);
+
+	if (marshal->compact) {
+		unsigned long long int encoded;
+		if (!_osync_marshal_read_varint(marshal, &encoded, error))
+			return FALSE;
+		*value = ZIGZAG_DECODE(encoded);
+		return TRUE;
+	}
+
 	osync_assert(marshal->buffer->len >= marshal->buffer_read_pos + sizeof(long long int));
 	
 	memcpy(value, &(marshal->buffer->data[ marshal->buffer_read_pos ]), sizeof(long long int));
@@ -184,12 +686,13 @@ osync_bool osync_marshal_read_long_long_int(OSyncMarshal *marshal, long long int
 
 osync_bool osync_marshal_read_const_string(OSyncMarshal *marshal, const char **value, OSyncError **error)
 {
-	int length = 0;
+	unsigned int length = 0;
 
-	if (!osync_marshal_read_int(marshal, &length, error))
+	/* A NULL string is written with length 0 */
+	if (!osync_marshal_read_uint(marshal, &length, error))
 		goto error;
 
-	if (length == -1) {
+	if (!length) {
 		*value = NULL;
 		return TRUE;
 	}
@@ -230,8 +733,39 @@ error:
 	return FALSE;
 }
 
+osync_bool osync_marshal_read_interned_string(OSyncMarshal *marshal, char **value, OSyncError **error)
+{
+	unsigned int id = 0;
+	const char *string = NULL;
+
+	if (!marshal->compact || !marshal->strings)
+		return osync_marshal_read_string(marshal, value, error);
+
+	if (!osync_marshal_read_uint(marshal, &id, error))
+		goto error;
+
+	if (!id) {
+		*value = NULL;
+		return TRUE;
+	}
+
+	string = osync_marshal_strings_lookup(marshal->strings, id);
+	if (!string) {
+		osync_error_set(error, OSYNC_ERROR_GENERIC, "Unknown string id %u in marshal", id);
+		goto error;
+	}
+
+	*value = osync_strdup(string);
+	return TRUE;
+
+error:
+	return FALSE;
+}
+
 osync_bool osync_marshal_read_const_data(OSyncMarshal *marshal, void **value, unsigned int size, OSyncError **error)
 {
+	_osync_marshal_flatten(marshal);
+
 	osync_assert(marshal->buffer->len >= marshal->buffer_read_pos + size);
 	
 	*value = &(marshal->buffer->data[marshal->buffer_read_pos]);
@@ -242,6 +776,8 @@ osync_bool osync_marshal_read_const_data(OSyncMarshal *marshal, void **value, un
 
 osync_bool osync_marshal_read_data(OSyncMarshal *marshal, void *value, unsigned int size, OSyncError **error)
 {
+	_osync_marshal_flatten(marshal);
+
 	osync_assert(marshal->buffer->len >= marshal->buffer_read_pos + size);
 	
 	memcpy(value, &(marshal->buffer->data[ marshal->buffer_read_pos ]), size );
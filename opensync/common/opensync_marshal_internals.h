@@ -32,6 +32,185 @@
 
 /*@{*/
 
+/** Payloads smaller than this are copied into the marshal buffer even
+ * when they are written by reference */
+#define OSYNC_MARSHAL_SEGMENT_MIN_SIZE 4096
+
+/** @brief Strings shared by the compact marshals of a connection */
+typedef struct OSyncMarshalStrings OSyncMarshalStrings;
+
+/** Maximal number of bytes kept in freed marshal buffers for reuse */
+#define OSYNC_MARSHAL_POOL_LIMIT (4 * 1024 * 1024)
+
+/** @brief Releases the owner of a payload referenced by a marshal */
+typedef void (* OSyncMarshalReleaseFn) (void *owner);
+
+/** @brief Called for each consecutive chunk of the serialized stream */
+typedef void (* OSyncMarshalChunkFn) (const char *data, unsigned int size, void *user_data);
+
+/** @brief Appends a sized blob without copying it into the marshal buffer
+ *
+ * Serializes exactly like osync_marshal_write_buffer(), but the payload itself
+ * is only referenced. The marshal takes over the reference passed as owner and
+ * calls release on it once the payload is no longer needed, which might happen
+ * right away if the payload is copied anyway because it is small.
+ *
+ * The payload must not be modified until it got released.
+ * 
+ * @param marshal The marshal object
+ * @param value The payload to reference
+ * @param size Size of the payload
+ * @param owner Reference which keeps the payload alive
+ * @param release Function to release owner, or NULL
+ * @param error Pointer to a error-struct
+ */
+OSYNC_TEST_EXPORT osync_bool osync_marshal_write_buffer_ref(OSyncMarshal *marshal, const void *value, unsigned int size, void *owner, OSyncMarshalReleaseFn release, OSyncError **error);
+
+/** @brief Get the upper bound of chunks the serialized stream consists of
+ *
+ * @param marshal The marshal object
+ * @returns Maximal number of times osync_marshal_foreach_chunk() calls its function
+ */
+unsigned int osync_marshal_get_max_chunks(OSyncMarshal *marshal);
+
+/** @brief Walk the serialized stream chunk by chunk without flattening it
+ *
+ * Referenced payloads are handed out in place, which allows to write a marshal
+ * with a single gather write.
+ *
+ * @param marshal The marshal object
+ * @param func Function to call for each non-empty chunk
+ * @param user_data Passed to func
+ */
+void osync_marshal_foreach_chunk(OSyncMarshal *marshal, OSyncMarshalChunkFn func, void *user_data);
+
+/** @brief Creates a new, empty string table
+ *
+ * Interned strings get consecutive ids starting with 1. A string table only
+ * grows, so an id stays valid as long as the table exists.
+ *
+ * @param error Pointer to a error-struct
+ * @returns Pointer to a newly allocated string table
+ */
+OSyncMarshalStrings *osync_marshal_strings_new(OSyncError **error);
+
+/** @brief Increase the reference count of the string table
+ *
+ * @param strings The string table
+ * @returns The referenced string table
+ */
+OSyncMarshalStrings *osync_marshal_strings_ref(OSyncMarshalStrings *strings);
+
+/** @brief Decrease the reference count of the string table
+ *
+ * @param strings The string table
+ */
+void osync_marshal_strings_unref(OSyncMarshalStrings *strings);
+
+/** @brief Get the id of a string, adding it to the table if needed
+ *
+ * @param strings The string table
+ * @param value The string to intern
+ * @returns The id of the string
+ */
+unsigned int osync_marshal_strings_intern(OSyncMarshalStrings *strings, const char *value);
+
+/** @brief Adds the string with the next id, as announced by the remote side
+ *
+ * @param strings The string table
+ * @param id The id the remote side assigned to the string
+ * @param value The string
+ * @param error Pointer to a error-struct
+ * @returns TRUE if id was the next id of the table, FALSE otherwise
+ */
+osync_bool osync_marshal_strings_add(OSyncMarshalStrings *strings, unsigned int id, const char *value, OSyncError **error);
+
+/** @brief Look up the string with the given id
+ *
+ * @param strings The string table
+ * @param id The id of the string
+ * @returns The string, which lives as long as the table, or NULL if unknown
+ */
+const char *osync_marshal_strings_lookup(OSyncMarshalStrings *strings, unsigned int id);
+
+/** @brief Get the number of strings in the table
+ *
+ * @param strings The string table
+ * @returns The highest id in use
+ */
+unsigned int osync_marshal_strings_get_count(OSyncMarshalStrings *strings);
+
+/** @brief Get the number of bytes kept in the pool of freed marshals
+ *
+ * Freed marshals with a buffer below 256 KiB are kept in size classes and
+ * handed out again by osync_marshal_sized_new(), up to
+ * OSYNC_MARSHAL_POOL_LIMIT bytes in total.
+ *
+ * @returns The summed buffer size of all pooled marshals
+ */
+OSYNC_TEST_EXPORT unsigned int osync_marshal_pool_get_size(void);
+
+/** @brief Free all marshals kept in the pool
+ */
+OSYNC_TEST_EXPORT void osync_marshal_pool_flush(void);
+
+/** @brief Switch a marshal to the compact encoding
+ *
+ * Integers of a compact marshal are written as variable length integers and
+ * interned strings as ids of the string table. This has to be done before
+ * anything is written to or read from the marshal.
+ *
+ * @param marshal The marshal object
+ * @param strings The string table of the connection, or NULL to write
+ *                interned strings inline
+ */
+void osync_marshal_set_compact(OSyncMarshal *marshal, OSyncMarshalStrings *strings);
+
+/** @brief Check if the marshal uses the compact encoding
+ *
+ * @param marshal The marshal object
+ * @returns TRUE if the marshal is compact, FALSE otherwise
+ */
+OSYNC_TEST_EXPORT osync_bool osync_marshal_is_compact(OSyncMarshal *marshal);
+
+/** @brief Get the number of bytes which are not read yet
+ *
+ * Fields appended by newer peers are read only if this is not 0.
+ *
+ * @param marshal The marshal object
+ * @returns The number of unread bytes
+ */
+OSYNC_TEST_EXPORT unsigned int osync_marshal_get_remaining_size(OSyncMarshal *marshal);
+
+/** @brief Get the highest string id referred to by the marshal
+ *
+ * The remote side has to know all strings up to this id before it is able
+ * to read the marshal.
+ *
+ * @param marshal The marshal object
+ * @returns The highest string id, 0 if there is none
+ */
+unsigned int osync_marshal_get_max_string_id(OSyncMarshal *marshal);
+
+/** @brief Appends a string which is expected to repeat, like a format name
+ *
+ * Compact marshals refer to the string by its id in the string table.
+ * Otherwise this is the same as osync_marshal_write_string().
+ *
+ * @param marshal The marshal object
+ * @param value The string to append, might be NULL
+ * @param error Pointer to a error-struct
+ */
+OSYNC_TEST_EXPORT osync_bool osync_marshal_write_interned_string(OSyncMarshal *marshal, const char *value, OSyncError **error);
+
+/** @brief Read a string written with osync_marshal_write_interned_string()
+ *
+ * @param marshal The marshal object
+ * @param value Reference to store the newly allocated string
+ * @param error Pointer to a error-struct
+ */
+OSYNC_TEST_EXPORT osync_bool osync_marshal_read_interned_string(OSyncMarshal *marshal, char **value, OSyncError **error);
+
 /** @brief Appends data with a specific length to the serialized buffer
  *
  * This data should be completely serialized. This is only for internal use,
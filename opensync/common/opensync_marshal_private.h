@@ -32,6 +32,36 @@
 
 /*@{*/
 
+/**
+ * @brief A payload referenced by, but not copied into, the marshal buffer
+ */
+typedef struct OSyncMarshalSegment {
+	/** Offset in the buffer the payload logically follows **/
+	unsigned int offset;
+	/** The referenced payload **/
+	const char *data;
+	/** Size of the referenced payload **/
+	unsigned int size;
+	/** Owner of the payload, kept alive as long as the segment **/
+	void *owner;
+	/** Releases the owner once the segment is dropped **/
+	OSyncMarshalReleaseFn release;
+} OSyncMarshalSegment;
+
+/**
+ * @brief Strings shared by the compact marshals of a connection
+ */
+struct OSyncMarshalStrings {
+	/** Reference counting */
+	int ref_count;
+	/** Protects ids and strings **/
+	GMutex *lock;
+	/** Maps a string to its id **/
+	GHashTable *ids;
+	/** The strings, the string with id n is stored at n - 1 **/
+	GPtrArray *strings;
+};
+
 /**
  * @brief A OSyncMarshal object 
  */
@@ -42,8 +72,70 @@ struct OSyncMarshal {
 	GByteArray *buffer;
 	/** The current read position **/
 	unsigned int buffer_read_pos;
+	/** Known lower bound of the allocated size of buffer **/
+	unsigned int buffer_alloc;
+	/** Referenced payloads, ordered by offset **/
+	OSyncMarshalSegment *segments;
+	/** Number of referenced payloads **/
+	unsigned int num_segments;
+	/** Allocated slots of segments **/
+	unsigned int segments_alloc;
+	/** Summed size of all referenced payloads **/
+	unsigned int segments_size;
+	/** Integers are variable length encoded **/
+	osync_bool compact;
+	/** String table of the connection, used by compact marshals **/
+	OSyncMarshalStrings *strings;
+	/** Highest string id referred to **/
+	unsigned int max_string_id;
 };
 
+/** @brief Number of buffer size classes kept in the marshal pool */
+#define OSYNC_MARSHAL_POOL_CLASSES 5
+
+/** @brief Buffer size of the smallest class, each class is four times larger */
+#define OSYNC_MARSHAL_POOL_MIN_SIZE 256
+
+/** @brief Takes a marshal with a buffer of at least size bytes from the pool
+ *
+ * @param size Minimal size of the buffer
+ * @returns A reset marshal or NULL if the pool has none of that size
+ */
+static OSyncMarshal *_osync_marshal_pool_get(unsigned int size);
+
+/** @brief Returns a marshal to the pool
+ *
+ * @param marshal The marshal, which has to be reset already
+ * @returns TRUE if the pool took the marshal, FALSE if it has to be freed
+ */
+static osync_bool _osync_marshal_pool_put(OSyncMarshal *marshal);
+
+/** @brief Copies all referenced payloads into the buffer
+ *
+ * Afterwards the buffer holds the complete serialized stream again.
+ * 
+ * @param marshal The marshal object
+ */
+static void _osync_marshal_flatten(OSyncMarshal *marshal);
+
+/** @brief Appends a variable length encoded integer
+ *
+ * Seven bits are stored per byte, least significant first. The high bit
+ * tells if another byte follows.
+ *
+ * @param marshal The marshal object
+ * @param value The value to append
+ */
+static void _osync_marshal_write_varint(OSyncMarshal *marshal, unsigned long long int value);
+
+/** @brief Reads a variable length encoded integer
+ *
+ * @param marshal The marshal object
+ * @param value Reference to store the value
+ * @param error Pointer to a error-struct
+ */
+static osync_bool _osync_marshal_read_varint(OSyncMarshal *marshal, unsigned long long int *value, OSyncError **error);
+
 /*@}*/
 
 #endif /* _OPENSYNC_MARSHAL_PRIVATE_H */
@@ -0,0 +1,190 @@
+/*
+ * libopensync - A synchronization framework
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ *
+ */
+
+#include "opensync.h"
+#include "opensync_internals.h"
+
+#ifdef HAVE_EVENTFD
+#include <sys/eventfd.h>
+#endif
+
+#include "opensync_wakeup_internals.h"
+#include "opensync_wakeup_private.h"
+
+#ifndef _WIN32
+static osync_bool _osync_wakeup_set_flags(int fd, OSyncError **error)
+{
+	int flags = fcntl(fd, F_GETFL);
+	if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+		osync_error_set(error, OSYNC_ERROR_GENERIC, "Unable to set wakeup flags: %s", g_strerror(errno));
+		return FALSE;
+	}
+
+	flags = fcntl(fd, F_GETFD);
+	if (flags == -1 || fcntl(fd, F_SETFD, flags | FD_CLOEXEC) == -1) {
+		osync_error_set(error, OSYNC_ERROR_GENERIC, "Unable to set wakeup flags: %s", g_strerror(errno));
+		return FALSE;
+	}
+
+	return TRUE;
+}
+#endif /* _WIN32 */
+
+OSyncWakeup *osync_wakeup_new(OSyncError **error)
+{
+	OSyncWakeup *wakeup = NULL;
+#ifndef _WIN32
+	int filedes[2];
+#endif
+	osync_trace(TRACE_ENTRY, "%s(%p)", __func__, error);
+
+	wakeup = osync_try_malloc0(sizeof(OSyncWakeup), error);
+	if (!wakeup)
+		goto error;
+
+	wakeup->read_fd = -1;
+	wakeup->write_fd = -1;
+
+#ifndef _WIN32
+#ifdef HAVE_EVENTFD
+	wakeup->read_fd = eventfd(0, 0);
+	if (wakeup->read_fd != -1) {
+		wakeup->write_fd = wakeup->read_fd;
+		if (!_osync_wakeup_set_flags(wakeup->read_fd, error))
+			goto error_free_wakeup;
+
+		osync_trace(TRACE_EXIT, "%s: %p (eventfd)", __func__, wakeup);
+		return wakeup;
+	}
+#endif /* HAVE_EVENTFD */
+
+	if (pipe(filedes) < 0) {
+		osync_error_set(error, OSYNC_ERROR_GENERIC, "Unable to create wakeup pipe: %s", g_strerror(errno));
+		goto error_free_wakeup;
+	}
+
+	wakeup->read_fd = filedes[0];
+	wakeup->write_fd = filedes[1];
+
+	if (!_osync_wakeup_set_flags(wakeup->read_fd, error)
+	    || !_osync_wakeup_set_flags(wakeup->write_fd, error))
+		goto error_free_wakeup;
+#endif /* _WIN32 */
+
+	osync_trace(TRACE_EXIT, "%s: %p", __func__, wakeup);
+	return wakeup;
+
+#ifndef _WIN32
+ error_free_wakeup:
+	osync_wakeup_free(wakeup);
+#endif
+ error:
+	osync_trace(TRACE_EXIT_ERROR, "%s: %s", __func__, osync_error_print(error));
+	return NULL;
+}
+
+void osync_wakeup_free(OSyncWakeup *wakeup)
+{
+	osync_assert(wakeup);
+
+#ifndef _WIN32
+	if (wakeup->write_fd != -1 && wakeup->write_fd != wakeup->read_fd)
+		close(wakeup->write_fd);
+
+	if (wakeup->read_fd != -1)
+		close(wakeup->read_fd);
+#endif
+
+	osync_free(wakeup);
+}
+
+void osync_wakeup_signal(OSyncWakeup *wakeup)
+{
+#ifndef _WIN32
+	guint64 value = 1;
+	ssize_t ret;
+	osync_assert(wakeup);
+
+	/* Only the first signal after an acknowledge needs to hit the fd */
+	if (!g_atomic_int_compare_and_exchange(&(wakeup->signaled), 0, 1))
+		return;
+
+	do {
+		if (wakeup->write_fd == wakeup->read_fd)
+			ret = write(wakeup->write_fd, &value, sizeof(value));
+		else
+			ret = write(wakeup->write_fd, "", 1);
+	} while (ret < 0 && errno == EINTR);
+
+	/* EAGAIN means the pipe is full, so the reader gets woken up anyway */
+	if (ret < 0 && errno != EAGAIN)
+		osync_trace(TRACE_ERROR, "Unable to signal wakeup: %i %s", errno, g_strerror(errno));
+#endif /* _WIN32 */
+}
+
+void osync_wakeup_acknowledge(OSyncWakeup *wakeup)
+{
+#ifndef _WIN32
+	char buffer[64];
+	ssize_t ret;
+	osync_assert(wakeup);
+
+	/* Drain before the reset. A signal which lands after the reset writes
+	 * a new byte, which must not get drained here. A signal which lands
+	 * before the reset gets skipped, so the caller has to look at its
+	 * queue afterwards. */
+	do {
+		ret = read(wakeup->read_fd, buffer, sizeof(buffer));
+	} while (ret > 0 || (ret < 0 && errno == EINTR));
+
+	g_atomic_int_set(&(wakeup->signaled), 0);
+#endif /* _WIN32 */
+}
+
+osync_bool osync_wakeup_attach(OSyncWakeup *wakeup, GSource *source, GPollFD **pollfd, OSyncError **error)
+{
+	osync_assert(wakeup);
+	osync_assert(source);
+	osync_assert(pollfd);
+
+	*pollfd = NULL;
+
+	if (wakeup->read_fd == -1)
+		return TRUE;
+
+	*pollfd = osync_try_malloc0(sizeof(GPollFD), error);
+	if (!*pollfd)
+		return FALSE;
+
+	(*pollfd)->fd = wakeup->read_fd;
+	(*pollfd)->events = G_IO_IN | G_IO_ERR;
+
+	g_source_add_poll(source, *pollfd);
+
+	return TRUE;
+}
+
+void osync_wakeup_detach(GSource *source, GPollFD *pollfd)
+{
+	if (!pollfd)
+		return;
+
+	g_source_remove_poll(source, pollfd);
+	osync_free(pollfd);
+}
@@ -0,0 +1,112 @@
+/*
+ * libopensync - A synchronization framework
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ *
+ */
+
+#ifndef _OPENSYNC_WAKEUP_INTERNALS_H
+#define _OPENSYNC_WAKEUP_INTERNALS_H
+
+/**
+ * @defgroup OSyncWakeupInternalAPI OpenSync Wakeup Internals
+ * @ingroup OSyncCommonPrivate
+ * @brief File descriptor based notification for GSources
+ *
+ * A wakeup is signaled by producers which push something on a GAsyncQueue
+ * and polled by the GSource which consumes the queue. This lets the
+ * GMainContext of the consumer sleep in poll() until there is work to do,
+ * instead of waking up periodically to look at the queue.
+ */
+
+/*@{*/
+
+typedef struct OSyncWakeup OSyncWakeup;
+
+/** @brief Poll timeout for sources which have nothing to do
+ *
+ * Platforms without file descriptor based wakeups fall back to polling.
+ */
+#ifdef _WIN32
+#define OSYNC_WAKEUP_IDLE_TIMEOUT 1
+#else
+#define OSYNC_WAKEUP_IDLE_TIMEOUT -1
+#endif
+
+/** @brief Allocates a new wakeup
+ * 
+ * Uses an eventfd where available, otherwise a non-blocking pipe.
+ *
+ * @param error The error which will hold the info in case of an error
+ * @returns A pointer to the new allocated OSyncWakeup or NULL on error
+ * 
+ */
+OSYNC_TEST_EXPORT OSyncWakeup *osync_wakeup_new(OSyncError **error);
+
+/** @brief Releases a wakeup and closes its file descriptors
+ * 
+ * @param wakeup Pointer to OSyncWakeup
+ * 
+ */
+OSYNC_TEST_EXPORT void osync_wakeup_free(OSyncWakeup *wakeup);
+
+/** @brief Wakes up the poll of all sources which watch this wakeup
+ *
+ * Can be called from any thread. Signaling an already signaled wakeup
+ * does not cost a syscall.
+ * 
+ * @param wakeup Pointer to OSyncWakeup
+ * 
+ */
+OSYNC_TEST_EXPORT void osync_wakeup_signal(OSyncWakeup *wakeup);
+
+/** @brief Resets a signaled wakeup
+ *
+ * Must be called by the consumer once its GPollFD reported activity.
+ * Signals for items pushed while acknowledging may not hit the file
+ * descriptor again, so the consumer has to look at the watched queue
+ * after this returns, never before.
+ * 
+ * @param wakeup Pointer to OSyncWakeup
+ * 
+ */
+OSYNC_TEST_EXPORT void osync_wakeup_acknowledge(OSyncWakeup *wakeup);
+
+/** @brief Adds the wakeup file descriptor to the polled fds of a source
+ *
+ * Every source gets its own GPollFD, so several sources of the same
+ * context can watch one wakeup. 
+ * 
+ * @param wakeup Pointer to OSyncWakeup
+ * @param source The GSource which should be woken up
+ * @param pollfd Location to store the GPollFD which was added to the source,
+ *               set to NULL if the platform has no file descriptor based wakeups
+ * @param error The error which will hold the info in case of an error
+ * @returns TRUE on success, FALSE otherwise
+ * 
+ */
+OSYNC_TEST_EXPORT osync_bool osync_wakeup_attach(OSyncWakeup *wakeup, GSource *source, GPollFD **pollfd, OSyncError **error);
+
+/** @brief Removes a GPollFD which was added by osync_wakeup_attach
+ * 
+ * @param source The GSource the wakeup was attached to
+ * @param pollfd The GPollFD returned by osync_wakeup_attach
+ * 
+ */
+OSYNC_TEST_EXPORT void osync_wakeup_detach(GSource *source, GPollFD *pollfd);
+
+/*@}*/
+
+#endif /* _OPENSYNC_WAKEUP_INTERNALS_H */
@@ -0,0 +1,44 @@
+/*
+ * libopensync - A synchronization framework
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ *
+ */
+
+#ifndef _OPENSYNC_WAKEUP_PRIVATE_H
+#define _OPENSYNC_WAKEUP_PRIVATE_H
+
+/**
+ * @defgroup OSyncWakeupPrivateAPI OpenSync Wakeup Private
+ * @ingroup OSyncCommonPrivate
+ */
+
+/*@{*/
+
+/**
+ * @brief Represents a Wakeup
+ */
+struct OSyncWakeup {
+	/** The file descriptor which gets polled */
+	int read_fd;
+	/** The file descriptor which gets written to signal (same as read_fd for eventfd) */
+	int write_fd;
+	/** Set while the wakeup is signaled and not yet acknowledged */
+	gint signaled;
+};
+
+/*@}*/
+
+#endif /* _OPENSYNC_WAKEUP_PRIVATE_H */
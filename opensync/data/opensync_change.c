@@ -147,11 +147,46 @@ void osync_change_set_data(OSyncChange *change, OSyncData *data)
 }
 
 OSyncData *osync_change_get_data(OSyncChange *change)
+{
+	OSyncError *error = NULL;
+
+	osync_assert(change);
+
+	/* The data might have been spilled by the change store. It remembers
+	 * errors, they fail the synchronization at its next trim */
+	if (change->data && !osync_data_page_in(change->data, &error)) {
+		osync_trace(TRACE_ERROR, "Unable to read the data of change %s back: %s", __NULLSTR(change->uid), osync_error_print(&error));
+		osync_error_unref(&error);
+	}
+
+	return change->data;
+}
+
+OSyncData *osync_change_peek_data(OSyncChange *change)
 {
 	osync_assert(change);
 	return change->data;
 }
 
+osync_bool osync_change_own_data(OSyncChange *change, OSyncError **error)
+{
+	OSyncData *data = NULL;
+
+	osync_assert(change);
+
+	if (!change->data || !osync_data_is_shared(change->data))
+		return TRUE;
+
+	data = osync_data_borrow(change->data, error);
+	if (!data)
+		return FALSE;
+
+	osync_change_set_data(change, data);
+	osync_data_unref(data);
+
+	return TRUE;
+}
+
 OSyncChange *osync_change_clone(OSyncChange *source, OSyncError **error)
 {
 	OSyncChange *change = NULL;
@@ -177,6 +212,18 @@ OSyncChange *osync_change_clone(OSyncChange *source, OSyncError **error)
 	return change;
 }
 
+osync_bool osync_change_is_stub(OSyncChange *change)
+{
+	osync_assert(change);
+	return change->stub;
+}
+
+void osync_change_set_stub(OSyncChange *change, osync_bool stub)
+{
+	osync_assert(change);
+	change->stub = stub;
+}
+
 OSyncConvCmpResult osync_change_compare(OSyncChange *leftchange, OSyncChange *rightchange, OSyncError **error)
 {
 	osync_trace(TRACE_ENTRY, "%s(%p, %p, %p)", __func__, leftchange, rightchange, error);
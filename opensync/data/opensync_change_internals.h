@@ -50,6 +50,54 @@ OSyncChange *osync_change_clone(OSyncChange *source, OSyncError **error);
  */
 osync_bool osync_change_duplicate(OSyncChange *change, osync_bool *dirty, OSyncError **error);
 
+/*! @brief Gets the data of a change without reading spilled data back
+ * 
+ * For callers which only look at the data object itself, not at its
+ * buffer. See osync_change_get_data().
+ * 
+ * @param change The change
+ * @returns the data object
+ * 
+ */
+OSyncData *osync_change_peek_data(OSyncChange *change);
+
+/*! @brief Replaces shared data of a change by a data object of its own
+ * 
+ * Data which got passed by reference between threads must not be
+ * modified. This has to be called before the data may get modified, e.g.
+ * by a conversion or a plugin. The new data object borrows the buffer,
+ * which only gets copied once it gets written, see osync_data_borrow().
+ * Data which is not shared is kept as it is.
+ * 
+ * @param change The change
+ * @param error An error struct
+ * @returns TRUE on success, FALSE otherwise
+ * 
+ */
+OSYNC_TEST_EXPORT osync_bool osync_change_own_data(OSyncChange *change, OSyncError **error);
+
+/*! @brief Checks if a change is a stub
+ * 
+ * A stub carries the uid, hash and changetype of a change but no payload.
+ * The payload has to get read from the plugin once it is needed.
+ * 
+ * @param change The change to check
+ * @returns TRUE if the change is a stub, FALSE otherwise
+ * 
+ */
+OSYNC_TEST_EXPORT osync_bool osync_change_is_stub(OSyncChange *change);
+
+/*! @brief Marks a change as stub or as complete change
+ * 
+ * Only changes of sinks which agreed on reporting stubs get marked.
+ * A change without data is not a stub by itself.
+ * 
+ * @param change The change to mark
+ * @param stub TRUE if the data of the change still has to get read
+ * 
+ */
+OSYNC_TEST_EXPORT void osync_change_set_stub(OSyncChange *change, osync_bool stub);
+
 /*@}*/
 
 #endif /*_OPENSYNC_CHANGE_INTERNALS_H_*/
@@ -35,6 +35,8 @@ struct OSyncChange {
 	OSyncChangeType changetype;
 	/** The data reported from the plugin */
 	OSyncData *data;
+	/** TRUE if the plugin reported the change without its data */
+	osync_bool stub;
 	int ref_count;
 };
 
@@ -28,6 +28,63 @@
 #include "opensync_data_private.h"
 #include "opensync_data_internals.h"
 
+/* Protects pinned and retired of all data objects */
+static GStaticMutex pin_lock = G_STATIC_MUTEX_INIT;
+
+static void _osync_data_retire_buffer(OSyncData *data)
+{
+	OSyncData *retired = NULL;
+
+	/* A borrowed buffer belongs to the source, see _osync_data_give_back() */
+	if (!data->pinned || !data->data || data->borrowed)
+		return;
+
+	retired = osync_data_new(data->data, data->size, data->objformat, NULL);
+	if (!retired) {
+		/* Better leak the buffer than free it underneath a reader */
+		data->data = NULL;
+		data->size = 0;
+		return;
+	}
+
+	data->retired = g_list_prepend(data->retired, retired);
+	data->data = NULL;
+	data->size = 0;
+}
+
+static OSyncData *_osync_data_give_back(OSyncData *data)
+{
+	OSyncData *source = data->borrowed;
+
+	if (!source)
+		return NULL;
+
+	data->borrowed = NULL;
+	data->data = NULL;
+	data->size = 0;
+
+	/* Readers of the pinned buffer keep the source alive */
+	if (data->pinned) {
+		data->retired = g_list_prepend(data->retired, source);
+		return NULL;
+	}
+
+	return source;
+}
+
+static void _osync_data_page_in(OSyncData *data)
+{
+	OSyncError *error = NULL;
+
+	if (!data->spilled)
+		return;
+
+	if (!osync_data_page_in(data, &error)) {
+		osync_trace(TRACE_ERROR, "Unable to read data %p back: %s", data, osync_error_print(&error));
+		osync_error_unref(&error);
+	}
+}
+
 OSyncData *osync_data_new(char *buffer, unsigned int size, OSyncObjFormat *format, OSyncError **error)
 {
 	OSyncData *data = osync_try_malloc0(sizeof(OSyncData), error);
@@ -61,7 +118,12 @@ void osync_data_unref(OSyncData *data)
 	osync_assert(data);
 	
 	if (g_atomic_int_dec_and_test(&(data->ref_count))) {
-		if (data->data)
+		if (data->store_funcs)
+			data->store_funcs->release(data->store_entry);
+
+		if (data->borrowed)
+			osync_data_unref(data->borrowed);
+		else if (data->data)
 			if (!osync_objformat_destroy(data->objformat, data->data, data->size, &error)) {
 				/* FIXME: We can't deal here with an error - right? Any other chance?! */
 				osync_error_unref(&error);
@@ -119,6 +181,8 @@ void osync_data_set_objtype(OSyncData *data, const char *objtype)
 void osync_data_get_data(OSyncData *data, char **buffer, unsigned int *size)
 {
 	osync_assert(data);
+	_osync_data_page_in(data);
+
 	if (buffer)
 		*buffer = data->data;
 	
@@ -128,22 +192,72 @@ void osync_data_get_data(OSyncData *data, char **buffer, unsigned int *size)
 
 void osync_data_steal_data(OSyncData *data, char **buffer, unsigned int *size)
 {
+	OSyncError *error = NULL;
+	OSyncData *source = NULL;
+
 	osync_assert(data);
 	osync_assert(buffer);
 	osync_assert(size);
+
+	_osync_data_page_in(data);
+
+	g_static_mutex_lock(&pin_lock);
+	if (data->borrowed && data->data) {
+		/* Copy on write, the source keeps its buffer */
+		if (!osync_objformat_copy(data->objformat, data->data, data->size, buffer, size, &error)) {
+			osync_trace(TRACE_ERROR, "Unable to copy the borrowed data of %p: %s", data, osync_error_print(&error));
+			osync_error_unref(&error);
+			*buffer = NULL;
+			*size = 0;
+		}
+		source = _osync_data_give_back(data);
+		g_static_mutex_unlock(&pin_lock);
+
+		if (source)
+			osync_data_unref(source);
+
+		if (data->store_funcs)
+			data->store_funcs->replaced(data, data->store_entry);
+		return;
+	}
+
+
+	if (data->pinned && data->data) {
+		/* The caller owns the stolen buffer, so hand out a copy
+		 * and keep the pinned one until all pins are gone */
+		*buffer = g_malloc0(data->size + 1);
+		memcpy(*buffer, data->data, data->size);
+		*size = data->size;
+		_osync_data_retire_buffer(data);
+		g_static_mutex_unlock(&pin_lock);
+		return;
+	}
 	
 	*buffer = data->data;
 	*size = data->size;
 	
 	data->data = NULL;
 	data->size = 0;
+	g_static_mutex_unlock(&pin_lock);
+
+	if (data->store_funcs)
+		data->store_funcs->replaced(data, data->store_entry);
 }
 
 void osync_data_set_data(OSyncData *data, char *buffer, unsigned int size)
 {
 	OSyncError *error = NULL;
+	OSyncData *source = NULL;
 
 	osync_assert(data);
+	g_static_mutex_lock(&pin_lock);
+	_osync_data_retire_buffer(data);
+	source = _osync_data_give_back(data);
+	g_static_mutex_unlock(&pin_lock);
+
+	if (source)
+		osync_data_unref(source);
+
 	if (data->data) {
 		if (!osync_objformat_destroy(data->objformat, data->data, data->size, &error)) {
 			/* FIXME: how to handle this? Do we really want to expose here an OSyncError*?! */
@@ -153,14 +267,85 @@ void osync_data_set_data(OSyncData *data, char *buffer, unsigned int size)
 	}
 	data->data = buffer;
 	data->size = size;
+	/* A spilled buffer got replaced */
+	data->spilled = FALSE;
+
+	if (data->store_funcs)
+		data->store_funcs->replaced(data, data->store_entry);
+}
+
+void osync_data_pin_data(OSyncData *data, char **buffer, unsigned int *size)
+{
+	osync_assert(data);
+	osync_assert(buffer);
+	osync_assert(size);
+
+	osync_data_ref(data);
+	_osync_data_page_in(data);
+
+	g_static_mutex_lock(&pin_lock);
+	data->pinned++;
+	*buffer = data->data;
+	*size = data->size;
+	g_static_mutex_unlock(&pin_lock);
+}
+
+void osync_data_unpin_data(OSyncData *data)
+{
+	GList *retired = NULL;
+	GList *r = NULL;
+
+	osync_assert(data);
+
+	g_static_mutex_lock(&pin_lock);
+	osync_assert(data->pinned > 0);
+	if (!--data->pinned) {
+		retired = data->retired;
+		data->retired = NULL;
+	}
+	g_static_mutex_unlock(&pin_lock);
+
+	for (r = retired; r; r = r->next)
+		osync_data_unref(r->data);
+	g_list_free(retired);
+
+	osync_data_unref(data);
 }
 
 osync_bool osync_data_has_data(OSyncData *data)
 {
 	osync_return_val_if_fail(data, FALSE);
+	/* Data which can't be read back is gone */
+	_osync_data_page_in(data);
 	return data->data ? TRUE : FALSE;
 }
 
+OSyncData *osync_data_borrow(OSyncData *source, OSyncError **error)
+{
+	OSyncData *data = NULL;
+
+	osync_assert(source);
+	_osync_data_page_in(source);
+
+	/* Borrow from the owner of the buffer, which outlives this one */
+	if (source->borrowed)
+		source = source->borrowed;
+
+	data = osync_data_new(NULL, 0, source->objformat, error);
+	if (!data)
+		return NULL;
+
+	data->objtype = osync_strdup(source->objtype);
+
+	if (source->data) {
+		data->data = source->data;
+		data->size = source->size;
+		data->borrowed = osync_data_ref(source);
+	}
+
+	return data;
+}
+
 OSyncData *osync_data_clone(OSyncData *source, OSyncError **error)
 {
 	OSyncData *data = NULL;
@@ -168,6 +353,7 @@ OSyncData *osync_data_clone(OSyncData *source, OSyncError **error)
 	unsigned int size = 0;
 	
 	osync_assert(source);
+	_osync_data_page_in(source);
 	
 	data = osync_data_new(NULL, 0, source->objformat, error);
 	if (!data)
@@ -198,6 +384,11 @@ OSyncConvCmpResult osync_data_compare(OSyncData *leftdata, OSyncData *rightdata,
 		osync_trace(TRACE_EXIT, "%s: SAME: OK. data is the same", __func__);
 		return OSYNC_CONV_DATA_SAME;
 	}
+
+	if (!osync_data_page_in(leftdata, error) || !osync_data_page_in(rightdata, error)) {
+		osync_trace(TRACE_EXIT_ERROR, "%s: %s", __func__, osync_error_print(error));
+		return OSYNC_CONV_DATA_UNKNOWN;
+	}
 	
 	if (leftdata->data == rightdata->data && leftdata->size == rightdata->size) {
 		osync_trace(TRACE_EXIT, "%s: SAME: OK. data point to same memory", __func__);
@@ -226,6 +417,8 @@ char *osync_data_get_printable(OSyncData *data, OSyncError **error)
 		
 	format = data->objformat;
 	osync_assert(format);
+
+	_osync_data_page_in(data);
 	
 	return osync_objformat_print(format, data->data, data->size, error);
 }
@@ -239,6 +432,8 @@ time_t osync_data_get_revision(OSyncData *data, OSyncError **error)
 	
 	format = data->objformat;
 	osync_assert(format);
+
+	_osync_data_page_in(data);
 	
 	time = osync_objformat_get_revision(format, data->data, data->size, error);
 	if (time == -1) {
@@ -250,3 +445,88 @@ time_t osync_data_get_revision(OSyncData *data, OSyncError **error)
 	return time;
 }
 
+void osync_data_set_shared(OSyncData *data)
+{
+	osync_assert(data);
+	data->shared = TRUE;
+}
+
+osync_bool osync_data_is_shared(OSyncData *data)
+{
+	osync_assert(data);
+	return data->shared;
+}
+
+void osync_data_set_store(OSyncData *data, const OSyncDataStoreFuncs *funcs, void *entry)
+{
+	osync_assert(data);
+	osync_assert(!data->store_funcs);
+	data->store_funcs = funcs;
+	data->store_entry = entry;
+}
+
+void *osync_data_get_store_entry(OSyncData *data)
+{
+	osync_assert(data);
+	return data->store_entry;
+}
+
+osync_bool osync_data_spill(OSyncData *data)
+{
+	OSyncError *error = NULL;
+	char *buffer = NULL;
+	unsigned int size = 0;
+
+	osync_assert(data);
+	osync_assert(data->store_funcs);
+
+	g_static_mutex_lock(&pin_lock);
+	/* Shared data is read by another thread without going through the
+	 * store, borrowed data belongs to a shared data object */
+	if (data->pinned || data->shared || data->borrowed || !data->data) {
+		g_static_mutex_unlock(&pin_lock);
+		return FALSE;
+	}
+
+	buffer = data->data;
+	size = data->size;
+	data->data = NULL;
+	data->size = 0;
+	data->spilled = TRUE;
+	g_static_mutex_unlock(&pin_lock);
+
+	if (!osync_objformat_destroy(data->objformat, buffer, size, &error)) {
+		/* The buffer is gone anyway */
+		osync_error_unref(&error);
+	}
+
+	return TRUE;
+}
+
+osync_bool osync_data_is_spilled(OSyncData *data)
+{
+	osync_assert(data);
+	return data->spilled;
+}
+
+void osync_data_restore(OSyncData *data, char *buffer, unsigned int size)
+{
+	osync_assert(data);
+	osync_assert(data->spilled);
+
+	g_static_mutex_lock(&pin_lock);
+	data->data = buffer;
+	data->size = size;
+	data->spilled = FALSE;
+	g_static_mutex_unlock(&pin_lock);
+}
+
+osync_bool osync_data_page_in(OSyncData *data, OSyncError **error)
+{
+	osync_assert(data);
+
+	if (!data->spilled)
+		return TRUE;
+
+	return data->store_funcs->page_in(data, data->store_entry, error);
+}
@@ -37,6 +37,30 @@
  */
 void osync_data_steal_data(OSyncData *data, char **buffer, unsigned int *size);
 
+/*! @brief Pin the buffer of a data object
+ *
+ * While pinned, the buffer returned stays valid and unmodified even if the
+ * data object gets new data assigned or its data stolen. This allows to
+ * hand out the buffer to another thread, e.g. to write it to a queue,
+ * without copying it first.
+ * 
+ * Every pin takes a reference to the data object and needs to be released
+ * with osync_data_unpin_data().
+ * 
+ * @param data The data object
+ * @param buffer Pointer to a char * that will be set to point to the data
+ * @param size Pointer to an integer variable that will be set to the size of the data
+ * 
+ */
+void osync_data_pin_data(OSyncData *data, char **buffer, unsigned int *size);
+
+/*! @brief Release a pin taken with osync_data_pin_data()
+ * 
+ * @param data The data object
+ * 
+ */
+void osync_data_unpin_data(OSyncData *data);
+
 /*! @brief Compares two data objects
  * 
  * Compares the two given data objects and returns:
@@ -51,6 +75,108 @@ void osync_data_steal_data(OSyncData *data, char **buffer, unsigned int *size);
  * 
  */
 OSyncConvCmpResult osync_data_compare(OSyncData *leftdata, OSyncData *rightdata, OSyncError **error);
+
+/*! @brief Mark a data object as passed to another thread by reference
+ * 
+ * Neither side may modify the data object afterwards. Who needs to has
+ * to work on a data object of its own, see osync_data_borrow().
+ * 
+ * @param data The data object
+ * 
+ */
+void osync_data_set_shared(OSyncData *data);
+
+/*! @brief Check if a data object got passed to another thread by reference
+ * 
+ * @param data The data object
+ * @returns TRUE if the data object is shared, FALSE otherwise
+ * 
+ */
+OSYNC_TEST_EXPORT osync_bool osync_data_is_shared(OSyncData *data);
+
+/*! @brief Creates a data object which reads the buffer of a shared one
+ * 
+ * Copy on write: the buffer only gets copied once it gets stolen, and
+ * dropped once it gets replaced by osync_data_set_data(). Until then the
+ * source is kept alive. Readers never pay for a copy.
+ * 
+ * @param source The shared data object, which must not get modified
+ * @param error An error struct
+ * @returns The new data object, or NULL if an error occurred
+ * 
+ */
+OSyncData *osync_data_borrow(OSyncData *source, OSyncError **error);
+
+/*! @brief Functions of a store which can take over the buffer of data objects */
+typedef struct OSyncDataStoreFuncs {
+	/** Reads the buffer of a spilled data object back with osync_data_restore() */
+	osync_bool (* page_in) (OSyncData *data, void *entry, OSyncError **error);
+	/** The buffer got replaced or taken, a saved copy is outdated */
+	void (* replaced) (OSyncData *data, void *entry);
+	/** The data object got destroyed */
+	void (* release) (void *entry);
+} OSyncDataStoreFuncs;
+
+/*! @brief Assign a data object to a store
+ * 
+ * The store may spill the buffer of the data object with osync_data_spill().
+ * The buffer gets read back transparently once it gets accessed.
+ * 
+ * @param data The data object
+ * @param funcs The functions of the store
+ * @param entry The entry of the data object in the store, passed to funcs
+ * 
+ */
+void osync_data_set_store(OSyncData *data, const OSyncDataStoreFuncs *funcs, void *entry);
+
+/*! @brief Get the entry of a data object in its store
+ * 
+ * @param data The data object
+ * @returns The entry passed to osync_data_set_store() or NULL
+ * 
+ */
+void *osync_data_get_store_entry(OSyncData *data);
+
+/*! @brief Drop the buffer of a data object, which got saved by its store
+ * 
+ * Pinned buffers can't be spilled.
+ * 
+ * @param data The data object
+ * @returns TRUE if the buffer got dropped, FALSE otherwise
+ * 
+ */
+osync_bool osync_data_spill(OSyncData *data);
+
+/*! @brief Check if the buffer of a data object got spilled
+ * 
+ * @param data The data object
+ * @returns TRUE if the buffer is only kept by the store
+ * 
+ */
+osync_bool osync_data_is_spilled(OSyncData *data);
+
+/*! @brief Hand the buffer of a spilled data object back
+ * 
+ * Only to be called by the page_in function of the store.
+ * 
+ * @param data The data object
+ * @param buffer The buffer read back by the store
+ * @param size The size of the buffer
+ * 
+ */
+void osync_data_restore(OSyncData *data, char *buffer, unsigned int size);
+
+/*! @brief Read the buffer of a spilled data object back
+ * 
+ * All functions which access the buffer do this on their own, but can't
+ * report errors. Call this first where an error has to fail the caller.
+ * 
+ * @param data The data object
+ * @param error An error struct
+ * @returns TRUE on success, FALSE otherwise
+ * 
+ */
+osync_bool osync_data_page_in(OSyncData *data, OSyncError **error);
 /*@}*/
 
 #endif /* _OPENSYNC_DATA_INTERNALS_H_ */
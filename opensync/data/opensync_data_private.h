@@ -42,8 +42,48 @@ struct OSyncData {
 	/** The name of the format */
 	OSyncObjFormat *objformat;
 	int ref_count;
+	/** Number of pins which require the current buffer to stay untouched */
+	int pinned;
+	/** Buffers replaced while pinned, kept as data objects until unpinned */
+	GList *retired;
+	/** The store which may take the buffer, see osync_data_set_store() */
+	const struct OSyncDataStoreFuncs *store_funcs;
+	void *store_entry;
+	/** TRUE while the buffer is only kept by the store */
+	osync_bool spilled;
+	/** TRUE once the data object got passed to another thread */
+	osync_bool shared;
+	/** The shared data object which owns the buffer, until it gets written */
+	OSyncData *borrowed;
 };
 
+/** @brief Moves the current buffer aside if it is pinned
+ *
+ * Has to be called with the pin lock held.
+ *
+ * @param data The data object
+ */
+static void _osync_data_retire_buffer(OSyncData *data);
+
+/** @brief Hands a borrowed buffer back to its data object
+ *
+ * Has to be called with the pin lock held. The data object is left
+ * without buffer. If it is pinned, the source gets retired.
+ *
+ * @param data The data object
+ * @returns The source, which the caller has to unref without the pin lock
+ */
+static OSyncData *_osync_data_give_back(OSyncData *data);
+
+/** @brief Reads the buffer back from the store if it got spilled
+ *
+ * Errors get traced here and remembered by the store, the data object
+ * stays without buffer then. See osync_data_page_in().
+ *
+ * @param data The data object
+ */
+static void _osync_data_page_in(OSyncData *data);
+
 /*@}*/
 
 #endif /* _OPENSYNC_DATA_PRIVATE_H_ */
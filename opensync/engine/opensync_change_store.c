@@ -0,0 +1,487 @@
+/*
+ * libopensync - A synchronization framework
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ *
+ */
+
+#include "opensync.h"
+#include "opensync_internals.h"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+#include <glib/gstdio.h>
+
+#include "opensync-data.h"
+#include "opensync-format.h"
+
+#include "data/opensync_data_internals.h"
+#include "format/opensync_objformat_internals.h"
+#include "common/opensync_marshal_internals.h"
+
+#include "opensync_change_store_internals.h"
+#include "opensync_change_store_private.h"
+
+#ifndef _WIN32
+static osync_bool _osync_change_store_page_in(OSyncData *data, void *userdata, OSyncError **error);
+static void _osync_change_store_replaced(OSyncData *data, void *userdata);
+static void _osync_change_store_release(void *userdata);
+
+static const OSyncDataStoreFuncs _osync_change_store_funcs = {
+	_osync_change_store_page_in,
+	_osync_change_store_replaced,
+	_osync_change_store_release
+};
+
+static void _osync_change_store_queue(OSyncChangeStore *store, OSyncChangeStoreEntry *entry)
+{
+	g_queue_push_tail(store->queue, entry);
+	entry->link = g_queue_peek_tail_link(store->queue);
+	store->resident += entry->size;
+
+	if (store->resident > store->peak)
+		store->peak = store->resident;
+}
+
+static void _osync_change_store_unqueue(OSyncChangeStore *store, OSyncChangeStoreEntry *entry)
+{
+	g_queue_delete_link(store->queue, entry->link);
+	entry->link = NULL;
+	store->resident -= entry->size;
+}
+
+/* Makes sure the mapping covers the first size bytes of the scratch file */
+static osync_bool _osync_change_store_map(OSyncChangeStore *store, size_t size, OSyncError **error)
+{
+	void *mapping = NULL;
+
+	if (size <= store->mapping_size)
+		return TRUE;
+
+	mapping = mmap(NULL, store->file_size, PROT_READ, MAP_SHARED, store->fd, 0);
+	if (mapping == MAP_FAILED) {
+		osync_error_set(error, OSYNC_ERROR_IO_ERROR, "Unable to map the change store: %s", g_strerror(errno));
+		return FALSE;
+	}
+
+	if (store->mapping)
+		munmap(store->mapping, store->mapping_size);
+
+	store->mapping = mapping;
+	store->mapping_size = store->file_size;
+	return TRUE;
+}
+
+static osync_bool _osync_change_store_write(OSyncChangeStore *store, const char *buffer, unsigned int length, OSyncError **error)
+{
+	unsigned int written = 0;
+
+	while (written < length) {
+		ssize_t ret = pwrite(store->fd, buffer + written, length - written, store->file_size + written);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+
+			osync_error_set(error, OSYNC_ERROR_IO_ERROR, "Unable to write to the change store: %s", g_strerror(errno));
+			return FALSE;
+		}
+		written += ret;
+	}
+
+	store->file_size += length;
+	return TRUE;
+}
+
+/* Writes the buffer of the entry to the scratch file and drops it. Sets
+ * spilled to FALSE if the buffer is pinned and has to stay in memory. */
+static osync_bool _osync_change_store_spill(OSyncChangeStore *store, OSyncChangeStoreEntry *entry, osync_bool *spilled, OSyncError **error)
+{
+	OSyncObjFormat *objformat = osync_data_get_objformat(entry->data);
+	OSyncMarshal *marshal = NULL;
+	char *buffer = NULL, *bytes = NULL;
+	unsigned int size = 0, length = 0;
+
+	/* The scratch file still has the buffer which got read back */
+	if (entry->stored)
+		goto spill;
+
+	osync_data_get_data(entry->data, &buffer, &size);
+	if (!buffer) {
+		*spilled = FALSE;
+		return TRUE;
+	}
+
+	bytes = buffer;
+	length = size;
+
+	/* The same as on the wire, see osync_marshal_data() */
+	if (osync_objformat_must_marshal(objformat)) {
+		marshal = osync_marshal_new(error);
+		if (!marshal)
+			goto error;
+
+		if (!osync_objformat_marshal(objformat, buffer, size, marshal, error))
+			goto error_free_marshal;
+
+		if (!osync_marshal_get_buffer(marshal, &bytes, &length, error))
+			goto error_free_marshal;
+	}
+
+	entry->offset = store->file_size;
+	entry->length = length;
+
+	if (!_osync_change_store_write(store, bytes, length, error))
+		goto error_free_marshal;
+
+	if (marshal)
+		osync_marshal_unref(marshal);
+
+	entry->stored = TRUE;
+
+ spill:
+	*spilled = osync_data_spill(entry->data);
+	if (*spilled)
+		store->num_spilled++;
+
+	return TRUE;
+
+ error_free_marshal:
+	if (marshal)
+		osync_marshal_unref(marshal);
+ error:
+	return FALSE;
+}
+
+static osync_bool _osync_change_store_trim(OSyncChangeStore *store, OSyncError **error)
+{
+	OSyncChangeStoreEntry *entry = NULL;
+	GList *pinned = NULL, *p = NULL;
+	osync_bool spilled = FALSE;
+	osync_bool ret = TRUE;
+
+	if (store->error) {
+		osync_error_set(error, OSYNC_ERROR_IO_ERROR, "Unable to read spilled data back: %s", osync_error_print(&store->error));
+		return FALSE;
+	}
+
+	while (store->resident > store->budget && (entry = g_queue_peek_head(store->queue))) {
+		_osync_change_store_unqueue(store, entry);
+
+		if (!_osync_change_store_spill(store, entry, &spilled, error)) {
+			_osync_change_store_queue(store, entry);
+			ret = FALSE;
+			break;
+		}
+
+		if (!spilled)
+			pinned = g_list_prepend(pinned, entry);
+	}
+
+	/* Pinned buffers are in use, try again next time */
+	for (p = pinned; p; p = p->next)
+		_osync_change_store_queue(store, p->data);
+	g_list_free(pinned);
+
+	return ret;
+}
+
+static osync_bool _osync_change_store_page_in(OSyncData *data, void *userdata, OSyncError **error)
+{
+	OSyncChangeStoreEntry *entry = userdata;
+	OSyncChangeStore *store = entry->store;
+	OSyncObjFormat *objformat = osync_data_get_objformat(data);
+	char *bytes = NULL, *buffer = NULL;
+	unsigned int size = 0;
+
+	g_mutex_lock(store->mutex);
+
+	/* Another thread was faster */
+	if (!osync_data_is_spilled(data)) {
+		g_mutex_unlock(store->mutex);
+		return TRUE;
+	}
+
+	/* Once failed, the synchronization is going to fail anyway */
+	if (store->error) {
+		osync_error_set(error, OSYNC_ERROR_IO_ERROR, "Unable to read spilled data back: %s", osync_error_print(&store->error));
+		g_mutex_unlock(store->mutex);
+		return FALSE;
+	}
+
+	if (!_osync_change_store_map(store, entry->offset + entry->length, error))
+		goto error;
+
+	bytes = (char *)store->mapping + entry->offset;
+
+	if (osync_objformat_must_marshal(objformat)) {
+		OSyncMarshal *marshal = osync_marshal_new(error);
+		if (!marshal)
+			goto error;
+
+		if (!osync_marshal_write_data(marshal, bytes, entry->length, error)
+		    || !osync_objformat_demarshal(objformat, marshal, &buffer, &size, error)) {
+			osync_marshal_unref(marshal);
+			goto error;
+		}
+
+		osync_marshal_unref(marshal);
+	} else {
+		/* Keep plain formats terminated, like osync_demarshal_data() */
+		buffer = osync_try_malloc0(entry->length + 1, error);
+		if (!buffer)
+			goto error;
+
+		memcpy(buffer, bytes, entry->length);
+		size = entry->length;
+	}
+
+	osync_data_restore(data, buffer, size);
+
+	entry->size = size;
+	_osync_change_store_queue(store, entry);
+
+	g_mutex_unlock(store->mutex);
+	return TRUE;
+
+ error:
+	/* Remembered for osync_change_store_trim(), most callers can't
+	 * report errors */
+	if (!store->error && error && *error) {
+		store->error = *error;
+		osync_error_ref(&store->error);
+	}
+	g_mutex_unlock(store->mutex);
+	return FALSE;
+}
+
+static void _osync_change_store_replaced(OSyncData *data, void *userdata)
+{
+	OSyncChangeStoreEntry *entry = userdata;
+	OSyncChangeStore *store = entry->store;
+	unsigned int size = 0;
+
+	/* Not spilled, so this doesn't read anything back */
+	osync_data_get_data(data, NULL, &size);
+
+	g_mutex_lock(store->mutex);
+	entry->stored = FALSE;
+
+	if (entry->link)
+		_osync_change_store_unqueue(store, entry);
+
+	entry->size = size;
+	_osync_change_store_queue(store, entry);
+	g_mutex_unlock(store->mutex);
+}
+
+static void _osync_change_store_release(void *userdata)
+{
+	OSyncChangeStoreEntry *entry = userdata;
+	OSyncChangeStore *store = entry->store;
+
+	g_mutex_lock(store->mutex);
+	if (entry->link)
+		_osync_change_store_unqueue(store, entry);
+	g_mutex_unlock(store->mutex);
+
+	osync_free(entry);
+	osync_change_store_unref(store);
+}
+#endif /* _WIN32 */
+
+OSyncChangeStore *osync_change_store_new(const char *directory, unsigned int budget, OSyncError **error)
+{
+#ifndef _WIN32
+	OSyncChangeStore *store = NULL;
+	char *filename = NULL;
+
+	osync_trace(TRACE_ENTRY, "%s(%s, %u, %p)", __func__, __NULLSTR(directory), budget, error);
+	osync_assert(directory);
+
+	store = osync_try_malloc0(sizeof(OSyncChangeStore), error);
+	if (!store)
+		goto error;
+
+	store->ref_count = 1;
+	store->budget = budget;
+
+	filename = g_build_filename(directory, "changestore-XXXXXX", NULL);
+	store->fd = g_mkstemp(filename);
+	if (store->fd == -1) {
+		osync_error_set(error, OSYNC_ERROR_IO_ERROR, "Unable to create the change store in %s: %s", directory, g_strerror(errno));
+		goto error_free_store;
+	}
+
+	/* Only the open file is needed */
+	g_unlink(filename);
+	g_free(filename);
+
+	store->mutex = g_mutex_new();
+	store->queue = g_queue_new();
+
+	osync_trace(TRACE_EXIT, "%s: %p", __func__, store);
+	return store;
+
+ error_free_store:
+	g_free(filename);
+	osync_free(store);
+ error:
+	osync_trace(TRACE_EXIT_ERROR, "%s: %s", __func__, osync_error_print(error));
+	return NULL;
+#else
+	osync_error_set(error, OSYNC_ERROR_NOT_SUPPORTED, "The change store is not supported on this platform");
+	return NULL;
+#endif
+}
+
+OSyncChangeStore *osync_change_store_ref(OSyncChangeStore *store)
+{
+	osync_assert(store);
+
+	g_atomic_int_inc(&(store->ref_count));
+
+	return store;
+}
+
+void osync_change_store_unref(OSyncChangeStore *store)
+{
+	osync_assert(store);
+
+	if (g_atomic_int_dec_and_test(&(store->ref_count))) {
+#ifndef _WIN32
+		if (store->mapping)
+			munmap(store->mapping, store->mapping_size);
+
+		close(store->fd);
+#endif
+
+		if (store->error)
+			osync_error_unref(&store->error);
+
+		g_queue_free(store->queue);
+		g_mutex_free(store->mutex);
+
+		osync_free(store);
+	}
+}
+
+osync_bool osync_change_store_add(OSyncChangeStore *store, OSyncChange *change, OSyncError **error)
+{
+#ifndef _WIN32
+	OSyncChangeStoreEntry *entry = NULL;
+	OSyncData *data = NULL;
+	char *buffer = NULL;
+	unsigned int size = 0;
+	osync_bool ret = FALSE;
+
+	osync_assert(store);
+	osync_assert(change);
+
+	data = osync_change_get_data(change);
+	if (!data || osync_data_get_store_entry(data))
+		return TRUE;
+
+	osync_data_get_data(data, &buffer, &size);
+	if (!buffer)
+		return TRUE;
+
+	entry = osync_try_malloc0(sizeof(OSyncChangeStoreEntry), error);
+	if (!entry)
+		return FALSE;
+
+	entry->store = osync_change_store_ref(store);
+	entry->data = data;
+	entry->size = size;
+	osync_data_set_store(data, &_osync_change_store_funcs, entry);
+
+	g_mutex_lock(store->mutex);
+	_osync_change_store_queue(store, entry);
+	ret = _osync_change_store_trim(store, error);
+	g_mutex_unlock(store->mutex);
+
+	return ret;
+#else
+	return TRUE;
+#endif
+}
+
+osync_bool osync_change_store_trim(OSyncChangeStore *store, OSyncError **error)
+{
+	osync_bool ret = TRUE;
+
+	osync_assert(store);
+
+#ifndef _WIN32
+	g_mutex_lock(store->mutex);
+	ret = _osync_change_store_trim(store, error);
+	g_mutex_unlock(store->mutex);
+#endif
+
+	return ret;
+}
+
+unsigned long long osync_change_store_get_resident(OSyncChangeStore *store)
+{
+	unsigned long long resident = 0;
+
+	osync_assert(store);
+
+	g_mutex_lock(store->mutex);
+	resident = store->resident;
+	g_mutex_unlock(store->mutex);
+
+	return resident;
+}
+
+unsigned long long osync_change_store_get_peak(OSyncChangeStore *store)
+{
+	unsigned long long peak = 0;
+
+	osync_assert(store);
+
+	g_mutex_lock(store->mutex);
+	peak = store->peak;
+	g_mutex_unlock(store->mutex);
+
+	return peak;
+}
+
+unsigned int osync_change_store_get_num_spilled(OSyncChangeStore *store)
+{
+	unsigned int num_spilled = 0;
+
+	osync_assert(store);
+
+	g_mutex_lock(store->mutex);
+	num_spilled = store->num_spilled;
+	g_mutex_unlock(store->mutex);
+
+	return num_spilled;
+}
+
+unsigned long long osync_change_store_get_file_size(OSyncChangeStore *store)
+{
+	unsigned long long file_size = 0;
+
+	osync_assert(store);
+
+	g_mutex_lock(store->mutex);
+	file_size = store->file_size;
+	g_mutex_unlock(store->mutex);
+
+	return file_size;
+}
@@ -0,0 +1,134 @@
+/*
+ * libopensync - A synchronization framework
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ *
+ */
+
+#ifndef _OPENSYNC_CHANGE_STORE_INTERNALS_H
+#define _OPENSYNC_CHANGE_STORE_INTERNALS_H
+
+/**
+ * @defgroup OSyncChangeStoreInternalAPI OpenSync Change Store Internals
+ * @ingroup OSyncEnginePrivate
+ * @brief Keeps the data of received changes within a memory budget
+ *
+ * The data of all changes added to the store count against its budget.
+ * Once over budget, the data which got added or read back first gets
+ * written to a scratch file and dropped from memory. Accessing such
+ * data, e.g. with osync_change_get_data(), maps the scratch file and
+ * reads it back.
+ *
+ * The size of a data object is the size reported by its format. For
+ * formats which have to be marshalled this is only the size of the
+ * toplevel buffer.
+ */
+
+/*@{*/
+
+typedef struct OSyncChangeStore OSyncChangeStore;
+
+/** @brief Creates a new change store
+ *
+ * The scratch file gets created in directory and removed right away, it
+ * is gone once the store and all its data got released.
+ *
+ * @param directory The directory for the scratch file
+ * @param budget Number of bytes of data to keep in memory
+ * @param error The error which will hold the info in case of an error
+ * @returns A pointer to the new OSyncChangeStore or NULL on error
+ *
+ */
+OSYNC_TEST_EXPORT OSyncChangeStore *osync_change_store_new(const char *directory, unsigned int budget, OSyncError **error);
+
+/** @brief Increase the reference count of a change store
+ *
+ * @param store Pointer to the change store
+ * @returns The referenced change store
+ */
+OSYNC_TEST_EXPORT OSyncChangeStore *osync_change_store_ref(OSyncChangeStore *store);
+
+/** @brief Decrease the reference count of a change store
+ *
+ * The data of the store holds references on its own, so the scratch file
+ * stays available until all of it got released.
+ *
+ * @param store Pointer to the change store
+ */
+OSYNC_TEST_EXPORT void osync_change_store_unref(OSyncChangeStore *store);
+
+/** @brief Adds the data of a change to the store
+ *
+ * Changes without data, stubs and data which is already kept by the store
+ * get ignored. Spills data if the store gets over budget.
+ *
+ * Must not be called while the buffer of any data of the store is in use.
+ *
+ * @param store Pointer to the change store
+ * @param change The change to add
+ * @param error The error which will hold the info in case of an error
+ * @returns TRUE on success, FALSE otherwise
+ */
+OSYNC_TEST_EXPORT osync_bool osync_change_store_add(OSyncChangeStore *store, OSyncChange *change, OSyncError **error);
+
+/** @brief Spills data until the store is within its budget again
+ *
+ * Data which got read back doesn't get spilled again before this is
+ * called or another change got added. Same restrictions as for
+ * osync_change_store_add() apply.
+ *
+ * Fails if spilled data couldn't get read back since the store got
+ * created, so such errors fail the synchronization.
+ *
+ * @param store Pointer to the change store
+ * @param error The error which will hold the info in case of an error
+ * @returns TRUE on success, FALSE otherwise
+ */
+OSYNC_TEST_EXPORT osync_bool osync_change_store_trim(OSyncChangeStore *store, OSyncError **error);
+
+/** @brief Get the number of bytes of data the store keeps in memory
+ *
+ * @param store Pointer to the change store
+ * @returns Number of bytes
+ */
+OSYNC_TEST_EXPORT unsigned long long osync_change_store_get_resident(OSyncChangeStore *store);
+
+/** @brief Get the highest number of bytes the store kept in memory so far
+ *
+ * Includes data which got read back or added before the store got
+ * trimmed again.
+ *
+ * @param store Pointer to the change store
+ * @returns Number of bytes
+ */
+OSYNC_TEST_EXPORT unsigned long long osync_change_store_get_peak(OSyncChangeStore *store);
+
+/** @brief Get the number of times data got spilled
+ *
+ * @param store Pointer to the change store
+ * @returns Number of spilled data objects
+ */
+OSYNC_TEST_EXPORT unsigned int osync_change_store_get_num_spilled(OSyncChangeStore *store);
+
+/** @brief Get the number of bytes written to the scratch file
+ *
+ * @param store Pointer to the change store
+ * @returns Size of the scratch file
+ */
+OSYNC_TEST_EXPORT unsigned long long osync_change_store_get_file_size(OSyncChangeStore *store);
+
+/*@}*/
+
+#endif /* _OPENSYNC_CHANGE_STORE_INTERNALS_H */
@@ -0,0 +1,84 @@
+/*
+ * libopensync - A synchronization framework
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ *
+ */
+
+#ifndef _OPENSYNC_CHANGE_STORE_PRIVATE_H
+#define _OPENSYNC_CHANGE_STORE_PRIVATE_H
+
+/**
+ * @defgroup OSyncChangeStorePrivateAPI OpenSync Change Store Private
+ * @ingroup OSyncEnginePrivate
+ */
+
+/*@{*/
+
+/*! @brief A data object kept by the store
+ */
+typedef struct OSyncChangeStoreEntry {
+	/** Referenced by every entry */
+	OSyncChangeStore *store;
+	/** Not referenced, the entry gets released with the data */
+	OSyncData *data;
+	/** Size of the buffer while in memory */
+	unsigned int size;
+	/** Location of the spilled buffer in the scratch file */
+	off_t offset;
+	unsigned int length;
+	/** TRUE while the scratch file holds the current buffer */
+	osync_bool stored;
+	/** Link in the queue of the store, NULL while spilled */
+	GList *link;
+} OSyncChangeStoreEntry;
+
+/*! @brief Represents a change store
+ */
+struct OSyncChangeStore {
+	/** Protects all fields and the entries */
+	GMutex *mutex;
+
+	/** The scratch file, only written at its end. Unchanged data
+	 * keeps its place when spilled again */
+	int fd;
+	off_t file_size;
+
+	/** Read only mapping of the scratch file */
+	void *mapping;
+	size_t mapping_size;
+
+	/** Number of bytes to keep in memory */
+	unsigned int budget;
+	/** Number of bytes kept in memory */
+	unsigned long long resident;
+	/** Highest number of bytes kept in memory so far */
+	unsigned long long peak;
+	/** OSyncChangeStoreEntry elements in memory, the next to spill first */
+	GQueue *queue;
+
+	/** Number of spilled data objects */
+	unsigned int num_spilled;
+
+	/** First error of reading spilled data back */
+	OSyncError *error;
+
+	/** Reference count **/
+	int ref_count;
+};
+
+/*@}*/
+
+#endif /* _OPENSYNC_CHANGE_STORE_PRIVATE_H */
@@ -29,23 +29,29 @@
 #include "opensync-data.h"
 #include "opensync-plugin.h"
 #include "opensync-xmlformat.h"
+#include "opensync-ipc.h"
 
 #include "archive/opensync_archive_internals.h"
 #include "client/opensync_client_proxy_internals.h"
+#include "ipc/opensync_message_internals.h"
+#include "ipc/opensync_queue_internals.h"
 #include "group/opensync_group_internals.h"
 #include "group/opensync_member_internals.h"
 #include "format/opensync_objformat_internals.h"
+#include "format/opensync_converter_internals.h"
 #include "common/opensync_marshal_internals.h"
+#include "data/opensync_change_internals.h"
 #include "plugin/opensync_plugin_internals.h"
 
 #include "opensync_status_internals.h"
 #include "opensync_obj_engine_internals.h"
 #include "opensync_sink_engine_internals.h"
 #include "opensync_mapping_entry_engine_internals.h"
+#include "opensync_change_store_internals.h"
 
 #include "opensync_engine.h"
-#include "opensync_engine_private.h"
 #include "opensync_engine_internals.h"
+#include "opensync_engine_private.h"
 
 
 #ifdef OPENSYNC_UNITTESTS
@@ -87,19 +93,34 @@ static void _finalize_callback(OSyncClientProxy *proxy, void *userdata, OSyncErr
 
 static gboolean _command_prepare(GSource *source, gint *timeout_)
 {
-	*timeout_ = 1;
+	OSyncEngine *engine = *((OSyncEngine **)(source + 1));
+
+	*timeout_ = OSYNC_WAKEUP_IDLE_TIMEOUT;
+	if (g_async_queue_length(engine->command_queue) > 0)
+		return TRUE;
+
 	return FALSE;
 }
 
 static gboolean _command_check(GSource *source)
 {
 	OSyncEngine *engine = *((OSyncEngine **)(source + 1));
+
+	if (engine->command_wakeup_fd && engine->command_wakeup_fd->revents)
+		osync_wakeup_acknowledge(engine->command_wakeup);
+
 	if (g_async_queue_length(engine->command_queue) > 0)
 		return TRUE;
 	
 	return FALSE;
 }
 
+static void _osync_engine_push_command(OSyncEngine *engine, OSyncEngineCommand *command)
+{
+	g_async_queue_push(engine->command_queue, command);
+	osync_wakeup_signal(engine->command_wakeup);
+}
+
 void osync_engine_command(OSyncEngine *engine, OSyncEngineCommand *command);
 
 static OSyncObjFormat *_osync_engine_get_internal_format(OSyncEngine *engine, const char *objtype)
@@ -189,11 +210,35 @@ error:
 	return;
 }
 
-static void _osync_engine_receive_change(OSyncClientProxy *proxy, void *userdata, OSyncChange *change)
+/* Returns the converter path which is used for the conversion of a single
+ * change. With conversion threads the cached path can't be configured for
+ * each change, so it gets copied together with its configuration. */
+static OSyncFormatConverterPath *_osync_engine_use_converter_path(OSyncEngine *engine, OSyncFormatConverterPath *path, OSyncError **error)
+{
+	OSyncFormatConverterPath *copy = NULL;
+	unsigned int i;
+
+	if (!engine->convert_pool)
+		return osync_converter_path_ref(path);
+
+	copy = osync_converter_path_new(error);
+	if (!copy)
+		return NULL;
+
+	for (i = 0; i < osync_converter_path_num_edges(path); i++)
+		osync_converter_path_add_edge(copy, osync_converter_path_nth_edge(path, i));
+
+	if (osync_converter_path_get_config(path))
+		osync_converter_path_set_config(copy, osync_converter_path_get_config(path));
+
+	return copy;
+}
+
+/* Detects the format of a received change and converts it to the common
+ * format. This neither touches the archive nor the object engines, so it
+ * is safe to call from the conversion threads. */
+static osync_bool _osync_engine_convert_change(OSyncEngine *engine, OSyncClientProxy *proxy, OSyncChange *change, OSyncError **error)
 {
-	OSyncEngine *engine = userdata;
-	OSyncError *error = NULL;
-	osync_bool found = FALSE;
 	OSyncMember *member = NULL;
 	osync_memberid memberid = 0;
 	const char *uid = NULL;
@@ -206,7 +251,7 @@ static void _osync_engine_receive_change(OSyncClientProxy *proxy, void *userdata
 	OSyncObjFormat *internalFormat = NULL;
 	OSyncObjFormat *detected_format = NULL;
 	
-	osync_trace(TRACE_ENTRY, "%s(%p, %p, %p)", __func__, proxy, userdata, change);
+	osync_trace(TRACE_ENTRY, "%s(%p, %p, %p)", __func__, engine, proxy, change);
 
 	member = osync_client_proxy_get_member(proxy);
 	memberid = osync_member_get_id(member);
@@ -221,9 +266,15 @@ static void _osync_engine_receive_change(OSyncClientProxy *proxy, void *userdata
 
 	data = osync_change_get_data(change);
 
+	/* Stubs get converted once their data got read */
+	if (osync_change_is_stub(change)) {
+		osync_trace(TRACE_EXIT, "%s: stub", __func__);
+		return TRUE;
+	}
+
 	/* try to detect encapsulated formats */
 	if (osync_change_get_changetype(change) != OSYNC_CHANGE_TYPE_DELETED)
-		if (!osync_format_env_detect_objformat_full(engine->formatenv, data, &detected_format, &error))
+		if (!osync_format_env_detect_objformat_full(engine->formatenv, data, &detected_format, error))
 			goto error;
 
 	if (detected_format && detected_format != osync_change_get_objformat(change)) {
@@ -250,34 +301,78 @@ static void _osync_engine_receive_change(OSyncClientProxy *proxy, void *userdata
 		OSyncFormatConverterPath *path = NULL;
 		OSyncObjFormatSink *formatsink = NULL;
 		OSyncObjFormat *common_format = internalFormat ? internalFormat : detected_format;
+		osync_bool converted = FALSE;
 		osync_trace(TRACE_INTERNAL, "converting to format %s", osync_objformat_get_name(common_format));
 
+		/* The cached paths are shared with the conversion threads */
+		g_mutex_lock(engine->convert_mutex);
+
 		path = _osync_engine_get_converter_path(engine, member_objtype);
 		if(!path) {
-			path = osync_format_env_find_path_with_detectors(engine->formatenv, osync_change_get_data(change), common_format, NULL, &error);
+			path = osync_format_env_find_path_with_detectors(engine->formatenv, osync_change_get_data(change), common_format, NULL, error);
 			_osync_engine_set_converter_path(engine, member_objtype, path);
 		}
 
+		if (path) {
+			/* Get the current configured format to honor the plugin configuration! */
+			formatsink = osync_objtype_sink_find_objformat_sink(objtype_sink, osync_change_get_objformat(change));
+			if (formatsink) {
+				const char *config = osync_objformat_sink_get_config(formatsink); 
+				osync_converter_path_set_config(path, config);
+			}
+
+			path = _osync_engine_use_converter_path(engine, path, error);
+		}
+
+		g_mutex_unlock(engine->convert_mutex);
+
 		if (!path)
 			goto error;
-	
-		/* Get the current configured format to honor the plugin configuration! */
-		formatsink = osync_objtype_sink_find_objformat_sink(objtype_sink, osync_change_get_objformat(change));
-		if (formatsink) {
-			const char *config = osync_objformat_sink_get_config(formatsink); 
-			osync_converter_path_set_config(path, config);
-		}
 
-		if (!osync_format_env_convert(engine->formatenv, path, data, &error)) {
+		/* Data of a threaded client is still referenced by the plugin,
+		 * it gets converted as a copy */
+		if (osync_converter_path_num_edges(path) && !osync_change_own_data(change, error)) {
+			osync_converter_path_unref(path);
 			goto error;
 		}
+		data = osync_change_get_data(change);
+
+		converted = osync_format_env_convert(engine->formatenv, path, data, error);
+		osync_converter_path_unref(path);
+		if (!converted)
+			goto error;
 	}
+
+	osync_free(member_objtype);
+	
+	osync_trace(TRACE_EXIT, "%s", __func__);
+	return TRUE;
+
+ error:
+	osync_free(member_objtype);
+	osync_trace(TRACE_EXIT_ERROR, "%s: %s", __func__, osync_error_print(error));
+	return FALSE;
+}
+
+/* Merges a converted change and passes it to its object engine. This
+ * has to run in the engine thread, in the order the changes got received. */
+static osync_bool _osync_engine_deliver_change(OSyncEngine *engine, OSyncClientProxy *proxy, OSyncChange *change, const OSyncEngineProfileTimer *convert_time, OSyncError **error)
+{
+	osync_bool found = FALSE;
+	OSyncMember *member = NULL;
+	const char *uid = NULL;
+	osync_memberid memberid = 0;
 	
+	osync_trace(TRACE_ENTRY, "%s(%p, %p, %p, %p)", __func__, engine, proxy, change, convert_time);
+
+	uid = osync_change_get_uid(change);
+
 	/* TODO: Move this into the objengine. */
 	/* Merger - Merge lost information to the change (don't merger anything when changetype is DELETED.) */
 	if( osync_group_get_merger_enabled(engine->group) &&
 			osync_group_get_converter_enabled(engine->group) &&	
-			(osync_change_get_changetype(change) != OSYNC_CHANGE_TYPE_DELETED)
+			(osync_change_get_changetype(change) != OSYNC_CHANGE_TYPE_DELETED) &&
+			!osync_change_is_stub(change)
 			/* FIXME &&
 			  only use the merger if the objformat has merger registered.
 			osync_objformat_has_merger(osync_change_get_objformat(change)) */ 
@@ -297,7 +392,7 @@ static void _osync_engine_receive_change(OSyncClientProxy *proxy, void *userdata
 
 				/* TODO: Merger save the archive data with the member so we have to load it only for one time*/
 				// osync_archive_load_data() is fetching the mappingid by uid in the db
-				int ret = osync_archive_load_data(engine->archive, uid, osync_change_get_objtype(change), &entirebuf, &entsize, &error);
+				int ret = osync_archive_load_data(engine->archive, uid, osync_change_get_objtype(change), &entirebuf, &entsize, error);
 				if (ret < 0) {
 					goto error; 
 				} 
@@ -305,16 +400,16 @@ static void _osync_engine_receive_change(OSyncClientProxy *proxy, void *userdata
 				if (ret > 0) {
 					OSyncMarshal *marshal;
 
-					marshal = osync_marshal_new(&error);
+					marshal = osync_marshal_new(error);
 					if (!marshal)
 						goto error;
 
-					if (!osync_marshal_write_data(marshal, entirebuf, entsize, &error)) {
+					if (!osync_marshal_write_data(marshal, entirebuf, entsize, error)) {
 						osync_marshal_unref(marshal);
 						goto error;
 					}
 
-					if (!osync_objformat_demarshal(objformat, marshal, &entirebuf, &entsize, &error)) {
+					if (!osync_objformat_demarshal(objformat, marshal, &entirebuf, &entsize, error)) {
 						osync_marshal_unref(marshal);
 						goto error;
 					}
@@ -343,28 +438,398 @@ static void _osync_engine_receive_change(OSyncClientProxy *proxy, void *userdata
 			OSyncObjEngine *objengine = o->data;
 			if (!strcmp(osync_change_get_objtype(change), osync_obj_engine_get_objtype(objengine))) {
 				found = TRUE;
-				if (!osync_obj_engine_receive_change(objengine, proxy, change, &error))
+				if (!osync_obj_engine_receive_change(objengine, proxy, change, error))
 					goto error;
 				break;
 			}	
 		}}
 	
 	if (!found) {
-		osync_error_set(&error, OSYNC_ERROR_GENERIC, "Unable to find engine which can handle objtype %s", osync_change_get_objtype(change));
+		osync_error_set(error, OSYNC_ERROR_GENERIC, "Unable to find engine which can handle objtype %s", osync_change_get_objtype(change));
 		goto error;
 	}
 
-	osync_free(member_objtype);
-	
+	/* Keep the data of the received changes within the memory budget */
+	if (engine->change_store && !osync_change_store_add(engine->change_store, change, error))
+		goto error;
+
+	memberid = osync_member_get_id(osync_client_proxy_get_member(proxy));
+	osync_engine_profile_add(engine->sync_profile, osync_change_get_objtype(change), memberid, OSYNC_ENGINE_PHASE_GET_CHANGES, NULL, 1);
+
+	/* Stubs get converted once their data got read */
+	if (!osync_change_is_stub(change))
+		osync_engine_profile_add(engine->sync_profile, osync_change_get_objtype(change), memberid, OSYNC_ENGINE_PHASE_CONVERT, convert_time, 1);
+
 	osync_trace(TRACE_EXIT, "%s", __func__);
-	return;
+	return TRUE;
 
  error:
-	osync_free(member_objtype);
-	
+	osync_trace(TRACE_EXIT_ERROR, "%s: %s", __func__, osync_error_print(error));
+	return FALSE;
+}
+
+static void _osync_engine_receive_change_error(OSyncEngine *engine, OSyncClientProxy *proxy, OSyncError *error)
+{
 	osync_engine_set_error(engine, error);
 	osync_status_update_member(engine, osync_client_proxy_get_member(proxy), OSYNC_ENGINE_MEMBER_EVENT_ERROR, NULL, error);
+}
+
+/* Delivers the jobs at the head of the pending queue, up to the first one
+ * which is still getting converted. Runs in the engine thread. */
+static gboolean _osync_engine_deliver_converted(gpointer user_data)
+{
+	OSyncEngine *engine = user_data;
+	OSyncEngineConvertJob *job = NULL;
+	OSyncError *error = NULL;
+
+	osync_trace(TRACE_ENTRY, "%s(%p)", __func__, user_data);
+
+	g_mutex_lock(engine->convert_mutex);
+	engine->convert_scheduled = FALSE;
+
+	while ((job = g_queue_peek_head(engine->convert_pending)) && job->done) {
+		g_queue_pop_head(engine->convert_pending);
+		g_mutex_unlock(engine->convert_mutex);
+
+		if (job->callback) {
+			engine->convert_delivering = TRUE;
+			job->callback(job->proxy, job->userdata, job->error);
+			engine->convert_delivering = FALSE;
+		} else if (job->error) {
+			_osync_engine_receive_change_error(engine, job->proxy, job->error);
+		} else if (!_osync_engine_deliver_change(engine, job->proxy, job->change, &job->convert_time, &error)) {
+			_osync_engine_receive_change_error(engine, job->proxy, error);
+			osync_error_unref(&error);
+		}
+
+		if (job->change)
+			osync_change_unref(job->change);
+		if (job->error)
+			osync_error_unref(&job->error);
+		osync_free(job);
+
+		g_mutex_lock(engine->convert_mutex);
+	}
+
+	g_mutex_unlock(engine->convert_mutex);
+
+	osync_trace(TRACE_EXIT, "%s", __func__);
+	return FALSE;
+}
+
+/* Schedules the delivery of finished jobs. Has to be called with convert_mutex held. */
+static void _osync_engine_schedule_delivery(OSyncEngine *engine)
+{
+	GSource *source = NULL;
+
+	if (engine->convert_scheduled)
+		return;
+
+	engine->convert_scheduled = TRUE;
+
+	source = g_idle_source_new();
+	g_source_set_callback(source, _osync_engine_deliver_converted, engine, NULL);
+	g_source_attach(source, engine->context);
+	g_source_unref(source);
+}
+
+static void _osync_engine_convert_worker(gpointer data, gpointer user_data)
+{
+	OSyncEngineConvertJob *job = data;
+	OSyncEngine *engine = user_data;
+
+	osync_engine_profile_timer_start(&job->convert_time);
+	_osync_engine_convert_change(engine, job->proxy, job->change, &job->error);
+	osync_engine_profile_timer_stop(&job->convert_time);
+
+	g_mutex_lock(engine->convert_mutex);
+	job->done = TRUE;
+	if (job == g_queue_peek_head(engine->convert_pending))
+		_osync_engine_schedule_delivery(engine);
+	g_mutex_unlock(engine->convert_mutex);
+}
+
+osync_bool osync_engine_defer_callback(OSyncEngine *engine, OSyncEngineDeferredFn callback, OSyncClientProxy *proxy, void *userdata, OSyncError *error)
+{
+	OSyncEngineConvertJob *job = NULL;
+	osync_bool deferred = FALSE;
+
+	osync_assert(engine);
+	osync_assert(callback);
+
+	if (!engine->convert_pool || engine->convert_delivering)
+		return FALSE;
+
+	g_mutex_lock(engine->convert_mutex);
+
+	if (g_queue_is_empty(engine->convert_pending))
+		goto out;
+
+	/* Without memory there is no way to keep the order */
+	job = osync_try_malloc0(sizeof(OSyncEngineConvertJob), NULL);
+	if (!job)
+		goto out;
+
+	job->callback = callback;
+	job->proxy = proxy;
+	job->userdata = userdata;
+	job->done = TRUE;
+	if (error) {
+		job->error = error;
+		osync_error_ref(&job->error);
+	}
+
+	g_queue_push_tail(engine->convert_pending, job);
+	deferred = TRUE;
+
+ out:
+	g_mutex_unlock(engine->convert_mutex);
+	return deferred;
+}
+
+/* Waits for the conversion threads and drops all changes which
+ * didn't get passed on. Deferred callbacks get dropped as well,
+ * since the engine is going down. */
+static void _osync_engine_stop_conversion(OSyncEngine *engine)
+{
+	OSyncEngineConvertJob *job = NULL;
+
+	if (!engine->convert_pool)
+		return;
+
+	g_thread_pool_free(engine->convert_pool, FALSE, TRUE);
+	engine->convert_pool = NULL;
+
+	g_mutex_lock(engine->convert_mutex);
+	while ((job = g_queue_pop_head(engine->convert_pending))) {
+		if (job->change)
+			osync_change_unref(job->change);
+		if (job->error)
+			osync_error_unref(&job->error);
+		osync_free(job);
+	}
+	g_mutex_unlock(engine->convert_mutex);
+}
+
+void osync_engine_set_conversion_threads(OSyncEngine *engine, unsigned int threads)
+{
+	osync_return_if_fail(engine);
+	engine->convert_threads = threads;
+}
+
+void osync_engine_set_parallel_objengines(OSyncEngine *engine, osync_bool parallel)
+{
+	osync_return_if_fail(engine);
+	engine->parallel_objengines = parallel;
+}
+
+void osync_engine_set_incremental_mapping(OSyncEngine *engine, osync_bool incremental)
+{
+	osync_return_if_fail(engine);
+	engine->incremental_mapping = incremental;
+}
+
+void osync_engine_set_change_stubs(OSyncEngine *engine, osync_bool stubs)
+{
+	osync_return_if_fail(engine);
+	engine->change_stubs = stubs;
+}
+
+void osync_engine_set_change_store_budget(OSyncEngine *engine, unsigned int budget)
+{
+	osync_return_if_fail(engine);
+	engine->change_store_budget = budget;
+}
+
+OSyncEngineProfile *osync_engine_get_profile(OSyncEngine *engine)
+{
+	OSyncEngineProfile *profile = NULL;
+
+	osync_return_val_if_fail(engine, NULL);
+
+	g_mutex_lock(engine->syncing_mutex);
+	if (engine->profile)
+		profile = osync_engine_profile_ref(engine->profile);
+	g_mutex_unlock(engine->syncing_mutex);
+
+	return profile;
+}
+
+OSyncEngineProfile *osync_engine_get_sync_profile(OSyncEngine *engine)
+{
+	osync_assert(engine);
+	return engine->sync_profile;
+}
+
+osync_bool osync_engine_trim_change_store(OSyncEngine *engine, OSyncError **error)
+{
+	osync_assert(engine);
+
+	/* Object engines running side by side might use any buffer */
+	if (!engine->change_store || engine->stages_running)
+		return TRUE;
+
+	return osync_change_store_trim(engine->change_store, error);
+}
+
+osync_bool osync_engine_store_change(OSyncEngine *engine, OSyncChange *change, OSyncError **error)
+{
+	osync_assert(engine);
+	osync_assert(change);
+
+	/* Adding spills just like trimming does */
+	if (!engine->change_store || engine->stages_running)
+		return TRUE;
+
+	return osync_change_store_add(engine->change_store, change, error);
+}
+
+void osync_engine_set_profile_file(OSyncEngine *engine, const char *filename)
+{
+	osync_return_if_fail(engine);
+
+	if (engine->profile_file)
+		osync_free(engine->profile_file);
+
+	engine->profile_file = osync_strdup(filename);
+}
+
+/* Starts a phase of all object engines, before they get the command */
+static void _osync_engine_start_phase(OSyncEngine *engine, OSyncEnginePhase phase)
+{
+	OSyncList *o = NULL;
+
+	for (o = engine->object_engines; o; o = o->next) {
+		OSyncObjEngine *objengine = o->data;
+		osync_engine_profile_start(engine->sync_profile, osync_obj_engine_get_objtype(objengine), 0, phase);
+	}
+}
+
+/* Makes the profile of the synchronization available, once its members
+ * got disconnected */
+static void _osync_engine_finish_profile(OSyncEngine *engine)
+{
+	OSyncEngineProfile *profile = engine->sync_profile;
+	OSyncEngineProfile *previous = NULL;
+	OSyncError *locerror = NULL;
+
+	if (!profile)
+		return;
+
+	engine->sync_profile = NULL;
+	osync_engine_profile_finish(profile);
+
+	if (engine->profile_file && !osync_engine_profile_save(profile, engine->profile_file, &locerror)) {
+		osync_trace(TRACE_ERROR, "Unable to write the profile: %s", osync_error_print(&locerror));
+		osync_error_unref(&locerror);
+	}
+
+	g_mutex_lock(engine->syncing_mutex);
+	previous = engine->profile;
+	engine->profile = profile;
+	g_mutex_unlock(engine->syncing_mutex);
+
+	if (previous)
+		osync_engine_profile_unref(previous);
+}
+
+static gpointer _osync_engine_stage_thread(gpointer data)
+{
+	OSyncObjEngine *objengine = data;
+
+	osync_obj_engine_run_stage(objengine, objengine->parent->stage_cmd);
+
+	return NULL;
+}
+
+/* Runs the stage of cmd for all object engines concurrently and waits for
+ * them. The results get picked up by osync_obj_engine_command(), which
+ * emits the events in the engine thread as before. */
+static void _osync_engine_run_stages(OSyncEngine *engine, OSyncEngineCmd cmd)
+{
+	OSyncList *o = NULL, *threads = NULL;
+	OSyncError *error = NULL;
+
+	if (!engine->parallel_objengines || osync_list_length(engine->object_engines) < 2)
+		return;
+
+	osync_trace(TRACE_ENTRY, "%s(%p, %s)", __func__, engine, osync_engine_get_cmdstr(cmd));
+
+	engine->stage_cmd = cmd;
+	engine->stages_running = TRUE;
+
+	for (o = engine->object_engines; o; o = o->next) {
+		OSyncObjEngine *objengine = o->data;
+		GThread *thread = g_thread_create(_osync_engine_stage_thread, objengine, TRUE, NULL);
+
+		/* Without a thread the stage runs as part of the command */
+		if (thread)
+			threads = osync_list_prepend(threads, thread);
+	}
+
+	while (threads) {
+		g_thread_join(threads->data);
+		threads = osync_list_delete_link(threads, threads);
+	}
+
+	engine->stages_running = FALSE;
+
+	/* The stages didn't trim while running side by side. Errors which
+	 * stick fail the next trim of the command again */
+	if (engine->change_store && !osync_change_store_trim(engine->change_store, &error)) {
+		osync_trace(TRACE_ERROR, "Unable to trim the change store: %s", osync_error_print(&error));
+		osync_error_unref(&error);
+	}
+
+	osync_trace(TRACE_EXIT, "%s", __func__);
+}
+
+static void _osync_engine_receive_change(OSyncClientProxy *proxy, void *userdata, OSyncChange *change)
+{
+	OSyncEngine *engine = userdata;
+	OSyncError *error = NULL;
+	OSyncEngineConvertJob *job = NULL;
+	OSyncEngineProfileTimer convert_time;
+	osync_bool converted = FALSE;
+	
+	osync_trace(TRACE_ENTRY, "%s(%p, %p, %p)", __func__, proxy, userdata, change);
+
+	if (!engine->convert_pool) {
+		osync_engine_profile_timer_start(&convert_time);
+		converted = _osync_engine_convert_change(engine, proxy, change, &error);
+		osync_engine_profile_timer_stop(&convert_time);
+		if (!converted)
+			goto error;
+
+		if (!_osync_engine_deliver_change(engine, proxy, change, &convert_time, &error))
+			goto error;
+
+		osync_trace(TRACE_EXIT, "%s", __func__);
+		return;
+	}
+
+	/* The change gets passed to its object engine once it and all
+	 * changes received before are converted */
+	job = osync_try_malloc0(sizeof(OSyncEngineConvertJob), &error);
+	if (!job)
+		goto error;
+
+	job->proxy = proxy;
+	job->change = osync_change_ref(change);
+
+	g_mutex_lock(engine->convert_mutex);
+	g_queue_push_tail(engine->convert_pending, job);
+	g_mutex_unlock(engine->convert_mutex);
+
+	g_thread_pool_push(engine->convert_pool, job, NULL);
+	
+	osync_trace(TRACE_EXIT, "%s: queued", __func__);
+	return;
+
+ error:
+	_osync_engine_receive_change_error(engine, proxy, error);
 	osync_trace(TRACE_EXIT_ERROR, "%s: %s", __func__, osync_error_print(&error));
+	osync_error_unref(&error);
 }
 
 /* This function is called from the master thread. The function dispatched incoming data from
@@ -404,7 +869,7 @@ osync_bool osync_engine_mapping_solve(OSyncEngine *engine, OSyncMappingEngine *m
 	cmd->master = change;
 	cmd->solve_type = OSYNC_ENGINE_SOLVE_CHOOSE;
 	
-	g_async_queue_push(engine->command_queue, cmd);
+	_osync_engine_push_command(engine, cmd);
 	
 	osync_trace(TRACE_EXIT, "%s", __func__);
 	return TRUE;
@@ -425,7 +890,7 @@ osync_bool osync_engine_mapping_duplicate(OSyncEngine *engine, OSyncMappingEngin
 	cmd->mapping_engine = mapping_engine;
 	cmd->solve_type = OSYNC_ENGINE_SOLVE_DUPLICATE;
 	
-	g_async_queue_push(engine->command_queue, cmd);
+	_osync_engine_push_command(engine, cmd);
 	
 	osync_trace(TRACE_EXIT, "%s", __func__);
 	return TRUE;
@@ -449,7 +914,7 @@ osync_bool osync_engine_mapping_ignore_conflict(OSyncEngine *engine, OSyncMappin
 	cmd->mapping_engine = mapping_engine;
 	cmd->solve_type = OSYNC_ENGINE_SOLVE_IGNORE;
 	
-	g_async_queue_push(engine->command_queue, cmd);
+	_osync_engine_push_command(engine, cmd);
 	
 	osync_trace(TRACE_EXIT, "%s", __func__);
 	return TRUE;
@@ -477,7 +942,7 @@ osync_bool osync_engine_mapping_use_latest(OSyncEngine *engine, OSyncMappingEngi
 	cmd->mapping_engine = mapping_engine;
 	cmd->solve_type = OSYNC_ENGINE_SOLVE_USE_LATEST;
 	
-	g_async_queue_push(engine->command_queue, cmd);
+	_osync_engine_push_command(engine, cmd);
 	
 	osync_trace(TRACE_EXIT, "%s", __func__);
 	return TRUE;
@@ -507,6 +972,10 @@ OSyncEngine *osync_engine_new(OSyncGroup *group, OSyncError **error)
 	engine->internalFormats = g_hash_table_new_full(g_str_hash, g_str_equal, osync_free, osync_free);
 	engine->internalSchemas = g_hash_table_new_full(g_str_hash, g_str_equal, osync_free, NULL);
 	engine->converterPathes = g_hash_table_new_full(g_str_hash, g_str_equal, osync_free, _osync_engine_converter_path_unref);
+	engine->memberStats = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, osync_free);
+
+	engine->convert_mutex = g_mutex_new();
+	engine->convert_pending = g_queue_new();
 	
 	engine->context = g_main_context_new();
 	engine->thread = osync_thread_new(engine->context, error);
@@ -518,6 +987,10 @@ OSyncEngine *osync_engine_new(OSyncGroup *group, OSyncError **error)
 
 	engine->command_queue = g_async_queue_new();
 
+	engine->command_wakeup = osync_wakeup_new(error);
+	if (!engine->command_wakeup)
+		goto error_free_engine;
+
 	if (!osync_group_get_configdir(group)) {
 		osync_trace(TRACE_INTERNAL, "No config dir found. Making stateless sync");
 	} else {
@@ -545,6 +1018,10 @@ OSyncEngine *osync_engine_new(OSyncGroup *group, OSyncError **error)
 	*engineptr = engine;
 
 	g_source_set_callback(engine->command_source, NULL, engine, NULL);
+
+	if (!osync_wakeup_attach(engine->command_wakeup, engine->command_source, &engine->command_wakeup_fd, error))
+		goto error_free_engine;
+
 	g_source_attach(engine->command_source, engine->context);
 	g_main_context_ref(engine->context);
 
@@ -601,6 +1078,24 @@ void osync_engine_unref(OSyncEngine *engine)
 
 		if (engine->converterPathes)
 			g_hash_table_destroy(engine->converterPathes);
+
+		if (engine->memberStats)
+			g_hash_table_destroy(engine->memberStats);
+
+		if (engine->convert_pending)
+			g_queue_free(engine->convert_pending);
+
+		if (engine->convert_mutex)
+			g_mutex_free(engine->convert_mutex);
+
+		if (engine->sync_profile)
+			osync_engine_profile_unref(engine->sync_profile);
+
+		if (engine->profile)
+			osync_engine_profile_unref(engine->profile);
+
+		if (engine->profile_file)
+			osync_free(engine->profile_file);
 		
 		if (engine->group)
 			osync_group_unref(engine->group);
@@ -614,6 +1109,9 @@ void osync_engine_unref(OSyncEngine *engine)
 		if (engine->format_dir)
 			osync_free(engine->format_dir);
 		
+		if (engine->command_wakeup_fd)
+			osync_wakeup_detach(engine->command_source, engine->command_wakeup_fd);
+
 		if (engine->thread)
 			osync_thread_unref(engine->thread);
 			
@@ -637,6 +1135,9 @@ void osync_engine_unref(OSyncEngine *engine)
 	
 		if (engine->command_source)
 			g_source_unref(engine->command_source);
+
+		if (engine->command_wakeup)
+			osync_wakeup_free(engine->command_wakeup);
 	
 		if (engine->command_functions)
 			osync_free(engine->command_functions);
@@ -728,6 +1229,7 @@ static void _osync_engine_stop(OSyncEngine *engine)
 
 static osync_bool _osync_engine_finalize_member(OSyncEngine *engine, OSyncClientProxy *proxy, OSyncError **error)
 {
+	OSyncQueueStats *stats = NULL;
 	unsigned int i = 1000;
 	osync_trace(TRACE_ENTRY, "%s(%p, %p, %p)", __func__, engine, proxy, error);
 		
@@ -748,6 +1250,12 @@ static osync_bool _osync_engine_finalize_member(OSyncEngine *engine, OSyncClient
 	
 	if (!osync_client_proxy_shutdown(proxy, error))
 		goto error;
+
+	stats = osync_try_malloc0(sizeof(OSyncQueueStats), NULL);
+	if (stats) {
+		osync_client_proxy_get_stats(proxy, stats);
+		g_hash_table_insert(engine->memberStats, osync_client_proxy_get_member(proxy), stats);
+	}
 	
 	engine->proxies = osync_list_remove(engine->proxies, proxy);
 	
@@ -806,6 +1314,8 @@ static OSyncClientProxy *_osync_engine_initialize_member(OSyncEngine *engine, OS
 	osync_client_proxy_set_context(proxy, engine->context);
 	osync_client_proxy_set_change_callback(proxy, _osync_engine_receive_change, engine);
 	osync_client_proxy_set_uid_update_callback(proxy, _osync_engine_receive_uid_update, engine);
+	osync_client_proxy_set_credit_window(proxy, osync_group_get_ipc_window(engine->group));
+	osync_client_proxy_set_change_stubs(proxy, engine->change_stubs);
 
 	if (osync_plugin_get_start_type(plugin) == OSYNC_START_TYPE_EXTERNAL) {
 
@@ -1085,7 +1595,9 @@ osync_bool osync_engine_handle_mixed_objtypes(OSyncEngine *engine, OSyncError **
 				}
 
 				sinkengine->entries = osync_list_remove(sinkengine->entries, mapping_entry_engine);
+				osync_sink_engine_unindex_entry(sinkengine, mapping_entry_engine);
 				new_sinkengine->entries = osync_list_append(new_sinkengine->entries, mapping_entry_engine);
+				osync_sink_engine_index_entry(new_sinkengine, mapping_entry_engine);
 				
 			}
 		}
@@ -1395,6 +1907,12 @@ static void _osync_engine_get_changes_callback(OSyncClientProxy *proxy, void *us
 	OSyncEngine *engine = userdata;
 	int position = 0;
 	osync_trace(TRACE_ENTRY, "%s(%p, %p, %p)", __func__, proxy, userdata, error);
+
+	/* Changes of this member might still get converted */
+	if (osync_engine_defer_callback(engine, _osync_engine_get_changes_callback, proxy, userdata, error)) {
+		osync_trace(TRACE_EXIT, "%s: deferred", __func__);
+		return;
+	}
 	
 	position = _osync_engine_get_proxy_position(engine, proxy);
 	
@@ -1554,12 +2072,49 @@ static void _osync_engine_generate_event(OSyncEngine *engine, OSyncEngineEvent e
 	}
 }
 
+/* Stops the phase of an object engine which ends with event */
+static void _osync_engine_stop_phase(OSyncEngine *engine, OSyncObjEngine *objengine, OSyncEngineEvent event)
+{
+	OSyncEnginePhase phase;
+
+	switch (event) {
+	case OSYNC_ENGINE_EVENT_CONNECTED:
+		phase = OSYNC_ENGINE_PHASE_CONNECT;
+		break;
+	case OSYNC_ENGINE_EVENT_READ:
+		phase = OSYNC_ENGINE_PHASE_GET_CHANGES;
+		break;
+	case OSYNC_ENGINE_EVENT_PREPARED_MAP:
+	case OSYNC_ENGINE_EVENT_MAPPED:
+		phase = OSYNC_ENGINE_PHASE_MAP;
+		break;
+	case OSYNC_ENGINE_EVENT_MULTIPLIED:
+		phase = OSYNC_ENGINE_PHASE_MULTIPLY;
+		break;
+	case OSYNC_ENGINE_EVENT_PREPARED_WRITE:
+		phase = OSYNC_ENGINE_PHASE_CONVERT;
+		break;
+	case OSYNC_ENGINE_EVENT_WRITTEN:
+		phase = OSYNC_ENGINE_PHASE_WRITE;
+		break;
+	case OSYNC_ENGINE_EVENT_SYNC_DONE:
+		phase = OSYNC_ENGINE_PHASE_SYNC_DONE;
+		break;
+	default:
+		return;
+	}
+
+	osync_engine_profile_stop(engine->sync_profile, osync_obj_engine_get_objtype(objengine), 0, phase);
+}
+
 static void _osync_engine_event_callback(OSyncObjEngine *objengine, OSyncEngineEvent event, OSyncError *error, void *userdata)
 {
 	OSyncEngine *engine = userdata;
 	int position = 0;
 	osync_trace(TRACE_ENTRY, "%s(%p, %s, %p, %p)", __func__, objengine, osync_engine_get_eventstr(event), error, userdata);
 
+	_osync_engine_stop_phase(engine, objengine, event);
+
 	position = _osync_engine_get_objengine_position(engine, objengine);
 	
 	if (error)
@@ -1713,6 +2268,24 @@ osync_bool osync_engine_initialize(OSyncEngine *engine, OSyncError **error)
 
 	if (!osync_engine_initialize_formats(engine, error))
 		goto error;
+
+	g_hash_table_remove_all(engine->memberStats);
+
+	if (engine->convert_threads) {
+		GError *gerror = NULL;
+		engine->convert_pool = g_thread_pool_new(_osync_engine_convert_worker, engine, engine->convert_threads, TRUE, &gerror);
+		if (!engine->convert_pool) {
+			osync_error_set(error, OSYNC_ERROR_GENERIC, "Unable to start the conversion threads: %s", gerror->message);
+			g_error_free(gerror);
+			goto error_finalize;
+		}
+	}
+
+	if (engine->change_store_budget) {
+		engine->change_store = osync_change_store_new(osync_group_get_configdir(group), engine->change_store_budget, error);
+		if (!engine->change_store)
+			goto error_finalize;
+	}
 	
 	osync_trace(TRACE_INTERNAL, "Running the main loop");
 	/* Plugins are loaded in this call, unless loaded previously.
@@ -1753,6 +2326,7 @@ osync_bool osync_engine_initialize(OSyncEngine *engine, OSyncError **error)
 			goto error_finalize;
 
 		osync_obj_engine_set_callback(objengine, _osync_engine_event_callback, engine);
+		osync_obj_engine_set_incremental_mapping(objengine, engine->incremental_mapping);
 		engine->object_engines = osync_list_append(engine->object_engines, objengine);
 
 		/* If previous sync was unclean, then trigger SlowSync for all ObjEngines.
@@ -1796,11 +2370,19 @@ osync_bool osync_engine_finalize(OSyncEngine *engine, OSyncError **error)
 	
 	engine->state = OSYNC_ENGINE_STATE_UNINITIALIZED;
 
+	_osync_engine_stop_conversion(engine);
+
 	while (engine->object_engines) {
 		OSyncObjEngine *objengine = engine->object_engines->data;
 		osync_obj_engine_unref(objengine);
 		engine->object_engines = osync_list_remove(engine->object_engines, engine->object_engines->data);
 	}
+
+	/* Data still referenced elsewhere keeps the scratch file */
+	if (engine->change_store) {
+		osync_change_store_unref(engine->change_store);
+		engine->change_store = NULL;
+	}
 	
 	while (engine->proxies) {
 		proxy = engine->proxies->data;
@@ -1852,6 +2434,14 @@ void osync_engine_command(OSyncEngine *engine, OSyncEngineCommand *command)
 	switch (command->cmd) {
 	case OSYNC_ENGINE_COMMAND_CONNECT:
 
+		/* Record the profile of this synchronization */
+		if (engine->sync_profile)
+			osync_engine_profile_unref(engine->sync_profile);
+
+		engine->sync_profile = osync_engine_profile_new(&locerror);
+		if (!engine->sync_profile)
+			goto error;
+
 		/* First we connect the main sinks */
 		for (o = engine->proxies; o; o = o->next) {
 			OSyncClientProxy *proxy = o->data;
@@ -1866,6 +2456,8 @@ void osync_engine_command(OSyncEngine *engine, OSyncEngineCommand *command)
 			if (!osync_obj_engine_initialize(objengine, &locerror))
 				goto error;
 
+			osync_engine_profile_start(engine->sync_profile, osync_obj_engine_get_objtype(objengine), 0, OSYNC_ENGINE_PHASE_CONNECT);
+
 			if (!osync_obj_engine_command(objengine, OSYNC_ENGINE_COMMAND_CONNECT, &locerror))
 				goto error;
 		}
@@ -1885,7 +2477,13 @@ void osync_engine_command(OSyncEngine *engine, OSyncEngineCommand *command)
 		}
 		break;
 	case OSYNC_ENGINE_COMMAND_MULTIPLY:
+		/* Conflicts read spilled data back. Nothing uses it right now */
+		if (!osync_engine_trim_change_store(engine, &locerror))
+			goto error;
+
 		/* Now that we have mapped everything, we multiply the changes */
+		_osync_engine_start_phase(engine, OSYNC_ENGINE_PHASE_MULTIPLY);
+		_osync_engine_run_stages(engine, OSYNC_ENGINE_COMMAND_MULTIPLY);
 		for (o = engine->object_engines; o; o = o->next) {
 			OSyncObjEngine *objengine = o->data;
 			if (!osync_obj_engine_command(objengine, OSYNC_ENGINE_COMMAND_MULTIPLY, &locerror))
@@ -1894,6 +2492,8 @@ void osync_engine_command(OSyncEngine *engine, OSyncEngineCommand *command)
 		break;
 	case OSYNC_ENGINE_COMMAND_PREPARE_WRITE:
 		/* Now that we have multiplied the change, we prepare the write event. */
+		_osync_engine_start_phase(engine, OSYNC_ENGINE_PHASE_CONVERT);
+		_osync_engine_run_stages(engine, OSYNC_ENGINE_COMMAND_PREPARE_WRITE);
 		for (o = engine->object_engines; o; o = o->next) {
 			OSyncObjEngine *objengine = o->data;
 			if (!osync_obj_engine_command(objengine, OSYNC_ENGINE_COMMAND_PREPARE_WRITE, &locerror))
@@ -2000,6 +2600,7 @@ void osync_engine_event(OSyncEngine *engine, OSyncEngineEvent event)
 		break;
 	case OSYNC_ENGINE_EVENT_CONNECT_DONE:
 		/* Now that we are connected and send the connect_done singal, we read the changes */
+		_osync_engine_start_phase(engine, OSYNC_ENGINE_PHASE_GET_CHANGES);
 		for (o = engine->object_engines; o; o = o->next) {
 			OSyncObjEngine *objengine = o->data;
 			if (!osync_obj_engine_command(objengine, OSYNC_ENGINE_COMMAND_READ, &locerror))
@@ -2016,6 +2617,7 @@ void osync_engine_event(OSyncEngine *engine, OSyncEngineEvent event)
 		break;
 	case OSYNC_ENGINE_EVENT_READ:
 		/* Now that we have read everything, we prepare for mapping the changes */
+		_osync_engine_start_phase(engine, OSYNC_ENGINE_PHASE_MAP);
 		for (o = engine->object_engines; o; o = o->next) {
 			OSyncObjEngine *objengine = o->data;
 			if (!osync_obj_engine_command(objengine, OSYNC_ENGINE_COMMAND_PREPARE_MAP, &locerror))
@@ -2025,6 +2627,8 @@ void osync_engine_event(OSyncEngine *engine, OSyncEngineEvent event)
 		break;
 	case OSYNC_ENGINE_EVENT_PREPARED_MAP:
 		/* Now that we have read everything, we map the changes */
+		_osync_engine_start_phase(engine, OSYNC_ENGINE_PHASE_MAP);
+		_osync_engine_run_stages(engine, OSYNC_ENGINE_COMMAND_MAP);
 		for (o = engine->object_engines; o; o = o->next) {
 			OSyncObjEngine *objengine = o->data;
 			if (!osync_obj_engine_command(objengine, OSYNC_ENGINE_COMMAND_MAP, &locerror))
@@ -2047,6 +2651,8 @@ void osync_engine_event(OSyncEngine *engine, OSyncEngineEvent event)
 		break;
 	case OSYNC_ENGINE_EVENT_MULTIPLIED:
 		/* Now that we have multiplied the changes, we write the changes */
+		_osync_engine_start_phase(engine, OSYNC_ENGINE_PHASE_CONVERT);
+		_osync_engine_run_stages(engine, OSYNC_ENGINE_COMMAND_PREPARE_WRITE);
 		for (o = engine->object_engines; o; o = o->next) {
 			OSyncObjEngine *objengine = o->data;
 			if (!osync_obj_engine_command(objengine, OSYNC_ENGINE_COMMAND_PREPARE_WRITE, &locerror))
@@ -2056,6 +2662,7 @@ void osync_engine_event(OSyncEngine *engine, OSyncEngineEvent event)
 		break;
 	case OSYNC_ENGINE_EVENT_PREPARED_WRITE:
 		/* Now that we have prepared the write event, we finally write the changes */
+		_osync_engine_start_phase(engine, OSYNC_ENGINE_PHASE_WRITE);
 		for (o = engine->object_engines; o; o = o->next) {
 			OSyncObjEngine *objengine = o->data;
 			if (!osync_obj_engine_command(objengine, OSYNC_ENGINE_COMMAND_WRITE, &locerror))
@@ -2072,6 +2679,7 @@ void osync_engine_event(OSyncEngine *engine, OSyncEngineEvent event)
 		break;
 	case OSYNC_ENGINE_EVENT_WRITTEN:
 		/* Lets call sync done */
+		_osync_engine_start_phase(engine, OSYNC_ENGINE_PHASE_SYNC_DONE);
 		for (o = engine->object_engines; o; o = o->next) {
 			OSyncObjEngine *objengine = o->data;
 			if (!osync_obj_engine_command(objengine, OSYNC_ENGINE_COMMAND_SYNC_DONE, &locerror))
@@ -2153,6 +2761,8 @@ void osync_engine_event(OSyncEngine *engine, OSyncEngineEvent event)
 		engine->obj_prepared_write = 0;
 		engine->obj_written = 0;
 		engine->obj_sync_done = 0;
+
+		_osync_engine_finish_profile(engine);
 			
 		g_mutex_lock(engine->syncing_mutex);
 		g_cond_signal(engine->syncing);
@@ -2197,7 +2807,7 @@ osync_bool osync_engine_synchronize(OSyncEngine *engine, OSyncError **error)
 		goto error;
 	cmd->cmd = OSYNC_ENGINE_COMMAND_CONNECT;
 	
-	g_async_queue_push(engine->command_queue, cmd);
+	_osync_engine_push_command(engine, cmd);
 	
 	osync_trace(TRACE_EXIT, "%s", __func__);
 	return TRUE;
@@ -2289,7 +2899,7 @@ osync_bool osync_engine_discover(OSyncEngine *engine, OSyncMember *member, OSync
 	cmd->cmd = OSYNC_ENGINE_COMMAND_DISCOVER;
 	cmd->member = member;
 	
-	g_async_queue_push(engine->command_queue, cmd);
+	_osync_engine_push_command(engine, cmd);
 	
 	osync_trace(TRACE_EXIT, "%s", __func__);
 	return TRUE;
@@ -2362,6 +2972,29 @@ OSyncClientProxy *osync_engine_find_proxy(OSyncEngine *engine, OSyncMember *memb
 	return NULL;
 }
 
+osync_bool osync_engine_get_member_stats(OSyncEngine *engine, OSyncMember *member, OSyncQueueStats *stats)
+{
+	OSyncClientProxy *proxy = NULL;
+	OSyncQueueStats *finalized = NULL;
+
+	osync_return_val_if_fail(engine, FALSE);
+	osync_return_val_if_fail(stats, FALSE);
+
+	proxy = osync_engine_find_proxy(engine, member);
+	if (proxy)
+		return osync_client_proxy_get_stats(proxy, stats);
+
+	/* The client got finalized already */
+	finalized = g_hash_table_lookup(engine->memberStats, member);
+	if (!finalized) {
+		memset(stats, 0, sizeof(OSyncQueueStats));
+		return FALSE;
+	}
+
+	*stats = *finalized;
+	return TRUE;
+}
+
 unsigned int osync_engine_num_objengines(OSyncEngine *engine)
 {
 	osync_return_val_if_fail(engine, 0);
@@ -2534,6 +3167,8 @@ osync_bool osync_engine_abort(OSyncEngine *engine, OSyncError **error)
 
 	/* Done. Unlock the command queue again. */
 	g_async_queue_unlock(engine->command_queue);
+
+	osync_wakeup_signal(engine->command_wakeup);
 	
 	osync_trace(TRACE_EXIT, "%s", __func__);
 	return TRUE;
@@ -2586,7 +3221,7 @@ osync_bool osync_engine_queue_command(OSyncEngine *engine, OSyncEngineCmd cmdid,
 	
 	cmd->cmd = cmdid;
 	
-	g_async_queue_push(engine->command_queue, cmd);
+	_osync_engine_push_command(engine, cmd);
 
 	osync_trace(TRACE_EXIT, "%s", __func__);
 	return TRUE;
@@ -380,6 +380,100 @@ OSYNC_EXPORT void osync_engine_set_enginestatus_callback(OSyncEngine *engine, os
  */
 OSYNC_EXPORT void osync_engine_set_memberstatus_callback(OSyncEngine *engine, osync_status_member_cb callback, void *user_data);
 
+/** @brief Sets the number of threads which convert the received changes
+ *
+ * By default the format detection and the conversion of received changes
+ * to the common format run in the engine thread. With conversion threads
+ * the changes get converted concurrently, but are still passed on in the
+ * order they got received. All format plugins have to be thread-safe to
+ * use this. The number gets used by the next osync_engine_initialize().
+ *
+ * @param engine A pointer to the engine
+ * @param threads The number of conversion threads, 0 to convert in the engine thread
+ *
+ */
+OSYNC_EXPORT void osync_engine_set_conversion_threads(OSyncEngine *engine, unsigned int threads);
+
+/** @brief Lets the object engines map, multiply and prepare the write concurrently
+ *
+ * By default the object engines run these phases one after another in the
+ * engine thread. If enabled, each object engine runs them in a thread of
+ * its own. The engine waits for all of them at the end of each phase, so
+ * the events are the same. All format plugins have to be thread-safe to
+ * use this.
+ *
+ * @param engine A pointer to the engine
+ * @param parallel TRUE to run the object engines concurrently
+ *
+ */
+OSYNC_EXPORT void osync_engine_set_parallel_objengines(OSyncEngine *engine, osync_bool parallel);
+
+/** @brief Maps the changes as they get received
+ *
+ * By default the changes get mapped once all members reported their
+ * changes. If enabled, each change gets mapped against the changes of the
+ * other members as soon as it arrives, so the mapping overlaps with the
+ * reading of the slower members. Conflicts still get detected once all
+ * changes got read.
+ *
+ * @param engine A pointer to the engine
+ * @param incremental TRUE to map the changes as they get received
+ *
+ */
+OSYNC_EXPORT void osync_engine_set_incremental_mapping(OSyncEngine *engine, osync_bool incremental);
+
+/** @brief Lets the plugins report stubs instead of complete changes
+ *
+ * If enabled, plugins which are able to read single changes may report
+ * their changes with uid, hash and changetype only. The engine reads the
+ * data of those changes before mapping, and only of the changes which got
+ * added or modified or need to get compared. Unmodified and deleted
+ * entries never get their data transferred.
+ *
+ * @param engine A pointer to the engine
+ * @param stubs TRUE to allow change stubs
+ *
+ */
+OSYNC_EXPORT void osync_engine_set_change_stubs(OSyncEngine *engine, osync_bool stubs);
+
+/** @brief Limits the memory used by the data of the received changes
+ *
+ * By default the data of all received changes stays in memory until it
+ * got written. With a budget, the engine writes the data which exceeds
+ * it to a scratch file in the group directory while the changes get read
+ * and mapped. The data gets read back once it is accessed, e.g. with
+ * osync_change_get_data(). Has to be set before osync_engine_initialize().
+ *
+ * @param engine A pointer to the engine
+ * @param budget Number of bytes of change data to keep in memory, 0 for no limit
+ *
+ */
+OSYNC_EXPORT void osync_engine_set_change_store_budget(OSyncEngine *engine, unsigned int budget);
+
+/** @brief Get the profile of the last synchronization
+ *
+ * The engine records the time and item counts of the phases of every
+ * synchronization, see OSyncEngineProfileAPI. The profile of a
+ * synchronization is available once its members got disconnected.
+ *
+ * @param engine A pointer to the engine
+ * @returns The profile, which the caller has to unref, or NULL before the first synchronization
+ *
+ */
+OSYNC_EXPORT OSyncEngineProfile *osync_engine_get_profile(OSyncEngine *engine);
+
+/** @brief Write the profile of every synchronization to a file
+ *
+ * After every synchronization the JSON representation of its profile,
+ * see osync_engine_profile_to_json(), replaces the file. Failing to write
+ * it doesn't fail the synchronization.
+ *
+ * @param engine A pointer to the engine
+ * @param filename The file to write or NULL to not write one
+ *
+ */
+OSYNC_EXPORT void osync_engine_set_profile_file(OSyncEngine *engine, const char *filename);
+
 /** @brief Find the Object Engine for a certain Object Type. 
  *
  * @param engine A pointer to the engine
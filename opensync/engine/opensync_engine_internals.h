@@ -21,6 +21,8 @@
 #ifndef OPENSYNC_ENGINE_INTERNALS_H_
 #define OPENSYNC_ENGINE_INTERNALS_H_
 
+#include "opensync_engine_profile_internals.h"
+
 /**
  * @defgroup OSyncEngineInternalAPI OpenSync Engine Internals
  * @ingroup OSyncEnginePrivate
@@ -33,6 +35,75 @@ void osync_engine_event(OSyncEngine *engine, OSyncEngineEvent event);
 
 OSyncClientProxy *osync_engine_find_proxy(OSyncEngine *engine, OSyncMember *member);
 
+typedef void (* OSyncEngineDeferredFn) (OSyncClientProxy *proxy, void *userdata, OSyncError *error);
+
+/** @brief Defer a reply callback until the received changes are passed on
+ *
+ * With conversion threads, changes which got received before the reply
+ * might still get converted. The callback gets called once they got
+ * passed to their object engines.
+ *
+ * @param engine Pointer to engine
+ * @param callback The callback to defer
+ * @param proxy The proxy argument of the callback
+ * @param userdata The userdata argument of the callback
+ * @param error The error argument of the callback, gets referenced
+ * @returns TRUE if the callback got deferred, FALSE if it has to be called now
+ *
+ */
+osync_bool osync_engine_defer_callback(OSyncEngine *engine, OSyncEngineDeferredFn callback, OSyncClientProxy *proxy, void *userdata, OSyncError *error);
+
+/** @brief Get the profile which records the running synchronization
+ *
+ * Only valid in the engine thread, or while it waits for the stages of
+ * the object engines.
+ *
+ * @param engine Pointer to engine
+ * @returns The profile or NULL if no synchronization is running
+ *
+ */
+OSyncEngineProfile *osync_engine_get_sync_profile(OSyncEngine *engine);
+
+/** @brief Keep the data of the received changes within the memory budget
+ *
+ * Only to be called while no buffer of the data of a received change is
+ * in use. Does nothing without a change store, or while the stages of the
+ * object engines run in threads of their own.
+ *
+ * @param engine Pointer to engine
+ * @param error Pointer to a error-struct
+ * @returns TRUE on success, FALSE if data couldn't get spilled or read back
+ *
+ */
+osync_bool osync_engine_trim_change_store(OSyncEngine *engine, OSyncError **error);
+
+/** @brief Count the data of a change the engine created against the memory budget
+ *
+ * For changes which didn't get received, like demerged clones. Same
+ * restrictions as for osync_engine_trim_change_store() apply.
+ *
+ * @param engine Pointer to engine
+ * @param change The change to keep in the change store
+ * @param error Pointer to a error-struct
+ * @returns TRUE on success, FALSE if data couldn't get spilled or read back
+ *
+ */
+osync_bool osync_engine_store_change(OSyncEngine *engine, OSyncChange *change, OSyncError **error);
+
+/** @brief Get the IPC counters of the connection to a member
+ *
+ * The counters of the queues to the client of the member get aggregated.
+ * They are kept after the client got shut down, until the engine got
+ * initialized again.
+ *
+ * @param engine Pointer to engine
+ * @param member The member
+ * @param stats The stats to fill
+ * @returns FALSE if there was never a client for the member
+ *
+ */
+OSYNC_TEST_EXPORT osync_bool osync_engine_get_member_stats(OSyncEngine *engine, OSyncMember *member, OSyncQueueStats *stats);
+
 OSyncArchive *osync_engine_get_archive(OSyncEngine *engine);
 OSYNC_TEST_EXPORT OSyncGroup *osync_engine_get_group(OSyncEngine *engine);
 
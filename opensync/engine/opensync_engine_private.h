@@ -45,6 +45,20 @@ typedef struct OSyncEngineCommand {
 	OSyncMember *member;
 } OSyncEngineCommand;
 
+/** A received change, or a deferred callback, in the order of receipt */
+typedef struct OSyncEngineConvertJob {
+	OSyncClientProxy *proxy;
+	OSyncChange *change;
+	/** Set by the conversion thread on failure, or the error argument of callback */
+	OSyncError *error;
+	/** TRUE once the change got converted */
+	osync_bool done;
+	OSyncEngineDeferredFn callback;
+	void *userdata;
+	/** Time the conversion thread spent converting the change */
+	OSyncEngineProfileTimer convert_time;
+} OSyncEngineConvertJob;
+
 struct OSyncEngine {
 	int ref_count;
 	/** The opensync group **/
@@ -87,6 +101,9 @@ struct OSyncEngine {
 	GAsyncQueue *command_queue;
 	GSourceFuncs *command_functions;
 	GSource *command_source;
+	/** Signaled whenever a command is pushed on the command queue **/
+	OSyncWakeup *command_wakeup;
+	GPollFD *command_wakeup_fd;
 	
 	GCond* syncing;
 	GMutex* syncing_mutex;
@@ -135,6 +152,40 @@ struct OSyncEngine {
 	GHashTable *internalSchemas;
 	/** converter_paths contains a hash of all OSyncFormatConverterPath objects **/
 	GHashTable *converterPathes;
+	/** IPC counters of the members whose client got finalized **/
+	GHashTable *memberStats;
+
+	/** Number of threads in convert_pool, 0 to convert in the engine thread **/
+	unsigned int convert_threads;
+	GThreadPool *convert_pool;
+	/** Protects converterPathes, convert_pending and convert_scheduled **/
+	GMutex *convert_mutex;
+	/** OSyncEngineConvertJob elements, in the order of receipt **/
+	GQueue *convert_pending;
+	osync_bool convert_scheduled;
+	/** TRUE while a deferred callback gets called **/
+	osync_bool convert_delivering;
+
+	/** Run the stages of the object engines in threads of their own **/
+	osync_bool parallel_objengines;
+	/** Map the changes as they get received **/
+	osync_bool incremental_mapping;
+	/** Let the plugins report changes without data **/
+	osync_bool change_stubs;
+	/** Bytes of change data to keep in memory, 0 for no limit **/
+	unsigned int change_store_budget;
+	/** Keeps the change data within change_store_budget **/
+	struct OSyncChangeStore *change_store;
+	/** The profile of the running synchronization **/
+	OSyncEngineProfile *sync_profile;
+	/** The profile of the last synchronization, protected by syncing_mutex **/
+	OSyncEngineProfile *profile;
+	/** Gets the profile written after every synchronization if set **/
+	char *profile_file;
+	/** The command whose stage the object engine threads run **/
+	OSyncEngineCmd stage_cmd;
+	/** TRUE while the object engine threads run, see _osync_engine_run_stages() **/
+	osync_bool stages_running;
 
 	/** The last completed engine event. */
 	OSyncEngineEvent lastevent;
@@ -0,0 +1,605 @@
+/*
+ * libopensync - A synchronization framework
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ *
+ */
+
+#include "opensync.h"
+#include "opensync_internals.h"
+
+#include <time.h>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#include "opensync-engine.h"
+
+#include "opensync_engine_profile_internals.h"
+#include "opensync_engine_profile_private.h"
+
+static double _osync_engine_profile_wall(void)
+{
+	GTimeVal now;
+
+	g_get_current_time(&now);
+	return now.tv_sec + (double)now.tv_usec / G_USEC_PER_SEC;
+}
+
+/* CPU time of the whole process */
+static double _osync_engine_profile_cpu(void)
+{
+#ifndef _WIN32
+	struct rusage usage;
+
+	if (getrusage(RUSAGE_SELF, &usage))
+		return 0;
+
+	return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+		+ (double)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / G_USEC_PER_SEC;
+#else
+	return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+/* CPU time of the calling thread, if the platform can tell */
+static double _osync_engine_profile_thread_cpu(void)
+{
+#ifdef CLOCK_THREAD_CPUTIME_ID
+	struct timespec now;
+
+	if (!clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now))
+		return now.tv_sec + now.tv_nsec / 1000000000.0;
+#endif
+	return _osync_engine_profile_cpu();
+}
+
+static OSyncEngineProfileRecord *_osync_engine_profile_record_new(const char *objtype, osync_memberid memberid)
+{
+	/* Recording goes on without the record */
+	OSyncEngineProfileRecord *record = osync_try_malloc0(sizeof(OSyncEngineProfileRecord), NULL);
+	if (!record)
+		return NULL;
+
+	record->objtype = osync_strdup(objtype);
+	record->memberid = memberid;
+
+	return record;
+}
+
+static void _osync_engine_profile_record_free(OSyncEngineProfileRecord *record)
+{
+	OSyncList *m = NULL;
+
+	for (m = record->members; m; m = m->next)
+		_osync_engine_profile_record_free(m->data);
+	osync_list_free(record->members);
+
+	osync_free(record->objtype);
+	osync_free(record);
+}
+
+static OSyncEngineProfileRecord *_osync_engine_profile_find_objtype(OSyncEngineProfile *profile, const char *objtype, osync_bool create)
+{
+	OSyncEngineProfileRecord *record = NULL;
+	OSyncList *o = NULL;
+
+	for (o = profile->objtypes; o; o = o->next) {
+		record = o->data;
+		if (!strcmp(record->objtype, objtype))
+			return record;
+	}
+
+	if (!create)
+		return NULL;
+
+	record = _osync_engine_profile_record_new(objtype, 0);
+	if (record)
+		profile->objtypes = osync_list_append(profile->objtypes, record);
+	return record;
+}
+
+static OSyncEngineProfileRecord *_osync_engine_profile_find_member(OSyncEngineProfileRecord *parent, osync_memberid memberid, osync_bool create)
+{
+	OSyncEngineProfileRecord *record = NULL;
+	OSyncList *m = NULL;
+
+	for (m = parent->members; m; m = m->next) {
+		record = m->data;
+		if (record->memberid == memberid)
+			return record;
+	}
+
+	if (!create)
+		return NULL;
+
+	record = _osync_engine_profile_record_new(parent->objtype, memberid);
+	if (record)
+		parent->members = osync_list_append(parent->members, record);
+	return record;
+}
+
+/* Looks up the record of objtype and memberid, objtype NULL is the whole engine */
+static OSyncEngineProfileRecord *_osync_engine_profile_find(OSyncEngineProfile *profile, const char *objtype, osync_memberid memberid, osync_bool create)
+{
+	OSyncEngineProfileRecord *record = NULL;
+
+	if (!objtype)
+		return &profile->engine;
+
+	record = _osync_engine_profile_find_objtype(profile, objtype, create);
+	if (!record || !memberid)
+		return record;
+
+	return _osync_engine_profile_find_member(record, memberid, create);
+}
+
+static void _osync_engine_profile_phase_start(OSyncEngineProfilePhase *phase, double wall, double cpu)
+{
+	if (!phase->running++) {
+		phase->wall_start = wall;
+		phase->cpu_start = cpu;
+	}
+}
+
+static void _osync_engine_profile_phase_stop(OSyncEngineProfilePhase *phase, double wall, double cpu)
+{
+	if (!phase->running || --phase->running)
+		return;
+
+	phase->wall_time += wall - phase->wall_start;
+	phase->cpu_time += cpu - phase->cpu_start;
+}
+
+/* The CPU time of the timer only goes to object types and members, the
+ * phases of the whole engine already have the CPU time of the process */
+static void _osync_engine_profile_phase_add(OSyncEngineProfilePhase *phase, const OSyncEngineProfileTimer *timer, unsigned int items, osync_bool cpu)
+{
+	if (timer) {
+		phase->wall_time += timer->wall_time;
+		if (cpu)
+			phase->cpu_time += timer->cpu_time;
+	}
+
+	phase->items += items;
+}
+
+/* Stops the phases of a record which are still running, e.g. after an error */
+static void _osync_engine_profile_record_finish(OSyncEngineProfileRecord *record, double wall, double cpu)
+{
+	OSyncList *m = NULL;
+	int i;
+
+	for (i = 0; i < OSYNC_ENGINE_NUM_PHASES; i++) {
+		if (!record->phases[i].running)
+			continue;
+
+		record->phases[i].running = 1;
+		_osync_engine_profile_phase_stop(&record->phases[i], wall, cpu);
+	}
+
+	for (m = record->members; m; m = m->next)
+		_osync_engine_profile_record_finish(m->data, wall, cpu);
+}
+
+OSyncEngineProfile *osync_engine_profile_new(OSyncError **error)
+{
+	OSyncEngineProfile *profile = NULL;
+
+	osync_trace(TRACE_ENTRY, "%s(%p)", __func__, error);
+
+	profile = osync_try_malloc0(sizeof(OSyncEngineProfile), error);
+	if (!profile)
+		goto error;
+
+	profile->ref_count = 1;
+	profile->mutex = g_mutex_new();
+
+	profile->wall_start = _osync_engine_profile_wall();
+	profile->cpu_start = _osync_engine_profile_cpu();
+
+	osync_trace(TRACE_EXIT, "%s: %p", __func__, profile);
+	return profile;
+
+ error:
+	osync_trace(TRACE_EXIT_ERROR, "%s: %s", __func__, osync_error_print(error));
+	return NULL;
+}
+
+OSyncEngineProfile *osync_engine_profile_ref(OSyncEngineProfile *profile)
+{
+	osync_assert(profile);
+
+	g_atomic_int_inc(&(profile->ref_count));
+
+	return profile;
+}
+
+void osync_engine_profile_unref(OSyncEngineProfile *profile)
+{
+	OSyncList *o = NULL;
+
+	osync_assert(profile);
+
+	if (g_atomic_int_dec_and_test(&(profile->ref_count))) {
+		for (o = profile->objtypes; o; o = o->next)
+			_osync_engine_profile_record_free(o->data);
+		osync_list_free(profile->objtypes);
+
+		g_mutex_free(profile->mutex);
+
+		osync_free(profile);
+	}
+}
+
+void osync_engine_profile_start(OSyncEngineProfile *profile, const char *objtype, osync_memberid memberid, OSyncEnginePhase phase)
+{
+	OSyncEngineProfileRecord *record = NULL;
+	double wall, cpu;
+
+	if (!profile)
+		return;
+
+	osync_assert(objtype);
+	osync_assert(phase < OSYNC_ENGINE_NUM_PHASES);
+
+	wall = _osync_engine_profile_wall();
+	cpu = _osync_engine_profile_cpu();
+
+	g_mutex_lock(profile->mutex);
+
+	/* Object types and members run concurrently, the CPU time of the
+	 * process only adds up for the whole engine. They get the CPU time
+	 * of their timers instead. */
+	record = _osync_engine_profile_find(profile, objtype, memberid, TRUE);
+	if (record) {
+		_osync_engine_profile_phase_start(&record->phases[phase], wall, 0);
+
+		if (!memberid)
+			_osync_engine_profile_phase_start(&profile->engine.phases[phase], wall, cpu);
+	}
+
+	g_mutex_unlock(profile->mutex);
+}
+
+void osync_engine_profile_stop(OSyncEngineProfile *profile, const char *objtype, osync_memberid memberid, OSyncEnginePhase phase)
+{
+	OSyncEngineProfileRecord *record = NULL;
+	double wall, cpu;
+
+	if (!profile)
+		return;
+
+	osync_assert(objtype);
+	osync_assert(phase < OSYNC_ENGINE_NUM_PHASES);
+
+	wall = _osync_engine_profile_wall();
+	cpu = _osync_engine_profile_cpu();
+
+	g_mutex_lock(profile->mutex);
+
+	record = _osync_engine_profile_find(profile, objtype, memberid, FALSE);
+	if (record && record->phases[phase].running) {
+		_osync_engine_profile_phase_stop(&record->phases[phase], wall, 0);
+
+		if (!memberid)
+			_osync_engine_profile_phase_stop(&profile->engine.phases[phase], wall, cpu);
+	}
+
+	g_mutex_unlock(profile->mutex);
+}
+
+void osync_engine_profile_add(OSyncEngineProfile *profile, const char *objtype, osync_memberid memberid, OSyncEnginePhase phase, const OSyncEngineProfileTimer *timer, unsigned int items)
+{
+	OSyncEngineProfileRecord *record = NULL;
+
+	if (!profile)
+		return;
+
+	osync_assert(objtype);
+	osync_assert(phase < OSYNC_ENGINE_NUM_PHASES);
+
+	g_mutex_lock(profile->mutex);
+
+	record = _osync_engine_profile_find_objtype(profile, objtype, TRUE);
+	if (record) {
+		_osync_engine_profile_phase_add(&record->phases[phase], timer, items, TRUE);
+
+		if (memberid)
+			record = _osync_engine_profile_find_member(record, memberid, TRUE);
+		if (memberid && record)
+			_osync_engine_profile_phase_add(&record->phases[phase], timer, items, TRUE);
+	}
+
+	_osync_engine_profile_phase_add(&profile->engine.phases[phase], timer, items, FALSE);
+
+	g_mutex_unlock(profile->mutex);
+}
+
+void osync_engine_profile_finish(OSyncEngineProfile *profile)
+{
+	OSyncList *o = NULL;
+	double wall, cpu;
+
+	if (!profile)
+		return;
+
+	wall = _osync_engine_profile_wall();
+	cpu = _osync_engine_profile_cpu();
+
+	g_mutex_lock(profile->mutex);
+
+	if (!profile->finished) {
+		_osync_engine_profile_record_finish(&profile->engine, wall, cpu);
+		for (o = profile->objtypes; o; o = o->next)
+			_osync_engine_profile_record_finish(o->data, wall, 0);
+
+		profile->wall_time = wall - profile->wall_start;
+		profile->cpu_time = cpu - profile->cpu_start;
+		profile->finished = TRUE;
+	}
+
+	g_mutex_unlock(profile->mutex);
+}
+
+void osync_engine_profile_timer_start(OSyncEngineProfileTimer *timer)
+{
+	osync_assert(timer);
+
+	timer->wall_time = _osync_engine_profile_wall();
+	timer->cpu_time = _osync_engine_profile_thread_cpu();
+}
+
+void osync_engine_profile_timer_stop(OSyncEngineProfileTimer *timer)
+{
+	osync_assert(timer);
+
+	timer->wall_time = _osync_engine_profile_wall() - timer->wall_time;
+	timer->cpu_time = _osync_engine_profile_thread_cpu() - timer->cpu_time;
+}
+
+double osync_engine_profile_get_total_wall_time(OSyncEngineProfile *profile)
+{
+	double wall_time = 0;
+
+	osync_assert(profile);
+
+	g_mutex_lock(profile->mutex);
+	if (profile->finished)
+		wall_time = profile->wall_time;
+	else
+		wall_time = _osync_engine_profile_wall() - profile->wall_start;
+	g_mutex_unlock(profile->mutex);
+
+	return wall_time;
+}
+
+double osync_engine_profile_get_total_cpu_time(OSyncEngineProfile *profile)
+{
+	double cpu_time = 0;
+
+	osync_assert(profile);
+
+	g_mutex_lock(profile->mutex);
+	if (profile->finished)
+		cpu_time = profile->cpu_time;
+	else
+		cpu_time = _osync_engine_profile_cpu() - profile->cpu_start;
+	g_mutex_unlock(profile->mutex);
+
+	return cpu_time;
+}
+
+unsigned int osync_engine_profile_num_objtypes(OSyncEngineProfile *profile)
+{
+	unsigned int num = 0;
+
+	osync_assert(profile);
+
+	g_mutex_lock(profile->mutex);
+	num = osync_list_length(profile->objtypes);
+	g_mutex_unlock(profile->mutex);
+
+	return num;
+}
+
+const char *osync_engine_profile_nth_objtype(OSyncEngineProfile *profile, unsigned int nth)
+{
+	OSyncEngineProfileRecord *record = NULL;
+
+	osync_assert(profile);
+
+	g_mutex_lock(profile->mutex);
+	record = osync_list_nth_data(profile->objtypes, nth);
+	g_mutex_unlock(profile->mutex);
+
+	/* Records stay until the profile gets released */
+	return record ? record->objtype : NULL;
+}
+
+/* Copies a phase of a record under the lock, zeroed if there is no record */
+static void _osync_engine_profile_get_phase(OSyncEngineProfile *profile, const char *objtype, osync_memberid memberid, OSyncEnginePhase phase, OSyncEngineProfilePhase *copy)
+{
+	OSyncEngineProfileRecord *record = NULL;
+
+	osync_assert(profile);
+	osync_assert(phase < OSYNC_ENGINE_NUM_PHASES);
+
+	memset(copy, 0, sizeof(OSyncEngineProfilePhase));
+
+	g_mutex_lock(profile->mutex);
+	record = _osync_engine_profile_find(profile, objtype, memberid, FALSE);
+	if (record)
+		*copy = record->phases[phase];
+	g_mutex_unlock(profile->mutex);
+}
+
+double osync_engine_profile_get_wall_time(OSyncEngineProfile *profile, const char *objtype, osync_memberid memberid, OSyncEnginePhase phase)
+{
+	OSyncEngineProfilePhase copy;
+
+	_osync_engine_profile_get_phase(profile, objtype, memberid, phase, &copy);
+	return copy.wall_time;
+}
+
+double osync_engine_profile_get_cpu_time(OSyncEngineProfile *profile, const char *objtype, osync_memberid memberid, OSyncEnginePhase phase)
+{
+	OSyncEngineProfilePhase copy;
+
+	_osync_engine_profile_get_phase(profile, objtype, memberid, phase, &copy);
+	return copy.cpu_time;
+}
+
+unsigned int osync_engine_profile_get_items(OSyncEngineProfile *profile, const char *objtype, osync_memberid memberid, OSyncEnginePhase phase)
+{
+	OSyncEngineProfilePhase copy;
+
+	_osync_engine_profile_get_phase(profile, objtype, memberid, phase, &copy);
+	return copy.items;
+}
+
+const char *osync_engine_profile_get_phasestr(OSyncEnginePhase phase)
+{
+	switch (phase) {
+	case OSYNC_ENGINE_PHASE_CONNECT:
+		return "connect";
+	case OSYNC_ENGINE_PHASE_GET_CHANGES:
+		return "get_changes";
+	case OSYNC_ENGINE_PHASE_MAP:
+		return "map";
+	case OSYNC_ENGINE_PHASE_MULTIPLY:
+		return "multiply";
+	case OSYNC_ENGINE_PHASE_CONVERT:
+		return "convert";
+	case OSYNC_ENGINE_PHASE_WRITE:
+		return "write";
+	case OSYNC_ENGINE_PHASE_SYNC_DONE:
+		return "sync_done";
+	case OSYNC_ENGINE_NUM_PHASES:
+		break;
+	}
+
+	return "UNKNOWN";
+}
+
+/* Seconds with a dot as decimal separator, whatever the locale */
+static void _osync_engine_profile_json_seconds(GString *json, double seconds)
+{
+	char buffer[G_ASCII_DTOSTR_BUF_SIZE];
+
+	g_string_append(json, g_ascii_formatd(buffer, sizeof(buffer), "%.6f", seconds));
+}
+
+static void _osync_engine_profile_json_string(GString *json, const char *string)
+{
+	const char *c = NULL;
+
+	g_string_append_c(json, '"');
+	for (c = string; *c; c++) {
+		if (*c == '"' || *c == '\\')
+			g_string_append_printf(json, "\\%c", *c);
+		else if ((unsigned char)*c < 0x20)
+			g_string_append_printf(json, "\\u%04x", (unsigned char)*c);
+		else
+			g_string_append_c(json, *c);
+	}
+	g_string_append_c(json, '"');
+}
+
+static void _osync_engine_profile_json_phases(GString *json, OSyncEngineProfileRecord *record, const char *indent)
+{
+	int i;
+
+	g_string_append(json, "{");
+	for (i = 0; i < OSYNC_ENGINE_NUM_PHASES; i++) {
+		OSyncEngineProfilePhase *phase = &record->phases[i];
+
+		g_string_append_printf(json, "%s\n%s\t\"%s\": { \"wall_time\": ", i ? "," : "", indent, osync_engine_profile_get_phasestr(i));
+		_osync_engine_profile_json_seconds(json, phase->wall_time);
+		g_string_append(json, ", \"cpu_time\": ");
+		_osync_engine_profile_json_seconds(json, phase->cpu_time);
+		g_string_append_printf(json, ", \"items\": %u }", phase->items);
+	}
+	g_string_append_printf(json, "\n%s}", indent);
+}
+
+char *osync_engine_profile_to_json(OSyncEngineProfile *profile)
+{
+	GString *json = NULL;
+	OSyncList *o = NULL, *m = NULL;
+	double wall_time, cpu_time;
+
+	osync_assert(profile);
+
+	wall_time = osync_engine_profile_get_total_wall_time(profile);
+	cpu_time = osync_engine_profile_get_total_cpu_time(profile);
+
+	json = g_string_new("{\n\t\"wall_time\": ");
+	_osync_engine_profile_json_seconds(json, wall_time);
+	g_string_append(json, ",\n\t\"cpu_time\": ");
+	_osync_engine_profile_json_seconds(json, cpu_time);
+
+	g_mutex_lock(profile->mutex);
+
+	g_string_append(json, ",\n\t\"phases\": ");
+	_osync_engine_profile_json_phases(json, &profile->engine, "\t");
+
+	g_string_append(json, ",\n\t\"objtypes\": [");
+	for (o = profile->objtypes; o; o = o->next) {
+		OSyncEngineProfileRecord *record = o->data;
+
+		g_string_append_printf(json, "%s\n\t\t{\n\t\t\t\"objtype\": ", o != profile->objtypes ? "," : "");
+		_osync_engine_profile_json_string(json, record->objtype);
+		g_string_append(json, ",\n\t\t\t\"phases\": ");
+		_osync_engine_profile_json_phases(json, record, "\t\t\t");
+
+		g_string_append(json, ",\n\t\t\t\"members\": [");
+		for (m = record->members; m; m = m->next) {
+			OSyncEngineProfileRecord *member = m->data;
+
+			g_string_append_printf(json, "%s\n\t\t\t\t{\n\t\t\t\t\t\"member\": %i,\n\t\t\t\t\t\"phases\": ", m != record->members ? "," : "", member->memberid);
+			_osync_engine_profile_json_phases(json, member, "\t\t\t\t\t");
+			g_string_append(json, "\n\t\t\t\t}");
+		}
+		g_string_append(json, record->members ? "\n\t\t\t]\n\t\t}" : "]\n\t\t}");
+	}
+	g_string_append(json, profile->objtypes ? "\n\t]\n}\n" : "]\n}\n");
+
+	g_mutex_unlock(profile->mutex);
+
+	return g_string_free(json, FALSE);
+}
+
+osync_bool osync_engine_profile_save(OSyncEngineProfile *profile, const char *filename, OSyncError **error)
+{
+	char *json = NULL;
+	osync_bool ret = FALSE;
+
+	osync_trace(TRACE_ENTRY, "%s(%p, %s, %p)", __func__, profile, __NULLSTR(filename), error);
+	osync_assert(profile);
+	osync_assert(filename);
+
+	json = osync_engine_profile_to_json(profile);
+	ret = osync_file_write(filename, json, strlen(json), 0644, error);
+	osync_free(json);
+
+	if (!ret) {
+		osync_trace(TRACE_EXIT_ERROR, "%s: %s", __func__, osync_error_print(error));
+		return FALSE;
+	}
+
+	osync_trace(TRACE_EXIT, "%s", __func__);
+	return TRUE;
+}
@@ -0,0 +1,178 @@
+/*
+ * libopensync - A synchronization framework
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ *
+ */
+
+#ifndef OPENSYNC_ENGINE_PROFILE_H_
+#define OPENSYNC_ENGINE_PROFILE_H_
+
+/**
+ * @defgroup OSyncEngineProfileAPI OpenSync Engine Profile
+ * @ingroup OSyncEngine
+ * @brief Time and item counts of the phases of a synchronization
+ *
+ * The engine records a profile for every synchronization, see
+ * osync_engine_get_profile(). For every phase it keeps the wall clock
+ * time, the CPU time of the engine process and the number of processed
+ * items. They are kept for the whole engine, per object type and per
+ * member of an object type.
+ *
+ * The phase of an object type lasts from the command of the engine until
+ * the object engine reported it done. The phase of a member lasts until
+ * the member replied. Phases of different object types and members
+ * overlap, so their times don't add up to the time of the engine.
+ *
+ * The conversion of received changes is timed per change and added to
+ * the convert phase, together with the preparation of the write phase.
+ * With conversion threads this is the time spent in all threads, with
+ * the CPU time of the converting thread where the platform provides it.
+ */
+
+/*@{*/
+
+/**
+ * @brief Phases of a synchronization
+ **/
+typedef enum {
+	/** Connecting the sinks, items: connected sinks */
+	OSYNC_ENGINE_PHASE_CONNECT = 0,
+	/** Reading the changes, items: received changes */
+	OSYNC_ENGINE_PHASE_GET_CHANGES,
+	/** Mapping the changes, items: mapped changes */
+	OSYNC_ENGINE_PHASE_MAP,
+	/** Multiplying the changes, items: multiplied mappings */
+	OSYNC_ENGINE_PHASE_MULTIPLY,
+	/** Converting received changes and preparing the write, items: converted changes */
+	OSYNC_ENGINE_PHASE_CONVERT,
+	/** Writing the changes, items: written changes */
+	OSYNC_ENGINE_PHASE_WRITE,
+	/** Calling sync_done of the sinks, items: sinks done */
+	OSYNC_ENGINE_PHASE_SYNC_DONE,
+	/** Number of phases */
+	OSYNC_ENGINE_NUM_PHASES
+} OSyncEnginePhase;
+
+/** @brief Increase the reference count of a profile
+ *
+ * @param profile Pointer to the profile
+ * @returns The referenced profile
+ */
+OSYNC_EXPORT OSyncEngineProfile *osync_engine_profile_ref(OSyncEngineProfile *profile);
+
+/** @brief Decrease the reference count of a profile
+ *
+ * @param profile Pointer to the profile
+ */
+OSYNC_EXPORT void osync_engine_profile_unref(OSyncEngineProfile *profile);
+
+/** @brief Get the wall clock time of the whole synchronization
+ *
+ * @param profile Pointer to the profile
+ * @returns Seconds from the start of the synchronization until the members got disconnected
+ */
+OSYNC_EXPORT double osync_engine_profile_get_total_wall_time(OSyncEngineProfile *profile);
+
+/** @brief Get the CPU time of the engine process during the synchronization
+ *
+ * @param profile Pointer to the profile
+ * @returns CPU seconds of the engine process
+ */
+OSYNC_EXPORT double osync_engine_profile_get_total_cpu_time(OSyncEngineProfile *profile);
+
+/** @brief Get the number of object types with a profile
+ *
+ * @param profile Pointer to the profile
+ * @returns Number of object types
+ */
+OSYNC_EXPORT unsigned int osync_engine_profile_num_objtypes(OSyncEngineProfile *profile);
+
+/** @brief Get the nth object type with a profile
+ *
+ * @param profile Pointer to the profile
+ * @param nth The position of the object type
+ * @returns The object type or NULL if nth is out of range
+ */
+OSYNC_EXPORT const char *osync_engine_profile_nth_objtype(OSyncEngineProfile *profile, unsigned int nth);
+
+/** @brief Get the wall clock time of a phase
+ *
+ * @param profile Pointer to the profile
+ * @param objtype The object type, NULL for the whole engine
+ * @param memberid The id of a member of the object type, 0 for the whole object type
+ * @param phase The phase
+ * @returns Seconds spent in the phase, 0 if there is no such profile
+ */
+OSYNC_EXPORT double osync_engine_profile_get_wall_time(OSyncEngineProfile *profile, const char *objtype, osync_memberid memberid, OSyncEnginePhase phase);
+
+/** @brief Get the CPU time of a phase
+ *
+ * For the whole engine this is the CPU time of the engine process while
+ * the phase ran, including plugins which run in a thread of it, but not
+ * plugins which run in a process of their own. Object types and members
+ * run concurrently, they only get the CPU time of the threads which
+ * worked on their behalf, e.g. to convert their changes.
+ *
+ * @param profile Pointer to the profile
+ * @param objtype The object type, NULL for the whole engine
+ * @param memberid The id of a member of the object type, 0 for the whole object type
+ * @param phase The phase
+ * @returns CPU seconds spent in the phase, 0 if there is no such profile
+ */
+OSYNC_EXPORT double osync_engine_profile_get_cpu_time(OSyncEngineProfile *profile, const char *objtype, osync_memberid memberid, OSyncEnginePhase phase);
+
+/** @brief Get the number of items processed in a phase
+ *
+ * See OSyncEnginePhase for what gets counted.
+ *
+ * @param profile Pointer to the profile
+ * @param objtype The object type, NULL for the whole engine
+ * @param memberid The id of a member of the object type, 0 for the whole object type
+ * @param phase The phase
+ * @returns Number of items, 0 if there is no such profile
+ */
+OSYNC_EXPORT unsigned int osync_engine_profile_get_items(OSyncEngineProfile *profile, const char *objtype, osync_memberid memberid, OSyncEnginePhase phase);
+
+/** @brief Get the name of a phase, as used in the JSON representation
+ *
+ * @param phase The phase
+ * @returns The name of the phase
+ */
+OSYNC_EXPORT const char *osync_engine_profile_get_phasestr(OSyncEnginePhase phase);
+
+/** @brief Get the JSON representation of a profile
+ *
+ * The object has the total times, the "phases" of the engine and the
+ * "objtypes", each with its "phases" and "members". Every phase has a
+ * "wall_time" and "cpu_time" in seconds and the "items".
+ *
+ * @param profile Pointer to the profile
+ * @returns The JSON text, which the caller has to free with osync_free()
+ */
+OSYNC_EXPORT char *osync_engine_profile_to_json(OSyncEngineProfile *profile);
+
+/** @brief Writes the JSON representation of a profile to a file
+ *
+ * @param profile Pointer to the profile
+ * @param filename The file to write, gets replaced
+ * @param error The error which will hold the info in case of an error
+ * @returns TRUE on success, FALSE otherwise
+ */
+OSYNC_EXPORT osync_bool osync_engine_profile_save(OSyncEngineProfile *profile, const char *filename, OSyncError **error);
+
+/*@}*/
+
+#endif /* OPENSYNC_ENGINE_PROFILE_H_ */
@@ -0,0 +1,114 @@
+/*
+ * libopensync - A synchronization framework
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ *
+ */
+
+#ifndef _OPENSYNC_ENGINE_PROFILE_INTERNALS_H
+#define _OPENSYNC_ENGINE_PROFILE_INTERNALS_H
+
+/**
+ * @defgroup OSyncEngineProfileInternalAPI OpenSync Engine Profile Internals
+ * @ingroup OSyncEnginePrivate
+ * @brief Records the profile of a synchronization
+ *
+ * All functions are thread safe. The recording functions accept a NULL
+ * profile and do nothing then, e.g. if an object engine runs without a
+ * synchronization.
+ */
+
+/*@{*/
+
+/*! @brief Measures a single piece of work, e.g. the conversion of a change
+ */
+typedef struct OSyncEngineProfileTimer {
+	/** Wall clock seconds, the start until stopped */
+	double wall_time;
+	/** CPU seconds of the calling thread, the start until stopped */
+	double cpu_time;
+} OSyncEngineProfileTimer;
+
+/** @brief Creates a new profile
+ *
+ * The total times of the profile start now.
+ *
+ * @param error The error which will hold the info in case of an error
+ * @returns A pointer to the new OSyncEngineProfile or NULL on error
+ */
+OSYNC_TEST_EXPORT OSyncEngineProfile *osync_engine_profile_new(OSyncError **error);
+
+/** @brief Starts a phase
+ *
+ * Phases of an object type also start the phase of the whole engine,
+ * unless it is running already. Phases which get started and stopped
+ * several times add up.
+ *
+ * @param profile Pointer to the profile or NULL
+ * @param objtype The object type
+ * @param memberid The id of a member of the object type, 0 for the whole object type
+ * @param phase The phase
+ */
+OSYNC_TEST_EXPORT void osync_engine_profile_start(OSyncEngineProfile *profile, const char *objtype, osync_memberid memberid, OSyncEnginePhase phase);
+
+/** @brief Stops a phase
+ *
+ * Phases which aren't running get ignored. The phase of the whole engine
+ * stops with the last object type.
+ *
+ * @param profile Pointer to the profile or NULL
+ * @param objtype The object type
+ * @param memberid The id of a member of the object type, 0 for the whole object type
+ * @param phase The phase
+ */
+OSYNC_TEST_EXPORT void osync_engine_profile_stop(OSyncEngineProfile *profile, const char *objtype, osync_memberid memberid, OSyncEnginePhase phase);
+
+/** @brief Adds items and the time of a timer to a phase
+ *
+ * The times and items of a member also get added to its object type and
+ * to the whole engine, those of an object type to the whole engine. The
+ * CPU time of the timer is not added to the whole engine, its phases have
+ * the CPU time of the process.
+ *
+ * @param profile Pointer to the profile or NULL
+ * @param objtype The object type
+ * @param memberid The id of a member of the object type, 0 for the whole object type
+ * @param phase The phase
+ * @param timer A stopped timer or NULL to only count items
+ * @param items Number of processed items
+ */
+OSYNC_TEST_EXPORT void osync_engine_profile_add(OSyncEngineProfile *profile, const char *objtype, osync_memberid memberid, OSyncEnginePhase phase, const OSyncEngineProfileTimer *timer, unsigned int items);
+
+/** @brief Stops all running phases and the total times
+ *
+ * @param profile Pointer to the profile or NULL
+ */
+OSYNC_TEST_EXPORT void osync_engine_profile_finish(OSyncEngineProfile *profile);
+
+/** @brief Starts a timer in the calling thread
+ *
+ * @param timer The timer
+ */
+OSYNC_TEST_EXPORT void osync_engine_profile_timer_start(OSyncEngineProfileTimer *timer);
+
+/** @brief Stops a timer, in the thread which started it
+ *
+ * @param timer The timer
+ */
+OSYNC_TEST_EXPORT void osync_engine_profile_timer_stop(OSyncEngineProfileTimer *timer);
+
+/*@}*/
+
+#endif /* _OPENSYNC_ENGINE_PROFILE_INTERNALS_H */
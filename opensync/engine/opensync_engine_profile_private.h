@@ -0,0 +1,79 @@
+/*
+ * libopensync - A synchronization framework
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ *
+ */
+
+#ifndef _OPENSYNC_ENGINE_PROFILE_PRIVATE_H
+#define _OPENSYNC_ENGINE_PROFILE_PRIVATE_H
+
+/**
+ * @defgroup OSyncEngineProfilePrivateAPI OpenSync Engine Profile Private
+ * @ingroup OSyncEnginePrivate
+ */
+
+/*@{*/
+
+/*! @brief Times and items of a single phase
+ */
+typedef struct OSyncEngineProfilePhase {
+	double wall_time;
+	double cpu_time;
+	unsigned int items;
+	/** Number of starts without a stop, the times run while not 0 */
+	unsigned int running;
+	/** Wall clock and process CPU time of the first start */
+	double wall_start;
+	double cpu_start;
+} OSyncEngineProfilePhase;
+
+/*! @brief Phases of the whole engine, an object type or a member
+ */
+typedef struct OSyncEngineProfileRecord {
+	/** NULL for the whole engine */
+	char *objtype;
+	/** 0 for the whole engine or object type */
+	osync_memberid memberid;
+	OSyncEngineProfilePhase phases[OSYNC_ENGINE_NUM_PHASES];
+	/** OSyncEngineProfileRecord elements of the members of an object type */
+	OSyncList *members;
+} OSyncEngineProfileRecord;
+
+/*! @brief Represents the profile of a synchronization
+ */
+struct OSyncEngineProfile {
+	/** Protects all fields, the recording happens in several threads */
+	GMutex *mutex;
+
+	/** Phases of the whole engine */
+	OSyncEngineProfileRecord engine;
+	/** OSyncEngineProfileRecord elements of the object types */
+	OSyncList *objtypes;
+
+	/** Times of the whole synchronization, running until finished */
+	double wall_start;
+	double cpu_start;
+	double wall_time;
+	double cpu_time;
+	osync_bool finished;
+
+	/** Reference count **/
+	int ref_count;
+};
+
+/*@}*/
+
+#endif /* _OPENSYNC_ENGINE_PROFILE_PRIVATE_H */
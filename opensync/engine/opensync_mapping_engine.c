@@ -330,12 +330,10 @@ osync_bool osync_mapping_engine_multiply(OSyncMappingEngine *engine, OSyncError
 
 		osync_trace(TRACE_INTERNAL, "Propagating change %s to %p from %p", osync_mapping_entry_get_uid(entry_engine->entry), entry_engine, engine->master);
 		
-		/* Clone the masterData. This has to be done since the data
-		 * might get changed (converted) and we dont want to touch the 
-		 * original data */
-		newData = osync_data_clone(masterData, error);
-		if (!newData)
-			goto error;
+		/* Share the masterData. It doesn't get converted in place,
+		 * osync_entry_engine_convert() converts a copy of it for
+		 * each target format */
+		newData = osync_data_ref(masterData);
 		
 		if (!existChange) {
 			existChange = osync_change_new(error);
@@ -480,7 +478,7 @@ osync_bool osync_mapping_engine_check_conflict(OSyncMappingEngine *engine)
 			
 			/* XXX: this compare is obsolate?! we do one complicated compare with dermging before this step! */
 #if 1 
-			if (osync_change_compare(leftchange, rightchange, NULL /* hopefully obsoalte*/) != OSYNC_CONV_DATA_SAME) {
+			if (osync_obj_engine_compare_changes(engine->parent, leftchange, rightchange, NULL /* hopefully obsoalte*/) != OSYNC_CONV_DATA_SAME) {
 				engine->conflict = TRUE;
 				goto conflict;
 			} else
@@ -754,7 +752,7 @@ osync_bool osync_mapping_engine_duplicate(OSyncMappingEngine *existingMapping, O
 			}
 			
 			if (change)
-				cmpret = osync_change_compare(existingEntry->change, change, error);
+				cmpret = osync_obj_engine_compare_changes(objengine, existingEntry->change, change, error);
 
 			if (!change  || cmpret == OSYNC_CONV_DATA_SAME) {
 				existingChange = existingEntry->change;
@@ -795,6 +793,7 @@ osync_bool osync_mapping_engine_duplicate(OSyncMappingEngine *existingMapping, O
 		osync_assert(newEntry);
 		osync_entry_engine_update(newEntry, existingChange);
 		osync_mapping_entry_set_uid(newEntry->entry, osync_change_get_uid(existingChange));
+		osync_sink_engine_index_entry(newEntry->sink_engine, newEntry);
 		osync_change_unref(existingChange);
 		
 		/* Set the last entry as the master */
@@ -42,9 +42,9 @@ struct OSyncMappingEngine {
 	osync_bool synced;
 };
 
-OSyncMappingEngine *osync_mapping_engine_new(OSyncObjEngine *parent, OSyncMapping *mapping, OSyncError **error);
+OSYNC_TEST_EXPORT OSyncMappingEngine *osync_mapping_engine_new(OSyncObjEngine *parent, OSyncMapping *mapping, OSyncError **error);
 OSyncMappingEngine *osync_mapping_engine_ref(OSyncMappingEngine *engine);
-void osync_mapping_engine_unref(OSyncMappingEngine *engine);
+OSYNC_TEST_EXPORT void osync_mapping_engine_unref(OSyncMappingEngine *engine);
 
 osync_bool osync_mapping_engine_multiply(OSyncMappingEngine *engine, OSyncError **error);
 
@@ -64,7 +64,7 @@ osync_bool osync_mapping_engine_multiply(OSyncMappingEngine *engine, OSyncError
  */
 osync_bool osync_mapping_engine_check_conflict(OSyncMappingEngine *engine);
 
-OSyncMappingEntryEngine *osync_mapping_engine_get_entry(OSyncMappingEngine *engine, OSyncSinkEngine *sinkengine);
+OSYNC_TEST_EXPORT OSyncMappingEntryEngine *osync_mapping_engine_get_entry(OSyncMappingEngine *engine, OSyncSinkEngine *sinkengine);
 OSyncMappingEntryEngine *osync_mapping_engine_find_entry_by_memberid(OSyncMappingEngine *engine, long long int memberid);
 
 OSYNC_TEST_EXPORT unsigned int osync_mapping_engine_num_changes(OSyncMappingEngine *engine);
@@ -62,6 +62,7 @@ OSyncMappingEntryEngine *osync_entry_engine_new(OSyncMappingEntry *entry, OSyncM
 	
 	sink_engine->entries = osync_list_append(sink_engine->entries, engine);
 	osync_entry_engine_ref(engine);
+	osync_sink_engine_index_entry(sink_engine, engine);
 	
 	osync_trace(TRACE_EXIT, "%s: %p", __func__, engine);
 	return engine;
@@ -210,7 +211,24 @@ error:
 	return FALSE;
 }
 
-osync_bool osync_entry_engine_convert(OSyncMappingEntryEngine *entry_engine, OSyncFormatEnv *formatenv, OSyncObjTypeSink *objtype_sink, OSyncFormatConverterPath **cachedpath, OSyncError **error)
+/* Returns TRUE if the data of the entry is the data of the master of its
+ * mapping, which osync_mapping_engine_multiply() shares with other entries.
+ * Once the master got a converted copy, the shared data is in the cache. */
+static osync_bool _osync_entry_engine_shares_master_data(OSyncMappingEntryEngine *entry_engine, GHashTable *converted)
+{
+	OSyncMappingEntryEngine *master = entry_engine->mapping_engine->master;
+	OSyncData *data = osync_change_get_data(entry_engine->change);
+
+	if (converted && g_hash_table_lookup(converted, data))
+		return TRUE;
+
+	if (!master || !master->change)
+		return FALSE;
+
+	return osync_change_get_data(master->change) == data;
+}
+
+osync_bool osync_entry_engine_convert(OSyncMappingEntryEngine *entry_engine, OSyncFormatEnv *formatenv, OSyncObjTypeSink *objtype_sink, OSyncFormatConverterPath **cachedpath, GHashTable *converted, OSyncError **error)
 {
 	char *objtype = NULL;
 	OSyncList *format_sinks = NULL;
@@ -218,6 +236,9 @@ osync_bool osync_entry_engine_convert(OSyncMappingEntryEngine *entry_engine, OSy
 	OSyncFormatConverter *converter = NULL;
 	OSyncChange *change = entry_engine->change;
 	OSyncFormatConverterPath *path;
+	OSyncData *data = NULL, *target_data = NULL;
+	GHashTable *targets = NULL;
+	char *target = NULL;
 
 	osync_trace(TRACE_INTERNAL, "Starting to convert change(%p:%s)/entry(uid:%s/id:%u) from objtype %s and format %s",
 			entry_engine->change,
@@ -253,12 +274,56 @@ osync_bool osync_entry_engine_convert(OSyncMappingEntryEngine *entry_engine, OSy
 	if (converter) {
 		OSyncObjFormat *format = osync_converter_get_targetformat(converter);
 		OSyncObjFormatSink *formatsink = osync_objtype_sink_find_objformat_sink(objtype_sink, format);
-		osync_converter_path_set_config(path, osync_objformat_sink_get_config(formatsink));
+		const char *config = osync_objformat_sink_get_config(formatsink);
+		osync_converter_path_set_config(path, config);
+		target = osync_strdup_printf("%s\n%s", osync_objformat_get_name(format), __NULLSTR(config));
+	}
+
+	data = osync_change_get_data(change);
+
+	/* Shared data gets converted as a copy, once for each target */
+	if (target && _osync_entry_engine_shares_master_data(entry_engine, converted)) {
+		if (converted) {
+			targets = g_hash_table_lookup(converted, data);
+			if (!targets) {
+				targets = g_hash_table_new_full(g_str_hash, g_str_equal, osync_free, (GDestroyNotify)osync_data_unref);
+				g_hash_table_insert(converted, osync_data_ref(data), targets);
+			}
+
+			target_data = g_hash_table_lookup(targets, target);
+			if (target_data) {
+				osync_trace(TRACE_INTERNAL, "Reusing the data already converted to format %s", osync_objformat_get_name(osync_data_get_objformat(target_data)));
+				osync_change_set_data(change, target_data);
+				goto converted;
+			}
+		}
+
+		target_data = osync_data_clone(data, error);
+		if (!target_data)
+			goto error_free_path;
+
+		if (!osync_format_env_convert(formatenv, path, target_data, error)) {
+			osync_data_unref(target_data);
+			goto error_free_path;
+		}
+
+		osync_change_set_data(change, target_data);
+
+		if (targets) {
+			g_hash_table_insert(targets, target, target_data);
+			target = NULL;
+		} else {
+			osync_data_unref(target_data);
+		}
+
+		goto converted;
 	}
 	
-	if (!osync_format_env_convert(formatenv, path, osync_change_get_data(entry_engine->change), error)) {
+	if (!osync_format_env_convert(formatenv, path, data, error)) {
 		goto error_free_path;
 	}
+
+ converted:
 	osync_trace(TRACE_INTERNAL, "converted to format %s", osync_objformat_get_name(osync_change_get_objformat(entry_engine->change)));
 		
 	if (*cachedpath)
@@ -268,12 +333,14 @@ osync_bool osync_entry_engine_convert(OSyncMappingEntryEngine *entry_engine, OSy
 		
 	osync_change_set_objtype(change, objtype);
 	osync_free(objtype);
+	osync_free(target);
 	osync_list_free(format_sinks);
 	
 	return TRUE;
 
 error_free_path:
 	osync_converter_path_unref(path);
+	osync_free(target);
 error_free_objtype:
 	osync_list_free(format_sinks);
 	osync_free(objtype);
@@ -130,15 +130,21 @@ osync_bool osync_entry_engine_demerge(OSyncMappingEntryEngine *engine, OSyncArch
  * The OSyncFormatConverterPath can be "cached" by supplied a refernce to the parameter.
  * Which should be reused, since this avoids conversion-path building and detection.
  *
+ * The data of the master entry is shared by the multiplied entries. It doesn't
+ * get converted in place, but as a copy. The converted copies are kept in the
+ * converted cache by the data and the target format and its configuration, so
+ * entries with the same target share one converted data.
+ *
  * @param engine Pointer to an OSyncMappingEntryEngine
  * @param formatenv Pointer to format environment 
  * @param objtype_sink Pointer to Object Type Sink which stores format configurations 
  * @param path Reference to OSyncFormatConverterPath to supplied or store the cache conversion path
+ * @param converted Cache of the converted copies of shared data, or NULL
  * @param error Pointer to error struct, which get set on any error
  * @returns TRUE on successful demerge, FALSE otherwise
  */
 
-osync_bool osync_entry_engine_convert(OSyncMappingEntryEngine *engine, OSyncFormatEnv *formatenv, OSyncObjTypeSink *objtype_sink, OSyncFormatConverterPath **path, OSyncError **error);
+osync_bool osync_entry_engine_convert(OSyncMappingEntryEngine *engine, OSyncFormatEnv *formatenv, OSyncObjTypeSink *objtype_sink, OSyncFormatConverterPath **path, GHashTable *converted, OSyncError **error);
 
 /*@}*/
 
@@ -44,6 +44,7 @@
 
 #include "archive/opensync_archive_internals.h"
 #include "data/opensync_change_internals.h"
+#include "data/opensync_data_internals.h"
 #include "client/opensync_client_proxy_internals.h"
 #include "group/opensync_member_internals.h"
 #include "format/opensync_objformat_internals.h"
@@ -52,6 +53,26 @@
 #include "mapping/opensync_mapping_table_internals.h"
 #include "mapping/opensync_mapping_table_internals.h"
 
+/* The phase of the member of sinkengine starts with the request to its client */
+static void _osync_obj_engine_profile_start(OSyncObjEngine *engine, OSyncSinkEngine *sinkengine, OSyncEnginePhase phase)
+{
+	osync_memberid memberid = osync_member_get_id(osync_client_proxy_get_member(sinkengine->proxy));
+
+	osync_engine_profile_start(osync_engine_get_sync_profile(engine->parent), engine->objtype, memberid, phase);
+}
+
+/* ... and stops with the reply, items are added for the member */
+static void _osync_obj_engine_profile_stop(OSyncObjEngine *engine, OSyncSinkEngine *sinkengine, OSyncEnginePhase phase, unsigned int items)
+{
+	OSyncEngineProfile *profile = osync_engine_get_sync_profile(engine->parent);
+	osync_memberid memberid = osync_member_get_id(osync_client_proxy_get_member(sinkengine->proxy));
+
+	osync_engine_profile_stop(profile, engine->objtype, memberid, phase);
+
+	if (items)
+		osync_engine_profile_add(profile, engine->objtype, memberid, phase, NULL, items);
+}
+
 OSyncMappingEngine *_osync_obj_engine_create_mapping_engine(OSyncObjEngine *engine, OSyncError **error)
 {
 	/* If there is none, create one */
@@ -61,7 +82,11 @@ OSyncMappingEngine *_osync_obj_engine_create_mapping_engine(OSyncObjEngine *engi
 	if (!mapping)
 		goto error;
 	
-	osync_mapping_set_id(mapping, osync_mapping_table_get_next_id(engine->mapping_table));
+	/* Scanning the table once is enough, the new mappings are numbered on */
+	if (!engine->next_mapping_id)
+		engine->next_mapping_id = osync_mapping_table_get_next_id(engine->mapping_table);
+
+	osync_mapping_set_id(mapping, engine->next_mapping_id++);
 	osync_mapping_table_add_mapping(engine->mapping_table, mapping);
 	
 	for (s = engine->sink_engines; s; s = s->next) {
@@ -95,6 +120,8 @@ static void _osync_obj_engine_connect_callback(OSyncClientProxy *proxy, void *us
 	OSyncError *locerror = NULL;
 	
 	osync_trace(TRACE_ENTRY, "%s(%p, %p, %i, %p)", __func__, proxy, userdata, slowsync, error);
+
+	_osync_obj_engine_profile_stop(engine, sinkengine, OSYNC_ENGINE_PHASE_CONNECT, error ? 0 : 1);
 	
 	if (error) {
 		osync_trace(TRACE_INTERNAL, "Obj Engine received connect error: %s", osync_error_print(&error));
@@ -266,21 +293,191 @@ error:
 	return NULL; 
 }
 
+/* Returns the demerged clone of the change for the capabilities. The clones
+ * are kept in demerged (change -> capabilities -> clone) while the change
+ * gets compared, so it gets demerged at most once per peer member. See
+ * _osync_obj_engine_mapping_release() for when they get dropped. The
+ * returned clone is owned by the cache, its data counts against the
+ * memory budget of the engine. */
+static OSyncChange *_osync_obj_engine_demerged_change(OSyncObjEngine *engine, GHashTable *demerged, OSyncCapabilities *caps, OSyncChange *change, OSyncError **error)
+{
+	GHashTable *clones = NULL;
+	OSyncChange *clone_change = NULL;
+
+	clones = g_hash_table_lookup(demerged, change);
+	if (clones) {
+		clone_change = g_hash_table_lookup(clones, caps);
+		if (clone_change)
+			return clone_change;
+	}
+
+	clone_change = _osync_obj_engine_clone_and_demerge_change(engine, caps, change, error);
+	if (!clone_change)
+		return NULL;
+
+	if (!osync_engine_store_change(engine->parent, clone_change, error)) {
+		osync_change_unref(clone_change);
+		return NULL;
+	}
+
+	if (!clones) {
+		clones = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, (GDestroyNotify)osync_change_unref);
+		/* Keep the change alive, its address is the key */
+		g_hash_table_insert(demerged, osync_change_ref(change), clones);
+	}
+
+	g_hash_table_insert(clones, caps, clone_change);
+	return clone_change;
+}
+
+/* A remembered result of osync_obj_engine_compare_changes(). The data,
+ * its format and the changetype of both changes at the time of the
+ * comparison tell if the result is still valid. The data is referenced,
+ * so its address can't get reused by another data object. */
+typedef struct compareResult {
+	OSyncConvCmpResult result;
+	OSyncData *data[2];
+	OSyncObjFormat *format[2];
+	OSyncChangeType changetype[2];
+} compareResult;
+
+/* Doesn't read spilled data back, only the data object itself matters */
+static void _osync_obj_engine_compare_state(OSyncChange *change, OSyncData **data, OSyncObjFormat **format, OSyncChangeType *changetype)
+{
+	*data = osync_change_peek_data(change);
+	*format = *data ? osync_data_get_objformat(*data) : NULL;
+	*changetype = osync_change_get_changetype(change);
+}
+
+static void _osync_obj_engine_compare_forget(compareResult *cmp)
+{
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if (cmp->data[i])
+			osync_data_unref(cmp->data[i]);
+		cmp->data[i] = NULL;
+	}
+}
+
+static void _osync_obj_engine_compare_free(compareResult *cmp)
+{
+	_osync_obj_engine_compare_forget(cmp);
+	osync_free(cmp);
+}
+
+static osync_bool _osync_obj_engine_compare_valid(compareResult *cmp, OSyncChange **changes)
+{
+	OSyncData *data = NULL;
+	OSyncObjFormat *format = NULL;
+	OSyncChangeType changetype;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		_osync_obj_engine_compare_state(changes[i], &data, &format, &changetype);
+		if (data != cmp->data[i] || format != cmp->format[i] || changetype != cmp->changetype[i])
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+OSyncConvCmpResult osync_obj_engine_compare_changes(OSyncObjEngine *engine, OSyncChange *leftchange, OSyncChange *rightchange, OSyncError **error)
+{
+	OSyncChange *changes[2];
+	GHashTable *results = NULL;
+	compareResult *cmp = NULL;
+	OSyncConvCmpResult ret;
+	int i;
+
+	osync_assert(engine);
+	osync_assert(leftchange);
+	osync_assert(rightchange);
+
+	/* The pair is kept in the order of the addresses, so it is found
+	 * whichever way round it gets compared */
+	changes[0] = leftchange < rightchange ? leftchange : rightchange;
+	changes[1] = leftchange < rightchange ? rightchange : leftchange;
+
+	if (engine->compare_results) {
+		results = g_hash_table_lookup(engine->compare_results, changes[0]);
+		if (results)
+			cmp = g_hash_table_lookup(results, changes[1]);
+	}
+
+	if (cmp && _osync_obj_engine_compare_valid(cmp, changes)) {
+		osync_trace(TRACE_INTERNAL, "Compare of %p and %p remembered: %i", leftchange, rightchange, cmp->result);
+		return cmp->result;
+	}
+
+	ret = osync_change_compare(leftchange, rightchange, error);
+
+	/* Errors are not remembered, the next compare tries again. Most
+	 * pairs mismatch and never get compared again once mapped, only
+	 * the pairs which end up in the same mapping are worth keeping */
+	if (ret != OSYNC_CONV_DATA_SAME && ret != OSYNC_CONV_DATA_SIMILAR) {
+		if (cmp)
+			g_hash_table_remove(results, changes[1]);
+		return ret;
+	}
+
+	if (!cmp) {
+		/* Nothing to remember if running out of memory */
+		cmp = osync_try_malloc0(sizeof(compareResult), NULL);
+		if (!cmp)
+			return ret;
+
+		if (!engine->compare_results)
+			engine->compare_results = g_hash_table_new_full(g_direct_hash, g_direct_equal, (GDestroyNotify)osync_change_unref, (GDestroyNotify)g_hash_table_destroy);
+
+		if (!results) {
+			results = g_hash_table_new_full(g_direct_hash, g_direct_equal, (GDestroyNotify)osync_change_unref, (GDestroyNotify)_osync_obj_engine_compare_free);
+			/* Keep the changes alive, their addresses are the keys */
+			g_hash_table_insert(engine->compare_results, osync_change_ref(changes[0]), results);
+		}
+
+		g_hash_table_insert(results, osync_change_ref(changes[1]), cmp);
+	}
+
+	_osync_obj_engine_compare_forget(cmp);
+
+	cmp->result = ret;
+	for (i = 0; i < 2; i++) {
+		_osync_obj_engine_compare_state(changes[i], &cmp->data[i], &cmp->format[i], &cmp->changetype[i]);
+		if (cmp->data[i])
+			osync_data_ref(cmp->data[i]);
+	}
+
+	return ret;
+}
+
 /* Finds the mapping to which the entry should belong. The
  * return value is MISMATCH if no mapping could be found,
  * SIMILAR if a mapping has been found but its not completely the same
  * SAME if a mapping has been found and is the same */
-static OSyncConvCmpResult _osync_obj_engine_mapping_find(OSyncList *mapping_engines, OSyncChange *change, OSyncSinkEngine *sinkengine, OSyncMappingEngine **mapping_engine, OSyncError **error)
+static OSyncConvCmpResult _osync_obj_engine_mapping_find(OSyncList *mapping_engines, GHashTable *skip, OSyncChange *change, OSyncSinkEngine *sinkengine, GHashTable *demerged, OSyncMappingEngine **mapping_engine, OSyncError **error)
 {	
 	OSyncList *m = NULL;
 	OSyncList *e = NULL;
 	OSyncConvCmpResult result = OSYNC_CONV_DATA_MISMATCH;
+	OSyncData *data = NULL;
+	char *buffer = NULL;
+	unsigned int size = 0;
 
 	osync_trace(TRACE_ENTRY, "%s(%p, %p, %p, %p)", __func__, mapping_engines, change, sinkengine, mapping_engine);
 
+	/* The change gets compared with all candidates, so only their
+	 * data gets spilled again while the store gets trimmed */
+	data = osync_change_get_data(change);
+	if (data)
+		osync_data_pin_data(data, &buffer, &size);
+
 	for (m=mapping_engines; m && (result != OSYNC_CONV_DATA_SAME); m=m->next) {
 		OSyncMappingEngine *tmp_mapping_engine = m->data;
 
+		if (skip && g_hash_table_lookup(skip, tmp_mapping_engine))
+			continue;
+
 		OSyncObjEngine *engine = tmp_mapping_engine->parent;
 		OSyncGroup *group = osync_engine_get_group(engine->parent); 
 
@@ -313,40 +510,36 @@ static OSyncConvCmpResult _osync_obj_engine_mapping_find(OSyncList *mapping_engi
 				caps2 = osync_member_get_capabilities(member2);
 			}
 
-			OSyncChange *clone_change1 = NULL, *clone_change2 = NULL;
 			OSyncChange *change1 = change;
 			OSyncChange *change2 = mapping_change;
 
 			osync_trace(TRACE_INTERNAL, "Member1-caps: %p Member2-caps: %p", caps1, caps2);
 
 			if (caps2) {
-				clone_change1 = _osync_obj_engine_clone_and_demerge_change(sinkengine->engine, caps2, change1, error);
-				if (!clone_change1)
+				change1 = _osync_obj_engine_demerged_change(sinkengine->engine, demerged, caps2, change, error);
+				if (!change1)
 					goto error;
 
 			}
 
 			if (caps1) {
-				clone_change2 = _osync_obj_engine_clone_and_demerge_change(sinkengine->engine, caps1, change2, error);
-				if (!clone_change2)
+				change2 = _osync_obj_engine_demerged_change(sinkengine->engine, demerged, caps1, mapping_change, error);
+				if (!change2)
 					goto error;
 
 			}
 
+			/* Demerged clones only live during the mapping, only
+			 * the compare of the changes themselves is worth keeping */
+			if (change1 == change && change2 == mapping_change)
+				tmp_result = osync_obj_engine_compare_changes(engine, change1, change2, error);
+			else
+				tmp_result = osync_change_compare(change1, change2, error);
 
-			if (clone_change1)
-				change1 = clone_change1;
-
-			if (clone_change2)
-				change2 = clone_change2;
-
-			tmp_result = osync_change_compare(change1, change2, error);
-
-			if (caps2)
-				osync_change_unref(clone_change1);
-
-			if (caps1)
-				osync_change_unref(clone_change2);
+			/* Each compare might read data back, keep the memory
+			 * budget during the scan and not only after it */
+			if (tmp_result != OSYNC_CONV_DATA_UNKNOWN && !osync_engine_trim_change_store(engine->parent, error))
+				goto error;
 
 			if(tmp_result == OSYNC_CONV_DATA_SAME) {
 				/* SAME is the best we can get */
@@ -366,117 +559,344 @@ static OSyncConvCmpResult _osync_obj_engine_mapping_find(OSyncList *mapping_engi
 		}
 	}
 
+	if (data)
+		osync_data_unpin_data(data);
+
 	osync_trace(TRACE_EXIT, "%s: %d, %p", __func__, (int)result, *mapping_engine);
 	return result;
 
 error:
+	if (data)
+		osync_data_unpin_data(data);
 	osync_trace(TRACE_EXIT_ERROR, "%s: %s", __func__, osync_error_print(error));
 	return OSYNC_CONV_DATA_UNKNOWN;
 }
 
-osync_bool osync_obj_engine_map_changes(OSyncObjEngine *engine, OSyncError **error)
+/* Returns the bucket of a change for the mapping, or NULL if the format
+ * has no mapping key for it. Changes which are not in the same format or
+ * of the same type never match, so both are part of the bucket. */
+static char *_osync_obj_engine_mapping_key(OSyncChange *change, OSyncError **error)
+{
+	OSyncData *data = osync_change_get_data(change);
+	OSyncObjFormat *format = NULL;
+	char *buffer = NULL, *key = NULL, *bucket = NULL;
+	unsigned int size = 0;
+
+	if (!data)
+		return NULL;
+
+	format = osync_data_get_objformat(data);
+	if (!format || !osync_objformat_has_mapping_key(format))
+		return NULL;
+
+	osync_data_get_data(data, &buffer, &size);
+	if (!buffer)
+		return NULL;
+
+	key = osync_objformat_get_mapping_key(format, buffer, size, error);
+	if (!key)
+		return NULL;
+
+	bucket = osync_strdup_printf("%s\n%i\n%s", osync_objformat_get_name(format), osync_change_get_changetype(change), key);
+	osync_free(key);
+	return bucket;
+}
+
+/* Makes a new mapping a candidate for changes of the bucket, or for all
+ * changes if there is no bucket. Takes over the bucket. */
+static void _osync_obj_engine_mapping_index(GHashTable *buckets, OSyncList **unkeyed, OSyncMappingEngine *mapping_engine, char *bucket)
+{
+	OSyncList *candidates = NULL;
+
+	/* The newest mapping is kept first, see _osync_obj_engine_mapping_candidates() */
+	if (!bucket) {
+		*unkeyed = osync_list_prepend(*unkeyed, mapping_engine);
+		return;
+	}
+
+	candidates = g_hash_table_lookup(buckets, bucket);
+	candidates = osync_list_prepend(candidates, mapping_engine);
+	g_hash_table_replace(buckets, bucket, candidates);
+}
+
+/* Collects the mappings a change of the bucket has to be compared with,
+ * the oldest first and those of the bucket before the unkeyed ones.
+ * Prepending reverses the lists, which have the newest first. */
+static OSyncList *_osync_obj_engine_mapping_candidates(GHashTable *buckets, OSyncList *unkeyed, GHashTable *mapped, const char *bucket)
+{
+	OSyncList *candidates = NULL, *c = NULL;
+
+	for (c = unkeyed; c; c = c->next) {
+		if (!g_hash_table_lookup(mapped, c->data))
+			candidates = osync_list_prepend(candidates, c->data);
+	}
+
+	for (c = g_hash_table_lookup(buckets, bucket); c; c = c->next) {
+		if (!g_hash_table_lookup(mapped, c->data))
+			candidates = osync_list_prepend(candidates, c->data);
+	}
+
+	return candidates;
+}
+
+/* The state of the mapping, which is kept until all received changes
+ * got mapped. See osync_obj_engine_set_incremental_mapping() */
+typedef struct mappingContext {
+	/** New mappings, which are not part of the object engine yet */
+	OSyncList *new_mappings;
+	/** Last element of new_mappings, to append in constant time */
+	OSyncList *new_mappings_last;
+	/** New mappings by the bucket of their first change */
+	GHashTable *buckets;
+	/** New mappings without a bucket, candidates for every change */
+	OSyncList *unkeyed;
+	/** The mappings which got a SAME change, by sinkengine */
+	GHashTable *mapped;
+	/** Demerged clones of the changes, see _osync_obj_engine_demerged_change() */
+	GHashTable *demerged;
+} mappingContext;
+
+static mappingContext *_osync_obj_engine_mapping_context(OSyncObjEngine *engine, OSyncError **error)
+{
+	mappingContext *ctx = engine->mapping_context;
+
+	if (ctx)
+		return ctx;
+
+	ctx = osync_try_malloc0(sizeof(mappingContext), error);
+	if (!ctx)
+		return NULL;
+
+	ctx->buckets = g_hash_table_new_full(g_str_hash, g_str_equal, osync_free, (GDestroyNotify)osync_list_free);
+	ctx->mapped = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, (GDestroyNotify)g_hash_table_destroy);
+	ctx->demerged = g_hash_table_new_full(g_direct_hash, g_direct_equal, (GDestroyNotify)osync_change_unref, (GDestroyNotify)g_hash_table_destroy);
+
+	engine->mapping_context = ctx;
+	return ctx;
+}
+
+/* Appends a new mapping. The mappings without bucket get compared in this
+ * order, which decides between SIMILAR mappings. */
+static void _osync_obj_engine_mapping_add(mappingContext *ctx, OSyncMappingEngine *mapping_engine)
+{
+	OSyncList *last = osync_list_append(ctx->new_mappings_last, mapping_engine);
+
+	if (ctx->new_mappings_last) {
+		ctx->new_mappings_last = ctx->new_mappings_last->next;
+	} else {
+		ctx->new_mappings = last;
+		ctx->new_mappings_last = last;
+	}
+}
+
+/* Hands the new mappings over to the object engine and drops the state of the mapping */
+static void _osync_obj_engine_mapping_done(OSyncObjEngine *engine)
+{
+	mappingContext *ctx = engine->mapping_context;
+
+	if (!ctx)
+		return;
+
+	engine->mapping_engines = osync_list_concat(engine->mapping_engines, ctx->new_mappings);
+
+	g_hash_table_destroy(ctx->buckets);
+	osync_list_free(ctx->unkeyed);
+	g_hash_table_destroy(ctx->mapped);
+	g_hash_table_destroy(ctx->demerged);
+	osync_free(ctx);
+
+	engine->mapping_context = NULL;
+}
+
+/* Drops the demerged clones of a change once it got mapped, and those of
+ * all changes of the mapping once every sinkengine has an entry in it. The
+ * clones would otherwise double the memory of the changes until all of
+ * them got mapped. Later compares demerge again. */
+static void _osync_obj_engine_mapping_release(mappingContext *ctx, OSyncMappingEngine *mapping_engine, OSyncChange *change)
+{
+	OSyncList *e = NULL;
+
+	g_hash_table_remove(ctx->demerged, change);
+
+	for (e = mapping_engine->entries; e; e = e->next) {
+		if (!osync_entry_engine_get_change(e->data))
+			return;
+	}
+
+	for (e = mapping_engine->entries; e; e = e->next)
+		g_hash_table_remove(ctx->demerged, osync_entry_engine_get_change(e->data));
+}
+
+/* Puts the change into a mapping. Changes are compared with the new mappings
+ * of the other sinkengines, which didn't get a SAME change of this sinkengine yet. */
+static osync_bool _osync_obj_engine_map_change(OSyncObjEngine *engine, mappingContext *ctx, OSyncSinkEngine *sinkengine, OSyncChange *change, OSyncError **error)
 {
 	OSyncMappingEngine *mapping_engine = NULL;
-	OSyncList *new_mappings = NULL, *v = NULL;
-	OSyncList *unmapped_mappings = NULL;
-	OSyncConvCmpResult result = 0;
 	OSyncMappingEntryEngine *entry_engine = NULL;
+	OSyncConvCmpResult result = 0;
 	OSyncChange *old_change;
+	/* Mappings of the sinkengine which got a SAME change */
+	GHashTable *mapped = NULL;
+	char *bucket = NULL;
+
+	osync_trace(TRACE_INTERNAL, "Looking for mapping for change %s, changetype %i from member %i", osync_change_get_uid(change), osync_change_get_changetype(change), osync_member_get_id(osync_client_proxy_get_member(sinkengine->proxy)));
+
+	osync_engine_profile_add(osync_engine_get_sync_profile(engine->parent), engine->objtype, osync_member_get_id(osync_client_proxy_get_member(sinkengine->proxy)), OSYNC_ENGINE_PHASE_MAP, NULL, 1);
+
+	mapped = g_hash_table_lookup(ctx->mapped, sinkengine);
+	if (!mapped) {
+		mapped = g_hash_table_new(g_direct_hash, g_direct_equal);
+		g_hash_table_insert(ctx->mapped, sinkengine, mapped);
+	}
+
+	bucket = _osync_obj_engine_mapping_key(change, error);
+	if (osync_error_is_set(error))
+		goto error;
+
+	/* See if there is an exisiting mapping, which fits the unmapped change.
+	 * Only mappings of the same bucket can fit, if the format provides one */
+	if (bucket) {
+		OSyncList *candidates = _osync_obj_engine_mapping_candidates(ctx->buckets, ctx->unkeyed, mapped, bucket);
+		result = _osync_obj_engine_mapping_find(candidates, NULL, change, sinkengine, ctx->demerged, &mapping_engine, error);
+		osync_list_free(candidates);
+	} else {
+		result = _osync_obj_engine_mapping_find(ctx->new_mappings, mapped, change, sinkengine, ctx->demerged, &mapping_engine, error);
+	}
+
+	switch (result) {
+		case OSYNC_CONV_DATA_MISMATCH:
+			/* If there is none, create one */
+			mapping_engine = _osync_obj_engine_create_mapping_engine(engine, error);
+			if (!mapping_engine)
+				goto error;
+
+			osync_trace(TRACE_INTERNAL, "Unable to find mapping. Creating new mapping with id %i", osync_mapping_get_id(mapping_engine->mapping));
+			_osync_obj_engine_mapping_add(ctx, mapping_engine);
+			_osync_obj_engine_mapping_index(ctx->buckets, &ctx->unkeyed, mapping_engine, bucket);
+			bucket = NULL;
+			break;
+		case OSYNC_CONV_DATA_SIMILAR:
+			mapping_engine->conflict = TRUE;
+			break;
+		case OSYNC_CONV_DATA_SAME:
+			g_hash_table_insert(mapped, mapping_engine, mapping_engine);
+			mapping_engine->conflict = FALSE;
+			break;
+		case OSYNC_CONV_DATA_UNKNOWN:
+			goto error;
+			break;
+	}
+
+	if (bucket) {
+		osync_free(bucket);
+		bucket = NULL;
+	}
+
+	/* Update the entry which belongs to our sinkengine with the the change */
+	entry_engine = osync_mapping_engine_get_entry(mapping_engine, sinkengine);
+	osync_assert(entry_engine);
+
+	/* Don't overwrite unprefered entry_engines (e.g. SIMILAR).
+	 *
+	 * Secenario: First a mapping with SIMILAR get created. Later a mapping
+	 * with SAME compare result gets detected. The SAME mapping engine get prefered.
+	 * 
+	 * The old change gets moved into a new mapping_engine.
+	 */
+	if ((old_change = osync_entry_engine_get_change(entry_engine))) {
+		OSyncMappingEngine *old_mapping_engine = NULL;
+		OSyncMappingEntryEngine *old_entry_engine = NULL;
+		old_mapping_engine = _osync_obj_engine_create_mapping_engine(engine, error);
+		if (!old_mapping_engine)
+			goto error;
+
+		_osync_obj_engine_mapping_add(ctx, old_mapping_engine);
+
+		bucket = _osync_obj_engine_mapping_key(old_change, error);
+		if (osync_error_is_set(error))
+			goto error;
+		_osync_obj_engine_mapping_index(ctx->buckets, &ctx->unkeyed, old_mapping_engine, bucket);
+		bucket = NULL;
+
+		old_entry_engine = osync_mapping_engine_get_entry(old_mapping_engine, sinkengine);
+		osync_entry_engine_update(old_entry_engine, old_change);
+	}
+
+	osync_entry_engine_update(entry_engine, change);
+
+	_osync_obj_engine_mapping_release(ctx, mapping_engine, change);
+
+	/* The compares read spilled data of the candidates back */
+	if (!osync_engine_trim_change_store(engine->parent, error))
+		goto error;
+
+	return TRUE;
+
+error:
+	if (bucket)
+		osync_free(bucket);
+	return FALSE;
+}
+
+osync_bool osync_obj_engine_map_changes(OSyncObjEngine *engine, OSyncError **error)
+{
+	mappingContext *ctx = NULL;
+	OSyncList *v = NULL;
 	
 	osync_trace(TRACE_ENTRY, "%s(%p)", __func__, engine);
 	//osync_trace_disable();
 
+	/* With incremental mapping most changes got mapped already */
+	ctx = _osync_obj_engine_mapping_context(engine, error);
+	if (!ctx)
+		goto error;
+
 	/* Go through all sink engines that are available */
 	for (v = engine->sink_engines; v; v = v->next) {
 		OSyncSinkEngine *sinkengine = v->data;
 		
-		/* We use a temp list to speed things up. We dont have to compare with newly created mappings for
-		 * the current sinkengine, since there will be only one entry (for the current sinkengine) so there
-		 * is no need to compare */
+		osync_trace(TRACE_INTERNAL, "Sinkengine of member %i", osync_member_get_id(osync_client_proxy_get_member(sinkengine->proxy)));
 
-		osync_memberid memberid = osync_member_get_id(osync_client_proxy_get_member(sinkengine->proxy));
-		osync_trace(TRACE_INTERNAL, "Sinkengine of member %i", memberid);
-
-		unmapped_mappings = osync_list_copy(new_mappings);
-		
 		/* For each sinkengine, go through all unmapped changes */
 		while (sinkengine->unmapped) {
 			OSyncChange *change = sinkengine->unmapped->data;
 			
-			osync_trace(TRACE_INTERNAL, "Looking for mapping for change %s, changetype %i from member %i", osync_change_get_uid(change), osync_change_get_changetype(change), memberid);
-	
-			/* See if there is an exisiting mapping, which fits the unmapped change */
-			result = _osync_obj_engine_mapping_find(unmapped_mappings, change, sinkengine, &mapping_engine, error);
-			switch (result) {
-				case OSYNC_CONV_DATA_MISMATCH:
-					/* If there is none, create one */
-					mapping_engine = _osync_obj_engine_create_mapping_engine(engine, error);
-					if (!mapping_engine)
-						goto error;
-					
-					osync_trace(TRACE_INTERNAL, "Unable to find mapping. Creating new mapping with id %i", osync_mapping_get_id(mapping_engine->mapping));
-					/* TODO: what about _prepend (O(1)) instead of _append (O(n))? Order doesn't matter here - right? */
-					new_mappings = osync_list_append(new_mappings, mapping_engine);
-					unmapped_mappings = osync_list_append(unmapped_mappings, mapping_engine);
-					break;
-				case OSYNC_CONV_DATA_SIMILAR:
-					mapping_engine->conflict = TRUE;
-					break;
-				case OSYNC_CONV_DATA_SAME:
-					unmapped_mappings = osync_list_remove(unmapped_mappings, mapping_engine);
-					mapping_engine->conflict = FALSE;
-					break;
-				case OSYNC_CONV_DATA_UNKNOWN:
-					goto error;
-					break;
-			}
-
-			/* Update the entry which belongs to our sinkengine with the the change */
-			entry_engine = osync_mapping_engine_get_entry(mapping_engine, sinkengine);
-			osync_assert(entry_engine);
-
-			/* Don't overwrite unprefered entry_engines (e.g. SIMILAR).
-			 *
-			 * Secenario: First a mapping with SIMILAR get created. Later a mapping
-			 * with SAME compare result gets detected. The SAME mapping engine get prefered.
-			 * 
-			 * The old change gets moved into a new mapping_engine.
-			 */
-			if ((old_change = osync_entry_engine_get_change(entry_engine))) {
-				OSyncMappingEngine *old_mapping_engine = NULL;
-				OSyncMappingEntryEngine *old_entry_engine = NULL;
-				old_mapping_engine = _osync_obj_engine_create_mapping_engine(engine, error);
-				if (!old_mapping_engine)
-					goto error;
-				
-				new_mappings = osync_list_append(new_mappings, old_mapping_engine);
-				unmapped_mappings = osync_list_append(unmapped_mappings, old_mapping_engine);
+			if (!_osync_obj_engine_map_change(engine, ctx, sinkengine, change, error))
+				goto error;
 
-				old_entry_engine = osync_mapping_engine_get_entry(old_mapping_engine, sinkengine);
-				osync_entry_engine_update(old_entry_engine, old_change);
-			}
-			
-			osync_entry_engine_update(entry_engine, change);
 			sinkengine->unmapped = osync_list_remove(sinkengine->unmapped, sinkengine->unmapped->data);
 			osync_change_unref(change);
 		}
-
-		osync_list_free(unmapped_mappings);
-		
 	}
 
-	engine->mapping_engines = osync_list_concat(engine->mapping_engines, new_mappings);
+	_osync_obj_engine_mapping_done(engine);
 	
 	//osync_trace_enable();
 	osync_trace(TRACE_EXIT, "%s", __func__);
 	return TRUE;
 
 error:
+	_osync_obj_engine_mapping_done(engine);
 	osync_trace_enable();
 	osync_trace(TRACE_EXIT_ERROR, "%s: %s", __func__, osync_error_print(error));
 	return FALSE;
 }
 
+OSyncChange *osync_obj_engine_demerged_change(OSyncObjEngine *engine, OSyncCapabilities *caps, OSyncChange *change, OSyncError **error)
+{
+	mappingContext *ctx = NULL;
+
+	osync_assert(engine);
+	osync_assert(caps);
+	osync_assert(change);
+
+	ctx = _osync_obj_engine_mapping_context(engine, error);
+	if (!ctx)
+		return NULL;
+
+	return _osync_obj_engine_demerged_change(engine, ctx->demerged, caps, change, error);
+}
+
 static void _osync_obj_engine_read_ignored_callback(OSyncClientProxy *proxy, void *userdata, OSyncError *error)
 {
 	OSyncSinkEngine *sinkengine = userdata;
@@ -496,6 +916,15 @@ static void _osync_obj_engine_read_callback(OSyncClientProxy *proxy, void *userd
 	
 	osync_trace(TRACE_ENTRY, "%s(%p, %p, %p)", __func__, proxy, userdata, error);
 	
+	/* Changes of this sink might still get converted */
+	if (osync_engine_defer_callback(engine->parent, _osync_obj_engine_read_callback, proxy, userdata, error)) {
+		osync_trace(TRACE_EXIT, "%s: deferred", __func__);
+		return;
+	}
+
+	/* The changes got counted as they got received */
+	_osync_obj_engine_profile_stop(engine, sinkengine, OSYNC_ENGINE_PHASE_GET_CHANGES, 0);
+
 	if (error) {
 		osync_obj_engine_set_error(engine, error);
 		engine->sink_errors |= 1 << sinkengine->position;
@@ -520,10 +949,138 @@ static void _osync_obj_engine_read_callback(OSyncClientProxy *proxy, void *userd
 	osync_trace(TRACE_EXIT, "%s", __func__);
 }
 
+static void _osync_obj_engine_stubs_read(OSyncObjEngine *engine)
+{
+	OSyncList *p = NULL;
+	unsigned int missing = 0;
+
+	for (p = engine->sink_engines; p; p = p->next) {
+		OSyncSinkEngine *sinkengine = p->data;
+		missing += g_hash_table_size(sinkengine->stubs);
+		g_hash_table_remove_all(sinkengine->stubs);
+	}
+
+	if (missing && !engine->stub_error) {
+		osync_error_set(&engine->stub_error, OSYNC_ERROR_GENERIC, "Data of %u changes didn't get read", missing);
+		osync_obj_engine_set_error(engine, engine->stub_error);
+	}
+
+	osync_obj_engine_event(engine, OSYNC_ENGINE_EVENT_PREPARED_MAP, engine->stub_error);
+
+	if (engine->stub_error)
+		osync_error_unref(&engine->stub_error);
+}
+
+static void _osync_obj_engine_read_stub_callback(OSyncClientProxy *proxy, void *userdata, OSyncError *error)
+{
+	OSyncSinkEngine *sinkengine = userdata;
+	OSyncObjEngine *engine = sinkengine->engine;
+
+	osync_trace(TRACE_ENTRY, "%s(%p, %p, %p)", __func__, proxy, userdata, error);
+
+	/* The read data might still get converted */
+	if (osync_engine_defer_callback(engine->parent, _osync_obj_engine_read_stub_callback, proxy, userdata, error)) {
+		osync_trace(TRACE_EXIT, "%s: deferred", __func__);
+		return;
+	}
+
+	if (error) {
+		if (!engine->stub_error) {
+			engine->stub_error = error;
+			osync_error_ref(&error);
+		}
+		osync_obj_engine_set_error(engine, error);
+		osync_status_update_member(engine->parent, osync_client_proxy_get_member(proxy), OSYNC_ENGINE_MEMBER_EVENT_ERROR, engine->objtype, error);
+	}
+
+	/* Reads of an aborted sync don't count anymore */
+	if (engine->stub_reads && !--engine->stub_reads)
+		_osync_obj_engine_stubs_read(engine);
+
+	osync_sink_engine_unref(sinkengine);
+	osync_trace(TRACE_EXIT, "%s", __func__);
+}
+
+/* Only compared or written changes need their data. A stub which is the only
+ * change of its mapping and didn't get modified has nothing to sync. */
+static osync_bool _osync_obj_engine_stub_needs_data(OSyncMappingEntryEngine *entry_engine)
+{
+	OSyncList *e = NULL;
+
+	if (osync_change_get_changetype(entry_engine->change) != OSYNC_CHANGE_TYPE_UNMODIFIED)
+		return TRUE;
+
+	for (e = entry_engine->mapping_engine->entries; e; e = e->next) {
+		OSyncMappingEntryEngine *other = e->data;
+		if (other != entry_engine && other->change)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+static osync_bool _osync_obj_engine_read_stub(OSyncObjEngine *engine, OSyncSinkEngine *sinkengine, OSyncChange *change, OSyncError **error)
+{
+	if (!osync_client_proxy_read(sinkengine->proxy, _osync_obj_engine_read_stub_callback, sinkengine, change, error))
+		return FALSE;
+	osync_sink_engine_ref(sinkengine); // Note that read_stub callback has a reference
+
+	g_hash_table_replace(sinkengine->stubs, osync_strdup(osync_change_get_uid(change)), osync_change_ref(change));
+	engine->stub_reads++;
+	return TRUE;
+}
+
+/* Requests the data of all change stubs which need it. The replies of the
+ * client are pipelined, like the commits of the changes. */
+static osync_bool _osync_obj_engine_read_stubs(OSyncObjEngine *engine, OSyncError **error)
+{
+	OSyncList *p = NULL, *o = NULL;
+
+	osync_trace(TRACE_ENTRY, "%s(%p, %p)", __func__, engine, error);
+
+	for (p = engine->active_sink_engines; p; p = p->next) {
+		OSyncSinkEngine *sinkengine = p->data;
+
+		/* Unmapped changes get compared while mapping */
+		for (o = sinkengine->unmapped; o; o = o->next) {
+			OSyncChange *change = o->data;
+
+			if (osync_change_is_stub(change) && !_osync_obj_engine_read_stub(engine, sinkengine, change, error))
+				goto error;
+		}
+
+		for (o = sinkengine->entries; o; o = o->next) {
+			OSyncMappingEntryEngine *entry_engine = o->data;
+
+			if (!entry_engine->change || !osync_change_is_stub(entry_engine->change))
+				continue;
+
+			if (!_osync_obj_engine_stub_needs_data(entry_engine)) {
+				osync_entry_engine_update(entry_engine, NULL);
+				entry_engine->mapping_engine->synced = TRUE;
+				continue;
+			}
+
+			if (!_osync_obj_engine_read_stub(engine, sinkengine, entry_engine->change, error))
+				goto error;
+		}
+	}
+
+	osync_trace(TRACE_EXIT, "%s: %u reads", __func__, engine->stub_reads);
+	return TRUE;
+
+ error:
+	/* The sync gets aborted, don't wait for the requested data */
+	engine->stub_reads = 0;
+	osync_trace(TRACE_EXIT_ERROR, "%s: %s", __func__, osync_error_print(error));
+	return FALSE;
+}
+
 osync_bool osync_obj_engine_receive_change(OSyncObjEngine *objengine, OSyncClientProxy *proxy, OSyncChange *change, OSyncError **error)
 {
 	OSyncSinkEngine *sinkengine = NULL;
-	OSyncList *e = NULL;
+	OSyncMappingEntryEngine *mapping_engine = NULL;
+	OSyncChange *stub = NULL;
 	
 	osync_assert(objengine);
 	
@@ -537,22 +1094,44 @@ osync_bool osync_obj_engine_receive_change(OSyncObjEngine *objengine, OSyncClien
 		osync_trace(TRACE_EXIT_ERROR, "%s: %s", __func__, osync_error_print(error));
 		return FALSE;
 	}
+
+	/* The requested data of a change stub */
+	stub = g_hash_table_lookup(sinkengine->stubs, osync_change_get_uid(change));
+	if (stub) {
+		osync_change_set_data(stub, osync_change_get_data(change));
+		osync_change_set_stub(stub, FALSE);
+		g_hash_table_remove(sinkengine->stubs, osync_change_get_uid(change));
+
+		osync_trace(TRACE_EXIT, "%s: Read stub", __func__);
+		return TRUE;
+	}
 	
 	/* We now have to see if the change matches one of the already existing mappings */
-	for (e = sinkengine->entries; e; e = e->next) {
-		OSyncMappingEntryEngine *mapping_engine = e->data;
+	mapping_engine = osync_sink_engine_find_entry(sinkengine, change);
+	if (mapping_engine) {
+		osync_entry_engine_update(mapping_engine, change);
 		
-		if (osync_entry_engine_matches(mapping_engine, change)) {
-			osync_entry_engine_update(mapping_engine, change);
-			
-			osync_status_update_change(sinkengine->engine->parent, change, osync_client_proxy_get_member(proxy), mapping_engine->mapping_engine->mapping, OSYNC_ENGINE_CHANGE_EVENT_READ, NULL);
-			
-			osync_trace(TRACE_EXIT, "%s: Updated", __func__);
-			return TRUE;
-		}
+		osync_status_update_change(sinkengine->engine->parent, change, osync_client_proxy_get_member(proxy), mapping_engine->mapping_engine->mapping, OSYNC_ENGINE_CHANGE_EVENT_READ, NULL);
+		
+		osync_trace(TRACE_EXIT, "%s: Updated", __func__);
+		return TRUE;
 	}
 	
 	osync_status_update_change(sinkengine->engine->parent, change, osync_client_proxy_get_member(proxy), NULL, OSYNC_ENGINE_CHANGE_EVENT_READ, NULL);
+
+	/* Map the change against the changes already received from the other
+	 * members while the rest still gets read. Conflicts get checked on MAP.
+	 * Stubs can't get compared before their data got read. */
+	if (objengine->incremental_mapping && !osync_change_is_stub(change)) {
+		mappingContext *ctx = _osync_obj_engine_mapping_context(objengine, error);
+		if (!ctx || !_osync_obj_engine_map_change(objengine, ctx, sinkengine, change, error)) {
+			osync_trace(TRACE_EXIT_ERROR, "%s: %s", __func__, osync_error_print(error));
+			return FALSE;
+		}
+
+		osync_trace(TRACE_EXIT, "%s: Mapped", __func__);
+		return TRUE;
+	}
 			
 	/* If we couldnt find a match entry, we will append it the unmapped changes
 	 * and take care of it later */
@@ -686,6 +1265,8 @@ void osync_obj_engine_commit_change_callback(OSyncClientProxy *proxy, void *user
 	osync_assert(entry_engine->mapping_engine);
 	osync_status_update_change(engine->parent, entry_engine->change, osync_client_proxy_get_member(proxy), entry_engine->mapping_engine->mapping, OSYNC_ENGINE_CHANGE_EVENT_WRITTEN, NULL);
 	osync_entry_engine_update(entry_engine, NULL);
+
+	osync_engine_profile_add(osync_engine_get_sync_profile(engine->parent), objengine_objtype, osync_member_get_id(member), OSYNC_ENGINE_PHASE_WRITE, NULL, 1);
 	
 	osync_trace(TRACE_EXIT, "%s", __func__);
 	return;
@@ -701,6 +1282,9 @@ void osync_obj_engine_written_callback(OSyncClientProxy *proxy, void *userdata,
 	OSyncObjEngine *engine = sinkengine->engine;
 	
 	osync_trace(TRACE_ENTRY, "%s(%p, %p, %p)", __func__, proxy, userdata, error);
+
+	/* The changes got counted as they got committed */
+	_osync_obj_engine_profile_stop(engine, sinkengine, OSYNC_ENGINE_PHASE_WRITE, 0);
 	
 	if (error) {
 		osync_obj_engine_set_error(engine, error);
@@ -723,6 +1307,8 @@ static void _osync_obj_engine_sync_done_callback(OSyncClientProxy *proxy, void *
 	OSyncError *locerror = NULL;
 	
 	osync_trace(TRACE_ENTRY, "%s(%p, %p, %p)", __func__, proxy, userdata, error);
+
+	_osync_obj_engine_profile_stop(engine, sinkengine, OSYNC_ENGINE_PHASE_SYNC_DONE, error ? 0 : 1);
 	
 	if (error) {
 		osync_obj_engine_set_error(engine, error);
@@ -761,9 +1347,12 @@ static osync_bool _create_mapping_engines(OSyncObjEngine *engine, OSyncError **e
 		if (!mapping_engine)
 			goto error;
 		
-		engine->mapping_engines = osync_list_append(engine->mapping_engines, mapping_engine);
+		engine->mapping_engines = osync_list_prepend(engine->mapping_engines, mapping_engine);
 	}
 	
+	/* In the order of the mapping table */
+	engine->mapping_engines = osync_list_reverse(engine->mapping_engines);
+
 	osync_list_free(mappings);
 	osync_trace(TRACE_EXIT, "%s", __func__);
 	return TRUE;
@@ -902,6 +1491,11 @@ void osync_obj_engine_unref(OSyncObjEngine *engine)
 			
 			engine->sink_engines = osync_list_remove(engine->sink_engines, sinkengine);
 		}
+
+		_osync_obj_engine_mapping_done(engine);
+
+		if (engine->compare_results)
+			g_hash_table_destroy(engine->compare_results);
 		
 		while (engine->mapping_engines) {
 			OSyncMappingEngine *mapping_engine = engine->mapping_engines->data;
@@ -912,6 +1506,12 @@ void osync_obj_engine_unref(OSyncObjEngine *engine)
 		
 		if (engine->error)
 			osync_error_unref(&engine->error);
+
+		if (engine->stage_error)
+			osync_error_unref(&engine->stage_error);
+
+		if (engine->stub_error)
+			osync_error_unref(&engine->stub_error);
 			
 		if (engine->objtype)
 			osync_free(engine->objtype);
@@ -1030,6 +1630,25 @@ void osync_obj_engine_finalize(OSyncObjEngine *engine)
 
 	engine->conflicts_solved = 0;
 
+	/* Drop the mapping state of an aborted sync */
+	_osync_obj_engine_mapping_done(engine);
+
+	/* Remembered compares are only valid for a single sync */
+	if (engine->compare_results) {
+		g_hash_table_destroy(engine->compare_results);
+		engine->compare_results = NULL;
+	}
+
+	/* Drop the result of a stage an aborted sync did not pick up */
+	engine->stage_done = FALSE;
+	if (engine->stage_error)
+		osync_error_unref(&engine->stage_error);
+
+	/* Replies to the stub reads of an aborted sync get ignored */
+	engine->stub_reads = 0;
+	if (engine->stub_error)
+		osync_error_unref(&engine->stub_error);
+
 	while (engine->sink_engines) {
 		OSyncSinkEngine *sinkengine = engine->sink_engines->data;
 		osync_sink_engine_unref(sinkengine);
@@ -1058,6 +1677,7 @@ void osync_obj_engine_finalize(OSyncObjEngine *engine)
 	
 	if (engine->mapping_table)
 		osync_mapping_table_close(engine->mapping_table);
+	engine->next_mapping_id = 0;
 
 	osync_trace(TRACE_EXIT, "%s", __func__);
 }
@@ -1074,12 +1694,81 @@ void osync_obj_engine_set_slowsync(OSyncObjEngine *engine, osync_bool slowsync)
 	engine->slowsync = slowsync;
 }
 
+void osync_obj_engine_set_incremental_mapping(OSyncObjEngine *engine, osync_bool incremental)
+{
+	osync_assert(engine);
+	engine->incremental_mapping = incremental;
+}
+
+osync_bool osync_obj_engine_get_incremental_mapping(OSyncObjEngine *engine)
+{
+	osync_assert(engine);
+	return engine->incremental_mapping;
+}
+
 osync_bool osync_obj_engine_get_slowsync(OSyncObjEngine *engine)
 {
 	osync_assert(engine);
 	return engine->slowsync;
 }
 
+static osync_bool _osync_obj_engine_stage(OSyncObjEngine *engine, OSyncEngineCmd cmd, OSyncError **error)
+{
+	OSyncList *p = NULL;
+
+	switch (cmd) {
+	case OSYNC_ENGINE_COMMAND_MAP:
+		/* We are now done reading the changes. so we can now start to create the mappings, conflicts etc */
+		return osync_obj_engine_map_changes(engine, error);
+	case OSYNC_ENGINE_COMMAND_MULTIPLY:
+		/* Now we can multiply the winner in the mapping */
+		osync_trace(TRACE_INTERNAL, "Multiplying %u mappings", osync_list_length(engine->mapping_engines));
+		for (p = engine->mapping_engines; p; p = p->next) {
+			OSyncMappingEngine *mapping_engine = p->data;
+			if (!osync_mapping_engine_multiply(mapping_engine, error))
+				return FALSE;
+		}
+
+		osync_engine_profile_add(osync_engine_get_sync_profile(engine->parent), engine->objtype, 0, OSYNC_ENGINE_PHASE_MULTIPLY, NULL, osync_list_length(engine->mapping_engines));
+		return TRUE;
+	case OSYNC_ENGINE_COMMAND_PREPARE_WRITE:
+		return osync_obj_engine_prepare_write(engine, error);
+	default:
+		return TRUE;
+	}
+}
+
+void osync_obj_engine_run_stage(OSyncObjEngine *engine, OSyncEngineCmd cmd)
+{
+	osync_trace(TRACE_ENTRY, "%s(%p:%s, %s)", __func__, engine, osync_obj_engine_get_objtype(engine), osync_engine_get_cmdstr(cmd));
+	osync_assert(engine);
+
+	engine->stage_result = _osync_obj_engine_stage(engine, cmd, &engine->stage_error);
+	engine->stage_cmd = cmd;
+	engine->stage_done = TRUE;
+
+	osync_trace(TRACE_EXIT, "%s: %i", __func__, engine->stage_result);
+}
+
+/* Runs the stage of cmd, unless osync_obj_engine_run_stage() did already */
+static osync_bool _osync_obj_engine_finish_stage(OSyncObjEngine *engine, OSyncEngineCmd cmd, OSyncError **error)
+{
+	if (!engine->stage_done || engine->stage_cmd != cmd)
+		return _osync_obj_engine_stage(engine, cmd, error);
+
+	engine->stage_done = FALSE;
+
+	/* Hand over the error of the stage */
+	if (error && !*error) {
+		*error = engine->stage_error;
+		engine->stage_error = NULL;
+	} else if (engine->stage_error) {
+		osync_error_unref(&engine->stage_error);
+	}
+
+	return engine->stage_result;
+}
+
 osync_bool osync_obj_engine_command(OSyncObjEngine *engine, OSyncEngineCmd cmd, OSyncError **error)
 {
 	OSyncList *p = NULL;
@@ -1101,6 +1790,8 @@ osync_bool osync_obj_engine_command(OSyncObjEngine *engine, OSyncEngineCmd cmd,
 		for (p = engine->active_sink_engines; p; p = p->next) {
 			sinkengine = p->data;
 
+			_osync_obj_engine_profile_start(engine, sinkengine, OSYNC_ENGINE_PHASE_CONNECT);
+
 			if (!osync_client_proxy_connect(sinkengine->proxy, _osync_obj_engine_connect_callback, sinkengine, engine->objtype, engine->slowsync, error))
 				goto error;
 			osync_sink_engine_ref(sinkengine); // Note that connect callback has a reference
@@ -1151,6 +1842,8 @@ osync_bool osync_obj_engine_command(OSyncObjEngine *engine, OSyncEngineCmd cmd,
 
 			objtype_sink = osync_member_find_objtype_sink(member, engine->objtype);
 
+			_osync_obj_engine_profile_start(engine, sinkengine, OSYNC_ENGINE_PHASE_GET_CHANGES);
+
 			/* Is there at least one other writeable sink? */
 			if (((objtype_sink && osync_objtype_sink_get_write(objtype_sink)) && write_sinks == 1) || write_sinks == 0) {
 				osync_sink_engine_ref(sinkengine); // Note that read callback has a reference
@@ -1169,11 +1862,15 @@ osync_bool osync_obj_engine_command(OSyncObjEngine *engine, OSyncEngineCmd cmd,
 
 		/* TODO: PLACEHOLDER for conversion and merge */
 
-		osync_obj_engine_event(engine, OSYNC_ENGINE_EVENT_PREPARED_MAP, *error);
+		/* PREPARED_MAP gets emitted once the data of the stubs got read */
+		if (!_osync_obj_engine_read_stubs(engine, error))
+			goto error;
+
+		if (!engine->stub_reads)
+			osync_obj_engine_event(engine, OSYNC_ENGINE_EVENT_PREPARED_MAP, *error);
 		break;
 	case OSYNC_ENGINE_COMMAND_MAP:
-		/* We are now done reading the changes. so we can now start to create the mappings, conflicts etc */
-		if (osync_obj_engine_map_changes(engine, error)) {
+		if (_osync_obj_engine_finish_stage(engine, cmd, error)) {
 			for (p = engine->mapping_engines; p; p = p->next) {
 				OSyncMappingEngine *mapping_engine = p->data;
 
@@ -1224,20 +1921,14 @@ osync_bool osync_obj_engine_command(OSyncObjEngine *engine, OSyncEngineCmd cmd,
 		break;
 	case OSYNC_ENGINE_COMMAND_MULTIPLY:
 
-		/* Now we can multiply the winner in the mapping */
-		osync_trace(TRACE_INTERNAL, "Multiplying %u mappings", osync_list_length(engine->mapping_engines));
-		for (p = engine->mapping_engines; p; p = p->next) {
-			OSyncMappingEngine *mapping_engine = p->data;
-			if (!osync_mapping_engine_multiply(mapping_engine, error))
-				break;
-		}
+		_osync_obj_engine_finish_stage(engine, cmd, error);
 
 		osync_obj_engine_event(engine, OSYNC_ENGINE_EVENT_MULTIPLIED, *error);
 
 		break;
 	case OSYNC_ENGINE_COMMAND_PREPARE_WRITE:
 
-		osync_obj_engine_prepare_write(engine, error);
+		_osync_obj_engine_finish_stage(engine, cmd, error);
 
 		osync_obj_engine_event(engine, OSYNC_ENGINE_EVENT_PREPARED_WRITE, *error);
 		break;
@@ -1266,6 +1957,8 @@ osync_bool osync_obj_engine_command(OSyncObjEngine *engine, OSyncEngineCmd cmd,
 		for (p = engine->active_sink_engines; p; p = p->next) {
 			sinkengine = p->data;
 
+			_osync_obj_engine_profile_start(engine, sinkengine, OSYNC_ENGINE_PHASE_SYNC_DONE);
+
 			if (!osync_client_proxy_sync_done(sinkengine->proxy, _osync_obj_engine_sync_done_callback, sinkengine, engine->objtype, error))
 				goto error;
 			osync_sink_engine_ref(sinkengine); // Note that sync_done callback has a reference
@@ -1404,6 +2097,19 @@ unsigned int osync_obj_engine_num_mapping_engines(OSyncObjEngine *engine)
 	return osync_list_length(engine->mapping_engines);
 }
 
+unsigned int osync_obj_engine_num_new_mappings(OSyncObjEngine *engine)
+{
+	mappingContext *ctx = NULL;
+
+	osync_assert(engine);
+
+	ctx = engine->mapping_context;
+	if (!ctx)
+		return 0;
+
+	return osync_list_length(ctx->new_mappings);
+}
+
 unsigned int osync_obj_engine_num_members(OSyncObjEngine *engine)
 {
 	osync_assert(engine);
@@ -1471,6 +2177,8 @@ osync_bool osync_obj_engine_prepare_write(OSyncObjEngine *engine, OSyncError **e
 	OSyncList *p;
 	osync_bool merger_enabled, converter_enabled;
 	OSyncGroup *group;
+	/* Converted copies of the multiplied data, shared by the sinks */
+	GHashTable *converted = NULL;
 
 	osync_assert(engine);
 
@@ -1481,6 +2189,8 @@ osync_bool osync_obj_engine_prepare_write(OSyncObjEngine *engine, OSyncError **e
 	if (!merger_enabled && !converter_enabled)
 		return TRUE;
 
+	converted = g_hash_table_new_full(g_direct_hash, g_direct_equal, (GDestroyNotify)osync_data_unref, (GDestroyNotify)g_hash_table_destroy);
+
 	for (p = engine->active_sink_engines; p; p = p->next) {
 		OSyncSinkEngine *sinkengine = p->data;
 
@@ -1489,14 +2199,16 @@ osync_bool osync_obj_engine_prepare_write(OSyncObjEngine *engine, OSyncError **e
 			goto error;
 
 		if (converter_enabled
-			&& !osync_sink_engine_convert_to_dest(sinkengine, engine->formatenv, error))
+			&& !osync_sink_engine_convert_to_dest(sinkengine, engine->formatenv, converted, error))
 			goto error;
 
 	}
 
+	g_hash_table_destroy(converted);
 	return TRUE;
 
 error:
+	g_hash_table_destroy(converted);
 	return FALSE;
 }
 
@@ -1521,6 +2233,8 @@ osync_bool osync_obj_engine_write(OSyncObjEngine *engine, OSyncError **error)
 		if (!osync_objtype_sink_get_write(objtype_sink)) 
 			continue;
 
+		_osync_obj_engine_profile_start(engine, sinkengine, OSYNC_ENGINE_PHASE_WRITE);
+
 		if (!osync_sink_engine_write(sinkengine, engine->archive, error))
 			goto error;
 	}
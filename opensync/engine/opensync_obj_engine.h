@@ -35,6 +35,18 @@ OSYNC_EXPORT const char *osync_obj_engine_get_objtype(OSyncObjEngine *engine);
 OSYNC_EXPORT void osync_obj_engine_set_slowsync(OSyncObjEngine *engine, osync_bool slowsync);
 OSYNC_EXPORT osync_bool osync_obj_engine_get_slowsync(OSyncObjEngine *engine);
 
+/** @brief Maps the changes of the OSyncObjEngine as they get received
+ *
+ * Each received change gets mapped against the changes already received
+ * from the other members, while the members still report their changes.
+ * Conflicts still get detected once all changes got read.
+ *
+ * @param engine Pointer to an OSyncObjEngine
+ * @param incremental TRUE to map the changes as they get received
+ */
+OSYNC_EXPORT void osync_obj_engine_set_incremental_mapping(OSyncObjEngine *engine, osync_bool incremental);
+OSYNC_EXPORT osync_bool osync_obj_engine_get_incremental_mapping(OSyncObjEngine *engine);
+
 OSYNC_EXPORT void osync_obj_engine_event(OSyncObjEngine *objengine, OSyncEngineEvent event, OSyncError *error);
 OSYNC_EXPORT osync_bool osync_obj_engine_command(OSyncObjEngine *engine, OSyncEngineCmd cmd, OSyncError **error);
 OSYNC_EXPORT void osync_obj_engine_set_callback(OSyncObjEngine *engine, OSyncObjEngineEventCallback callback, void *userdata);
@@ -34,6 +34,15 @@ struct OSyncObjEngine {
 	/** Status of Slow Sync **/
 	osync_bool slowsync;
 
+	/** Map the changes as they get received, instead of on MAP **/
+	osync_bool incremental_mapping;
+	/** State of the mapping until all changes got mapped **/
+	struct mappingContext *mapping_context;
+	/** Id of the next new mapping, 0 until the mapping table got scanned for it **/
+	osync_mappingid next_mapping_id;
+	/** Results of osync_obj_engine_compare_changes() during the sync **/
+	GHashTable *compare_results;
+
 	/** Pointer to assinged OSyncArchive */
 	OSyncArchive *archive;
 	
@@ -76,6 +85,11 @@ struct OSyncObjEngine {
 	int sink_sync_done;
 	/** Bit count total number of completed write-/commit-phases */
 	int sink_written;
+
+	/** Number of pending reads of change stubs */
+	unsigned int stub_reads;
+	/** First error of the reads of change stubs */
+	OSyncError *stub_error;
 	
 	/** Callback to give feedback to (parent) OSyncEngine */ 
 	OSyncObjEngineEventCallback callback;
@@ -90,6 +104,12 @@ struct OSyncObjEngine {
 
 	/** Conflicts already solved */
 	osync_bool conflicts_solved;
+
+	/** TRUE if the stage of stage_cmd already ran, see osync_obj_engine_run_stage() */
+	osync_bool stage_done;
+	OSyncEngineCmd stage_cmd;
+	osync_bool stage_result;
+	OSyncError *stage_error;
 };
 
 OSyncMappingEngine *_osync_obj_engine_create_mapping_engine(OSyncObjEngine *engine, OSyncError **error);
@@ -101,6 +121,57 @@ OSyncMappingEngine *_osync_obj_engine_create_mapping_engine(OSyncObjEngine *engi
  */
 unsigned int osync_obj_engine_num_mapping_engines(OSyncObjEngine *engine);
 
+/*! @brief Get number of new mappings which are not part of the OSyncObjEngine yet
+ *
+ * With incremental mapping, received changes get mapped before MAP, which
+ * adds the new mappings to the OSyncObjEngine.
+ *
+ * @param engine Pointer to OSyncObjEngine
+ * @returns Number of new mappings
+ */
+OSYNC_TEST_EXPORT unsigned int osync_obj_engine_num_new_mappings(OSyncObjEngine *engine);
+
+/*! @brief Put all unmapped changes of the OSyncObjEngine into mappings
+ *
+ * Ends the mapping run, which drops the demerged clones of the changes.
+ *
+ * @param engine Pointer to OSyncObjEngine
+ * @param error Pointer to error struct, which get set on any error
+ * @returns TRUE on success, FALSE otherwise
+ */
+OSYNC_TEST_EXPORT osync_bool osync_obj_engine_map_changes(OSyncObjEngine *engine, OSyncError **error);
+
+/*! @brief Get the demerged clone of a change, as used for mapping
+ *
+ * A change gets demerged at most once per capabilities until it got
+ * mapped. The clone is owned by the OSyncObjEngine until then, or until
+ * every member has a change in its mapping or the mapping run ends.
+ *
+ * @param engine Pointer to OSyncObjEngine
+ * @param caps The capabilities of the peer member
+ * @param change The change to demerge
+ * @param error Pointer to error struct, which get set on any error
+ * @returns The demerged clone, NULL on error
+ */
+OSYNC_TEST_EXPORT OSyncChange *osync_obj_engine_demerged_change(OSyncObjEngine *engine, OSyncCapabilities *caps, OSyncChange *change, OSyncError **error);
+
+/*! @brief Compare two changes of this OSyncObjEngine
+ *
+ * Same as osync_change_compare(), but the result gets remembered until the
+ * OSyncObjEngine gets finalized. Mapping, conflict detection and duplication
+ * compare many of the same pairs, so each pair gets compared only once.
+ * A remembered result gets dropped if the data or changetype of one of the
+ * changes got replaced since. Object format compare functions are expected
+ * to be symmetric, the order of the changes doesn't matter.
+ *
+ * @param engine Pointer to an OSyncObjEngine
+ * @param leftchange The first change
+ * @param rightchange The second change
+ * @param error Pointer to error struct, which get set on any error
+ * @returns The result of the comparison, OSYNC_CONV_DATA_UNKNOWN on error
+ */
+OSYNC_TEST_EXPORT OSyncConvCmpResult osync_obj_engine_compare_changes(OSyncObjEngine *engine, OSyncChange *leftchange, OSyncChange *rightchange, OSyncError **error);
+
 /*! @brief Prepare the OSyncObjEngine for writing
  *
  * This function prepare the write process, by demerging and converting if
@@ -112,6 +183,20 @@ unsigned int osync_obj_engine_num_mapping_engines(OSyncObjEngine *engine);
  */
 osync_bool osync_obj_engine_prepare_write(OSyncObjEngine *engine, OSyncError **error);
 
+/*! @brief Run the stage of a command ahead of the command
+ *
+ * The MAP, MULTIPLY and PREPARE_WRITE commands start with a stage which
+ * only works on the mappings and sink engines of this OSyncObjEngine and
+ * doesn't call back into the OSyncEngine. This runs the stage, so it can
+ * happen in a thread of its own while other OSyncObjEngines do the same.
+ * The result gets picked up by the next osync_obj_engine_command() for cmd,
+ * which has to be called from the engine thread.
+ *
+ * @param engine Pointer to an OSyncObjEngine
+ * @param cmd The command whose stage should run
+ */
+void osync_obj_engine_run_stage(OSyncObjEngine *engine, OSyncEngineCmd cmd);
+
 /*! @brief Start write/commit for OSyncObjEngine
  *
  * This function writes/commits the entries of all OSyncSinkEngine, which are
@@ -55,6 +55,10 @@ OSyncSinkEngine *osync_sink_engine_new(int position, OSyncClientProxy *proxy, OS
 	
 	sinkengine->engine = objengine;
 	osync_obj_engine_ref(objengine);
+
+	sinkengine->uid_index = g_hash_table_new_full(g_str_hash, g_str_equal, osync_free, (GDestroyNotify)osync_list_free);
+	sinkengine->indexed_uids = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, osync_free);
+	sinkengine->stubs = g_hash_table_new_full(g_str_hash, g_str_equal, osync_free, (GDestroyNotify)osync_change_unref);
 	
 	osync_trace(TRACE_EXIT, "%s: %p", __func__, sinkengine);
 	return sinkengine;
@@ -91,6 +95,10 @@ void osync_sink_engine_unref(OSyncSinkEngine *engine)
 			
 			engine->entries = osync_list_remove(engine->entries, engine->entries->data);
 		}
+
+		g_hash_table_destroy(engine->uid_index);
+		g_hash_table_destroy(engine->indexed_uids);
+		g_hash_table_destroy(engine->stubs);
 		
 		osync_obj_engine_unref(engine->engine);
 
@@ -111,6 +119,66 @@ osync_bool osync_sink_engine_is_connected(OSyncSinkEngine *engine)
 	return !!(objengine->sink_connects & (1 << engine->position));
 }
 
+void osync_sink_engine_index_entry(OSyncSinkEngine *engine, OSyncMappingEntryEngine *entry_engine)
+{
+	const char *uid = NULL;
+	OSyncList *entries = NULL;
+
+	osync_assert(engine);
+	osync_assert(entry_engine);
+
+	osync_sink_engine_unindex_entry(engine, entry_engine);
+
+	uid = osync_mapping_entry_get_uid(entry_engine->entry);
+	if (!uid)
+		return;
+
+	/* Keep the order of the entries, the first one matches */
+	entries = g_hash_table_lookup(engine->uid_index, uid);
+	entries = osync_list_append(entries, entry_engine);
+	g_hash_table_replace(engine->uid_index, osync_strdup(uid), entries);
+	g_hash_table_insert(engine->indexed_uids, entry_engine, osync_strdup(uid));
+}
+
+void osync_sink_engine_unindex_entry(OSyncSinkEngine *engine, OSyncMappingEntryEngine *entry_engine)
+{
+	const char *uid = NULL;
+	OSyncList *entries = NULL;
+
+	osync_assert(engine);
+	osync_assert(entry_engine);
+
+	uid = g_hash_table_lookup(engine->indexed_uids, entry_engine);
+	if (!uid)
+		return;
+
+	entries = g_hash_table_lookup(engine->uid_index, uid);
+	entries = osync_list_remove(entries, entry_engine);
+	if (entries)
+		g_hash_table_replace(engine->uid_index, osync_strdup(uid), entries);
+	else
+		g_hash_table_remove(engine->uid_index, uid);
+
+	g_hash_table_remove(engine->indexed_uids, entry_engine);
+}
+
+OSyncMappingEntryEngine *osync_sink_engine_find_entry(OSyncSinkEngine *engine, OSyncChange *change)
+{
+	OSyncList *e = NULL;
+
+	osync_assert(engine);
+	osync_assert(change);
+
+	for (e = g_hash_table_lookup(engine->uid_index, osync_change_get_uid(change)); e; e = e->next) {
+		OSyncMappingEntryEngine *entry_engine = e->data;
+
+		if (osync_entry_engine_matches(entry_engine, change))
+			return entry_engine;
+	}
+
+	return NULL;
+}
+
 const OSyncList *osync_sink_engine_get_mapping_entry_engines(OSyncSinkEngine *engine)
 {
 	osync_return_val_if_fail(engine, NULL);
@@ -165,7 +233,7 @@ error:
 	return FALSE;
 }
 
-osync_bool osync_sink_engine_convert_to_dest(OSyncSinkEngine *engine, OSyncFormatEnv *formatenv, OSyncError **error)
+osync_bool osync_sink_engine_convert_to_dest(OSyncSinkEngine *engine, OSyncFormatEnv *formatenv, GHashTable *converted, OSyncError **error)
 {
 	OSyncList *o;
 	OSyncMember *member;
@@ -198,7 +266,7 @@ osync_bool osync_sink_engine_convert_to_dest(OSyncSinkEngine *engine, OSyncForma
 		if (osync_change_get_changetype(entry_engine->change) == OSYNC_CHANGE_TYPE_DELETED)
 			continue;
 
-		if (!osync_entry_engine_convert(entry_engine, formatenv, objtype_sink, &path, error))
+		if (!osync_entry_engine_convert(entry_engine, formatenv, objtype_sink, &path, converted, error))
 			goto error;
 	}
 
@@ -215,11 +283,33 @@ error:
 	return FALSE;
 }
 
+/* Commits the collected changes with a single message, or a plain
+ * commit_change if there is only one */
+static osync_bool _osync_sink_engine_commit_batch(OSyncSinkEngine *engine, OSyncChange **changes, void **entry_engines, unsigned int *num_changes, OSyncError **error)
+{
+	osync_bool ret = TRUE;
+
+	if (*num_changes == 1)
+		ret = osync_client_proxy_commit_change(engine->proxy,
+				osync_obj_engine_commit_change_callback,
+				entry_engines[0], changes[0], error);
+	else if (*num_changes > 1)
+		ret = osync_client_proxy_commit_changes(engine->proxy,
+				osync_obj_engine_commit_change_callback,
+				entry_engines, changes, *num_changes, error);
+
+	*num_changes = 0;
+	return ret;
+}
+
 osync_bool osync_sink_engine_write(OSyncSinkEngine *engine, OSyncArchive *archive, OSyncError **error)
 {
 	OSyncList *o;
 	const char *objtype;
 	OSyncMember *member;
+	OSyncChange **batch_changes = NULL;
+	void **batch_entry_engines = NULL;
+	unsigned int batch_size, num_batched = 0;
 
 	osync_assert(engine);
 	osync_assert(archive);
@@ -227,6 +317,18 @@ osync_bool osync_sink_engine_write(OSyncSinkEngine *engine, OSyncArchive *archiv
 	objtype = osync_obj_engine_get_objtype(engine->engine);
 	member = osync_client_proxy_get_member(engine->proxy);
 
+	batch_size = osync_client_proxy_get_commit_batch_size(engine->proxy);
+	if (!batch_size)
+		batch_size = 1;
+
+	batch_changes = osync_try_malloc0(sizeof(OSyncChange *) * batch_size, error);
+	if (!batch_changes)
+		goto error;
+
+	batch_entry_engines = osync_try_malloc0(sizeof(void *) * batch_size, error);
+	if (!batch_entry_engines)
+		goto error;
+
 	for (o = engine->entries; o; o = o->next) {
 		OSyncMappingEntryEngine *entry_engine = o->data;
 		osync_assert(entry_engine);
@@ -242,9 +344,12 @@ osync_bool osync_sink_engine_write(OSyncSinkEngine *engine, OSyncArchive *archiv
 					osync_change_get_objtype(change), 
 					osync_member_get_id(member));
 
-			if (!osync_client_proxy_commit_change(engine->proxy, 
-						osync_obj_engine_commit_change_callback, 
-						entry_engine, change, error))
+			batch_changes[num_batched] = change;
+			batch_entry_engines[num_batched] = entry_engine;
+			num_batched++;
+
+			if (num_batched == batch_size
+			    && !_osync_sink_engine_commit_batch(engine, batch_changes, batch_entry_engines, &num_batched, error))
 				goto error;
 
 		} else if (entry_engine->change) {
@@ -270,12 +375,22 @@ osync_bool osync_sink_engine_write(OSyncSinkEngine *engine, OSyncArchive *archiv
 		}
 	}
 
+	if (!_osync_sink_engine_commit_batch(engine, batch_changes, batch_entry_engines, &num_batched, error))
+		goto error;
+
+	osync_free(batch_entry_engines);
+	batch_entry_engines = NULL;
+	osync_free(batch_changes);
+	batch_changes = NULL;
+
 	if (!osync_client_proxy_committed_all(engine->proxy, osync_obj_engine_written_callback, engine, objtype, error))
 		goto error;
 
 	return TRUE;
 
 error:
+	osync_free(batch_entry_engines);
+	osync_free(batch_changes);
 	return FALSE;
 }
 
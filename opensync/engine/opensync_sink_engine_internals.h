@@ -35,15 +35,49 @@ struct OSyncSinkEngine {
 	OSyncObjEngine *engine;
 	/** List of assinged OSyncMappingEntryEngine elements */
 	OSyncList *entries;
+	/** Lists of the entries by the UID of their OSyncMappingEntry */
+	GHashTable *uid_index;
+	/** UID under which each entry got indexed */
+	GHashTable *indexed_uids;
 	/** List of assinged OSyncMappingEntryEngine elemebts, but unmapped (no counter-entry) */
 	OSyncList *unmapped;
+	/** Change stubs whose data got requested from the client, by UID */
+	GHashTable *stubs;
 };
 
-OSyncSinkEngine *osync_sink_engine_new(int position, OSyncClientProxy *proxy, OSyncObjEngine *objengine, OSyncError **error);
+OSYNC_TEST_EXPORT OSyncSinkEngine *osync_sink_engine_new(int position, OSyncClientProxy *proxy, OSyncObjEngine *objengine, OSyncError **error);
 OSyncSinkEngine *osync_sink_engine_ref(OSyncSinkEngine *engine);
-void osync_sink_engine_unref(OSyncSinkEngine *engine);
+OSYNC_TEST_EXPORT void osync_sink_engine_unref(OSyncSinkEngine *engine);
 osync_bool osync_sink_engine_is_connected(OSyncSinkEngine *engine);
 
+/** @brief Adds an OSyncMappingEntryEngine to the UID index
+ *
+ * Has to be called whenever an entry got assigned to the OSyncSinkEngine or
+ * the UID of its OSyncMappingEntry changed. Entries without UID are not
+ * indexed, since they can't match any change.
+ *
+ * @param engine Pointer to an OSyncSinkEngine
+ * @param entry_engine Pointer to an OSyncMappingEntryEngine of engine
+ */
+OSYNC_TEST_EXPORT void osync_sink_engine_index_entry(OSyncSinkEngine *engine, OSyncMappingEntryEngine *entry_engine);
+
+/** @brief Removes an OSyncMappingEntryEngine from the UID index
+ *
+ * @param engine Pointer to an OSyncSinkEngine
+ * @param entry_engine Pointer to an OSyncMappingEntryEngine which gets removed from engine
+ */
+void osync_sink_engine_unindex_entry(OSyncSinkEngine *engine, OSyncMappingEntryEngine *entry_engine);
+
+/** @brief Find the OSyncMappingEntryEngine which matches a change
+ *
+ * See osync_entry_engine_matches().
+ *
+ * @param engine Pointer to an OSyncSinkEngine
+ * @param change Pointer to the reported change
+ * @returns The matching OSyncMappingEntryEngine or NULL if there is none
+ */
+OSYNC_TEST_EXPORT OSyncMappingEntryEngine *osync_sink_engine_find_entry(OSyncSinkEngine *engine, OSyncChange *change);
+
 /** @brief Demerge all entries of OSyncSinkEngine
  *
  * If the Member/Client of the OSyncSinkEngine doesn't have capabilities
@@ -65,10 +99,11 @@ osync_bool osync_sink_engine_demerge(OSyncSinkEngine *engine, OSyncArchive *arch
  *
  * @param engine Pointer to an OSyncSinkEngine which should convert 
  * @param formatenv Pointer to an OSyncFormatEnv for plugins to use
+ * @param converted Cache of converted data, see osync_entry_engine_convert()
  * @param error Pointer to error struct, which get set on any error
  * @returns TRUE on success, FALSE otherwise
  */
-osync_bool osync_sink_engine_convert_to_dest(OSyncSinkEngine *engine, OSyncFormatEnv *formatenv, OSyncError **error);
+osync_bool osync_sink_engine_convert_to_dest(OSyncSinkEngine *engine, OSyncFormatEnv *formatenv, GHashTable *converted, OSyncError **error);
 
 /** @brief Write/commit all entries of OSyncSinkEngine to the client/peer
  *
@@ -250,6 +250,29 @@ time_t osync_objformat_get_revision(OSyncObjFormat *format, const char *data, un
 	return format->revision_func(data, size, format->user_data, error);
 }
 
+void osync_objformat_set_mapping_key_func(OSyncObjFormat *format, OSyncFormatMappingKeyFunc mapping_key_func)
+{
+	osync_return_if_fail(format);
+	format->mapping_key_func = mapping_key_func;
+}
+
+osync_bool osync_objformat_has_mapping_key(OSyncObjFormat *format)
+{
+	osync_assert(format);
+	return format->mapping_key_func ? TRUE : FALSE;
+}
+
+char *osync_objformat_get_mapping_key(OSyncObjFormat *format, const char *data, unsigned int size, OSyncError **error)
+{
+	osync_assert(format);
+	osync_assert(data);
+
+	if (!format->mapping_key_func)
+		return NULL;
+
+	return format->mapping_key_func(data, size, format->user_data, error);
+}
+
 void osync_objformat_set_marshal_func(OSyncObjFormat *format, OSyncFormatMarshalFunc marshal_func)
 {
 	osync_return_if_fail(format);
@@ -43,6 +43,7 @@ typedef time_t (* OSyncFormatRevisionFunc) (const char *data, unsigned int size,
 typedef osync_bool (* OSyncFormatMarshalFunc) (const char *input, unsigned int inpsize, OSyncMarshal *marshal, void *user_data, OSyncError **error);
 typedef osync_bool (* OSyncFormatDemarshalFunc) (OSyncMarshal *marshal, char **output, unsigned int *outpsize, void *user_data, OSyncError **error);
 typedef osync_bool (* OSyncFormatValidateFunc) (const char *data, unsigned int size, void *user_data, OSyncError **error);
+typedef char *(* OSyncFormatMappingKeyFunc) (const char *data, unsigned int size, void *user_data, OSyncError **error);
 
 /**
  * @brief Creates a new object format
@@ -221,6 +222,25 @@ OSYNC_EXPORT void osync_objformat_set_demarshal_func(OSyncObjFormat *format, OSy
  */
 OSYNC_EXPORT void osync_objformat_set_validate_func(OSyncObjFormat *format, OSyncFormatValidateFunc validate_func);
 
+/**
+ * @brief Sets the optional mapping key function for an object format
+ *
+ * The mapping key is a fingerprint of an object, e.g. the normalized name
+ * of a contact. While mapping the changes of a slow-sync, only objects with
+ * the same key get compared with the compare function. Objects whose compare
+ * result would not be a mismatch must therefore have the same key. The key
+ * should only depend on data which all members keep, since objects may be
+ * compared after unsupported fields got removed.
+ *
+ * The returned key must be allocated with osync_try_malloc0() or
+ * osync_strdup*(). If NULL is returned without setting an error, the object
+ * gets compared with all others.
+ *
+ * @param format Pointer to the object format
+ * @param mapping_key_func The mapping key function to use
+ */
+OSYNC_EXPORT void osync_objformat_set_mapping_key_func(OSyncObjFormat *format, OSyncFormatMappingKeyFunc mapping_key_func);
+
 /**
  * @brief Prints the specified object
  *
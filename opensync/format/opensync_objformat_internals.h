@@ -69,6 +69,27 @@ OSYNC_TEST_EXPORT osync_bool osync_objformat_finalize(OSyncObjFormat *format, OS
  */
 OSYNC_TEST_EXPORT OSyncConvCmpResult osync_objformat_compare(OSyncObjFormat *format, const char *leftdata, unsigned int leftsize, const char *rightdata, unsigned int rightsize, OSyncError **error);
 
+/**
+ * @brief Checks if the object format provides mapping keys
+ *
+ * @param format Pointer to the object format
+ * @returns TRUE if a mapping key function is set
+ */
+OSYNC_TEST_EXPORT osync_bool osync_objformat_has_mapping_key(OSyncObjFormat *format);
+
+/**
+ * @brief Get the mapping key of an object
+ *
+ * See osync_objformat_set_mapping_key_func().
+ *
+ * @param format Pointer to the object format
+ * @param data Pointer to the object
+ * @param size the size in bytes of the object
+ * @param error Pointer to an error struct
+ * @returns The key, which the caller has to free, or NULL if there is none
+ */
+OSYNC_TEST_EXPORT char *osync_objformat_get_mapping_key(OSyncObjFormat *format, const char *data, unsigned int size, OSyncError **error);
+
 /**
  * @brief Duplicate an object of the specified format
  *
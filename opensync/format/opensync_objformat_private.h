@@ -61,6 +61,7 @@ struct OSyncObjFormat {
 	OSyncFormatMarshalFunc marshal_func;
 	OSyncFormatDemarshalFunc demarshal_func;
 	OSyncFormatValidateFunc validate_func;
+	OSyncFormatMappingKeyFunc mapping_key_func;
 };
 
 /*@}*/
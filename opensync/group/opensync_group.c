@@ -291,6 +291,8 @@ OSyncGroup *osync_group_new(OSyncError **error)
 
 	/* By default Converter is enabled */
 	group->converter_enabled = TRUE;
+
+	group->ipc_window = OSYNC_GROUP_IPC_WINDOW;
 	
 	osync_trace(TRACE_EXIT, "%s: %p", __func__, group);
 	return group;
@@ -537,6 +539,10 @@ osync_bool osync_group_save(OSyncGroup *group, OSyncError **error)
 	xmlNewChild(doc->children, NULL, (xmlChar*)"merger_enabled", (xmlChar*) (group->merger_enabled ? "true" : "false"));
 	xmlNewChild(doc->children, NULL, (xmlChar*)"converter_enabled", (xmlChar*) (group->converter_enabled ? "true" : "false"));
 
+	tmstr = osync_strdup_printf("%u", group->ipc_window);
+	xmlNewChild(doc->children, NULL, (xmlChar*)"ipc_window", (xmlChar*)tmstr);
+	osync_free(tmstr);
+
 
 	xmlSaveFormatFile(filename, doc, 1);
 	osync_xml_free_doc(doc);
@@ -687,6 +693,9 @@ osync_bool osync_group_load(OSyncGroup *group, const char *path, OSyncError **er
 			if (!xmlStrcmp(cur->name, (const xmlChar *)"converter_enabled"))
 				group->converter_enabled = (!g_ascii_strcasecmp("true", str)) ? TRUE : FALSE;
 
+			if (!xmlStrcmp(cur->name, (const xmlChar *)"ipc_window"))
+				group->ipc_window = (unsigned int)atoi(str);
+
 			// TODO: reimplement the filter!
 			/*if (!xmlStrcmp(cur->name, (const xmlChar *)"filter")) {
 				filternode = cur->xmlChildrenNode;
@@ -1019,6 +1028,20 @@ osync_bool osync_group_get_converter_enabled(OSyncGroup *group)
 	return group->converter_enabled;
 }
 
+unsigned int osync_group_get_ipc_window(OSyncGroup *group)
+{
+	osync_assert(group);
+
+	return group->ipc_window;
+}
+
+void osync_group_set_ipc_window(OSyncGroup *group, unsigned int window)
+{
+	osync_assert(group);
+
+	group->ipc_window = window;
+}
+
 void osync_group_set_converter_enabled(OSyncGroup *group, osync_bool converter_enabled)
 {
 	osync_assert(group);
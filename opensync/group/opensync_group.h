@@ -311,6 +311,27 @@ OSYNC_EXPORT osync_bool osync_group_get_converter_enabled(OSyncGroup *group);
  */
 OSYNC_EXPORT void osync_group_set_converter_enabled(OSyncGroup *group, osync_bool converter_enabled);
 
+/** @brief Get the IPC window of the group
+ * 
+ * The IPC window is the number of messages a plugin process or thread
+ * can send ahead of the engine, before it has to wait for the engine to
+ * catch up. This bounds the memory used for huge syncs.
+ * 
+ * @param group The group
+ * @return The number of messages, 0 if the window is disabled
+ */
+OSYNC_EXPORT unsigned int osync_group_get_ipc_window(OSyncGroup *group);
+
+/** @brief Configure the IPC window of the group
+ * 
+ * The default is OSYNC_GROUP_IPC_WINDOW.
+ * 
+ * @param group The group
+ * @param window The number of messages, 0 disables the window
+ */
+OSYNC_EXPORT void osync_group_set_ipc_window(OSyncGroup *group, unsigned int window);
+#define OSYNC_GROUP_IPC_WINDOW 256
+
 
 /** @brief Check if group configuration is up to date. 
  * 
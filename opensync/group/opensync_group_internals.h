@@ -57,6 +57,8 @@ struct OSyncGroup {
 	osync_bool merger_enabled;
 	/** The configured converter status of this group */
 	osync_bool converter_enabled;
+	/** The number of messages a plugin can send ahead of the engine */
+	unsigned int ipc_window;
 
 #ifdef OPENSYNC_UNITTESTS
 	/** Modify schema directory for unittesting */
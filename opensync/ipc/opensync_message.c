@@ -29,10 +29,48 @@
 #include "opensync_message_internals.h"
 #include "opensync_message_private.h"
 
+/* Freed messages, chained through their user_data */
+static GStaticMutex pool_lock = G_STATIC_MUTEX_INIT;
+static OSyncMessage *pool = NULL;
+static unsigned int pool_count = 0;
+
+static OSyncMessage *_osync_message_pool_get(OSyncError **error)
+{
+	OSyncMessage *message = NULL;
+
+	g_static_mutex_lock(&pool_lock);
+	if (pool) {
+		message = pool;
+		pool = message->user_data;
+		pool_count--;
+	}
+	g_static_mutex_unlock(&pool_lock);
+
+	if (!message)
+		return osync_try_malloc0(sizeof(OSyncMessage), error);
+
+	memset(message, 0, sizeof(OSyncMessage));
+	return message;
+}
+
+static void _osync_message_pool_put(OSyncMessage *message)
+{
+	g_static_mutex_lock(&pool_lock);
+	if (pool_count < OSYNC_MESSAGE_POOL_LIMIT) {
+		message->user_data = pool;
+		pool = message;
+		pool_count++;
+		message = NULL;
+	}
+	g_static_mutex_unlock(&pool_lock);
+
+	if (message)
+		osync_free(message);
+}
 
 OSyncMessage *osync_message_new(OSyncMessageCommand cmd, unsigned int size, OSyncError **error)
 {
-	OSyncMessage *message = osync_try_malloc0(sizeof(OSyncMessage), error);
+	OSyncMessage *message = _osync_message_pool_get(error);
 	if (!message)
 		return NULL;
 
@@ -41,7 +79,7 @@ OSyncMessage *osync_message_new(OSyncMessageCommand cmd, unsigned int size, OSyn
 
 	message->marshal = osync_marshal_sized_new(size, error);
 	if (!message->marshal) {
-		osync_free(message);
+		_osync_message_pool_put(message);
 		return NULL;
 	}
 
@@ -59,9 +97,16 @@ void osync_message_unref(OSyncMessage *message)
 {
 	if (g_atomic_int_dec_and_test(&(message->refCount))) {
 		
+		unsigned int i;
+
 		osync_marshal_unref(message->marshal);
+
+		for (i = 0; i < message->num_references; i++)
+			message->references[i].release(message->references[i].object);
+		if (message->references)
+			osync_free(message->references);
 		
-		osync_free(message);
+		_osync_message_pool_put(message);
 	}
 }
 
@@ -112,6 +157,11 @@ unsigned int osync_message_get_message_size(OSyncMessage *message)
 	return osync_marshal_get_marshal_size(message->marshal);
 }
 
+unsigned int osync_message_get_remaining_size(OSyncMessage *message)
+{
+	return osync_marshal_get_remaining_size(message->marshal);
+}
+
 osync_bool osync_message_set_message_size(OSyncMessage *message, unsigned int size, OSyncError **error)
 {
 	return osync_marshal_set_marshal_size(message->marshal, size, error);
@@ -343,8 +393,84 @@ char* osync_message_get_commandstr(OSyncMessage *message)
 			cmdstr = "OSYNC_MESSAGE_QUEUE_ERROR"; break;
 		case OSYNC_MESSAGE_QUEUE_HUP:
 			cmdstr = "OSYNC_MESSAGE_QUEUE_HUP"; break;
+		case OSYNC_MESSAGE_NEW_CHANGES:
+			cmdstr = "OSYNC_MESSAGE_NEW_CHANGES"; break;
+		case OSYNC_MESSAGE_COMMIT_CHANGES:
+			cmdstr = "OSYNC_MESSAGE_COMMIT_CHANGES"; break;
+		case OSYNC_MESSAGE_QUEUE_CREDIT:
+			cmdstr = "OSYNC_MESSAGE_QUEUE_CREDIT"; break;
+		case OSYNC_MESSAGE_QUEUE_STRINGS:
+			cmdstr = "OSYNC_MESSAGE_QUEUE_STRINGS"; break;
 		}
 	
 	return cmdstr;	
 }
 
+void osync_message_set_by_reference(OSyncMessage *message, osync_bool by_reference)
+{
+	osync_assert(message);
+	message->by_reference = by_reference;
+}
+
+osync_bool osync_message_is_by_reference(OSyncMessage *message)
+{
+	osync_assert(message);
+	return message->by_reference;
+}
+
+osync_bool osync_message_write_reference(OSyncMessage *message, void *object, OSyncMessageReleaseFn release, OSyncError **error)
+{
+	OSyncMessageReference *reference = NULL;
+
+	osync_assert(message);
+	osync_assert(message->by_reference);
+	osync_assert(release);
+
+	if (message->num_references == message->references_alloc) {
+		unsigned int alloc = message->references_alloc ? message->references_alloc * 2 : 4;
+		OSyncMessageReference *references = osync_try_malloc0(alloc * sizeof(OSyncMessageReference), error);
+		if (!references)
+			goto error;
+
+		if (message->references) {
+			memcpy(references, message->references, message->num_references * sizeof(OSyncMessageReference));
+			osync_free(message->references);
+		}
+
+		message->references = references;
+		message->references_alloc = alloc;
+	}
+
+	/* Only the index goes into the marshal */
+	if (!osync_message_write_uint(message, message->num_references, error))
+		goto error;
+
+	reference = &message->references[message->num_references++];
+	reference->object = object;
+	reference->release = release;
+
+	return TRUE;
+
+error:
+	release(object);
+	return FALSE;
+}
+
+osync_bool osync_message_read_reference(OSyncMessage *message, void **object, OSyncError **error)
+{
+	unsigned int index = 0;
+
+	osync_assert(message);
+	osync_assert(object);
+
+	if (!osync_message_read_uint(message, &index, error))
+		return FALSE;
+
+	if (index >= message->num_references) {
+		osync_error_set(error, OSYNC_ERROR_GENERIC, "Message refers to unknown object %u", index);
+		return FALSE;
+	}
+
+	*object = message->references[index].object;
+	return TRUE;
+}
@@ -58,9 +58,16 @@ typedef enum {
 	OSYNC_MESSAGE_MAPPINGENTRY_CHANGED,
 	OSYNC_MESSAGE_ERROR,
 	OSYNC_MESSAGE_QUEUE_ERROR,
-	OSYNC_MESSAGE_QUEUE_HUP
+	OSYNC_MESSAGE_QUEUE_HUP,
+	OSYNC_MESSAGE_NEW_CHANGES,
+	OSYNC_MESSAGE_COMMIT_CHANGES,
+	OSYNC_MESSAGE_QUEUE_CREDIT,
+	OSYNC_MESSAGE_QUEUE_STRINGS
 } OSyncMessageCommand;
 
+/** @brief Number of message commands, keep it behind the last command */
+#define OSYNC_MESSAGE_NUM_COMMANDS (OSYNC_MESSAGE_QUEUE_STRINGS + 1)
+
 /** @brief Function which can receive messages
  * 
  * @param message The reply that is being received.
@@ -69,6 +76,13 @@ typedef enum {
  */
 typedef void (*OSyncMessageHandler)(OSyncMessage *message, void *user_data);
 
+/** @brief Drops a reference to an object passed along with a message
+ * 
+ * @param object The object
+ * 
+ */
+typedef void (*OSyncMessageReleaseFn)(void *object);
+
 /** @brief Creates a new message of the given command
  * 
  * @param cmd The message command 
@@ -176,6 +190,14 @@ OSYNC_TEST_EXPORT OSyncMarshal *osync_message_get_marshal(OSyncMessage *message)
  */
 OSYNC_TEST_EXPORT unsigned int osync_message_get_message_size(OSyncMessage *message);
 
+/** @brief Get the number of bytes of the message which are not read yet
+ *
+ * @param message The message
+ * @returns The number of unread bytes
+ *
+ */
+OSYNC_TEST_EXPORT unsigned int osync_message_get_remaining_size(OSyncMessage *message);
+
 /** @brief Set message size for supplied message object
  * 
  * @param message The message
@@ -392,6 +414,43 @@ OSYNC_TEST_EXPORT osync_bool osync_message_read_const_string(OSyncMessage *messa
  */
 OSYNC_TEST_EXPORT osync_bool osync_message_read_buffer(OSyncMessage *message, void **value, unsigned int *size, OSyncError **error);
 
+/** @brief Let the message pass objects by reference
+ *
+ * Only possible if sender and receiver share the address space, i.e. for
+ * thread communication. See osync_message_write_reference().
+ *
+ * @param message The message
+ * @param by_reference TRUE to pass objects by reference
+ */
+OSYNC_TEST_EXPORT void osync_message_set_by_reference(OSyncMessage *message, osync_bool by_reference);
+
+/** @brief Check if the message passes objects by reference
+ *
+ * @param message The message
+ * @returns TRUE if objects are passed by reference
+ */
+osync_bool osync_message_is_by_reference(OSyncMessage *message);
+
+/** @brief Appends a reference to an object instead of its serialization
+ *
+ * The message takes over the reference passed with object and releases it
+ * once the message is freed.
+ *
+ * @param message The message
+ * @param object The object
+ * @param release Function to drop the reference
+ * @param error Pointer to a error-struct
+ */
+OSYNC_TEST_EXPORT osync_bool osync_message_write_reference(OSyncMessage *message, void *object, OSyncMessageReleaseFn release, OSyncError **error);
+
+/** @brief Reads a reference written with osync_message_write_reference()
+ *
+ * @param message The message
+ * @param object Reference to store the object, which is owned by the message
+ * @param error Pointer to a error-struct
+ */
+OSYNC_TEST_EXPORT osync_bool osync_message_read_reference(OSyncMessage *message, void **object, OSyncError **error);
+
 /*@}*/
 
 #endif /* _OPENSYNC_MESSAGES_INTERNALS_H */
@@ -31,6 +31,16 @@
  */
 
 /*@{*/
+/*! @brief An object passed by reference along with a message
+ * 
+ */
+typedef struct OSyncMessageReference {
+	/** The referenced object */
+	void *object;
+	/** Drops the reference the message holds */
+	OSyncMessageReleaseFn release;
+} OSyncMessageReference;
+
 /*! @brief A OSyncMessage
  * 
  */
@@ -50,8 +60,20 @@ struct OSyncMessage {
 	osync_bool is_answered;
 	/** The internal OSyncMarshal object **/
 	OSyncMarshal *marshal;
+	/** If objects get passed by reference instead of being marshaled */
+	osync_bool by_reference;
+	/** Objects passed by reference, the marshal holds their index */
+	OSyncMessageReference *references;
+	/** Number of objects passed by reference */
+	unsigned int num_references;
+	/** Allocated slots of references */
+	unsigned int references_alloc;
 };
 
+/** @brief Maximal number of freed messages kept for reuse
+ */
+#define OSYNC_MESSAGE_POOL_LIMIT 1024
+
 /*@}*/
 
 #endif /* _OPENSYNC_MESSAGES_PRIVATE_H */
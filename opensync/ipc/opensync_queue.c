@@ -24,11 +24,360 @@
 #include "opensync_internals.h"
 
 #include "opensync_message_internals.h"
+#include "common/opensync_marshal_internals.h"
 #include "opensync_queue.h"
 
 #include "opensync_queue_internals.h"
+#include "opensync_shmring_internals.h"
 #include "opensync_queue_private.h"
 
+/* Replies and messages generated by the queue itself are not subject to
+ * flow control, they are needed to resolve pending commands */
+static osync_bool _osync_queue_needs_credit(OSyncMessage *message)
+{
+	switch (osync_message_get_cmd(message)) {
+	case OSYNC_MESSAGE_REPLY:
+	case OSYNC_MESSAGE_ERRORREPLY:
+	case OSYNC_MESSAGE_QUEUE_CREDIT:
+	case OSYNC_MESSAGE_QUEUE_STRINGS:
+	case OSYNC_MESSAGE_QUEUE_ERROR:
+	case OSYNC_MESSAGE_QUEUE_HUP:
+		return FALSE;
+	default:
+		return TRUE;
+	}
+}
+
+/* Applies the credits granted by the remote receiver to the queue
+ * we send our messages on */
+static void _osync_queue_receive_credits(OSyncQueue *queue, OSyncMessage *message)
+{
+	OSyncQueue *sender = queue->reply_queue;
+	OSyncError *error = NULL;
+	long long int limit = 0;
+
+	if (!osync_message_read_long_long_int(message, &limit, &error)) {
+		osync_trace(TRACE_INTERNAL, "Unable to read credits: %s", osync_error_print(&error));
+		osync_error_unref(&error);
+		return;
+	}
+
+	if (!sender) {
+		osync_trace(TRACE_INTERNAL, "Ignoring credits, queue %p has no reply queue", queue);
+		return;
+	}
+
+	g_mutex_lock(sender->creditLock);
+	sender->credit_enabled = TRUE;
+	if (limit > sender->credit_limit)
+		sender->credit_limit = limit;
+	g_cond_broadcast(sender->creditCond);
+	g_mutex_unlock(sender->creditLock);
+}
+
+static void _osync_queue_grant_credits(OSyncQueue *queue, OSyncQueue *credit_queue, long long int limit)
+{
+	OSyncMessage *message = NULL;
+	OSyncError *error = NULL;
+
+	message = osync_message_new(OSYNC_MESSAGE_QUEUE_CREDIT, 0, &error);
+	if (!message)
+		goto error;
+
+	if (!osync_message_write_long_long_int(message, limit, &error))
+		goto error_free_message;
+
+	if (!osync_queue_send_message(credit_queue, NULL, message, &error))
+		goto error_free_message;
+
+	osync_message_unref(message);
+	return;
+
+ error_free_message:
+	osync_message_unref(message);
+ error:
+	osync_trace(TRACE_INTERNAL, "Unable to grant credits on queue %p: %s", queue, osync_error_print(&error));
+	osync_error_unref(&error);
+}
+
+/* Called for every dispatched message, grants new credits once half of
+ * the window got consumed */
+static void _osync_queue_consume_credit(OSyncQueue *queue, OSyncMessage *message)
+{
+	OSyncQueue *credit_queue = NULL;
+	long long int limit = 0;
+
+	if (!_osync_queue_needs_credit(message))
+		return;
+
+	g_mutex_lock(queue->creditLock);
+
+	queue->credit_consumed++;
+
+	if (queue->credit_window && queue->credit_queue
+	    && queue->credit_consumed + queue->credit_window - queue->credit_granted >= MAX(queue->credit_window / 2, 1)) {
+		limit = queue->credit_consumed + queue->credit_window;
+		queue->credit_granted = limit;
+		credit_queue = osync_queue_ref(queue->credit_queue);
+	}
+
+	g_mutex_unlock(queue->creditLock);
+
+	if (credit_queue) {
+		_osync_queue_grant_credits(queue, credit_queue, limit);
+		osync_queue_unref(credit_queue);
+	}
+}
+
+/* Adds the strings announced by the remote sender. They always arrive
+ * before the first compact message which refers to them */
+static void _osync_queue_receive_strings(OSyncQueue *queue, OSyncMessage *message)
+{
+	OSyncError *error = NULL;
+	unsigned int first = 0, count = 0, i;
+	char *value = NULL;
+
+	osync_message_read_uint(message, &first, &error);
+	osync_message_read_uint(message, &count, &error);
+
+	for (i = 0; i < count && !osync_error_is_set(&error); i++) {
+		if (!osync_message_read_string(message, &value, &error))
+			break;
+
+		osync_marshal_strings_add(queue->recv_strings, first + i, value ? value : "", &error);
+		osync_free(value);
+	}
+
+	if (osync_error_is_set(&error)) {
+		osync_trace(TRACE_ERROR, "Unable to read announced strings: %s", osync_error_print(&error));
+		osync_error_unref(&error);
+	}
+}
+
+/* Keeps the largest length of an async queue */
+static void _osync_queue_stats_depth(unsigned int *peak, GMutex *lock, GAsyncQueue *async_queue)
+{
+	gint length = g_async_queue_length(async_queue);
+
+	if (length <= 0 || (unsigned int) length <= *peak)
+		return;
+
+	g_mutex_lock(lock);
+	if ((unsigned int) length > *peak)
+		*peak = length;
+	g_mutex_unlock(lock);
+}
+
+static void _osync_queue_push_incoming(OSyncQueue *queue, OSyncMessage *message)
+{
+	/* Credits are handled right away, they must not wait behind
+	   messages blocked by the pending limit */
+	if (osync_message_get_cmd(message) == OSYNC_MESSAGE_QUEUE_CREDIT) {
+		_osync_queue_receive_credits(queue, message);
+		osync_message_unref(message);
+		return;
+	}
+
+	if (osync_message_get_cmd(message) == OSYNC_MESSAGE_QUEUE_STRINGS) {
+		_osync_queue_receive_strings(queue, message);
+		osync_message_unref(message);
+		return;
+	}
+
+	g_async_queue_push(queue->incoming, message);
+	osync_wakeup_signal(queue->incoming_wakeup);
+
+	_osync_queue_stats_depth(&queue->stats.incoming_peak, queue->statsLock, queue->incoming);
+}
+
+static void _osync_queue_stats_sent(OSyncQueue *queue, unsigned int size)
+{
+	g_mutex_lock(queue->statsLock);
+	queue->stats.messages_sent++;
+	queue->stats.bytes_sent += size;
+	g_mutex_unlock(queue->statsLock);
+}
+
+static void _osync_queue_stats_received(OSyncQueue *queue, unsigned int size)
+{
+	g_mutex_lock(queue->statsLock);
+	queue->stats.messages_received++;
+	queue->stats.bytes_received += size;
+	g_mutex_unlock(queue->statsLock);
+}
+
+static void _osync_queue_stats_latency(OSyncQueue *queue, OSyncPendingMessage *pending)
+{
+	GTimeVal now;
+	long long int usec;
+	unsigned int bucket = 0;
+
+	g_get_current_time(&now);
+	usec = (now.tv_sec - pending->sent.tv_sec) * 1000000LL + (now.tv_usec - pending->sent.tv_usec);
+
+	/* Log2 buckets, the clock might have been set back */
+	while (usec > 1 && bucket < OSYNC_QUEUE_STATS_LATENCY_BUCKETS - 1) {
+		usec >>= 1;
+		bucket++;
+	}
+
+	if ((unsigned int) pending->cmd >= OSYNC_MESSAGE_NUM_COMMANDS)
+		return;
+
+	g_mutex_lock(queue->statsLock);
+	queue->stats.latency[pending->cmd][bucket]++;
+	g_mutex_unlock(queue->statsLock);
+}
+
+static int _osync_queue_timeval_cmp(const GTimeVal *a, const GTimeVal *b)
+{
+	if (a->tv_sec != b->tv_sec)
+		return a->tv_sec < b->tv_sec ? -1 : 1;
+
+	if (a->tv_usec != b->tv_usec)
+		return a->tv_usec < b->tv_usec ? -1 : 1;
+
+	return 0;
+}
+
+/* Wakes up the queue thread if the expiration is earlier than the deadline
+ * the timeout source is currently sleeping for. The caller has to hold
+ * the pending lock. */
+static void _osync_queue_arm_timeout(OSyncQueue *queue, const GTimeVal *expiration)
+{
+	if (queue->timeout_deadline.tv_sec == 0
+	    || _osync_queue_timeval_cmp(expiration, &queue->timeout_deadline) < 0)
+		osync_wakeup_signal(queue->wakeup);
+}
+
+static guint _osync_queue_id_hash(gconstpointer key)
+{
+	const osync_messageid id = *((const osync_messageid *) key);
+
+	return (guint) (id ^ (id >> 32));
+}
+
+static gboolean _osync_queue_id_equal(gconstpointer a, gconstpointer b)
+{
+	return *((const osync_messageid *) a) == *((const osync_messageid *) b);
+}
+
+static gboolean _osync_queue_expires_before(OSyncPendingMessage *a, OSyncPendingMessage *b)
+{
+	return _osync_queue_timeval_cmp(&a->timeout_info->expiration, &b->timeout_info->expiration) < 0;
+}
+
+static void _osync_queue_timeout_heap_set(OSyncQueue *queue, guint index, OSyncPendingMessage *pending)
+{
+	g_ptr_array_index(queue->pendingTimeouts, index) = pending;
+	pending->heap_index = index;
+}
+
+static void _osync_queue_timeout_heap_sift_up(OSyncQueue *queue, guint index)
+{
+	OSyncPendingMessage *pending = g_ptr_array_index(queue->pendingTimeouts, index);
+
+	while (index > 0) {
+		guint parent = (index - 1) / 2;
+		OSyncPendingMessage *parent_pending = g_ptr_array_index(queue->pendingTimeouts, parent);
+
+		if (!_osync_queue_expires_before(pending, parent_pending))
+			break;
+
+		_osync_queue_timeout_heap_set(queue, index, parent_pending);
+		index = parent;
+	}
+
+	_osync_queue_timeout_heap_set(queue, index, pending);
+}
+
+static void _osync_queue_timeout_heap_sift_down(OSyncQueue *queue, guint index)
+{
+	GPtrArray *heap = queue->pendingTimeouts;
+	OSyncPendingMessage *pending = g_ptr_array_index(heap, index);
+
+	while (2 * index + 1 < heap->len) {
+		guint child = 2 * index + 1;
+
+		if (child + 1 < heap->len
+		    && _osync_queue_expires_before(g_ptr_array_index(heap, child + 1), g_ptr_array_index(heap, child)))
+			child++;
+
+		if (!_osync_queue_expires_before(g_ptr_array_index(heap, child), pending))
+			break;
+
+		_osync_queue_timeout_heap_set(queue, index, g_ptr_array_index(heap, child));
+		index = child;
+	}
+
+	_osync_queue_timeout_heap_set(queue, index, pending);
+}
+
+static void _osync_queue_timeout_heap_remove(OSyncQueue *queue, OSyncPendingMessage *pending)
+{
+	GPtrArray *heap = queue->pendingTimeouts;
+	guint index = pending->heap_index;
+	OSyncPendingMessage *last = g_ptr_array_remove_index(heap, heap->len - 1);
+
+	/* Fill the hole with the last element and restore the heap order */
+	if (last != pending) {
+		_osync_queue_timeout_heap_set(queue, index, last);
+		_osync_queue_timeout_heap_sift_down(queue, index);
+		_osync_queue_timeout_heap_sift_up(queue, last->heap_index);
+	}
+}
+
+/* Returns the pending reply with the earliest timeout or NULL. The caller has
+ * to hold the pending lock. */
+static OSyncPendingMessage *_osync_queue_first_timeout(OSyncQueue *queue)
+{
+	if (!queue->pendingTimeouts->len)
+		return NULL;
+
+	return g_ptr_array_index(queue->pendingTimeouts, 0);
+}
+
+/* Rejects a pending message with the id of another one, its reply or
+ * timeout could not be told apart. The caller has to hold the pending lock. */
+static osync_bool _osync_queue_add_pending(OSyncQueue *queue, OSyncPendingMessage *pending, OSyncError **error)
+{
+	if (g_hash_table_lookup(queue->pendingTable, &pending->id)) {
+		osync_error_set(error, OSYNC_ERROR_GENERIC, "A message with id %lli is already pending", pending->id);
+		return FALSE;
+	}
+
+	pending->link = g_list_alloc();
+	pending->link->data = pending;
+	g_queue_push_tail_link(queue->pendingReplies, pending->link);
+
+	g_hash_table_insert(queue->pendingTable, &pending->id, pending);
+
+	if (pending->timeout_info) {
+		g_ptr_array_add(queue->pendingTimeouts, pending);
+		_osync_queue_timeout_heap_sift_up(queue, queue->pendingTimeouts->len - 1);
+	}
+
+	queue->pendingCount++;
+	if (queue->pendingCount > queue->pendingPeak)
+		queue->pendingPeak = queue->pendingCount;
+
+	return TRUE;
+}
+
+/* The caller has to hold the pending lock */
+static void _osync_queue_take_pending(OSyncQueue *queue, OSyncPendingMessage *pending)
+{
+	g_queue_delete_link(queue->pendingReplies, pending->link);
+	pending->link = NULL;
+
+	g_hash_table_remove(queue->pendingTable, &pending->id);
+
+	if (pending->timeout_info)
+		_osync_queue_timeout_heap_remove(queue, pending);
+
+	queue->pendingCount--;
+}
+
 static gboolean _osync_queue_generate_error(OSyncQueue *queue, OSyncMessageCommand errcode, OSyncError **error)
 {
 	OSyncMessage *message;
@@ -43,31 +392,61 @@ static gboolean _osync_queue_generate_error(OSyncQueue *queue, OSyncMessageComma
 	}
 	osync_trace(TRACE_INTERNAL, "Generating incoming error message %p(%s), id= %lli", message, osync_message_get_commandstr(message), osync_message_get_id(message));
 	
-	g_async_queue_push(queue->incoming, message);
+	_osync_queue_push_incoming(queue, message);
 	// we don't ref this, since _new() above already gives us the ref
 	// and we are giving that ref away to the queue
 	//osync_message_ref(message);
 	
-	if (queue->incomingContext)
-		g_main_context_wakeup(queue->incomingContext);
-
 	return TRUE;
 }
 
 static gboolean _timeout_prepare(GSource *source, gint *timeout_)
 {
-	/* TODO adapt *timeout_ value to shortest message timeout value...
-	   GTimeVal current_time;
-	   g_source_get_current_time(source, &current_time);
-	*/
+	GTimeVal current_time;
+	GTimeVal deadline = { 0, 0 };
+	OSyncPendingMessage *pending;
+	glong msec;
+
+	OSyncQueue *queue = *((OSyncQueue **)(source + 1));
+
+	/* Sleep until the earliest expiration of the queue timer or any
+	 * pending message timeout. Senders of new pending messages wake us
+	 * up if they expire earlier. */
+	g_mutex_lock(queue->pendingLock);
+
+	if (queue->pendingCount > 0 && queue->pending_timeout.tv_sec > 0)
+		deadline = queue->pending_timeout;
+
+	pending = _osync_queue_first_timeout(queue);
+	if (pending && (deadline.tv_sec == 0
+	    || _osync_queue_timeval_cmp(&pending->timeout_info->expiration, &deadline) < 0))
+		deadline = pending->timeout_info->expiration;
 
-	*timeout_ = 1;
+	queue->timeout_deadline = deadline;
+
+	g_mutex_unlock(queue->pendingLock);
+
+	if (deadline.tv_sec == 0) {
+		*timeout_ = OSYNC_WAKEUP_IDLE_TIMEOUT;
+		return FALSE;
+	}
+
+	g_source_get_current_time(source, &current_time);
+
+	msec = (deadline.tv_sec - current_time.tv_sec) * 1000
+		+ (deadline.tv_usec - current_time.tv_usec + 999) / 1000;
+
+	if (msec <= 0) {
+		*timeout_ = 0;
+		return TRUE;
+	}
+
+	*timeout_ = msec > G_MAXINT ? G_MAXINT : msec;
 	return FALSE;
 }
 
 static gboolean _timeout_check(GSource *source)
 {
-	OSyncList *p;
 	GTimeVal current_time;
 	OSyncTimeoutInfo *toinfo;
 	OSyncPendingMessage *pending;
@@ -90,12 +469,9 @@ static gboolean _timeout_check(GSource *source)
 		}
 	}
 
-	for (p = queue->pendingReplies; p; p = p->next) {
-		pending = p->data;
-
-		if (!pending->timeout_info)
-			continue;
-
+	/* Only the earliest timeout can have expired */
+	pending = _osync_queue_first_timeout(queue);
+	if (pending) {
 		toinfo = pending->timeout_info;
 
 		if (current_time.tv_sec > toinfo->expiration.tv_sec 
@@ -115,7 +491,6 @@ static gboolean _timeout_check(GSource *source)
 
 static gboolean _timeout_dispatch(GSource *source, GSourceFunc callback, gpointer user_data)
 {
-	OSyncList *p;
 	OSyncPendingMessage *pending;
 	OSyncTimeoutInfo *toinfo;
 	OSyncQueue *queue = NULL;
@@ -140,15 +515,15 @@ static gboolean _timeout_dispatch(GSource *source, GSourceFunc callback, gpointe
 			osync_trace(TRACE_INTERNAL, "%s: Pending queue timer expired: receiver must have died", __func__);
 			_osync_queue_generate_error(queue, OSYNC_MESSAGE_QUEUE_ERROR, NULL);
 			queue->pending_timeout.tv_sec = 0; // Stop timer
+
+			g_mutex_lock(queue->statsLock);
+			queue->stats.timeouts++;
+			g_mutex_unlock(queue->statsLock);
 		}
 	}
 
-	for (p = queue->pendingReplies; p; p = p->next) {
-		pending = p->data;
-
-		if (!pending->timeout_info)
-			continue;
-
+	pending = _osync_queue_first_timeout(queue);
+	if (pending) {
 		toinfo = pending->timeout_info;
 
 		if (current_time.tv_sec > toinfo->expiration.tv_sec ||
@@ -174,11 +549,18 @@ static gboolean _timeout_dispatch(GSource *source, GSourceFunc callback, gpointe
 				 would catch this message, the pending callback
 				 gets called twice! */
 
-			queue->pendingReplies = osync_list_remove(queue->pendingReplies, pending);
-			queue->pendingCount--;
+			_osync_queue_take_pending(queue, pending);
 			/* Unlock the pending lock since the messages might be sent during the callback */
 			g_mutex_unlock(queue->pendingLock);
 
+			g_mutex_lock(queue->statsLock);
+			queue->stats.timeouts++;
+			g_mutex_unlock(queue->statsLock);
+			_osync_queue_stats_latency(queue, pending);
+
+			if (queue->pendingLimit)
+				osync_wakeup_signal(queue->incoming_wakeup);
+
 			pending->callback(errormsg, pending->user_data);
 			if (errormsg != NULL)
 				osync_message_unref(errormsg);
@@ -187,13 +569,9 @@ static gboolean _timeout_dispatch(GSource *source, GSourceFunc callback, gpointe
 			g_free(pending->timeout_info);
 			osync_free(pending);
 
-			/* Lock again, to keep the iteration of the pendingReplies list atomic. */
-			g_mutex_lock(queue->pendingLock);
-
-			/* The queue may have been modified while it was unlocked so don't go
-			   looking for any more entries.  If there are more, they will be found
-			   on the next call */
-			break;
+			/* Further expired entries are found on the next call, the
+			   pending replies may have been modified while it was unlocked */
+			return TRUE;
 		}
 	}
 	
@@ -202,16 +580,8 @@ static gboolean _timeout_dispatch(GSource *source, GSourceFunc callback, gpointe
 	return TRUE;
 }
 
-static gboolean _incoming_prepare(GSource *source, gint *timeout_)
-{
-	*timeout_ = 1;
-	return FALSE;
-}
-
-static gboolean _incoming_check(GSource *source)
+static gboolean _incoming_ready(OSyncQueue *queue)
 {
-	OSyncQueue *queue = *((OSyncQueue **)(source + 1));
-
 	/* As well as checking there is something on the incoming queue, we check
 	   that we are not blocked because we have too many pending commands.
 	   This check is only done if the pendingLimit has been set.
@@ -229,6 +599,24 @@ static gboolean _incoming_check(GSource *source)
 	return FALSE;
 }
 
+static gboolean _incoming_prepare(GSource *source, gint *timeout_)
+{
+	OSyncQueue *queue = *((OSyncQueue **)(source + 1));
+
+	*timeout_ = OSYNC_WAKEUP_IDLE_TIMEOUT;
+	return _incoming_ready(queue);
+}
+
+static gboolean _incoming_check(GSource *source)
+{
+	OSyncQueue *queue = *((OSyncQueue **)(source + 1));
+
+	if (queue->incoming_wakeup_fd && queue->incoming_wakeup_fd->revents)
+		osync_wakeup_acknowledge(queue->incoming_wakeup);
+
+	return _incoming_ready(queue);
+}
+
 static void _osync_send_timeout_response(OSyncMessage *errormsg, void *user_data)
 {
 	OSyncQueue *queue = user_data;
@@ -273,7 +661,7 @@ static void _osync_queue_restart_pending_timeout(OSyncQueue *queue)
 		timeout = queue->max_timeout + OSYNC_QUEUE_PENDING_QUEUE_IPC_DELAY;
 		if (timeout < OSYNC_QUEUE_PENDING_QUEUE_MIN_TIMEOUT) 
 			timeout = OSYNC_QUEUE_PENDING_QUEUE_MIN_TIMEOUT;
-		g_source_get_current_time(queue->timeout_source, &queue->pending_timeout);
+		g_get_current_time(&queue->pending_timeout);
 		queue->pending_timeout.tv_sec += timeout;
 	}
 }
@@ -282,7 +670,7 @@ static void _osync_queue_restart_pending_timeout(OSyncQueue *queue)
 static void _osync_queue_remove_pending_reply(OSyncQueue *queue, OSyncMessage *reply, gboolean callback)
 {
 	OSyncPendingMessage *pending = NULL;
-	OSyncList *p = NULL;
+	osync_messageid id = osync_message_get_id(reply);
 
 	osync_trace(TRACE_ENTRY, "%s(%p, %p, %d)", __func__, queue, reply, callback);
 	osync_trace(TRACE_INTERNAL, "Searching for pending message id=%lli", osync_message_get_id(reply));
@@ -291,39 +679,41 @@ static void _osync_queue_remove_pending_reply(OSyncQueue *queue, OSyncMessage *r
 	 * list since another thread might be duing the updates */
 	g_mutex_lock(queue->pendingLock);
 			
-	for (p = queue->pendingReplies; p; p = p->next) {
-		pending = p->data;
-			
-		if (pending->id == osync_message_get_id(reply)) {
-			
-			osync_trace(TRACE_INTERNAL, "Found pending message id=%lli: %p", osync_message_get_id(reply), pending);
-			/* Remove first the pending message!
-			   To avoid that _timeout_dispatch catchs this message
-			   when we're releasing the lock. If _timeout_dispatch
-			   would catch this message, the pending callback
-			   gets called twice! */
-			
-			queue->pendingReplies = osync_list_remove(queue->pendingReplies, pending);
-			if (--queue->pendingCount != 0)
-				_osync_queue_restart_pending_timeout(queue);
+	pending = g_hash_table_lookup(queue->pendingTable, &id);
+	if (pending) {
+		osync_trace(TRACE_INTERNAL, "Found pending message id=%lli: %p", osync_message_get_id(reply), pending);
+		/* Remove first the pending message!
+		   To avoid that _timeout_dispatch catchs this message
+		   when we're releasing the lock. If _timeout_dispatch
+		   would catch this message, the pending callback
+		   gets called twice! */
+		
+		_osync_queue_take_pending(queue, pending);
+		if (queue->pendingCount != 0)
+			_osync_queue_restart_pending_timeout(queue);
 
-			/* Unlock the pending lock since the messages might be sent during the callback */
-			g_mutex_unlock(queue->pendingLock);
-			
-			if (callback) {
-				/* Call the callback of the pending message */
-				osync_assert(pending->callback);
-				pending->callback(reply, pending->user_data);
-			}
+		/* Unlock the pending lock since the messages might be sent during the callback */
+		g_mutex_unlock(queue->pendingLock);
 
-			// TODO: Refcounting for OSyncPendingMessage
-			if (pending->timeout_info)
-				g_free(pending->timeout_info);
-			osync_free(pending);
+		/* Incoming commands might have been blocked by the pending limit */
+		if (queue->pendingLimit)
+			osync_wakeup_signal(queue->incoming_wakeup);
+		
+		if (callback) {
+			_osync_queue_stats_latency(queue, pending);
 
-			osync_trace(TRACE_EXIT, "%s", __func__);
-			return;
+			/* Call the callback of the pending message */
+			osync_assert(pending->callback);
+			pending->callback(reply, pending->user_data);
 		}
+
+		// TODO: Refcounting for OSyncPendingMessage
+		if (pending->timeout_info)
+			g_free(pending->timeout_info);
+		osync_free(pending);
+
+		osync_trace(TRACE_EXIT, "%s", __func__);
+		return;
 	}
 	
 	g_mutex_unlock(queue->pendingLock);
@@ -373,7 +763,7 @@ static gboolean _incoming_dispatch(GSource *source, GSourceFunc callback, gpoint
 					goto error;
 
 				GTimeVal current_time;
-				g_source_get_current_time(queue->timeout_source, &current_time);
+				g_get_current_time(&current_time);
 
 				toinfo->expiration = current_time;
 				toinfo->expiration.tv_sec += timeout;
@@ -384,12 +774,21 @@ static gboolean _incoming_dispatch(GSource *source, GSourceFunc callback, gpoint
 				pending->user_data = queue;
 		
 				g_mutex_lock(queue->pendingLock);
-				queue->pendingReplies = osync_list_append(queue->pendingReplies, pending);
-				queue->pendingCount++;
+				if (_osync_queue_add_pending(queue, pending, &error)) {
+					_osync_queue_arm_timeout(queue, &toinfo->expiration);
+				} else {
+					/* The peer reused an id, only the first message gets a timeout response */
+					osync_trace(TRACE_ERROR, "Not tracking the timeout of message %p: %s", message, osync_error_print(&error));
+					osync_error_unref(&error);
+					g_free(toinfo);
+					osync_free(pending);
+				}
 				g_mutex_unlock(queue->pendingLock);
 			}
 
 			queue->message_handler(message, queue->user_data);
+
+			_osync_queue_consume_credit(queue, message);
 		}
 		
 		osync_message_unref(message);
@@ -409,6 +808,11 @@ static gboolean _incoming_dispatch(GSource *source, GSourceFunc callback, gpoint
 
 static void _osync_queue_stop_incoming(OSyncQueue *queue)
 {
+	if (queue->incoming_wakeup_fd) {
+		osync_wakeup_detach(queue->incoming_source, queue->incoming_wakeup_fd);
+		queue->incoming_wakeup_fd = NULL;
+	}
+
 	if (queue->incoming_source) {
 		g_source_destroy(queue->incoming_source);
 		queue->incoming_source = NULL;
@@ -427,194 +831,584 @@ static void _osync_queue_stop_incoming(OSyncQueue *queue)
 
 static gboolean _queue_prepare(GSource *source, gint *timeout_)
 {
-	*timeout_ = 1;
+	OSyncQueue *queue = *((OSyncQueue **)(source + 1));
+
+	*timeout_ = OSYNC_WAKEUP_IDLE_TIMEOUT;
+	if (g_async_queue_length(queue->outgoing) > 0)
+		return TRUE;
 	return FALSE;
 }
 
 static gboolean _queue_check(GSource *source)
 {
 	OSyncQueue *queue = *((OSyncQueue **)(source + 1));
+
+	/* The wakeup of the queue thread is polled by this source, but all
+	 * other sources of the context get checked in the same iteration */
+	if (queue->wakeup_fd && queue->wakeup_fd->revents)
+		osync_wakeup_acknowledge(queue->wakeup);
+
 	if (g_async_queue_length(queue->outgoing) > 0)
 		return TRUE;
 	return FALSE;
 }
 
-static int _osync_queue_write_data(OSyncQueue *queue, const void *vptr, size_t n, OSyncError **error)
+static osync_bool _osync_queue_write_vector(OSyncQueue *queue, struct iovec *iov, int iovcnt, OSyncError **error)
 {
 #ifdef _WIN32
+	osync_error_set(error, OSYNC_ERROR_NOT_SUPPORTED, "Writing IPC data is not supported on this platform");
 	return FALSE;
 #else //_WIN32
+	if (queue->ring)
+		return osync_shm_ring_writev(queue->ring, iov, iovcnt, queue->fd, error);
 
-	ssize_t nwritten = 0;
+	while (iovcnt > 0) {
+		ssize_t nwritten = writev(queue->fd, iov, iovcnt > IOV_MAX ? IOV_MAX : iovcnt);
 
-	while (n > 0) {
-		if ((nwritten = write(queue->fd, vptr, n)) <= 0) {
+		if (nwritten <= 0) {
 			if (errno == EINTR)
-				nwritten = 0;  /* and call write() again */
-			else {
-				osync_error_set(error, OSYNC_ERROR_IO_ERROR, "Unable to write IPC data: %i: %s", errno, g_strerror(errno));
-				return (-1);  /* error */
-			}
+				continue;  /* and call writev() again */
+
+			osync_error_set(error, OSYNC_ERROR_IO_ERROR, "Unable to write IPC data: %i: %s", errno, g_strerror(errno));
+			return FALSE;
+		}
+
+		/* Skip the vectors which got written completely and
+		 * continue with the remainder of a partial one */
+		while (iovcnt > 0 && (size_t) nwritten >= iov->iov_len) {
+			nwritten -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+
+		if (nwritten > 0) {
+			iov->iov_base = (char *) iov->iov_base + nwritten;
+			iov->iov_len -= nwritten;
 		}
-		
-		n -= nwritten;
-		vptr += nwritten;
 	}
-	return (nwritten);
+
+	return TRUE;
 #endif //_WIN32
 }
 
-static osync_bool _osync_queue_write_long_long_int(OSyncQueue *queue, const long long int message, OSyncError **error)
+static void _osync_queue_build_frame_header(char *header, OSyncMessage *message)
+{
+	int size = osync_message_get_message_size(message);
+	int cmd = osync_message_get_cmd(message);
+	long long int id = osync_message_get_id(message);
+	int timeout = (int) osync_message_get_timeout(message);
+
+	if (osync_marshal_is_compact(osync_message_get_marshal(message)))
+		cmd |= OSYNC_QUEUE_FRAME_COMPACT;
+
+	/* The size of the message */
+	memcpy(header, &size, sizeof(int));
+	header += sizeof(int);
+
+	/* The command type (integer) */
+	memcpy(header, &cmd, sizeof(int));
+	header += sizeof(int);
+
+	/* The id (long long int) */
+	memcpy(header, &id, sizeof(long long int));
+	header += sizeof(long long int);
+
+	/* The timeout (integer) */
+	memcpy(header, &timeout, sizeof(int));
+}
+
+static osync_bool _osync_queue_reserve_write_batch(OSyncQueue *queue, unsigned int size, OSyncError **error)
 {
-	if (_osync_queue_write_data(queue, &message, sizeof(long long int), error) < 0)
+	OSyncMessage **batch = NULL;
+	struct iovec *iov = NULL;
+	char *headers = NULL;
+
+	if (queue->write_batch_alloc >= size)
+		return TRUE;
+
+	/* Each message might be preceded by an announcement of strings */
+	batch = osync_try_malloc0(2 * size * sizeof(OSyncMessage *), error);
+	iov = osync_try_malloc0(4 * size * sizeof(struct iovec), error);
+	headers = osync_try_malloc0(2 * size * OSYNC_QUEUE_FRAME_HEADER_SIZE, error);
+	if (!batch || !iov || !headers) {
+		osync_free(batch);
+		osync_free(iov);
+		osync_free(headers);
+		return FALSE;
+	}
+
+	osync_free(queue->write_batch);
+	osync_free(queue->write_iov);
+	osync_free(queue->write_headers);
+
+	queue->write_batch = batch;
+	queue->write_iov = iov;
+	queue->write_iov_alloc = 4 * size;
+	queue->write_headers = headers;
+	queue->write_batch_alloc = size;
+
+	return TRUE;
+}
+
+/* Makes room for at least size vectors, keeping the gathered ones */
+static osync_bool _osync_queue_reserve_write_iov(OSyncQueue *queue, unsigned int size, OSyncError **error)
+{
+	struct iovec *iov = NULL;
+	unsigned int alloc = queue->write_iov_alloc;
+
+	if (alloc >= size)
+		return TRUE;
+
+	while (alloc < size)
+		alloc *= 2;
+
+	iov = osync_try_malloc0(alloc * sizeof(struct iovec), error);
+	if (!iov)
 		return FALSE;
 
+	memcpy(iov, queue->write_iov, queue->write_iov_alloc * sizeof(struct iovec));
+	osync_free(queue->write_iov);
+
+	queue->write_iov = iov;
+	queue->write_iov_alloc = alloc;
+
 	return TRUE;
 }
 
-static osync_bool _osync_queue_write_int(OSyncQueue *queue, const int message, OSyncError **error)
+typedef struct queueGather {
+	struct iovec *iov;
+	int iovcnt;
+} queueGather;
+
+static void _osync_queue_gather_chunk(const char *data, unsigned int size, void *user_data)
+{
+	queueGather *gather = user_data;
+
+	gather->iov[gather->iovcnt].iov_base = (char *) data;
+	gather->iov[gather->iovcnt].iov_len = size;
+	gather->iovcnt++;
+}
+
+/* Creates the announcement of all strings the remote side does not know yet,
+ * up to the ones used by a compact message which is about to be written */
+static OSyncMessage *_osync_queue_announce_strings(OSyncQueue *queue, OSyncMessage *message, OSyncError **error)
+{
+	OSyncMessage *announcement = NULL;
+	unsigned int max = osync_marshal_get_max_string_id(osync_message_get_marshal(message));
+	unsigned int id;
+
+	if (max <= queue->strings_announced)
+		return NULL;
+
+	announcement = osync_message_new(OSYNC_MESSAGE_QUEUE_STRINGS, 0, error);
+	if (!announcement)
+		return NULL;
+
+	osync_message_write_uint(announcement, queue->strings_announced + 1, error);
+	osync_message_write_uint(announcement, max - queue->strings_announced, error);
+	for (id = queue->strings_announced + 1; id <= max; id++)
+		osync_message_write_string(announcement, osync_marshal_strings_lookup(queue->send_strings, id), error);
+
+	if (osync_error_is_set(error)) {
+		osync_message_unref(announcement);
+		return NULL;
+	}
+
+	queue->strings_announced = max;
+	return announcement;
+}
+
+/* Adds the frame of a message to the vectors of the current write */
+static osync_bool _osync_queue_gather_message(OSyncQueue *queue, OSyncMessage *message, unsigned int count, int *iovcnt, OSyncError **error)
 {
-	if (_osync_queue_write_data(queue, &message, sizeof(int), error) < 0)
+	OSyncMarshal *marshal = osync_message_get_marshal(message);
+	queueGather gather;
+	char *header = NULL;
+
+	/* Payloads referenced by the marshal are gathered in
+	 * place instead of being copied into its buffer first */
+	if (!_osync_queue_reserve_write_iov(queue, *iovcnt + 1 + osync_marshal_get_max_chunks(marshal), error))
 		return FALSE;
 
+	header = queue->write_headers + count * OSYNC_QUEUE_FRAME_HEADER_SIZE;
+	_osync_queue_build_frame_header(header, message);
+
+	queue->write_iov[*iovcnt].iov_base = header;
+	queue->write_iov[*iovcnt].iov_len = OSYNC_QUEUE_FRAME_HEADER_SIZE;
+	(*iovcnt)++;
+
+	gather.iov = queue->write_iov;
+	gather.iovcnt = *iovcnt;
+	osync_marshal_foreach_chunk(marshal, _osync_queue_gather_chunk, &gather);
+	*iovcnt = gather.iovcnt;
+
 	return TRUE;
 }
 
-/* This function sends the data to the remote side. If there is an error, it sends an error
- * message to the incoming queue */
+/* This function sends the data to the remote side. Up to write_batch_size
+ * messages get written with a single writev(). If there is an error, it sends
+ * an error message to the incoming queue */
 static gboolean _queue_dispatch(GSource *source, GSourceFunc callback, gpointer user_data)
 {
 	OSyncQueue *queue = user_data;
 	OSyncError *error = NULL;
+	unsigned int batch_size = queue->write_batch_size;
+	unsigned int count = 0;
+	unsigned int i;
 	
 	OSyncMessage *message = NULL;
+
+	if (!batch_size)
+		batch_size = OSYNC_QUEUE_WRITE_BATCH_SIZE;
+
+	if (!_osync_queue_reserve_write_batch(queue, batch_size, &error))
+		goto error;
 	
-	while ((message = g_async_queue_try_pop(queue->outgoing))) {
-		char *data = NULL;
-		unsigned int length = 0;
+	do {
+		unsigned int num_messages = 0;
+		int iovcnt = 0;
+		count = 0;
 
-		/* Check if the queue is connected */
-		if (!queue->connected) {
-			osync_error_set(&error, OSYNC_ERROR_GENERIC, "Trying to send to a queue thats not connected");
-			goto error;
+		while (num_messages < batch_size && (message = g_async_queue_try_pop(queue->outgoing))) {
+			OSyncMessage *announcement = NULL;
+
+			/* Check if the queue is connected */
+			if (!queue->connected) {
+				osync_error_set(&error, OSYNC_ERROR_GENERIC, "Trying to send to a queue thats not connected");
+				break;
+			}
+
+			/* When using threadec communication, the message is directly passed to the */
+			/* incoming asynch queue of the connected queue                             */
+			if (queue->usethreadcom){
+				unsigned int size = osync_message_get_message_size(message);
+				_osync_queue_stats_sent(queue, size);
+				_osync_queue_stats_received(queue->connected_queue, size);
+				_osync_queue_push_incoming(queue->connected_queue, message);
+				message = NULL;
+				continue;
+			}
+			
+			/* Strings used by a compact message for the first
+			 * time are announced right before it */
+			announcement = _osync_queue_announce_strings(queue, message, &error);
+			if (osync_error_is_set(&error))
+				break;
+
+			if (announcement) {
+				queue->write_batch[count] = announcement;
+				if (!_osync_queue_gather_message(queue, announcement, count++, &iovcnt, &error))
+					break;
+				_osync_queue_stats_sent(queue, OSYNC_QUEUE_FRAME_HEADER_SIZE + osync_message_get_message_size(announcement));
+			}
+
+			if (!_osync_queue_gather_message(queue, message, count, &iovcnt, &error))
+				break;
+			_osync_queue_stats_sent(queue, OSYNC_QUEUE_FRAME_HEADER_SIZE + osync_message_get_message_size(message));
+
+			/* The message keeps the payload alive until it got written */
+			queue->write_batch[count++] = message;
+			num_messages++;
+			message = NULL;
 		}
 
-		/* When using threadec communication, the message is directly passed to the */
-		/* incoming asynch queue of the connected queue                             */
-		if (queue->usethreadcom){
-			g_async_queue_push(queue->connected_queue->incoming, message);
-			continue;
+		/* Messages which got gathered before an error are still sent */
+		if (iovcnt) {
+			OSyncError *write_error = NULL;
+			if (!_osync_queue_write_vector(queue, queue->write_iov, iovcnt, &write_error)) {
+				if (error)
+					osync_error_unref(&write_error);
+				else
+					error = write_error;
+			}
 		}
-		
-		/* The size of the message */
-		if (!_osync_queue_write_int(queue, osync_message_get_message_size(message), &error))
-			goto error;
-		
-		/* The command type (integer) */
-		if (!_osync_queue_write_int(queue, osync_message_get_cmd(message), &error))
-			goto error;
 
-		/* The id (long long int) */
-		if (!_osync_queue_write_long_long_int(queue, osync_message_get_id(message), &error))
-			goto error;
-		
-		/* The timeout (integer) */
-		if (!_osync_queue_write_int(queue, (int) osync_message_get_timeout(message), &error))
-			goto error;
-		
-		if (!osync_message_get_buffer(message, &data, &length, &error))
+		for (i = 0; i < count; i++)
+			osync_message_unref(queue->write_batch[i]);
+		count = 0;
+
+		if (error)
 			goto error;
+	} while (g_async_queue_length(queue->outgoing) > 0);
+	
+	return TRUE;
+	
+ error:
+	for (i = 0; i < count; i++)
+		osync_message_unref(queue->write_batch[i]);
+
+	if (message)
+		osync_message_unref(message);
+	
+	if (error) {
+		message = osync_message_new_queue_error(error, NULL);
+		if (message)
+			_osync_queue_push_incoming(queue, message);
 		
-		if (length) {
-			unsigned int sent = 0;
-			do {
-				int written = _osync_queue_write_data(queue, data + sent, length - sent, &error);
-				if (written < 0)
-					goto error;
-				
-				sent += written;
-			} while (sent < length);
+		osync_error_unref(&error);
+	}
+	return FALSE;
+}
+
+static gboolean _source_prepare(GSource *source, gint *timeout_)
+{
+	*timeout_ = OSYNC_WAKEUP_IDLE_TIMEOUT;
+	return FALSE;
+}
+
+/* Checks without blocking if more data can be read from the pipe */
+static osync_bool _osync_queue_data_available(OSyncQueue *queue)
+{
+#ifdef _WIN32
+	return FALSE;
+#else //_WIN32
+	struct pollfd pfd;
+	int ret;
+
+	if (queue->ring_fd.fd != -1)
+		return osync_shm_ring_get_available(queue->ring) > 0;
+
+	pfd.fd = queue->fd;
+	pfd.events = POLLIN;
+
+	do {
+		ret = poll(&pfd, 1, 0);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret > 0 && (pfd.revents & POLLIN))
+		return TRUE;
+
+	return FALSE;
+#endif //_WIN32
+}
+
+/* Stops polling the pipe, it would keep reporting the hangup */
+static void _osync_queue_stop_polling_fd(OSyncQueue *queue)
+{
+	if (queue->ring_fd.fd != -1) {
+		g_source_remove_poll(queue->read_source, &queue->ring_fd);
+		queue->ring_fd.fd = -1;
+	}
+
+	if (queue->read_fd.fd == -1)
+		return;
+
+	g_source_remove_poll(queue->read_source, &queue->read_fd);
+	queue->read_fd.fd = -1;
+}
+
+/* The queue is not connected anymore, so we cannot receive any data on the
+ * pipe and pending replies will never be answered. So we return error messages
+ * for all of them, once. */
+static void _osync_queue_report_broken_pipe(OSyncQueue *queue)
+{
+	GList *p = NULL;
+	OSyncMessage *message = NULL;
+	OSyncError *error = NULL;
+
+	if (!queue->pendingCount)
+		return;
+
+	g_mutex_lock(queue->pendingLock);
+	osync_error_set(&error, OSYNC_ERROR_IO_ERROR, "Broken Pipe");
+	for (p = queue->pendingReplies->head; p; p = p->next) {
+		OSyncPendingMessage *pending = p->data;
+
+		if (pending->error_reported)
+			continue;
+
+		message = osync_message_new_errorreply(NULL, error, NULL);
+		if (message) {
+			osync_message_set_id(message, pending->id);
+			pending->error_reported = TRUE;
+
+			_osync_queue_push_incoming(queue, message);
 		}
-		
-		osync_message_unref(message);
 	}
-	
-	return TRUE;
-	
- error:
-	if (message)
-		osync_message_unref(message);
-	
-	if (error) {
-		message = osync_message_new_queue_error(error, NULL);
-		if (message)
-			g_async_queue_push(queue->incoming, message);
-		
-		osync_error_unref(&error);
+
+	osync_error_unref(&error);
+	g_mutex_unlock(queue->pendingLock);
+}
+
+static int _osync_queue_read_some(OSyncQueue *queue, void *buffer, size_t n, OSyncError **error)
+{
+#ifdef _WIN32
+	return 0;
+#else //_WIN32
+	ssize_t nread = 0;
+
+	/* Only called when the ring has data, so 0 still means EOF */
+	if (queue->ring_fd.fd != -1)
+		return osync_shm_ring_read(queue->ring, buffer, n);
+
+	do {
+		nread = read(queue->fd, buffer, n);
+	} while (nread < 0 && errno == EINTR);
+
+	if (nread < 0) {
+		osync_error_set(error, OSYNC_ERROR_IO_ERROR, "Unable to read IPC data: %i: %s", errno, g_strerror(errno));
+		return -1;
+	}
+
+	return nread;  /* 0 on EOF */
+#endif //_WIN32
+}
+
+static void _osync_queue_reset_read_buffer(OSyncQueue *queue)
+{
+	queue->read_buffer_start = 0;
+	queue->read_buffer_end = 0;
+
+	if (queue->read_message) {
+		osync_message_unref(queue->read_message);
+		queue->read_message = NULL;
+	}
+	queue->read_message_size = 0;
+	queue->read_message_offset = 0;
+}
+
+/* Creates the message described by the frame header. The frame header
+ * mirrors the one written by _osync_queue_build_frame_header() */
+static OSyncMessage *_osync_queue_new_frame_message(OSyncQueue *queue, const char *header, int *size, OSyncError **error)
+{
+	OSyncMessage *message = NULL;
+	osync_bool compact = FALSE;
+	int cmd = 0, timeout = 0;
+	osync_messageid id = 0;
+
+	/* The size of the buffer */
+	memcpy(size, header, sizeof(int));
+	header += sizeof(int);
+
+	/* The command */
+	memcpy(&cmd, header, sizeof(int));
+	header += sizeof(int);
+
+	/* The id */
+	memcpy(&id, header, sizeof(long long int));
+	header += sizeof(long long int);
+
+	/* The timeout */
+	memcpy(&timeout, header, sizeof(int));
+
+	if (*size < 0) {
+		osync_error_set(error, OSYNC_ERROR_IO_ERROR, "Received frame with invalid size %i", *size);
+		return NULL;
+	}
+
+	if (cmd & OSYNC_QUEUE_FRAME_COMPACT) {
+		cmd &= ~OSYNC_QUEUE_FRAME_COMPACT;
+		compact = TRUE;
+	}
+
+	message = osync_message_new(cmd, *size, error);
+	if (!message)
+		return NULL;
+
+	if (compact)
+		osync_marshal_set_compact(osync_message_get_marshal(message), queue->recv_strings);
+
+	osync_message_set_id(message, id);
+	osync_message_set_timeout(message, (unsigned int) timeout);
+
+	return message;
+}
+
+/* Parses all complete frames out of the receive buffer. A frame with a large
+ * payload which is not yet complete becomes the read_message of the queue */
+static osync_bool _osync_queue_parse_frames(OSyncQueue *queue, OSyncError **error)
+{
+	OSyncMessage *message = NULL;
+
+	while (queue->read_buffer_end - queue->read_buffer_start >= OSYNC_QUEUE_FRAME_HEADER_SIZE) {
+		char *frame = queue->read_buffer + queue->read_buffer_start;
+		unsigned int available = queue->read_buffer_end - queue->read_buffer_start - OSYNC_QUEUE_FRAME_HEADER_SIZE;
+		char *buffer = NULL;
+		int size = 0;
+
+		memcpy(&size, frame, sizeof(int));
+
+		/* Small frames stay in the receive buffer until they are complete */
+		if (size >= 0 && (unsigned int) size > available && size < OSYNC_QUEUE_READ_DIRECT_THRESHOLD)
+			break;
+
+		message = _osync_queue_new_frame_message(queue, frame, &size, error);
+		if (!message)
+			return FALSE;
+
+		/* We now get the buffer from the message which will already
+		 * have the correct size for the payload */
+		if (!osync_message_get_buffer(message, &buffer, NULL, error))
+			goto error_free_message;
+
+		if ((unsigned int) size > available) {
+			memcpy(buffer, frame + OSYNC_QUEUE_FRAME_HEADER_SIZE, available);
+
+			queue->read_message = message;
+			queue->read_message_size = size;
+			queue->read_message_offset = available;
+
+			queue->read_buffer_start = 0;
+			queue->read_buffer_end = 0;
+			return TRUE;
+		}
+
+		if (size)
+			memcpy(buffer, frame + OSYNC_QUEUE_FRAME_HEADER_SIZE, size);
+		queue->read_buffer_start += OSYNC_QUEUE_FRAME_HEADER_SIZE + size;
+
+		if (!osync_message_set_message_size(message, size, error))
+			goto error_free_message;
+
+		_osync_queue_stats_received(queue, OSYNC_QUEUE_FRAME_HEADER_SIZE + size);
+		_osync_queue_push_incoming(queue, message);
+	}
+
+	if (queue->read_buffer_start == queue->read_buffer_end) {
+		queue->read_buffer_start = 0;
+		queue->read_buffer_end = 0;
 	}
-	return FALSE;
-}
 
-static gboolean _source_prepare(GSource *source, gint *timeout_)
-{
-	*timeout_ = 1;
+	return TRUE;
+
+ error_free_message:
+	osync_message_unref(message);
 	return FALSE;
 }
 
-static int _osync_queue_read_data(OSyncQueue *queue, void *vptr, size_t n, OSyncError **error)
+/* Continues reading a large payload directly into the buffer of the message */
+static osync_bool _osync_queue_read_payload(OSyncQueue *queue, OSyncError **error)
 {
-#ifdef _WIN32
-	return 0;
-#else //_WIN32
-	size_t nleft;
-	ssize_t nread = 0;
+	OSyncMessage *message = queue->read_message;
+	char *buffer = NULL;
+	int nread = 0;
 
-	nleft = n;
-	while (n > 0) {
-		if ((nread = read(queue->fd, vptr, nleft)) < 0) {
-			if (errno == EINTR)
-				nread = 0;  /* and call read() again */
-			else {
-				osync_error_set(error, OSYNC_ERROR_IO_ERROR, "Unable to read IPC data: %i: %s", errno, g_strerror(errno));
-				return (-1);
-			}
-		} else if (nread == 0)
-			break;  /* EOF */
-		
-		nleft -= nread;
-		vptr += nread;
-	}
-	return (n - nleft);  /* return >= 0 */
-#endif //_WIN32
-}
+	if (!osync_message_get_buffer(message, &buffer, NULL, error))
+		return FALSE;
 
-static osync_bool _osync_queue_read_int(OSyncQueue *queue, int *message, OSyncError **error)
-{
-	int read = _osync_queue_read_data(queue, message, sizeof(int), error);
-	
-	if (read < 0)
+	nread = _osync_queue_read_some(queue, buffer + queue->read_message_offset, queue->read_message_size - queue->read_message_offset, error);
+	if (nread < 0)
 		return FALSE;
 
-	if (read != sizeof(int)) {
-		osync_error_set(error, OSYNC_ERROR_IO_ERROR, "Unable to read int. EOF");
+	if (nread == 0) {
+		osync_error_set(error, OSYNC_ERROR_IO_ERROR, "Encountered EOF while data was missing");
 		return FALSE;
 	}
-	
-	return TRUE;
-}
 
-static osync_bool _osync_queue_read_long_long_int(OSyncQueue *queue, long long int *message, OSyncError **error)
-{
-	int read = _osync_queue_read_data(queue, message, sizeof(long long int), error);
+	queue->read_message_offset += nread;
+	if (queue->read_message_offset < queue->read_message_size)
+		return TRUE;
 
-	if (read < 0)
-		return FALSE;
-	
-	if (read != sizeof(long long int)) {
-		osync_error_set(error, OSYNC_ERROR_IO_ERROR, "Unable to read int. EOF");
+	if (!osync_message_set_message_size(message, queue->read_message_size, error))
 		return FALSE;
-	}
 
+	_osync_queue_stats_received(queue, OSYNC_QUEUE_FRAME_HEADER_SIZE + queue->read_message_size);
+
+	queue->read_message = NULL;
+	queue->read_message_size = 0;
+	queue->read_message_offset = 0;
+
+	_osync_queue_push_incoming(queue, message);
 	return TRUE;
 }
 
@@ -625,28 +1419,7 @@ static gboolean _source_check(GSource *source)
 	OSyncError *error = NULL;
 	
 	if (queue->connected == FALSE) {
-		/* Ok. so we arent connected. lets check if there are pending replies. We cannot
-		 * receive any data on the pipe, therefore, any pending replies will never
-		 * be answered. So we return error messages for all of them. */
-		if (queue->pendingReplies) {
-			OSyncList *p = NULL;
-			g_mutex_lock(queue->pendingLock);
-			osync_error_set(&error, OSYNC_ERROR_IO_ERROR, "Broken Pipe");
-			for (p = queue->pendingReplies; p; p = p->next) {
-				OSyncPendingMessage *pending = p->data;
-				
-				message = osync_message_new_errorreply(NULL, error, NULL);
-				if (message) {
-					osync_message_set_id(message, pending->id);
-					
-					g_async_queue_push(queue->incoming, message);
-				}
-			}
-			
-			osync_error_unref(&error);
-			g_mutex_unlock(queue->pendingLock);
-		}
-		
+		_osync_queue_report_broken_pipe(queue);
 		return FALSE;
 	}
 
@@ -655,17 +1428,24 @@ static gboolean _source_check(GSource *source)
 			_osync_queue_generate_error(queue, OSYNC_MESSAGE_QUEUE_HUP, &error);
 		return FALSE;
 	}
-	
-	switch (osync_queue_poll(queue)) {
-	case OSYNC_QUEUE_EVENT_NONE:
-		return FALSE;
-	case OSYNC_QUEUE_EVENT_READ:
+
+	/* Remaining data gets read before a hangup is reported */
+	if (queue->ring_fd.fd != -1) {
+		if (queue->ring_fd.revents)
+			osync_shm_ring_acknowledge(queue->ring);
+
+		if (osync_shm_ring_get_available(queue->ring) > 0)
+			return TRUE;
+	}
+
+	if (queue->read_fd.revents & G_IO_IN)
 		return TRUE;
-	case OSYNC_QUEUE_EVENT_HUP:
-	case OSYNC_QUEUE_EVENT_ERROR:
+
+	if (queue->read_fd.revents & (G_IO_HUP | G_IO_ERR | G_IO_NVAL)) {
+		_osync_queue_stop_polling_fd(queue);
 		if (!_osync_queue_generate_error(queue, OSYNC_MESSAGE_QUEUE_HUP, &error))
 			goto error;
-		return FALSE;
+		_osync_queue_report_broken_pipe(queue);
 	}
 	
 	return FALSE;
@@ -673,89 +1453,71 @@ static gboolean _source_check(GSource *source)
  error:
 	message = osync_message_new_queue_error(error, NULL);
 	if (message) 
-		g_async_queue_push(queue->incoming, message);
+		_osync_queue_push_incoming(queue, message);
 	
 	osync_error_unref(&error);
 	return FALSE;
 }
 
-/* This function reads from the file descriptor and inserts incoming data into the
- * incoming queue */
+/* This function reads from the file descriptor into the receive buffer and inserts
+ * all complete messages into the incoming queue. Incomplete frames are kept for the
+ * next dispatch */
 static gboolean _source_dispatch(GSource *source, GSourceFunc callback, gpointer user_data)
 {
 	OSyncQueue *queue = user_data;
 	OSyncMessage *message = NULL;
 	OSyncError *error = NULL;
+
+	if (!queue->read_buffer) {
+		queue->read_buffer = osync_try_malloc0(OSYNC_QUEUE_READ_BUFFER_SIZE, &error);
+		if (!queue->read_buffer)
+			goto error;
+	}
 	
 	do {
-		int size = 0;
-		int cmd = 0, timeout = 0;
-		osync_messageid id = 0;
-		char *buffer = NULL;
-		
-		/* The size of the buffer */
-		if (!_osync_queue_read_int(queue, &size, &error))
-			goto error;
-		
-		/* The command */
-		if (!_osync_queue_read_int(queue, &cmd, &error))
-			goto error;
-		
-		/* The id */
-		if (!_osync_queue_read_long_long_int(queue, &id, &error))
-			goto error;
-		
-		/* The timeout */
-		if (!_osync_queue_read_int(queue, &timeout, &error))
-			goto error;
-		
-		message = osync_message_new(cmd, size, &error);
-		if (!message)
+		int nread = 0;
+
+		if (queue->read_message) {
+			if (!_osync_queue_read_payload(queue, &error))
+				goto error;
+			continue;
+		}
+
+		/* Move an incomplete frame to the front to make room for the read */
+		if (queue->read_buffer_start > 0) {
+			memmove(queue->read_buffer, queue->read_buffer + queue->read_buffer_start, queue->read_buffer_end - queue->read_buffer_start);
+			queue->read_buffer_end -= queue->read_buffer_start;
+			queue->read_buffer_start = 0;
+		}
+
+		nread = _osync_queue_read_some(queue, queue->read_buffer + queue->read_buffer_end, OSYNC_QUEUE_READ_BUFFER_SIZE - queue->read_buffer_end, &error);
+		if (nread < 0)
 			goto error;
-	
-		osync_message_set_id(message, id);
-		osync_message_set_timeout(message, (unsigned int) timeout);
-		
-		/* We now get the buffer from the message which will already
-		 * have the correct size for the read */
-		if (!osync_message_get_buffer(message, &buffer, NULL, &error))
-			goto error_free_message;
 
-		if (size) {
-			int read = 0;
-			do {
-				int inc = _osync_queue_read_data(queue, buffer + read, size - read, &error);
-				
-				if (inc < 0)
-					goto error_free_message;
-				
-				if (inc == 0) {
-					osync_error_set(&error, OSYNC_ERROR_IO_ERROR, "Encountered EOF while data was missing");
-					goto error_free_message;
-				}
-				
-				read += inc;
-			} while (read < size);
+		if (nread == 0) {
+			if (queue->read_buffer_end > 0) {
+				osync_error_set(&error, OSYNC_ERROR_IO_ERROR, "Encountered EOF while data was missing");
+				goto error;
+			}
+
+			/* The hangup gets reported by _source_check */
+			break;
 		}
+		queue->read_buffer_end += nread;
 
-		if (!osync_message_set_message_size(message, size, &error))
-			goto error_free_message;
-		
-		g_async_queue_push(queue->incoming, message);
-		
-		if (queue->incomingContext)
-			g_main_context_wakeup(queue->incomingContext);
-	} while (_source_check(queue->read_source));
+		if (!_osync_queue_parse_frames(queue, &error))
+			goto error;
+	} while (_osync_queue_data_available(queue));
 	
 	return TRUE;
 
- error_free_message:
-	osync_message_unref(message);
  error:
+	_osync_queue_reset_read_buffer(queue);
+
 	if (error) {
 		message = osync_message_new_queue_error(error, NULL);
 		if (message)
-			g_async_queue_push(queue->incoming, message);
+			_osync_queue_push_incoming(queue, message);
 		
 		
 		osync_error_unref(&error);
@@ -795,6 +1557,10 @@ OSyncQueue *osync_queue_new(const char *name, OSyncError **error)
 		g_thread_init (NULL);
 	
 	queue->pendingLock = g_mutex_new();
+	queue->statsLock = g_mutex_new();
+	queue->pendingReplies = g_queue_new();
+	queue->pendingTable = g_hash_table_new(_osync_queue_id_hash, _osync_queue_id_equal);
+	queue->pendingTimeouts = g_ptr_array_new();
 	
 	queue->context = g_main_context_new();
 	
@@ -803,6 +1569,30 @@ OSyncQueue *osync_queue_new(const char *name, OSyncError **error)
 
 	queue->disconnectLock = g_mutex_new();
 
+	queue->creditLock = g_mutex_new();
+	queue->creditCond = g_cond_new();
+
+	queue->wire_version = OSYNC_QUEUE_WIRE_VERSION_PLAIN;
+	queue->send_strings = osync_marshal_strings_new(error);
+	if (!queue->send_strings)
+		goto error_free_queue;
+
+	queue->recv_strings = osync_marshal_strings_new(error);
+	if (!queue->recv_strings)
+		goto error_free_queue;
+
+	queue->wakeup = osync_wakeup_new(error);
+	if (!queue->wakeup)
+		goto error_free_queue;
+
+	queue->incoming_wakeup = osync_wakeup_new(error);
+	if (!queue->incoming_wakeup)
+		goto error_free_queue;
+
+	queue->read_fd.fd = -1;
+	queue->ring_fd.fd = -1;
+	queue->write_batch_size = OSYNC_QUEUE_WRITE_BATCH_SIZE;
+
 	queue->ref_count = 1;
 
 	queue->usethreadcom = FALSE;
@@ -812,6 +1602,9 @@ OSyncQueue *osync_queue_new(const char *name, OSyncError **error)
 	osync_trace(TRACE_EXIT, "%s: %p", __func__, queue);
 	return queue;
 
+ error_free_queue:
+	queue->ref_count = 1;
+	osync_queue_unref(queue);
  error:
 	osync_trace(TRACE_EXIT_ERROR, "%s: %s", __func__, osync_error_print(error));
 	return NULL;
@@ -862,6 +1655,87 @@ osync_bool osync_queue_new_threadcom(OSyncQueue **read_queue, OSyncQueue **write
 
 }
 
+osync_bool osync_queue_new_shm_rings(OSyncQueue **read_queue, OSyncQueue **write_queue, OSyncError **error)
+{
+	OSyncShmRing *ring = NULL;
+	osync_trace(TRACE_ENTRY, "%s(%p, %p, %p)", __func__, read_queue, write_queue, error);
+
+	ring = osync_shm_ring_new(OSYNC_SHM_RING_SIZE, error);
+	if (!ring)
+		goto error;
+
+	if (!osync_queue_new_pipes(read_queue, write_queue, error))
+		goto error_free_ring;
+
+	(*read_queue)->ring = ring;
+	(*write_queue)->ring = osync_shm_ring_ref(ring);
+
+	osync_trace(TRACE_EXIT, "%s", __func__);
+	return TRUE;
+
+ error_free_ring:
+	osync_shm_ring_unref(ring);
+ error:
+	osync_trace(TRACE_EXIT_ERROR, "%s: %s", __func__, osync_error_print(error));
+	return FALSE;
+}
+
+OSyncQueue *osync_queue_new_from_shm_spec(const char *spec, OSyncError **error)
+{
+	OSyncQueue *queue = NULL;
+	int fd = -1;
+	int offset = 0;
+	osync_trace(TRACE_ENTRY, "%s(%s, %p)", __func__, __NULLSTR(spec), error);
+
+	if (!spec || sscanf(spec, "%i:%n", &fd, &offset) != 1 || !offset) {
+		osync_error_set(error, OSYNC_ERROR_PARAMETER, "Invalid shared memory queue \"%s\"", __NULLSTR(spec));
+		goto error;
+	}
+
+	queue = osync_queue_new_from_fd(fd, error);
+	if (!queue)
+		goto error;
+
+	queue->ring = osync_shm_ring_new_from_spec(spec + offset, error);
+	if (!queue->ring)
+		goto error_free_queue;
+
+	osync_trace(TRACE_EXIT, "%s: %p", __func__, queue);
+	return queue;
+
+ error_free_queue:
+	osync_queue_unref(queue);
+ error:
+	osync_trace(TRACE_EXIT_ERROR, "%s: %s", __func__, osync_error_print(error));
+	return NULL;
+}
+
+char *osync_queue_get_shm_spec(OSyncQueue *queue)
+{
+	char *ring_spec = NULL;
+	char *spec = NULL;
+	osync_assert(queue);
+
+	if (!queue->ring)
+		return NULL;
+
+	ring_spec = osync_shm_ring_get_spec(queue->ring);
+	spec = osync_strdup_printf("%i:%s", queue->fd, ring_spec);
+	osync_free(ring_spec);
+
+	return spec;
+}
+
+osync_bool osync_queue_set_shm_inheritable(OSyncQueue *queue, OSyncError **error)
+{
+	osync_assert(queue);
+
+	if (!queue->ring)
+		return TRUE;
+
+	return osync_shm_ring_set_inheritable(queue->ring, error);
+}
+
 osync_bool osync_queue_new_pipes(OSyncQueue **read_queue, OSyncQueue **write_queue, OSyncError **error)
 {
 #ifdef _WIN32
@@ -916,9 +1790,21 @@ void osync_queue_unref(OSyncQueue *queue)
 
 	if (g_atomic_int_dec_and_test(&(queue->ref_count))) {
 		g_mutex_free(queue->pendingLock);
+		g_mutex_free(queue->statsLock);
 
 		g_mutex_free(queue->disconnectLock);
 
+		if (queue->credit_queue)
+			osync_queue_unref(queue->credit_queue);
+
+		g_cond_free(queue->creditCond);
+		g_mutex_free(queue->creditLock);
+
+		if (queue->send_strings)
+			osync_marshal_strings_unref(queue->send_strings);
+		if (queue->recv_strings)
+			osync_marshal_strings_unref(queue->recv_strings);
+
 		g_main_context_unref(queue->context);
 
 		_osync_queue_stop_incoming(queue);
@@ -929,11 +1815,10 @@ void osync_queue_unref(OSyncQueue *queue)
 		_osync_queue_flush_messages(queue->outgoing);
 		g_async_queue_unref(queue->outgoing);
 
-		while (queue->pendingReplies) {
-			pending = queue->pendingReplies->data;
+		while (queue->pendingCount > 0) {
+			pending = g_queue_peek_head(queue->pendingReplies);
 
-			queue->pendingReplies = osync_list_remove(queue->pendingReplies, pending);
-			queue->pendingCount--;
+			_osync_queue_take_pending(queue, pending);
 
 			/** @todo Refcounting for OSyncPendingMessage */
 			if (pending->timeout_info)
@@ -944,11 +1829,31 @@ void osync_queue_unref(OSyncQueue *queue)
 
 		osync_assert(queue->pendingCount == 0);
 
+		g_queue_free(queue->pendingReplies);
+		g_hash_table_destroy(queue->pendingTable);
+		g_ptr_array_free(queue->pendingTimeouts, TRUE);
+
 		if (queue->name)
 			osync_free(queue->name);
 
 		if (queue->connected_queue)
 			queue->connected_queue = NULL;
+
+		if (queue->wakeup)
+			osync_wakeup_free(queue->wakeup);
+
+		if (queue->incoming_wakeup)
+			osync_wakeup_free(queue->incoming_wakeup);
+
+		osync_free(queue->write_batch);
+		osync_free(queue->write_iov);
+		osync_free(queue->write_headers);
+
+		_osync_queue_reset_read_buffer(queue);
+		osync_free(queue->read_buffer);
+
+		if (queue->ring)
+			osync_shm_ring_unref(queue->ring);
 		
 		osync_free(queue);
 		queue = NULL;
@@ -1040,6 +1945,16 @@ osync_bool osync_queue_connect(OSyncQueue *queue, OSyncQueueType type, OSyncErro
 		}
 #endif /*_WIN32*/
 	}
+	/* A new connection starts without any known strings */
+	if (osync_marshal_strings_get_count(queue->recv_strings)) {
+		OSyncMarshalStrings *strings = osync_marshal_strings_new(error);
+		if (!strings)
+			goto error_close;
+		osync_marshal_strings_unref(queue->recv_strings);
+		queue->recv_strings = strings;
+	}
+	queue->strings_announced = 0;
+
 	queue->connected = TRUE;
 	queue->connection_closing = FALSE;
 #ifndef _WIN32
@@ -1064,6 +1979,11 @@ osync_bool osync_queue_connect(OSyncQueue *queue, OSyncQueueType type, OSyncErro
 	queueptr = (OSyncQueue **)(queue->write_source + 1);
 	*queueptr = queue;
 	g_source_set_callback(queue->write_source, NULL, queue, NULL);
+
+	/* Only one source needs to poll the wakeup of the queue thread */
+	if (!osync_wakeup_attach(queue->wakeup, queue->write_source, &queue->wakeup_fd, error))
+		goto error_close;
+
 	g_source_attach(queue->write_source, queue->context);
 	if (queue->context)
 		g_main_context_ref(queue->context);
@@ -1080,6 +2000,21 @@ osync_bool osync_queue_connect(OSyncQueue *queue, OSyncQueueType type, OSyncErro
 	queueptr = (OSyncQueue **)(queue->read_source + 1);
 	*queueptr = queue;
 	g_source_set_callback(queue->read_source, NULL, queue, NULL);
+
+	if (!queue->usethreadcom) {
+		queue->read_fd.fd = queue->fd;
+		queue->read_fd.events = G_IO_IN | G_IO_HUP | G_IO_ERR;
+		queue->read_fd.revents = 0;
+		g_source_add_poll(queue->read_source, &queue->read_fd);
+	}
+
+	if (queue->ring && type == OSYNC_QUEUE_RECEIVER) {
+		queue->ring_fd.fd = osync_shm_ring_get_data_fd(queue->ring);
+		queue->ring_fd.events = G_IO_IN | G_IO_ERR;
+		queue->ring_fd.revents = 0;
+		g_source_add_poll(queue->read_source, &queue->ring_fd);
+	}
+
 	g_source_attach(queue->read_source, queue->context);
 	if (queue->context)
 		g_main_context_ref(queue->context);
@@ -1130,13 +2065,12 @@ osync_bool osync_queue_disconnect(OSyncQueue *queue, OSyncError **error)
 	queue->disc_in_progress = TRUE;
 
 	while (queue->pendingCount > 0) {
-		OSyncPendingMessage *pending = queue->pendingReplies->data;
+		OSyncPendingMessage *pending = g_queue_peek_head(queue->pendingReplies);
 		OSyncError *error = NULL;
 		OSyncError *huperr = NULL;
 		OSyncMessage *errormsg = NULL;
 		
-		queue->pendingReplies = osync_list_remove(queue->pendingReplies, pending);
-		queue->pendingCount--;
+		_osync_queue_take_pending(queue, pending);
 
 		/* Call the callback of the pending message */
 		if (pending->callback) {
@@ -1182,14 +2116,41 @@ osync_bool osync_queue_disconnect(OSyncQueue *queue, OSyncError **error)
 		queue->thread = NULL;
 	}
 	
-	//g_source_unref(queue->write_source);
+	/* The sources poll file descriptors owned by the queue */
+	if (queue->write_source) {
+		if (queue->wakeup_fd) {
+			osync_wakeup_detach(queue->write_source, queue->wakeup_fd);
+			queue->wakeup_fd = NULL;
+		}
+		g_source_destroy(queue->write_source);
+		g_source_unref(queue->write_source);
+		queue->write_source = NULL;
+	}
 	
 	if (queue->write_functions) {
 		osync_free(queue->write_functions);
 		queue->write_functions = NULL;
 	}
 		
-	//g_source_unref(queue->read_source);
+	if (queue->read_source) {
+		_osync_queue_stop_polling_fd(queue);
+		g_source_destroy(queue->read_source);
+		g_source_unref(queue->read_source);
+		queue->read_source = NULL;
+	}
+
+	_osync_queue_reset_read_buffer(queue);
+
+	if (queue->read_functions) {
+		osync_free(queue->read_functions);
+		queue->read_functions = NULL;
+	}
+
+	if (queue->timeout_source) {
+		g_source_destroy(queue->timeout_source);
+		g_source_unref(queue->timeout_source);
+		queue->timeout_source = NULL;
+	}
 	
 	if (queue->timeout_functions) {
 		osync_free(queue->timeout_functions);
@@ -1204,6 +2165,7 @@ osync_bool osync_queue_disconnect(OSyncQueue *queue, OSyncError **error)
 
 	if (queue->usethreadcom){
 		queue->connected_queue->connection_closing = TRUE;
+		osync_wakeup_signal(queue->connected_queue->wakeup);
 	}else{
 		if (queue->fd != -1 && close(queue->fd) != 0) {
 			osync_error_set(error, OSYNC_ERROR_GENERIC, "Unable to close queue");
@@ -1214,11 +2176,26 @@ osync_bool osync_queue_disconnect(OSyncQueue *queue, OSyncError **error)
 	
 	queue->fd = -1;
 	queue->connected = FALSE;
+
+	/* Release senders waiting for credits, nothing gets sent anymore */
+	g_mutex_lock(queue->creditLock);
+	queue->credit_enabled = FALSE;
+	queue->credit_sent = queue->credit_limit = 0;
+	queue->credit_consumed = queue->credit_granted = 0;
+	g_cond_broadcast(queue->creditCond);
+	g_mutex_unlock(queue->creditLock);
+
+	if (queue->ring) {
+		osync_shm_ring_unref(queue->ring);
+		queue->ring = NULL;
+	}
 	g_mutex_unlock(queue->disconnectLock);
 
 	g_mutex_lock(queue->pendingLock);
 	queue->disc_in_progress = FALSE;
 	g_mutex_unlock(queue->pendingLock);
+
+	osync_wakeup_signal(queue->incoming_wakeup);
 	
 	osync_trace(TRACE_EXIT, "%s", __func__);
 	return TRUE;
@@ -1290,6 +2267,121 @@ void osync_queue_set_pending_limit(OSyncQueue *queue, unsigned int limit)
 	osync_trace(TRACE_EXIT, "%s", __func__);
 }
 
+void osync_queue_set_credit_window(OSyncQueue *queue, OSyncQueue *credit_queue, unsigned int window)
+{
+	long long int limit = 0;
+
+	osync_trace(TRACE_ENTRY, "%s(%p, %p, %u)", __func__, queue, credit_queue, window);
+	osync_assert(queue);
+
+	g_mutex_lock(queue->creditLock);
+
+	if (credit_queue)
+		osync_queue_ref(credit_queue);
+	if (queue->credit_queue)
+		osync_queue_unref(queue->credit_queue);
+	queue->credit_queue = credit_queue;
+
+	queue->credit_window = window;
+
+	/* The initial grant, before the first message got dispatched */
+	if (window && credit_queue) {
+		limit = queue->credit_consumed + window;
+		queue->credit_granted = limit;
+	}
+
+	g_mutex_unlock(queue->creditLock);
+
+	if (limit)
+		_osync_queue_grant_credits(queue, credit_queue, limit);
+
+	osync_trace(TRACE_EXIT, "%s", __func__);
+}
+
+void osync_queue_set_wire_version(OSyncQueue *queue, unsigned int version)
+{
+	osync_assert(queue);
+	osync_assert(version >= OSYNC_QUEUE_WIRE_VERSION_PLAIN && version <= OSYNC_QUEUE_WIRE_VERSION);
+
+	queue->wire_version = version;
+}
+
+unsigned int osync_queue_get_wire_version(OSyncQueue *queue)
+{
+	osync_assert(queue);
+	return queue->wire_version;
+}
+
+void osync_queue_prepare_message(OSyncQueue *queue, OSyncMessage *message)
+{
+	osync_assert(queue);
+	osync_assert(message);
+
+	/* Thread communication passes the message itself, so the changes
+	 * don't have to be serialized at all */
+	if (queue->usethreadcom) {
+		osync_message_set_by_reference(message, TRUE);
+		return;
+	}
+
+	if (queue->wire_version < OSYNC_QUEUE_WIRE_VERSION_COMPACT)
+		return;
+
+	osync_marshal_set_compact(osync_message_get_marshal(message), queue->send_strings);
+}
+
+void osync_queue_get_stats(OSyncQueue *queue, OSyncQueueStats *stats)
+{
+	osync_assert(queue);
+	osync_assert(stats);
+
+	g_mutex_lock(queue->statsLock);
+	*stats = queue->stats;
+	g_mutex_unlock(queue->statsLock);
+
+	g_mutex_lock(queue->pendingLock);
+	stats->pending_replies = queue->pendingCount;
+	stats->pending_peak = queue->pendingPeak;
+	g_mutex_unlock(queue->pendingLock);
+
+	stats->incoming_depth = MAX(g_async_queue_length(queue->incoming), 0);
+	stats->outgoing_depth = MAX(g_async_queue_length(queue->outgoing), 0);
+}
+
+void osync_queue_stats_merge(OSyncQueueStats *stats, const OSyncQueueStats *other)
+{
+	unsigned int i, j;
+
+	osync_assert(stats);
+	osync_assert(other);
+
+	stats->messages_sent += other->messages_sent;
+	stats->bytes_sent += other->bytes_sent;
+	stats->messages_received += other->messages_received;
+	stats->bytes_received += other->bytes_received;
+	stats->incoming_depth += other->incoming_depth;
+	stats->incoming_peak = MAX(stats->incoming_peak, other->incoming_peak);
+	stats->outgoing_depth += other->outgoing_depth;
+	stats->outgoing_peak = MAX(stats->outgoing_peak, other->outgoing_peak);
+	stats->pending_replies += other->pending_replies;
+	stats->pending_peak = MAX(stats->pending_peak, other->pending_peak);
+	stats->timeouts += other->timeouts;
+
+	for (i = 0; i < OSYNC_MESSAGE_NUM_COMMANDS; i++)
+		for (j = 0; j < OSYNC_QUEUE_STATS_LATENCY_BUCKETS; j++)
+			stats->latency[i][j] += other->latency[i][j];
+}
+
+void osync_queue_set_write_batch_size(OSyncQueue *queue, unsigned int size)
+{
+	osync_trace(TRACE_ENTRY, "%s(%p, %u)", __func__, queue, size);
+
+	/* The scratch space of the writer grows on the next dispatch */
+	queue->write_batch_size = size ? size : OSYNC_QUEUE_WRITE_BATCH_SIZE;
+	
+	osync_trace(TRACE_EXIT, "%s", __func__);
+}
+
 osync_bool osync_queue_setup_with_gmainloop(OSyncQueue *queue, GMainContext *context, OSyncError **error)
 {
 	OSyncQueue **queueptr = NULL;
@@ -1308,6 +2400,10 @@ osync_bool osync_queue_setup_with_gmainloop(OSyncQueue *queue, GMainContext *con
 	queueptr = (OSyncQueue **)(queue->incoming_source + 1);
 	*queueptr = queue;
 	g_source_set_callback(queue->incoming_source, NULL, queue, NULL);
+
+	if (!osync_wakeup_attach(queue->incoming_wakeup, queue->incoming_source, &queue->incoming_wakeup_fd, error))
+		goto error;
+
 	g_source_attach(queue->incoming_source, context);
 	queue->incomingContext = context;
 	// For the source
@@ -1405,6 +2501,18 @@ osync_bool osync_queue_send_message_with_timeout(OSyncQueue *queue, OSyncQueue *
 		}
 	}
 
+	if (_osync_queue_needs_credit(message)) {
+		/* Wait for the remote receiver to grant credits, before the
+		   timeout of the message starts ticking */
+		g_mutex_lock(queue->creditLock);
+		while (queue->credit_enabled && queue->credit_sent >= queue->credit_limit) {
+			osync_trace(TRACE_INTERNAL, "Waiting for credits on queue %p", queue);
+			g_cond_wait(queue->creditCond, queue->creditLock);
+		}
+		queue->credit_sent++;
+		g_mutex_unlock(queue->creditLock);
+	}
+
 	if (osync_message_get_handler(message)) {
 		OSyncPendingMessage *pending = NULL;
 		GTimeVal current_time;
@@ -1421,10 +2529,12 @@ osync_bool osync_queue_send_message_with_timeout(OSyncQueue *queue, OSyncQueue *
 		if (!pending)
 			goto error;
 
-		/* g_sourcet_get_current_time used cached time ... hopefully faster then g_get_.._time() */
-		g_source_get_current_time(queue->timeout_source, &current_time);
+		g_get_current_time(&current_time);
 
-		id = opensync_queue_gen_id(&current_time);
+		/* Ids only have to be unique among the pending replies */
+		do {
+			id = opensync_queue_gen_id(&current_time);
+		} while (g_hash_table_lookup(replyqueue->pendingTable, &id));
 		osync_message_set_id(message, id);
 		pending->id = id;
 		osync_trace(TRACE_INTERNAL, "Setting id %lli for pending reply", id);
@@ -1441,19 +2551,35 @@ osync_bool osync_queue_send_message_with_timeout(OSyncQueue *queue, OSyncQueue *
 		
 		pending->callback = osync_message_get_handler(message);
 		pending->user_data = osync_message_get_handler_data(message);
+		pending->cmd = osync_message_get_cmd(message);
+		pending->sent = current_time;
 		
-		replyqueue->pendingReplies = osync_list_append(replyqueue->pendingReplies, pending);
-		if (replyqueue->pendingCount++ == 0) {
+		if (!_osync_queue_add_pending(replyqueue, pending, error)) {
+			g_mutex_unlock(replyqueue->pendingLock);
+			osync_free(pending);
+			goto error;
+		}
+
+		if (replyqueue->pendingCount == 1) {
 			/* Start queue timeout */
 			_osync_queue_restart_pending_timeout(replyqueue);
+			if (replyqueue->max_timeout)
+				_osync_queue_arm_timeout(replyqueue, &replyqueue->pending_timeout);
 		}
+
+		/* The reply will never come, let the queue thread report it */
+		if (!replyqueue->connected)
+			osync_wakeup_signal(replyqueue->wakeup);
+
 		g_mutex_unlock(replyqueue->pendingLock);
 	}
 	
 	osync_message_ref(message);
 	g_async_queue_push(queue->outgoing, message);
 
-	g_main_context_wakeup(queue->context);
+	osync_wakeup_signal(queue->wakeup);
+
+	_osync_queue_stats_depth(&queue->stats.outgoing_peak, queue->statsLock, queue->outgoing);
 
 	osync_trace(TRACE_EXIT, "%s", __func__);
 	return TRUE;
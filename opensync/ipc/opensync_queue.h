@@ -74,6 +74,16 @@ OSYNC_EXPORT OSyncQueue *osync_queue_new(const char *name, OSyncError **error);
  */
 OSYNC_EXPORT OSyncQueue *osync_queue_new_from_fd(int fd, OSyncError **error);
 
+/** 
+ * @brief Creates a new asynchronous queue on a shared memory ring
+ * @param spec The descriptor returned by osync_queue_get_shm_spec() in the parent process
+ * @param error An OpenSync Error
+ * 
+ * This function return the pointer to a newly created OSyncQueue
+ * 
+ */
+OSYNC_EXPORT OSyncQueue *osync_queue_new_from_shm_spec(const char *spec, OSyncError **error);
+
 /**
  * @brief Initializes and creates a new FIFO Queue
  * @param queue OpenSync Queue that should be used to create a Queue
@@ -50,6 +50,22 @@
  */
 OSYNC_TEST_EXPORT osync_bool osync_queue_new_pipes(OSyncQueue **read_queue, OSyncQueue **write_queue, OSyncError **error);
 
+/** 
+ * @brief Creates anonymous pipes whose data is carried by a shared memory ring
+ * @param read_queue Queue to read from
+ * @param write_queue Queue to write to
+ * @param error An OpenSync Error
+ * 
+ * Used like osync_queue_new_pipes(). The pipes only report a hangup of the
+ * remote side, the messages are copied through a memfd mapped by both
+ * processes. A child process gets its queue from the descriptor
+ * returned by osync_queue_get_shm_spec().
+ *
+ * Fails if the platform has no memfd or eventfd support, callers should
+ * fall back to osync_queue_new_pipes() then.
+ */
+OSYNC_TEST_EXPORT osync_bool osync_queue_new_shm_rings(OSyncQueue **read_queue, OSyncQueue **write_queue, OSyncError **error);
+
 /**
  * @brief Creates two queues which are connected via thread communication 
  */
@@ -120,6 +136,86 @@ OSYNC_TEST_EXPORT void osync_queue_remove_cross_link(OSyncQueue *queue);
 OSYNC_TEST_EXPORT void osync_queue_set_pending_limit(OSyncQueue *queue, unsigned int limit);
 #define OSYNC_QUEUE_PENDING_LIMIT 5
 
+/**
+ * @brief Set the maximum number of messages written at once
+ *
+ * The queue gathers up to this number of outgoing messages, frame headers
+ * and payloads, into a single vectored write. A batch size of 1 writes
+ * each message on its own.
+ *
+ * The default is OSYNC_QUEUE_WRITE_BATCH_SIZE.
+ *
+ * @param queue The queue which sends the messages
+ * @param size The maximum number of messages per write, 0 resets the default
+ *
+ */
+OSYNC_TEST_EXPORT void osync_queue_set_write_batch_size(OSyncQueue *queue, unsigned int size);
+#define OSYNC_QUEUE_WRITE_BATCH_SIZE 64
+
+/**
+ * @brief Enable credit based flow control on a receiving queue
+ *
+ * The receiver grants the remote sender credits for window messages. The
+ * sender blocks in osync_queue_send_message() once all credits are used up,
+ * and further credits are granted while the messages get dispatched. This
+ * bounds the number of messages which are sent but not yet dispatched.
+ * Replies are not subject to flow control.
+ *
+ * The credits are sent on credit_queue, which has to be connected to the
+ * command queue of the remote sender. The remote side has to cross link its
+ * queues, see osync_queue_cross_link(). A window of 0 disables granting
+ * credits, the sender is not limited until it received its first credit.
+ *
+ * @param queue The queue which receives the messages
+ * @param credit_queue The queue to send the credits on
+ * @param window The maximum number of messages which are not yet dispatched
+ * 
+ */
+OSYNC_TEST_EXPORT void osync_queue_set_credit_window(OSyncQueue *queue, OSyncQueue *credit_queue, unsigned int window);
+#define OSYNC_QUEUE_CREDIT_WINDOW 256
+
+/**
+ * @brief Set the wire format version of messages sent on the queue
+ *
+ * Version 1 is the fixed size encoding every peer understands. Version 2
+ * encodes integers with variable length and sends interned strings, like
+ * format and objtype names, only once per connection. The version has to
+ * be agreed on with the remote side before it is raised above 1.
+ *
+ * Only messages passed to osync_queue_prepare_message() use the version,
+ * every frame tells the receiver how its payload is encoded.
+ *
+ * @param queue The queue which sends the messages
+ * @param version The wire format version, up to OSYNC_QUEUE_WIRE_VERSION
+ *
+ */
+OSYNC_TEST_EXPORT void osync_queue_set_wire_version(OSyncQueue *queue, unsigned int version);
+
+/**
+ * @brief Get the wire format version of messages sent on the queue
+ *
+ * @param queue The queue which sends the messages
+ * @returns The wire format version
+ *
+ */
+OSYNC_TEST_EXPORT unsigned int osync_queue_get_wire_version(OSyncQueue *queue);
+#define OSYNC_QUEUE_WIRE_VERSION_PLAIN 1
+#define OSYNC_QUEUE_WIRE_VERSION_COMPACT 2
+#define OSYNC_QUEUE_WIRE_VERSION OSYNC_QUEUE_WIRE_VERSION_COMPACT
+
+/**
+ * @brief Encode a new message with the wire format version of the queue
+ *
+ * Has to be called before anything is written to the message, which then
+ * must only be sent on this queue. Messages for thread communication pass
+ * the data of changes by reference.
+ *
+ * @param queue The queue the message will be sent on
+ * @param message The message
+ *
+ */
+OSYNC_TEST_EXPORT void osync_queue_prepare_message(OSyncQueue *queue, OSyncMessage *message);
+
 /**
  * @brief Sends a Message to a Queue
  * @param queue Pointer to the queue
@@ -202,6 +298,89 @@ const char *osync_queue_get_path(OSyncQueue *queue);
  */
 int osync_queue_get_fd(OSyncQueue *queue);
 
+/**
+ * @brief Describes the file descriptors of a shared memory ring queue
+ * 
+ * The descriptor is passed to a child process which inherited the file
+ * descriptors, see osync_queue_new_from_shm_spec().
+ *
+ * @param queue The queue created by osync_queue_new_shm_rings()
+ * @returns The descriptor, which the caller has to free, or NULL if the queue has no ring
+ * 
+ */
+OSYNC_TEST_EXPORT char *osync_queue_get_shm_spec(OSyncQueue *queue);
+
+/**
+ * @brief Lets the process started by exec() inherit the ring of a queue
+ *
+ * The ring is closed on exec() otherwise. Does nothing for queues
+ * without a ring.
+ *
+ * @param queue The queue created by osync_queue_new_shm_rings()
+ * @param error The error which will hold the info in case of an error
+ * @returns TRUE on success, FALSE otherwise
+ * 
+ */
+OSYNC_TEST_EXPORT osync_bool osync_queue_set_shm_inheritable(OSyncQueue *queue, OSyncError **error);
+
+/** @brief Number of buckets of the latency histograms of OSyncQueueStats
+ *
+ * Bucket 0 counts latencies below 2 microseconds, bucket n latencies from
+ * 2^n up to 2^(n+1) microseconds. The last bucket also counts all longer ones.
+ */
+#define OSYNC_QUEUE_STATS_LATENCY_BUCKETS 32
+
+/** @brief Counters of a queue
+ *
+ * The counters are always kept and cheap to update. Sent and received
+ * messages include the internal messages of the queue, bytes include the
+ * frame headers. Latencies are measured from sending a message with a reply
+ * handler until the reply or timeout arrived. They are counted by the queue
+ * which receives the replies, under the command of the request.
+ */
+struct OSyncQueueStats {
+	/** Messages and bytes written to the remote side */
+	unsigned long long int messages_sent;
+	unsigned long long int bytes_sent;
+	/** Messages and bytes read from the remote side */
+	unsigned long long int messages_received;
+	unsigned long long int bytes_received;
+	/** Current and largest number of messages waiting to be dispatched */
+	unsigned int incoming_depth;
+	unsigned int incoming_peak;
+	/** Current and largest number of messages waiting to be written */
+	unsigned int outgoing_depth;
+	unsigned int outgoing_peak;
+	/** Current and largest number of replies the queue waits for */
+	unsigned int pending_replies;
+	unsigned int pending_peak;
+	/** Number of pending replies which timed out, including expirations
+	 * of the overall pending queue timer */
+	unsigned long long int timeouts;
+	/** Request to reply latencies per command, see OSYNC_QUEUE_STATS_LATENCY_BUCKETS */
+	unsigned int latency[OSYNC_MESSAGE_NUM_COMMANDS][OSYNC_QUEUE_STATS_LATENCY_BUCKETS];
+};
+
+/**
+ * @brief Get a snapshot of the counters of a queue
+ *
+ * @param queue The queue
+ * @param stats The stats to fill
+ *
+ */
+OSYNC_TEST_EXPORT void osync_queue_get_stats(OSyncQueue *queue, OSyncQueueStats *stats);
+
+/**
+ * @brief Add the counters of a queue to an aggregate
+ *
+ * Counters and current depths are summed up, peaks keep the largest value.
+ *
+ * @param stats The aggregate, zeroed before the first call
+ * @param other The counters to add
+ *
+ */
+OSYNC_TEST_EXPORT void osync_queue_stats_merge(OSyncQueueStats *stats, const OSyncQueueStats *other);
+
 /**
  * @brief Queries if a queue is still alive
  * @param queue Pointer to the queue
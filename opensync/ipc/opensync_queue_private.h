@@ -25,8 +25,19 @@
 #ifndef _WIN32
 #include <sys/poll.h>
 #include <sys/time.h>
+#include <sys/uio.h>
+#include <limits.h>
+#else //_WIN32
+struct iovec {
+	void *iov_base;
+	size_t iov_len;
+};
 #endif //_WIN32
 
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
 #include <signal.h>
 
 /**
@@ -59,6 +70,10 @@ struct OSyncQueue {
 	GSourceFuncs *incoming_functions;
 	GSource *incoming_source;
 
+	/** Signaled whenever a message is pushed on the incoming queue */
+	OSyncWakeup *incoming_wakeup;
+	GPollFD *incoming_wakeup_fd;
+
 	/** The context in which the IO of the queue is dispatched */
 	GMainContext *context;
 	GMainContext *incomingContext;
@@ -68,20 +83,91 @@ struct OSyncQueue {
 	GAsyncQueue *incoming;
 	GAsyncQueue *outgoing;
 	
-	/** List of pending replies */
-	OSyncList *pendingReplies;
+	/** Pending replies in the order they were added */
+	GQueue *pendingReplies;
+	/** Pending replies indexed by the message id */
+	GHashTable *pendingTable;
+	/** Min-heap of the pending replies with a timeout, ordered by expiration */
+	GPtrArray *pendingTimeouts;
 	GMutex *pendingLock;
 	unsigned int pendingCount, pendingLimit;
+	/** Largest pendingCount so far, protected by the pending lock */
+	unsigned int pendingPeak;
+
+	/** Counters of the queue, except for the pending replies */
+	GMutex *statsLock;
+	OSyncQueueStats stats;
+
+	/** Credit based flow control, protected by the credit lock */
+	GMutex *creditLock;
+	/** Signaled whenever the sender got new credits */
+	GCond *creditCond;
+	/** Set once the receiver granted credits, the sender is unlimited before */
+	gboolean credit_enabled;
+	/** Number of messages subject to flow control sent so far */
+	long long int credit_sent;
+	/** Number of messages the receiver allows to be sent in total */
+	long long int credit_limit;
+
+	/** Window granted to the remote sender, zero if disabled */
+	unsigned int credit_window;
+	/** The queue which carries the credits to the remote sender */
+	OSyncQueue *credit_queue;
+	/** Number of messages subject to flow control dispatched so far */
+	long long int credit_consumed;
+	/** Message limit granted last to the remote sender */
+	long long int credit_granted;
 	
 	GSourceFuncs *write_functions;
 	GSource *write_source;
+
+	/** Wire format version used for messages prepared for this queue */
+	unsigned int wire_version;
+	/** Strings interned by compact messages sent on this queue */
+	OSyncMarshalStrings *send_strings;
+	/** Number of send_strings already announced to the remote side,
+	 * only used by the queue thread */
+	unsigned int strings_announced;
+	/** Strings announced by the remote sender of this connection */
+	OSyncMarshalStrings *recv_strings;
+
+	/** Maximum number of messages gathered into a single write */
+	unsigned int write_batch_size;
+	/** Scratch space of the writer, only used by the queue thread */
+	unsigned int write_batch_alloc;
+	OSyncMessage **write_batch;
+	struct iovec *write_iov;
+	/** Allocated vectors of write_iov, grows with referenced payloads */
+	unsigned int write_iov_alloc;
+	char *write_headers;
 	
 	GSourceFuncs *read_functions;
 	GSource *read_source;
+	GPollFD read_fd;
+
+	/** Shared memory ring which carries the data instead of the pipe,
+	 * the pipe then only reports a hangup of the remote side */
+	OSyncShmRing *ring;
+	/** Data notification of the ring, polled by receivers */
+	GPollFD ring_fd;
+
+	/** Receive buffer of the reader, only used by the queue thread */
+	char *read_buffer;
+	unsigned int read_buffer_start, read_buffer_end;
+	/** Message whose large payload is read directly into its own buffer */
+	OSyncMessage *read_message;
+	unsigned int read_message_size, read_message_offset;
 
 	/** Timeout Source **/
 	GSourceFuncs *timeout_functions;
 	GSource *timeout_source;
+
+	/** Deadline the timeout source is currently sleeping for, zero if none */
+	GTimeVal timeout_deadline;
+
+	/** Signaled whenever the sources of the queue thread have work to do */
+	OSyncWakeup *wakeup;
+	GPollFD *wakeup_fd;
 	
 	GMutex *disconnectLock;
 
@@ -123,6 +209,26 @@ struct OSyncQueue {
  */
 #define OSYNC_QUEUE_PENDING_QUEUE_MIN_TIMEOUT 20
 
+/** @brief Size of the frame header which precedes each message on the wire
+ *
+ * The header consists of the payload size (int), the command (int),
+ * the message id (long long int) and the timeout (int).
+ */
+#define OSYNC_QUEUE_FRAME_HEADER_SIZE (3 * sizeof(int) + sizeof(long long int))
+
+/** @brief Set in the command of the frame header if the payload is compact
+ */
+#define OSYNC_QUEUE_FRAME_COMPACT 0x40000000
+
+/** @brief Size of the receive buffer of a queue
+ */
+#define OSYNC_QUEUE_READ_BUFFER_SIZE (64 * 1024)
+
+/** @brief Payloads of at least this size which are not yet complete in the
+ * receive buffer are read directly into the buffer of the message
+ */
+#define OSYNC_QUEUE_READ_DIRECT_THRESHOLD 4096
+
 /** @brief Timeout object 
  */
 typedef struct OSyncTimeoutInfo {
@@ -141,6 +247,15 @@ typedef struct OSyncPendingMessage {
 	gpointer user_data;
 	/** Message Timeout */
 	OSyncTimeoutInfo *timeout_info;
+	/** An error reply got already generated since the queue is not connected */
+	osync_bool error_reported;
+	/** Link in the pendingReplies queue */
+	GList *link;
+	/** Position in the pendingTimeouts heap, only valid with timeout_info */
+	guint heap_index;
+	/** Command of the message and the time it got sent, for the latency stats */
+	OSyncMessageCommand cmd;
+	GTimeVal sent;
 } OSyncPendingMessage;
 
 /**
@@ -153,6 +268,30 @@ typedef struct OSyncPendingMessage {
  * */
 static osync_messageid opensync_queue_gen_id(const GTimeVal *tv);
 
+/** @brief Count a message written to the remote side
+ *
+ * @param queue The sending queue
+ * @param size Bytes written for the message
+ *
+ */
+static void _osync_queue_stats_sent(OSyncQueue *queue, unsigned int size);
+
+/** @brief Count a message read from the remote side
+ *
+ * @param queue The receiving queue
+ * @param size Bytes read for the message
+ *
+ */
+static void _osync_queue_stats_received(OSyncQueue *queue, unsigned int size);
+
+/** @brief Count the latency of a pending reply which just got answered
+ *
+ * @param queue The queue which received the reply
+ * @param pending The pending reply
+ *
+ */
+static void _osync_queue_stats_latency(OSyncQueue *queue, OSyncPendingMessage *pending);
+
 /** @brief Flush all message of the Queue 
  * 
  * Flush all message inside the Queue and dereference the messages.
@@ -22,8 +22,10 @@
 #include "opensync_internals.h"
 
 #include "opensync_message_internals.h"
+#include "common/opensync_marshal_internals.h"
 
 #include "opensync-data.h"
+#include "data/opensync_data_internals.h"
 #include "opensync-format.h"
 #include "format/opensync_objformat_internals.h"
 
@@ -57,14 +59,19 @@ osync_bool osync_marshal_data(OSyncMessage *message, OSyncData *data, OSyncError
 	/* Find the format */
 	objformat = osync_data_get_objformat(data);
 
-	/* Write the format and objtype first */
-	osync_message_write_string(message, osync_objformat_get_name(objformat), error);
-	osync_message_write_string(message, osync_data_get_objtype(data), error);
+	/* Write the format and objtype first. They repeat for almost every
+	 * change, so compact messages only send them once per connection */
+	osync_marshal_write_interned_string(osync_message_get_marshal(message), osync_objformat_get_name(objformat), error);
+	osync_marshal_write_interned_string(osync_message_get_marshal(message), osync_data_get_objtype(data), error);
 
 	if (osync_error_is_set(error))
 		goto error;
 
-	/* Now we get the pointer to the data */
+	/* Now we get the pointer to the data, which might need to get read
+	 * back from the change store first */
+	if (!osync_data_page_in(data, error))
+		goto error;
+
 	osync_data_get_data(data, &input_data, &input_size);
 
 	if (input_size > 0) {
@@ -81,9 +88,15 @@ osync_bool osync_marshal_data(OSyncMessage *message, OSyncData *data, OSyncError
 			/* If the format is a plain format, then we have to add
 			 * one byte for \0 to the input_size. This extra byte will
 			 * be removed by the osync_demarshal_data funciton.
+			 *
+			 * Large payloads are only referenced by the message and
+			 * written straight out of the data object. The pin keeps
+			 * the buffer intact until the message got sent.
 			 */
+			OSyncMarshal *marshal = osync_message_get_marshal(message);
+			osync_data_pin_data(data, &input_data, &input_size);
 			input_size++;
-			if (!osync_message_write_buffer(message, input_data, input_size, error))
+			if (!osync_marshal_write_buffer_ref(marshal, input_data, input_size, data, (OSyncMarshalReleaseFn)osync_data_unpin_data, error))
 				goto error;
 		}
 	} else {
@@ -117,8 +130,8 @@ osync_bool osync_demarshal_data(OSyncMessage *message, OSyncData **data, OSyncFo
 	 * data */
 
 	/* Get the objtype and format */
-	osync_message_read_string(message, &objformat, error);
-	osync_message_read_string(message, &objtype, error);
+	osync_marshal_read_interned_string(osync_message_get_marshal(message), &objformat, error);
+	osync_marshal_read_interned_string(osync_message_get_marshal(message), &objtype, error);
 
 	if (osync_error_is_set(error))
 		goto error;
@@ -168,6 +181,35 @@ osync_bool osync_demarshal_data(OSyncMessage *message, OSyncData **data, OSyncFo
 	return FALSE;
 }
 
+static osync_bool _osync_demarshal_data_reference(OSyncMessage *message, OSyncData **data, OSyncFormatEnv *env, OSyncError **error)
+{
+	OSyncData *shared = NULL;
+	OSyncObjFormat *format = NULL;
+
+	if (!osync_message_read_reference(message, (void **)&shared, error))
+		return FALSE;
+
+	/* The data can only be shared if both sides use the same format
+	 * objects. Otherwise fall back to a copy in the local format. */
+	format = osync_format_env_find_objformat(env, osync_objformat_get_name(osync_data_get_objformat(shared)));
+	if (!format) {
+		osync_error_set(error, OSYNC_ERROR_GENERIC, "Unable to find objformat %s", osync_objformat_get_name(osync_data_get_objformat(shared)));
+		return FALSE;
+	}
+
+	if (format == osync_data_get_objformat(shared)) {
+		*data = osync_data_ref(shared);
+		return TRUE;
+	}
+
+	*data = osync_data_clone(shared, error);
+	if (!*data)
+		return FALSE;
+
+	osync_data_set_objformat(*data, format);
+	return TRUE;
+}
+
 osync_bool osync_marshal_change(OSyncMessage *message, OSyncChange *change, OSyncError **error)
 {
 	OSyncData *data = NULL;
@@ -189,6 +231,19 @@ osync_bool osync_marshal_change(OSyncMessage *message, OSyncChange *change, OSyn
 		goto error;
 
 	data = osync_change_get_data(change);
+
+	/* Messages between threads only carry a reference to the data. From
+	 * now on neither side must touch the data, see osync_change_own_data() */
+	if (osync_message_is_by_reference(message)) {
+		if (!osync_data_page_in(data, error))
+			goto error;
+
+		osync_data_set_shared(data);
+		if (!osync_message_write_reference(message, osync_data_ref(data), (OSyncMessageReleaseFn)osync_data_unref, error))
+			goto error;
+		return TRUE;
+	}
+
 	if (!osync_marshal_data(message, data, error))
 		goto error;
 
@@ -221,7 +276,10 @@ osync_bool osync_demarshal_change(OSyncMessage *message, OSyncChange **change, O
 	if (osync_error_is_set(error))
 		goto error_free;
 
-	if (!osync_demarshal_data(message, &data, env, error))
+	if (osync_message_is_by_reference(message)) {
+		if (!_osync_demarshal_data_reference(message, &data, env, error))
+			goto error_free;
+	} else if (!osync_demarshal_data(message, &data, env, error))
 		goto error_free;
 
 	*change = osync_change_new(error);
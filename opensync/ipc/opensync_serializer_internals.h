@@ -32,8 +32,8 @@
 osync_bool osync_marshal_data(OSyncMessage *message, OSyncData *data, OSyncError **error);
 osync_bool osync_demarshal_data(OSyncMessage *message, OSyncData **data, OSyncFormatEnv *env, OSyncError **error);
 
-osync_bool osync_marshal_change(OSyncMessage *message, OSyncChange *change, OSyncError **error);
-osync_bool osync_demarshal_change(OSyncMessage *message, OSyncChange **change, OSyncFormatEnv *env, OSyncError **error);
+OSYNC_TEST_EXPORT osync_bool osync_marshal_change(OSyncMessage *message, OSyncChange *change, OSyncError **error);
+OSYNC_TEST_EXPORT osync_bool osync_demarshal_change(OSyncMessage *message, OSyncChange **change, OSyncFormatEnv *env, OSyncError **error);
 
 osync_bool osync_marshal_error(OSyncMessage *message, OSyncError *marshal_error, OSyncError **error);
 osync_bool osync_demarshal_error(OSyncMessage *message, OSyncError **marshal_error, OSyncError **error);
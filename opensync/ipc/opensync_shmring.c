@@ -0,0 +1,402 @@
+/*
+ * libopensync - A synchronization framework
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ *
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* memfd_create() */
+#endif
+
+#include "opensync.h"
+#include "opensync_internals.h"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/poll.h>
+#endif
+
+#ifdef HAVE_EVENTFD
+#include <sys/eventfd.h>
+#endif
+
+#include "opensync_shmring_internals.h"
+#include "opensync_shmring_private.h"
+
+#if defined(HAVE_MEMFD_CREATE) && defined(HAVE_EVENTFD) && !defined(_WIN32)
+#define OSYNC_SHM_RING_SUPPORTED
+#endif
+
+#ifndef _WIN32
+static osync_bool _osync_shm_ring_map(OSyncShmRing *ring, OSyncError **error)
+{
+	struct stat st;
+	size_t size = 0;
+
+	if (fstat(ring->mem_fd, &st) != 0) {
+		osync_error_set(error, OSYNC_ERROR_IO_ERROR, "Unable to stat shared memory ring: %s", g_strerror(errno));
+		return FALSE;
+	}
+
+	size = st.st_size - OSYNC_SHM_RING_DATA_OFFSET;
+	if (st.st_size <= OSYNC_SHM_RING_DATA_OFFSET || (size & (size - 1))) {
+		osync_error_set(error, OSYNC_ERROR_IO_ERROR, "Shared memory ring has invalid size %li", (long) st.st_size);
+		return FALSE;
+	}
+
+	ring->mapping = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->mem_fd, 0);
+	if (ring->mapping == MAP_FAILED) {
+		ring->mapping = NULL;
+		osync_error_set(error, OSYNC_ERROR_IO_ERROR, "Unable to map shared memory ring: %s", g_strerror(errno));
+		return FALSE;
+	}
+
+	ring->mapping_size = st.st_size;
+	ring->header = ring->mapping;
+	ring->data = (char *) ring->mapping + OSYNC_SHM_RING_DATA_OFFSET;
+	ring->size = size;
+
+	return TRUE;
+}
+
+static void _osync_shm_ring_signal(int fd)
+{
+	guint64 value = 1;
+	ssize_t ret;
+
+	do {
+		ret = write(fd, &value, sizeof(value));
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret < 0 && errno != EAGAIN)
+		osync_trace(TRACE_ERROR, "Unable to signal shared memory ring: %i %s", errno, g_strerror(errno));
+}
+
+static void _osync_shm_ring_drain(int fd)
+{
+	guint64 value;
+	ssize_t ret;
+
+	do {
+		ret = read(fd, &value, sizeof(value));
+	} while (ret > 0 || (ret < 0 && errno == EINTR));
+}
+
+static unsigned int _osync_shm_ring_get_free(OSyncShmRing *ring)
+{
+	guint head = ring->header->head;
+	guint tail = g_atomic_int_get(&(ring->header->tail));
+
+	return ring->size - (head - tail);
+}
+
+/* Sleeps until the reader consumed data or went away */
+static osync_bool _osync_shm_ring_wait_space(OSyncShmRing *ring, int hup_fd, OSyncError **error)
+{
+	struct pollfd pfd[2];
+	int ret;
+
+	g_atomic_int_set(&(ring->header->writer_waiting), 1);
+
+	/* The reader might have made room before it saw the flag */
+	if (_osync_shm_ring_get_free(ring) > 0)
+		return TRUE;
+
+	pfd[0].fd = ring->space_fd;
+	pfd[0].events = POLLIN;
+	pfd[0].revents = 0;
+	pfd[1].fd = hup_fd;
+	pfd[1].events = 0;
+	pfd[1].revents = 0;
+
+	do {
+		ret = poll(pfd, hup_fd != -1 ? 2 : 1, -1);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret < 0) {
+		osync_error_set(error, OSYNC_ERROR_IO_ERROR, "Unable to wait for shared memory ring: %s", g_strerror(errno));
+		return FALSE;
+	}
+
+	if (pfd[1].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+		osync_error_set(error, OSYNC_ERROR_IO_ERROR, "Unable to write IPC data: Reader went away");
+		return FALSE;
+	}
+
+	_osync_shm_ring_drain(ring->space_fd);
+	return TRUE;
+}
+#endif /* _WIN32 */
+
+OSyncShmRing *osync_shm_ring_new(unsigned int size, OSyncError **error)
+{
+#ifdef OSYNC_SHM_RING_SUPPORTED
+	OSyncShmRing *ring = NULL;
+	osync_trace(TRACE_ENTRY, "%s(%u, %p)", __func__, size, error);
+
+	if (!size || (size & (size - 1))) {
+		osync_error_set(error, OSYNC_ERROR_GENERIC, "Shared memory ring size %u is not a power of two", size);
+		goto error;
+	}
+
+	ring = osync_try_malloc0(sizeof(OSyncShmRing), error);
+	if (!ring)
+		goto error;
+
+	ring->ref_count = 1;
+	ring->data_fd = -1;
+	ring->space_fd = -1;
+
+	/* Only the plugin process the ring is meant for inherits the
+	 * descriptors, see osync_shm_ring_set_inheritable() */
+	ring->mem_fd = memfd_create("opensync-ring", MFD_CLOEXEC);
+	if (ring->mem_fd == -1) {
+		osync_error_set(error, OSYNC_ERROR_IO_ERROR, "Unable to create shared memory ring: %s", g_strerror(errno));
+		goto error_free_ring;
+	}
+
+	if (ftruncate(ring->mem_fd, OSYNC_SHM_RING_DATA_OFFSET + size) != 0) {
+		osync_error_set(error, OSYNC_ERROR_IO_ERROR, "Unable to size shared memory ring: %s", g_strerror(errno));
+		goto error_free_ring;
+	}
+
+	ring->data_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	ring->space_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (ring->data_fd == -1 || ring->space_fd == -1) {
+		osync_error_set(error, OSYNC_ERROR_IO_ERROR, "Unable to create shared memory ring notification: %s", g_strerror(errno));
+		goto error_free_ring;
+	}
+
+	if (!_osync_shm_ring_map(ring, error))
+		goto error_free_ring;
+
+	osync_trace(TRACE_EXIT, "%s: %p", __func__, ring);
+	return ring;
+
+ error_free_ring:
+	osync_shm_ring_unref(ring);
+ error:
+	osync_trace(TRACE_EXIT_ERROR, "%s: %s", __func__, osync_error_print(error));
+	return NULL;
+#else
+	osync_error_set(error, OSYNC_ERROR_NOT_SUPPORTED, "Shared memory rings are not supported on this platform");
+	return NULL;
+#endif /* OSYNC_SHM_RING_SUPPORTED */
+}
+
+OSyncShmRing *osync_shm_ring_new_from_spec(const char *spec, OSyncError **error)
+{
+#ifndef _WIN32
+	OSyncShmRing *ring = NULL;
+	osync_trace(TRACE_ENTRY, "%s(%s, %p)", __func__, __NULLSTR(spec), error);
+
+	ring = osync_try_malloc0(sizeof(OSyncShmRing), error);
+	if (!ring)
+		goto error;
+
+	ring->ref_count = 1;
+	ring->mem_fd = -1;
+	ring->data_fd = -1;
+	ring->space_fd = -1;
+
+	if (!spec || sscanf(spec, "%i:%i:%i", &ring->mem_fd, &ring->data_fd, &ring->space_fd) != 3) {
+		osync_error_set(error, OSYNC_ERROR_PARAMETER, "Invalid shared memory ring \"%s\"", __NULLSTR(spec));
+		goto error_free_ring;
+	}
+
+	if (!_osync_shm_ring_map(ring, error))
+		goto error_free_ring;
+
+	osync_trace(TRACE_EXIT, "%s: %p", __func__, ring);
+	return ring;
+
+ error_free_ring:
+	osync_shm_ring_unref(ring);
+ error:
+	osync_trace(TRACE_EXIT_ERROR, "%s: %s", __func__, osync_error_print(error));
+	return NULL;
+#else
+	osync_error_set(error, OSYNC_ERROR_NOT_SUPPORTED, "Shared memory rings are not supported on this platform");
+	return NULL;
+#endif /* _WIN32 */
+}
+
+OSyncShmRing *osync_shm_ring_ref(OSyncShmRing *ring)
+{
+	osync_assert(ring);
+	
+	g_atomic_int_inc(&(ring->ref_count));
+
+	return ring;
+}
+
+void osync_shm_ring_unref(OSyncShmRing *ring)
+{
+	osync_assert(ring);
+	
+	if (g_atomic_int_dec_and_test(&(ring->ref_count))) {
+#ifndef _WIN32
+		if (ring->mapping)
+			munmap(ring->mapping, ring->mapping_size);
+
+		if (ring->mem_fd != -1)
+			close(ring->mem_fd);
+
+		if (ring->data_fd != -1)
+			close(ring->data_fd);
+
+		if (ring->space_fd != -1)
+			close(ring->space_fd);
+#endif /* _WIN32 */
+
+		osync_free(ring);
+	}
+}
+
+char *osync_shm_ring_get_spec(OSyncShmRing *ring)
+{
+	osync_assert(ring);
+	return osync_strdup_printf("%i:%i:%i", ring->mem_fd, ring->data_fd, ring->space_fd);
+}
+
+osync_bool osync_shm_ring_set_inheritable(OSyncShmRing *ring, OSyncError **error)
+{
+#ifndef _WIN32
+	int fds[3];
+	int flags, i;
+	osync_assert(ring);
+
+	fds[0] = ring->mem_fd;
+	fds[1] = ring->data_fd;
+	fds[2] = ring->space_fd;
+
+	for (i = 0; i < 3; i++) {
+		flags = fcntl(fds[i], F_GETFD);
+		if (flags == -1 || fcntl(fds[i], F_SETFD, flags & ~FD_CLOEXEC) == -1) {
+			osync_error_set(error, OSYNC_ERROR_IO_ERROR, "Unable to pass on shared memory ring: %s", g_strerror(errno));
+			return FALSE;
+		}
+	}
+#endif /* _WIN32 */
+
+	return TRUE;
+}
+
+int osync_shm_ring_get_data_fd(OSyncShmRing *ring)
+{
+	osync_assert(ring);
+	return ring->data_fd;
+}
+
+void osync_shm_ring_acknowledge(OSyncShmRing *ring)
+{
+	osync_assert(ring);
+#ifndef _WIN32
+	_osync_shm_ring_drain(ring->data_fd);
+#endif
+}
+
+unsigned int osync_shm_ring_get_available(OSyncShmRing *ring)
+{
+	guint head, tail;
+	osync_assert(ring);
+
+	head = g_atomic_int_get(&(ring->header->head));
+	tail = ring->header->tail;
+
+	return head - tail;
+}
+
+unsigned int osync_shm_ring_read(OSyncShmRing *ring, void *buffer, unsigned int size)
+{
+	guint tail;
+	unsigned int offset, first, n;
+	osync_assert(ring);
+
+	n = osync_shm_ring_get_available(ring);
+	if (n > size)
+		n = size;
+
+	if (!n)
+		return 0;
+
+	tail = ring->header->tail;
+	offset = tail & (ring->size - 1);
+	first = MIN(n, ring->size - offset);
+
+	memcpy(buffer, ring->data + offset, first);
+	memcpy((char *) buffer + first, ring->data, n - first);
+
+	g_atomic_int_set(&(ring->header->tail), (gint) (tail + n));
+
+#ifndef _WIN32
+	if (g_atomic_int_compare_and_exchange(&(ring->header->writer_waiting), 1, 0))
+		_osync_shm_ring_signal(ring->space_fd);
+#endif
+
+	return n;
+}
+
+osync_bool osync_shm_ring_writev(OSyncShmRing *ring, const struct iovec *iov, int iovcnt, int hup_fd, OSyncError **error)
+{
+#ifndef _WIN32
+	guint head;
+	int i;
+	osync_assert(ring);
+
+	head = ring->header->head;
+
+	for (i = 0; i < iovcnt; i++) {
+		const char *src = iov[i].iov_base;
+		size_t left = iov[i].iov_len;
+
+		while (left > 0) {
+			unsigned int space = _osync_shm_ring_get_free(ring);
+			unsigned int offset, first, n;
+
+			if (!space) {
+				/* Let the reader drain what is there before sleeping */
+				_osync_shm_ring_signal(ring->data_fd);
+
+				if (!_osync_shm_ring_wait_space(ring, hup_fd, error))
+					return FALSE;
+				continue;
+			}
+
+			n = left < space ? left : space;
+			offset = head & (ring->size - 1);
+			first = MIN(n, ring->size - offset);
+
+			memcpy(ring->data + offset, src, first);
+			memcpy(ring->data, src + first, n - first);
+
+			head += n;
+			g_atomic_int_set(&(ring->header->head), (gint) head);
+
+			src += n;
+			left -= n;
+		}
+	}
+
+	_osync_shm_ring_signal(ring->data_fd);
+	return TRUE;
+#else
+	osync_error_set(error, OSYNC_ERROR_NOT_SUPPORTED, "Shared memory rings are not supported on this platform");
+	return FALSE;
+#endif /* _WIN32 */
+}
@@ -0,0 +1,163 @@
+/*
+ * libopensync - A synchronization framework
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ *
+ */
+
+#ifndef _OPENSYNC_SHMRING_INTERNALS_H
+#define _OPENSYNC_SHMRING_INTERNALS_H
+
+/**
+ * @defgroup OSyncShmRingInternalAPI OpenSync Shared Memory Ring Internals
+ * @ingroup OSyncIPCPrivate
+ * @brief Single producer, single consumer byte ring in shared memory
+ *
+ * The ring lives in a memfd which is mapped by the writing and the reading
+ * process. Data is copied into and out of the mapping without a syscall.
+ * The writer notifies the reader through an eventfd, and the reader
+ * notifies a writer which waits for free space through a second one.
+ *
+ * The ring does not detect a peer which went away, the queue keeps a pipe
+ * open alongside the ring for this.
+ */
+
+/*@{*/
+
+typedef struct OSyncShmRing OSyncShmRing;
+
+struct iovec;
+
+/** @brief Default size of the data area of a ring, must be a power of two */
+#define OSYNC_SHM_RING_SIZE (1024 * 1024)
+
+/** @brief Creates a new ring
+ *
+ * Fails if the platform has no memfd or eventfd support.
+ *
+ * @param size The size of the data area, must be a power of two
+ * @param error The error which will hold the info in case of an error
+ * @returns A pointer to the new OSyncShmRing or NULL on error
+ * 
+ */
+OSYNC_TEST_EXPORT OSyncShmRing *osync_shm_ring_new(unsigned int size, OSyncError **error);
+
+/** @brief Maps a ring created by another process
+ *
+ * @param spec The descriptor string returned by osync_shm_ring_get_spec()
+ * @param error The error which will hold the info in case of an error
+ * @returns A pointer to the OSyncShmRing or NULL on error
+ * 
+ */
+OSYNC_TEST_EXPORT OSyncShmRing *osync_shm_ring_new_from_spec(const char *spec, OSyncError **error);
+
+/** @brief Increase the reference count of the ring
+ * 
+ * @param ring Pointer to the ring
+ * @returns The referenced ring
+ * 
+ */
+OSYNC_TEST_EXPORT OSyncShmRing *osync_shm_ring_ref(OSyncShmRing *ring);
+
+/** @brief Decrease the reference count of the ring
+ *
+ * Unmaps the ring and closes its file descriptors once the count drops to 0.
+ * 
+ * @param ring Pointer to the ring
+ * 
+ */
+OSYNC_TEST_EXPORT void osync_shm_ring_unref(OSyncShmRing *ring);
+
+/** @brief Describes the file descriptors of the ring
+ *
+ * The file descriptors are inherited by a child process, once passed on
+ * with osync_shm_ring_set_inheritable(), which maps the ring with
+ * osync_shm_ring_new_from_spec().
+ * 
+ * @param ring Pointer to the ring
+ * @returns The descriptor string, the caller has to free it
+ * 
+ */
+OSYNC_TEST_EXPORT char *osync_shm_ring_get_spec(OSyncShmRing *ring);
+
+/** @brief Lets a process started by exec() inherit the ring
+ *
+ * The file descriptors of a new ring get closed on exec(), so they don't
+ * leak into unrelated processes. The forked child which execs the peer
+ * of the ring calls this right before exec().
+ * 
+ * @param ring Pointer to the ring
+ * @param error The error which will hold the info in case of an error
+ * @returns TRUE on success, FALSE otherwise
+ * 
+ */
+OSYNC_TEST_EXPORT osync_bool osync_shm_ring_set_inheritable(OSyncShmRing *ring, OSyncError **error);
+
+/** @brief Get the file descriptor which gets readable when data was written
+ * 
+ * @param ring Pointer to the ring
+ * @returns The file descriptor of the data notification
+ * 
+ */
+OSYNC_TEST_EXPORT int osync_shm_ring_get_data_fd(OSyncShmRing *ring);
+
+/** @brief Resets the data notification
+ *
+ * Must be called by the reader before it looks at the ring, after the
+ * data notification file descriptor became readable.
+ * 
+ * @param ring Pointer to the ring
+ * 
+ */
+OSYNC_TEST_EXPORT void osync_shm_ring_acknowledge(OSyncShmRing *ring);
+
+/** @brief Get the number of bytes which can be read from the ring
+ * 
+ * @param ring Pointer to the ring
+ * @returns The number of readable bytes
+ * 
+ */
+OSYNC_TEST_EXPORT unsigned int osync_shm_ring_get_available(OSyncShmRing *ring);
+
+/** @brief Copies data out of the ring
+ *
+ * Does not block.
+ * 
+ * @param ring Pointer to the ring
+ * @param buffer The buffer to copy the data to
+ * @param size The size of the buffer
+ * @returns The number of bytes copied, 0 if the ring is empty
+ * 
+ */
+OSYNC_TEST_EXPORT unsigned int osync_shm_ring_read(OSyncShmRing *ring, void *buffer, unsigned int size);
+
+/** @brief Copies data into the ring
+ *
+ * Blocks while the ring is full until the reader made room, or the
+ * reader went away.
+ * 
+ * @param ring Pointer to the ring
+ * @param iov The data to write
+ * @param iovcnt The number of elements in iov
+ * @param hup_fd A file descriptor which reports an error or hangup once the reader is gone, or -1
+ * @param error The error which will hold the info in case of an error
+ * @returns TRUE if all data got written, FALSE otherwise
+ * 
+ */
+OSYNC_TEST_EXPORT osync_bool osync_shm_ring_writev(OSyncShmRing *ring, const struct iovec *iov, int iovcnt, int hup_fd, OSyncError **error);
+
+/*@}*/
+
+#endif /* _OPENSYNC_SHMRING_INTERNALS_H */
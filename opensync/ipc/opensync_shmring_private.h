@@ -0,0 +1,72 @@
+/*
+ * libopensync - A synchronization framework
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ *
+ */
+
+#ifndef _OPENSYNC_SHMRING_PRIVATE_H
+#define _OPENSYNC_SHMRING_PRIVATE_H
+
+/**
+ * @defgroup OSyncShmRingPrivateAPI OpenSync Shared Memory Ring Private
+ * @ingroup OSyncIPCPrivate
+ */
+
+/*@{*/
+
+/*! @brief Control block at the start of the shared mapping
+ *
+ * head and tail are free running byte counters, the positions in the
+ * data area are taken modulo the size.
+ */
+typedef struct OSyncShmRingHeader {
+	/** Bytes written so far, only advanced by the writer */
+	gint head;
+	/** Bytes read so far, only advanced by the reader */
+	gint tail;
+	/** Set by a writer which sleeps until the reader made room */
+	gint writer_waiting;
+} OSyncShmRingHeader;
+
+/** @brief Offset of the data area in the mapping, keeps head and data
+ * on separate cache lines
+ */
+#define OSYNC_SHM_RING_DATA_OFFSET 64
+
+/*! @brief Represents one mapping of a ring
+ */
+struct OSyncShmRing {
+	/** The shared memory */
+	int mem_fd;
+	/** Signaled by the writer after writing */
+	int data_fd;
+	/** Signaled by the reader when a waiting writer can continue */
+	int space_fd;
+
+	/** The mapping and its parts */
+	void *mapping;
+	size_t mapping_size;
+	OSyncShmRingHeader *header;
+	char *data;
+	unsigned int size;
+
+	/** Reference count **/
+	int ref_count;
+};
+
+/*@}*/
+
+#endif /* _OPENSYNC_SHMRING_PRIVATE_H */
@@ -191,7 +191,9 @@ void osync_mapping_table_add_mapping(OSyncMappingTable *table, OSyncMapping *map
 	osync_assert(table);
 	osync_assert(mapping);
 	
-	table->mappings = osync_list_append(table->mappings, mapping);
+	/* The newest mapping is kept first, adding is done for every new
+	 * mapping of a synchronization */
+	table->mappings = osync_list_prepend(table->mappings, mapping);
 	osync_mapping_ref(mapping);
 }
 
@@ -212,8 +214,16 @@ unsigned int osync_mapping_table_num_mappings(OSyncMappingTable *table)
 
 OSyncMapping *osync_mapping_table_nth_mapping(OSyncMappingTable *table, unsigned int nth)
 {
+	unsigned int num = 0;
+
 	osync_assert(table);
-	return osync_list_nth_data(table->mappings, nth);
+
+	/* In the order the mappings got added */
+	num = osync_list_length(table->mappings);
+	if (nth >= num)
+		return NULL;
+
+	return osync_list_nth_data(table->mappings, num - nth - 1);
 }
 
 osync_mappingid osync_mapping_table_get_next_id(OSyncMappingTable *table)
@@ -229,5 +239,5 @@ osync_mappingid osync_mapping_table_get_next_id(OSyncMappingTable *table)
 }
 
 OSyncList *osync_mapping_table_get_mappings(OSyncMappingTable *table) {
-	return osync_list_copy(table->mappings);
+	return osync_list_reverse(osync_list_copy(table->mappings));
 }
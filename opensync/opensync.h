@@ -257,6 +257,7 @@ typedef struct OSyncObjEngine OSyncObjEngine;
 typedef struct OSyncSinkEngine OSyncSinkEngine;
 typedef struct OSyncMappingEntryEngine OSyncMappingEntryEngine;
 typedef struct OSyncMappingEngine OSyncMappingEngine;
+typedef struct OSyncEngineProfile OSyncEngineProfile;
 
 typedef struct  OSyncEngineMemberUpdate OSyncEngineMemberUpdate;
 typedef struct  OSyncEngineChangeUpdate OSyncEngineChangeUpdate;
@@ -282,6 +283,7 @@ typedef struct OSyncHashTable OSyncHashTable;
 /* IPC component */
 typedef struct OSyncMessage OSyncMessage;
 typedef struct OSyncQueue OSyncQueue;
+typedef struct OSyncQueueStats OSyncQueueStats;
 
 /* Group component */
 typedef struct OSyncGroup OSyncGroup;
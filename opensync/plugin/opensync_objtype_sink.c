@@ -403,6 +403,29 @@ void osync_objtype_sink_commit_change(OSyncObjTypeSink *sink, OSyncPluginInfo *i
 	osync_trace(TRACE_EXIT, "%s", __func__);
 }
 
+void osync_objtype_sink_commit_changes(OSyncObjTypeSink *sink, OSyncPluginInfo *info, OSyncChange **changes, OSyncContext **contexts)
+{
+	OSyncObjTypeSinkFunctions functions;
+	unsigned int i;
+	osync_trace(TRACE_ENTRY, "%s(%p, %p, %p, %p)", __func__, sink, info, changes, contexts);
+	g_assert(sink);
+	g_assert(changes);
+	g_assert(contexts);
+
+	functions = sink->functions;
+
+	if (!functions.batch_commit) {
+		for (i = 0; changes[i]; i++) {
+			g_assert(contexts[i]);
+			osync_objtype_sink_commit_change(sink, info, changes[i], contexts[i]);
+		}
+	} else {
+		functions.batch_commit(sink, info, contexts, changes, osync_objtype_sink_get_userdata(sink));
+	}
+
+	osync_trace(TRACE_EXIT, "%s", __func__);
+}
+
 void osync_objtype_sink_committed_all(OSyncObjTypeSink *sink, OSyncPluginInfo *info, OSyncContext *ctx)
 {
 	OSyncObjTypeSinkFunctions functions;
@@ -495,6 +518,18 @@ void osync_objtype_sink_set_slowsync(OSyncObjTypeSink *sink, osync_bool slowsync
 	sink->slowsync = slowsync;
 }
 
+osync_bool osync_objtype_sink_get_change_stubs(OSyncObjTypeSink *sink)
+{
+	osync_assert(sink);
+	return sink->change_stubs;
+}
+
+void osync_objtype_sink_set_change_stubs(OSyncObjTypeSink *sink, osync_bool change_stubs)
+{
+	osync_assert(sink);
+	sink->change_stubs = change_stubs;
+}
+
 void osync_objtype_sink_set_connect_timeout(OSyncObjTypeSink *sink, unsigned int timeout)
 {
 	osync_assert(sink);
@@ -757,6 +792,12 @@ void osync_objtype_sink_set_commit_func(OSyncObjTypeSink *sink, OSyncSinkCommitF
 	sink->functions.commit = commit_func;
 }
 
+void osync_objtype_sink_set_batch_commit_func(OSyncObjTypeSink *sink, OSyncSinkBatchCommitFn batch_commit_func)
+{
+	osync_return_if_fail(sink);
+	sink->functions.batch_commit = batch_commit_func;
+}
+
 void osync_objtype_sink_set_committed_all_func(OSyncObjTypeSink *sink, OSyncSinkCommittedAllFn committed_all_func)
 {
 	osync_return_if_fail(sink);
@@ -101,6 +101,25 @@ typedef void (* OSyncSinkGetChangesFn) (OSyncObjTypeSink *sink, OSyncPluginInfo
  */
 typedef void (* OSyncSinkCommitFn) (OSyncObjTypeSink *sink, OSyncPluginInfo *info, OSyncContext *ctx, OSyncChange *change, void *data);
 
+/**
+ * @brief Callback function to commit several changes to a sink at once
+ * 
+ * This function is optional and set through osync_objtype_sink_set_batch_commit_func.
+ * If set, it gets called instead of the commit function with all changes of a
+ * commit batch, so protocols with bulk operations can write them in one go.
+ * Both arrays are NULL terminated and have the same length. Every context in
+ * contexts MUST be replied with osync_context_success() or osync_context_report_error()
+ * for the change with the same index. The rules of OSyncSinkCommitFn apply to every
+ * single change.
+ * 
+ * @param sink Pointer to the Sink which corresponds to the functions
+ * @param info PluginInfo pointer e.g. to get all formats
+ * @param contexts NULL terminated array of contexts, one for each change
+ * @param changes NULL terminated array of entries to commit
+ * @param data Pointer to the data which is passed in osync_objtype_sink_set_userdata
+ */
+typedef void (* OSyncSinkBatchCommitFn) (OSyncObjTypeSink *sink, OSyncPluginInfo *info, OSyncContext **contexts, OSyncChange **changes, void *data);
+
 /**
  * @brief Callback function to which got called after all changes got committed
  * 
@@ -423,6 +442,23 @@ OSYNC_EXPORT osync_bool osync_objtype_sink_get_read(OSyncObjTypeSink *sink);
  */
 OSYNC_EXPORT void osync_objtype_sink_set_read(OSyncObjTypeSink *sink, osync_bool read);
 
+/** @brief Checks if the engine accepts change stubs from get_changes
+ *
+ * A change stub has an uid, a hash and a changetype, and data of the
+ * right object format and object type, but without any content. If the
+ * engine accepts stubs, the sink may report its added and modified
+ * changes as stubs. The engine reads the content of the changes it needs
+ * with the read function of the sink later on. Deleted changes are
+ * reported as before.
+ *
+ * The engine only asks sinks with a read function for stubs.
+ *
+ * @param sink Pointer to the sink
+ * @returns TRUE if the sink may report change stubs, FALSE otherwise
+ *
+ */
+OSYNC_EXPORT osync_bool osync_objtype_sink_get_change_stubs(OSyncObjTypeSink *sink);
+
 /** @brief Queries a sink for the changed objects since the last sync
  * 
  * Calls the get_changes function on a sink
@@ -503,6 +539,19 @@ OSYNC_EXPORT void osync_objtype_sink_connect_done(OSyncObjTypeSink *sink, OSyncP
  */
 OSYNC_EXPORT void osync_objtype_sink_commit_change(OSyncObjTypeSink *sink, OSyncPluginInfo *info, OSyncChange *change, OSyncContext *ctx);
 
+/** @brief Commits several changes to the device
+ * 
+ * Calls the batch_commit function on a sink. If the sink has no batch_commit
+ * function the commit_change function gets called for every single change.
+ * 
+ * @param sink Pointer to the sink
+ * @param info Pointer to the plugin info object
+ * @param changes NULL terminated array of changes to write
+ * @param contexts NULL terminated array of sync contexts, one for each change
+ * 
+ */
+OSYNC_EXPORT void osync_objtype_sink_commit_changes(OSyncObjTypeSink *sink, OSyncPluginInfo *info, OSyncChange **changes, OSyncContext **contexts);
+
 /** @brief Tells the sink that all changes have been committed
  * 
  * Calls the committed_all function on a sink.
@@ -628,6 +677,8 @@ OSYNC_EXPORT void osync_objtype_sink_set_get_changes_func(OSyncObjTypeSink *sink
 
 OSYNC_EXPORT void osync_objtype_sink_set_commit_func(OSyncObjTypeSink *sink, OSyncSinkCommitFn commit_func);
 
+OSYNC_EXPORT void osync_objtype_sink_set_batch_commit_func(OSyncObjTypeSink *sink, OSyncSinkBatchCommitFn batch_commit_func);
+
 OSYNC_EXPORT void osync_objtype_sink_set_committed_all_func(OSyncObjTypeSink *sink, OSyncSinkCommittedAllFn committed_all_func);
 
 OSYNC_EXPORT void osync_objtype_sink_set_read_func(OSyncObjTypeSink *sink, OSyncSinkReadFn read_func);
@@ -37,6 +37,7 @@ typedef struct OSyncObjTypeSinkFunctions {
 	OSyncSinkDisconnectFn disconnect;
 	OSyncSinkGetChangesFn get_changes;
 	OSyncSinkCommitFn commit;
+	OSyncSinkBatchCommitFn batch_commit;
 	OSyncSinkCommittedAllFn committed_all;
 	OSyncSinkReadFn read;
 	OSyncSinkSyncDoneFn sync_done;
@@ -275,6 +276,16 @@ osync_bool osync_objtype_sink_get_slowsync(OSyncObjTypeSink *sink);
  */
 void osync_objtype_sink_set_slowsync(OSyncObjTypeSink *sink, osync_bool slowsync);
 
+/** @brief Sets if the engine accepts change stubs from get_changes
+ *
+ * See osync_objtype_sink_get_change_stubs()
+ *
+ * @param sink Pointer to the sink
+ * @param change_stubs TRUE if the sink may report change stubs, FALSE otherwise
+ *
+ */
+void osync_objtype_sink_set_change_stubs(OSyncObjTypeSink *sink, osync_bool change_stubs);
+
 /** @brief Returns the number of object formats in the sink
  * 
  * @param sink Pointer to the sink
@@ -117,6 +117,9 @@ struct OSyncObjTypeSink {
 	/** The request status of a slow-sync of this sink */
 	osync_bool slowsync;
 
+	/** The engine accepts change stubs from get_changes */
+	osync_bool change_stubs;
+
 	/** Referce counting */
 	int ref_count;
 
@@ -4,7 +4,11 @@
 #include <opensync/opensync-ipc.h>
 #include <opensync/opensync-plugin.h>
 
+#include "opensync/client/opensync_client_internals.h"
 #include "opensync/client/opensync_client_proxy_internals.h"
+#include "opensync/client/opensync_client_proxy_private.h"
+#include "opensync/ipc/opensync_message_internals.h"
+#include "opensync/ipc/opensync_queue_internals.h"
 #include "opensync/plugin/opensync_objtype_sink_internals.h"
 
 START_TEST (proxy_new)
@@ -141,6 +145,75 @@ START_TEST (proxy_init)
 }
 END_TEST
 
+/* Initializes a proxy asking for the given wire version, or for the default
+ * one if version is 0, and returns the version the client agreed on */
+static unsigned int init_wire_version(unsigned int version)
+{
+	char *testbed = setup_testbed(NULL);
+	char *formatdir = g_strdup_printf("%s/formats",  testbed);
+	char *plugindir = g_strdup_printf("%s/plugins",  testbed);
+	unsigned int agreed;
+
+	OSyncFormatEnv *formatenv = osync_testing_load_formatenv(formatdir);
+	
+	OSyncError *error = NULL;
+	OSyncThread *thread = osync_thread_new(NULL, &error);
+	fail_unless(thread != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+	osync_thread_start(thread);
+	
+	OSyncClientProxy *proxy = osync_client_proxy_new(formatenv, NULL, &error);
+	fail_unless(proxy != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+
+	if (version)
+		osync_client_proxy_set_wire_version(proxy, version);
+	
+	fail_unless(osync_client_proxy_spawn(proxy, OSYNC_START_TYPE_THREAD, NULL, NULL, &error), NULL);
+	fail_unless(error == NULL, NULL);
+
+	init_replies = 0;
+	fin_replies = 0;
+	
+	OSyncPluginConfig *config = simple_plugin_config(NULL, "data1", "mockobjtype1", "mockformat1", NULL);
+	fail_unless(osync_client_proxy_initialize(proxy, initialize_callback, GINT_TO_POINTER(1), formatdir, plugindir, "mock-sync", "test", testbed, config, &error), NULL);
+	osync_plugin_config_unref(config);
+
+	fail_unless(error == NULL, NULL);
+	
+	while (init_replies != 1) { g_usleep(100); }
+
+	agreed = osync_queue_get_wire_version(proxy->outgoing);
+	
+	fail_unless(osync_client_proxy_finalize(proxy, finalize_callback, GINT_TO_POINTER(1), &error), NULL);
+	fail_unless(error == NULL, NULL);
+	
+	while (fin_replies != 1) { g_usleep(100); }
+	
+	fail_unless(osync_client_proxy_shutdown(proxy, &error), NULL);
+	fail_unless(error == NULL, NULL);
+	
+	osync_client_proxy_unref(proxy);
+	
+	g_free(formatdir);
+	g_free(plugindir);
+	
+	osync_thread_stop(thread);
+	osync_thread_unref(thread);
+	
+	destroy_testbed(testbed);
+
+	return agreed;
+}
+
+START_TEST (proxy_init_wire_version)
+{
+	/* Plain stays the default, compact is used only if asked for */
+	fail_unless(init_wire_version(0) == OSYNC_QUEUE_WIRE_VERSION_PLAIN, NULL);
+	fail_unless(init_wire_version(OSYNC_QUEUE_WIRE_VERSION_COMPACT) == OSYNC_QUEUE_WIRE_VERSION_COMPACT, NULL);
+}
+END_TEST
+
 START_TEST (proxy_discover)
 {
 	char *testbed = setup_testbed(NULL);
@@ -270,11 +343,188 @@ START_TEST (proxy_connect)
 }
 END_TEST
 
+static int connect_done_replies = 0;
+static int get_changes_replies = 0;
+static int num_changes = 0;
+/* Number of changes received when the get_changes reply arrived */
+static int changes_before_reply = 0;
+static double last_change_time = 0;
+static double reply_time = 0;
+static GTimer *batch_timer = NULL;
+
+static void connect_done_callback(OSyncClientProxy *proxy, void *userdata, OSyncError *error)
+{
+	fail_unless(error == NULL, NULL);
+	connect_done_replies++;
+}
+
+static void batch_change_callback(OSyncClientProxy *proxy, void *userdata, OSyncChange *change)
+{
+	last_change_time = g_timer_elapsed(batch_timer, NULL);
+	num_changes++;
+}
+
+static void get_changes_callback(OSyncClientProxy *proxy, void *userdata, OSyncError *error)
+{
+	fail_unless(error == NULL, NULL);
+	reply_time = g_timer_elapsed(batch_timer, NULL);
+	changes_before_reply = num_changes;
+	g_atomic_int_inc(&get_changes_replies);
+}
+
+#define BATCH_NUM_CHANGES 5
+
+/* Runs get_changes for BATCH_NUM_CHANGES new files with the given batching
+ * of the client, returns the number of messages the client sent for it */
+static unsigned long long int get_changes_batched(unsigned int size, unsigned int bytes, unsigned int timeout)
+{
+	char *testbed = setup_testbed("sync");
+	char *formatdir = g_strdup_printf("%s/formats",  testbed);
+	char *plugindir = g_strdup_printf("%s/plugins",  testbed);
+	OSyncQueueStats before, after;
+	int i;
+
+	for (i = 0; i < BATCH_NUM_CHANGES; i++) {
+		char *command = g_strdup_printf("cp testdata data1/testdata%i", i);
+		osync_testing_system_abort(command);
+		g_free(command);
+	}
+
+	/* The mock plugin expects a committed_all before disconnect */
+	g_setenv("NO_COMMITTED_ALL_CHECK", "1", TRUE);
+
+	init_replies = connect_replies = connect_done_replies = disconnect_replies = fin_replies = 0;
+	get_changes_replies = num_changes = changes_before_reply = 0;
+
+	OSyncFormatEnv *formatenv = osync_testing_load_formatenv(formatdir);
+
+	OSyncError *error = NULL;
+	OSyncThread *thread = osync_thread_new(NULL, &error);
+	fail_unless(thread != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+	osync_thread_start(thread);
+	
+	OSyncClientProxy *proxy = osync_client_proxy_new(formatenv, NULL, &error);
+	fail_unless(proxy != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+
+	osync_client_proxy_set_change_callback(proxy, batch_change_callback, NULL);
+
+	fail_unless(osync_client_proxy_spawn(proxy, OSYNC_START_TYPE_THREAD, NULL, NULL, &error), NULL);
+	fail_unless(error == NULL, NULL);
+
+	osync_client_set_change_batch(proxy->client, size, bytes, timeout);
+	
+	OSyncPluginConfig *config = simple_plugin_config(NULL, "data1", "mockobjtype1", "mockformat1", NULL);
+	fail_unless(osync_client_proxy_initialize(proxy, initialize_callback, GINT_TO_POINTER(1), formatdir, plugindir, "mock-sync", "test", testbed, config, &error), NULL);
+	osync_plugin_config_unref(config);
+	fail_unless(error == NULL, NULL);
+	
+	while (init_replies != 1) { g_usleep(100); }
+	
+	fail_unless(osync_client_proxy_connect(proxy, connect_callback, GINT_TO_POINTER(1), "mockobjtype1", FALSE, &error), NULL);
+	fail_unless(error == NULL, NULL);
+	
+	while (connect_replies != 1) { g_usleep(100); }
+
+	fail_unless(osync_client_proxy_connect_done(proxy, connect_done_callback, NULL, "mockobjtype1", FALSE, &error), NULL);
+	fail_unless(error == NULL, NULL);
+	
+	while (connect_done_replies != 1) { g_usleep(100); }
+
+	fail_unless(osync_client_proxy_get_stats(proxy, &before), NULL);
+	batch_timer = g_timer_new();
+
+	fail_unless(osync_client_proxy_get_changes(proxy, get_changes_callback, NULL, "mockobjtype1", FALSE, &error), NULL);
+	fail_unless(error == NULL, NULL);
+
+	while (g_atomic_int_get(&get_changes_replies) != 1) { g_usleep(100); }
+
+	fail_unless(osync_client_proxy_get_stats(proxy, &after), NULL);
+
+	/* Every change arrives before the reply */
+	fail_unless(changes_before_reply == BATCH_NUM_CHANGES, NULL);
+	
+	fail_unless(osync_client_proxy_disconnect(proxy, disconnect_callback, GINT_TO_POINTER(1), "mockobjtype1", &error), NULL);
+	fail_unless(error == NULL, NULL);
+	
+	while (disconnect_replies != 1) { g_usleep(100); }
+	
+	fail_unless(osync_client_proxy_finalize(proxy, finalize_callback, GINT_TO_POINTER(1), &error), NULL);
+	fail_unless(error == NULL, NULL);
+	
+	while (fin_replies != 1) { g_usleep(100); }
+	
+	fail_unless(osync_client_proxy_shutdown(proxy, &error), NULL);
+	fail_unless(error == NULL, NULL);
+	
+	osync_client_proxy_unref(proxy);
+	
+	g_free(formatdir);
+	g_free(plugindir);
+	
+	osync_thread_stop(thread);
+	osync_thread_unref(thread);
+
+	g_timer_destroy(batch_timer);
+	batch_timer = NULL;
+	
+	destroy_testbed(testbed);
+
+	return after.messages_received - before.messages_received;
+}
+
+/* A batch gets sent once it holds the maximum number of changes. The
+ * last, partial batch goes right before the reply. */
+START_TEST (proxy_get_changes_batch_size)
+{
+	/* 2 + 2 + 1 changes and the reply */
+	fail_unless(get_changes_batched(2, 1024 * 1024, 0) == 4, NULL);
+
+	/* Every change on its own */
+	fail_unless(get_changes_batched(1, 1024 * 1024, 0) == BATCH_NUM_CHANGES + 1, NULL);
+}
+END_TEST
+
+/* A batch gets sent once it reached the size in bytes */
+START_TEST (proxy_get_changes_batch_bytes)
+{
+	/* Already the first change exceeds a byte */
+	fail_unless(get_changes_batched(100, 1, 0) == BATCH_NUM_CHANGES + 1, NULL);
+
+	/* All changes fit */
+	fail_unless(get_changes_batched(100, 1024 * 1024, 0) == 2, NULL);
+}
+END_TEST
+
+/* A batch waits at most the timeout, without a timeout it waits for
+ * the reply. The plugin reports its success one second after the
+ * changes. */
+START_TEST (proxy_get_changes_batch_timeout)
+{
+	g_setenv("GET_CHANGES_DELAY_SUCCESS", "1000", TRUE);
+
+	fail_unless(get_changes_batched(100, 1024 * 1024, 0) == 2, NULL);
+	fail_unless(last_change_time >= 0.9, NULL);
+	fail_unless(last_change_time <= reply_time, NULL);
+
+	fail_unless(get_changes_batched(100, 1024 * 1024, 20) == 2, NULL);
+	fail_unless(last_change_time < 0.5, NULL);
+	fail_unless(reply_time >= 0.9, NULL);
+
+	g_unsetenv("GET_CHANGES_DELAY_SUCCESS");
+}
+END_TEST
+
 OSYNC_TESTCASE_START("proxy")
 OSYNC_TESTCASE_ADD(proxy_new)
 OSYNC_TESTCASE_ADD(proxy_spawn)
 OSYNC_TESTCASE_ADD(proxy_init)
+OSYNC_TESTCASE_ADD(proxy_init_wire_version)
 OSYNC_TESTCASE_ADD(proxy_discover)
 OSYNC_TESTCASE_ADD(proxy_connect)
+OSYNC_TESTCASE_ADD(proxy_get_changes_batch_size)
+OSYNC_TESTCASE_ADD(proxy_get_changes_batch_bytes)
+OSYNC_TESTCASE_ADD(proxy_get_changes_batch_timeout)
 OSYNC_TESTCASE_END
 
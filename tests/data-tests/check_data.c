@@ -3,6 +3,8 @@
 #include <opensync/opensync-data.h>
 #include <opensync/opensync-format.h>
 
+#include "opensync/data/opensync_change_internals.h"
+
 START_TEST (data_new)
 {
 	char *testbed = setup_testbed(NULL);
@@ -189,6 +191,43 @@ START_TEST (data_objtype)
 }
 END_TEST
 
+START_TEST (data_change_stub)
+{
+	char *testbed = setup_testbed(NULL);
+	
+	OSyncError *error = NULL;
+	OSyncObjFormat *format = osync_objformat_new("test", "objtype", &error);
+	fail_unless(format != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+	
+	OSyncData *data = osync_data_new(NULL, 0, format, &error);
+	fail_unless(data != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+
+	OSyncChange *change = osync_change_new(&error);
+	fail_unless(change != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+
+	osync_change_set_changetype(change, OSYNC_CHANGE_TYPE_MODIFIED);
+	osync_change_set_data(change, data);
+
+	/* Empty data alone doesn't make a stub */
+	fail_unless(!osync_change_is_stub(change), NULL);
+
+	osync_change_set_stub(change, TRUE);
+	fail_unless(osync_change_is_stub(change), NULL);
+
+	osync_change_set_stub(change, FALSE);
+	fail_unless(!osync_change_is_stub(change), NULL);
+	
+	osync_change_unref(change);
+	osync_data_unref(data);
+	osync_objformat_unref(format);
+	
+	destroy_testbed(testbed);
+}
+END_TEST
+
 OSYNC_TESTCASE_START("data")
 OSYNC_TESTCASE_ADD(data_new)
 OSYNC_TESTCASE_ADD(data_new_with_data)
@@ -196,5 +235,6 @@ OSYNC_TESTCASE_ADD(data_set_data)
 OSYNC_TESTCASE_ADD(data_set_data2)
 OSYNC_TESTCASE_ADD(data_objformat)
 OSYNC_TESTCASE_ADD(data_objtype)
+OSYNC_TESTCASE_ADD(data_change_stub)
 OSYNC_TESTCASE_END
 
@@ -10,6 +10,10 @@
 
 #include "opensync/engine/opensync_engine_internals.h"
 #include "opensync/engine/opensync_engine_private.h"
+#include "opensync/engine/opensync_change_store_internals.h"
+
+#include "opensync/format/opensync_converter_private.h"
+#include "opensync/format/opensync_objformat_internals.h"
 
 #include "opensync/group/opensync_member_internals.h"
 #include "opensync/client/opensync_client_internals.h"
@@ -313,11 +317,17 @@ static void _free_group(OSyncDebugGroup *debug)
 {
 	osync_client_unref(debug->client1);
 	osync_client_unref(debug->client2);
+	if (debug->client3)
+		osync_client_unref(debug->client3);
 	
 	osync_plugin_unref(debug->plugin);
+	if (debug->plugin2)
+		osync_plugin_unref(debug->plugin2);
 	
 	osync_member_unref(debug->member1);
 	osync_member_unref(debug->member2);
+	if (debug->member3)
+		osync_member_unref(debug->member3);
 	osync_group_unref(debug->group);
 	
 	g_free(debug);
@@ -2017,6 +2027,495 @@ START_TEST (engine_sync_read_write_stress2)
 }
 END_TEST
 
+/* The master change of member 1 gets written to members 2 and 3, which
+ * share the same target format */
+static int num_shared_conversions = 0;
+static int num_shared_commits = 0;
+static char *shared_commits[2];
+static char *shared_commit_buffers[2];
+static OSyncFormatConvertFunc shared_convert_func = NULL;
+
+static osync_bool _count_shared_conversion(char *input, unsigned int inpsize, char **output, unsigned int *outpsize, osync_bool *free_input, const char *config, void *userdata, OSyncError **error)
+{
+	g_atomic_int_inc(&num_shared_conversions);
+	return shared_convert_func(input, inpsize, output, outpsize, free_input, config, userdata, error);
+}
+
+static void commit_change8(OSyncObjTypeSink *sink, OSyncPluginInfo *info, OSyncContext *ctx, OSyncChange *change, void *data)
+{
+	mock_env *env = data;
+	char *buffer = NULL;
+	unsigned int size = 0;
+	int i;
+	osync_trace(TRACE_ENTRY, "%s(%p, %p, %p, %p)", __func__, data, info, ctx, change);
+	
+	osync_assert(!strcmp(osync_objformat_get_name(osync_change_get_objformat(change)), "mockformat1a"));
+
+	osync_data_get_data(osync_change_get_data(change), &buffer, &size);
+	osync_assert(size == sizeof(OSyncFileFormat));
+
+	OSyncFileFormat *file = (OSyncFileFormat *)buffer;
+	i = g_atomic_int_exchange_and_add(&num_shared_commits, 1);
+	osync_assert(i < 2);
+	shared_commits[i] = g_strndup(file->data, file->size);
+	shared_commit_buffers[i] = buffer;
+
+	/* Like a plugin that replaces the record, which must not affect
+	 * what the other member gets */
+	OSyncFileFormat *replaced = osync_try_malloc0(sizeof(OSyncFileFormat), NULL);
+	osync_assert(replaced != NULL);
+	replaced->path = g_strdup(file->path);
+	replaced->data = g_strdup("");
+	osync_data_set_data(osync_change_get_data(change), (char *)replaced, sizeof(OSyncFileFormat));
+
+	g_atomic_int_inc(&(env->num_commit_changes));
+	
+	osync_context_report_success(ctx);
+	
+	osync_trace(TRACE_EXIT, "%s", __func__);
+}
+
+static void *initialize8(OSyncPlugin *plugin, OSyncPluginInfo *info, OSyncError **error)
+{
+	osync_trace(TRACE_ENTRY, "%s(%p, %p)", __func__, info, error);
+
+	mock_env *env = osync_try_malloc0(sizeof(mock_env), error);
+	if (!env)
+		goto error;
+
+	OSyncObjTypeSink *sink = osync_objtype_sink_new("mockobjtype1", error);
+	if (!sink)
+		goto error;
+	
+	OSyncObjFormatSink *format_sink = osync_objformat_sink_new("mockformat1a", error);
+	osync_objtype_sink_add_objformat_sink(sink, format_sink);
+	osync_objformat_sink_unref(format_sink);
+	
+	osync_objtype_sink_set_connect_func(sink, connect5);
+	osync_objtype_sink_set_disconnect_func(sink, disconnect5);
+	osync_objtype_sink_set_get_changes_func(sink, get_changes);
+	osync_objtype_sink_set_commit_func(sink, commit_change8);
+
+	osync_objtype_sink_set_userdata(sink, env);
+
+	osync_plugin_info_add_objtype(info, sink);
+	osync_objtype_sink_unref(sink);
+	
+	osync_trace(TRACE_EXIT, "%s: %p", __func__, env);
+	return (void *)env;
+
+error:
+	osync_trace(TRACE_EXIT_ERROR, "%s: %s", __func__, osync_error_print(error));
+	return NULL;
+}
+
+static void finalize8(void *data)
+{
+	mock_env *env = data;
+	
+	osync_assert(env->num_connect == 1);
+	osync_assert(env->num_disconnect == 1);
+	osync_assert(env->num_commit_changes == 1);
+	
+	g_free(env);
+}
+
+static void finalize8_master(void *data)
+{
+	mock_env *env = data;
+	
+	osync_assert(env->num_connect == 1);
+	osync_assert(env->num_disconnect == 1);
+	osync_assert(env->num_get_changes == 1);
+	osync_assert(env->num_commit_changes == 0);
+	
+	g_free(env);
+}
+
+static OSyncMember *_create_member8(OSyncDebugGroup *debug, const char *testbed, int id, OSyncPlugin *plugin, const char *objformat, OSyncClient **client)
+{
+	OSyncError *error = NULL;
+	OSyncMember *member = osync_member_new(&error);
+	fail_unless(member != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+	osync_group_add_member(debug->group, member);
+	osync_member_set_pluginname(member, osync_plugin_get_name(plugin));
+	char *path = g_strdup_printf("%s/configs/group/%i", testbed, id);
+	osync_member_set_configdir(member, path);
+	g_free(path);
+	_member_add_format(member, "mockobjtype1", objformat);
+
+	*client = osync_client_new(&error);
+	fail_unless(*client != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+	char *pipe_path = g_strdup_printf("%s/configs/group/%i/pluginpipe", testbed, id);
+	osync_client_run_external(*client, pipe_path, plugin, &error);
+	g_free(pipe_path);
+
+	return member;
+}
+
+static OSyncDebugGroup *_create_group8(char *testbed)
+{
+	osync_trace(TRACE_ENTRY, "%s(%s)", __func__, testbed);
+	
+	OSyncDebugGroup *debug = g_malloc0(sizeof(OSyncDebugGroup));
+	
+	OSyncError *error = NULL;
+	debug->group = osync_group_new(&error);
+	fail_unless(debug->group != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+
+	osync_group_set_configdir(debug->group, testbed);
+
+	debug->plugin = osync_plugin_new(&error);
+	fail_unless(debug->plugin != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+	
+	osync_plugin_set_name(debug->plugin, "mock-sync-foo");
+	osync_plugin_set_longname(debug->plugin, "Mock Sync Plugin");
+	osync_plugin_set_description(debug->plugin, "This is a pseudo plugin");
+	osync_plugin_set_start_type(debug->plugin, OSYNC_START_TYPE_EXTERNAL);
+	osync_plugin_set_config_type(debug->plugin, OSYNC_PLUGIN_NO_CONFIGURATION);
+	
+	osync_plugin_set_initialize_func(debug->plugin, initialize5);
+	osync_plugin_set_finalize_func(debug->plugin, finalize8_master);
+
+	debug->plugin2 = osync_plugin_new(&error);
+	fail_unless(debug->plugin2 != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+	
+	osync_plugin_set_name(debug->plugin2, "mock-sync-bar");
+	osync_plugin_set_longname(debug->plugin2, "Mock Sync Plugin");
+	osync_plugin_set_description(debug->plugin2, "This is a pseudo plugin");
+	osync_plugin_set_start_type(debug->plugin2, OSYNC_START_TYPE_EXTERNAL);
+	osync_plugin_set_config_type(debug->plugin2, OSYNC_PLUGIN_NO_CONFIGURATION);
+	
+	osync_plugin_set_initialize_func(debug->plugin2, initialize8);
+	osync_plugin_set_finalize_func(debug->plugin2, finalize8);
+
+	debug->member1 = _create_member8(debug, testbed, 1, debug->plugin, "mockformat1", &debug->client1);
+	debug->member2 = _create_member8(debug, testbed, 2, debug->plugin2, "mockformat1a", &debug->client2);
+	debug->member3 = _create_member8(debug, testbed, 3, debug->plugin2, "mockformat1a", &debug->client3);
+	
+	osync_trace(TRACE_EXIT, "%s: %p", __func__, debug);
+	return debug;
+}
+
+START_TEST (engine_sync_shared_conversion)
+{
+	char *testbed = setup_testbed("multisync_easy_new");
+	char *formatdir = g_strdup_printf("%s/formats",  testbed);
+	
+	OSyncError *error = NULL;
+	OSyncDebugGroup *debug = _create_group8(testbed);
+
+	OSyncEngine *engine = osync_engine_new(debug->group, &error);
+	fail_unless(engine != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+	osync_engine_set_formatdir(engine, formatdir);
+	osync_engine_set_schemadir(engine, testbed);
+
+	_engine_instrument_pluginenv(engine, debug);
+
+	fail_unless(osync_engine_initialize(engine, &error), NULL);
+	fail_unless(error == NULL, NULL);
+
+	/* Count the conversions to the format of members 2 and 3 */
+	OSyncObjFormat *mockformat1 = osync_format_env_find_objformat(engine->formatenv, "mockformat1");
+	OSyncObjFormat *mockformat1a = osync_format_env_find_objformat(engine->formatenv, "mockformat1a");
+	OSyncFormatConverter *converter = osync_format_env_find_converter(engine->formatenv, mockformat1, mockformat1a);
+	fail_unless(converter != NULL, NULL);
+	shared_convert_func = converter->convert_func;
+	converter->convert_func = _count_shared_conversion;
+	
+	fail_unless(osync_engine_synchronize_and_block(engine, &error), NULL);
+	fail_unless(error == NULL, NULL);
+
+	/* Both members got the same record, converted only once */
+	fail_unless(num_shared_conversions == 1, NULL);
+	fail_unless(num_shared_commits == 2, NULL);
+	fail_unless(shared_commits[0] != NULL && shared_commits[1] != NULL, NULL);
+	fail_unless(!strcmp(shared_commits[0], shared_commits[1]), NULL);
+	/* Reading the committed data doesn't copy it */
+	fail_unless(shared_commit_buffers[0] == shared_commit_buffers[1], NULL);
+	
+	fail_unless(osync_engine_finalize(engine, &error), NULL);
+	fail_unless(error == NULL, NULL);
+	
+	_free_group(debug);
+	
+	osync_engine_unref(engine);
+
+	g_free(shared_commits[0]);
+	g_free(shared_commits[1]);
+	g_free(formatdir);
+	
+	destroy_testbed(testbed);
+}
+END_TEST
+
+/* Both members report the same records. The mock format has a mapping key,
+ * so each change only gets compared with the mapping of the same key */
+#define MAPPING_KEY_CHANGES 20
+
+static int num_mapping_key_compares = 0;
+
+static OSyncConvCmpResult compare_count9(const char *leftdata, unsigned int leftsize, const char *rightdata, unsigned int rightsize, void *user_data, OSyncError **error)
+{
+	OSyncFileFormat *leftfile = (OSyncFileFormat *)leftdata;
+	OSyncFileFormat *rightfile = (OSyncFileFormat *)rightdata;
+
+	g_atomic_int_inc(&num_mapping_key_compares);
+
+	if (strcmp(leftfile->path, rightfile->path))
+		return OSYNC_CONV_DATA_MISMATCH;
+
+	if (leftfile->size == rightfile->size && !memcmp(leftfile->data, rightfile->data, leftfile->size))
+		return OSYNC_CONV_DATA_SAME;
+
+	return OSYNC_CONV_DATA_SIMILAR;
+}
+
+static void get_changes9(OSyncObjTypeSink *sink, OSyncPluginInfo *info, OSyncContext *ctx, osync_bool slow_sync, void *data)
+{
+	mock_env *env = data;
+	int i;
+	osync_trace(TRACE_ENTRY, "%s(%p, %p, %p)", __func__, data, info, ctx);
+	
+	OSyncFormatEnv *formatenv = osync_plugin_info_get_format_env(info);
+	osync_assert(formatenv != NULL);
+	
+	OSyncObjFormat *format = osync_format_env_find_objformat(formatenv, "mockformat1");
+	osync_assert(format != NULL);
+
+	for (i = 0; i < MAPPING_KEY_CHANGES; i++) {
+		OSyncError *error = NULL;
+		OSyncChange *change = osync_change_new(&error);
+		osync_assert(change != NULL);
+		
+		osync_change_set_changetype(change, OSYNC_CHANGE_TYPE_ADDED);
+
+		char *uid = g_strdup_printf("uid%i", i);
+		osync_change_set_uid(change, uid);
+		g_free(uid);
+		
+		OSyncFileFormat *file = osync_try_malloc0(sizeof(OSyncFileFormat), &error);
+		osync_assert(file != NULL);
+		file->path = g_strdup(osync_change_get_uid(change));
+		file->data = g_strdup(osync_change_get_uid(change));
+		file->size = strlen(file->data);
+			
+		OSyncData *changedata = osync_data_new((char *)file, sizeof(OSyncFileFormat), format, &error);
+		osync_assert(changedata != NULL);
+		osync_data_set_objtype(changedata, "mockobjtype1");
+
+		osync_change_set_data(change, changedata);
+		osync_data_unref(changedata);
+		
+		osync_context_report_change(ctx, change);
+		osync_change_unref(change);
+	}
+	
+	g_atomic_int_inc(&(env->num_get_changes));
+	
+	osync_context_report_success(ctx);
+	
+	osync_trace(TRACE_EXIT, "%s", __func__);
+}
+
+static void *initialize9(OSyncPlugin *plugin, OSyncPluginInfo *info, OSyncError **error)
+{
+	osync_trace(TRACE_ENTRY, "%s(%p, %p)", __func__, info, error);
+
+	mock_env *env = osync_try_malloc0(sizeof(mock_env), error);
+	if (!env)
+		goto error;
+
+	OSyncObjTypeSink *sink = osync_objtype_sink_new("mockobjtype1", error);
+	if (!sink)
+		goto error;
+	
+	OSyncObjFormatSink *format_sink = osync_objformat_sink_new("mockformat1", error);
+	osync_objtype_sink_add_objformat_sink(sink, format_sink);
+	osync_objformat_sink_unref(format_sink);
+	
+	osync_objtype_sink_set_connect_func(sink, connect5);
+	osync_objtype_sink_set_disconnect_func(sink, disconnect5);
+	osync_objtype_sink_set_get_changes_func(sink, get_changes9);
+	osync_objtype_sink_set_commit_func(sink, commit_change5);
+
+	osync_objtype_sink_set_userdata(sink, env);
+
+	osync_plugin_info_add_objtype(info, sink);
+	osync_objtype_sink_unref(sink);
+	
+	osync_trace(TRACE_EXIT, "%s: %p", __func__, env);
+	return (void *)env;
+
+error:
+	osync_trace(TRACE_EXIT_ERROR, "%s: %s", __func__, osync_error_print(error));
+	return NULL;
+}
+
+static void finalize9(void *data)
+{
+	mock_env *env = data;
+	
+	osync_assert(env->num_connect == 1);
+	osync_assert(env->num_disconnect == 1);
+	osync_assert(env->num_get_changes == 1);
+	/* All records are the same on both sides */
+	osync_assert(env->num_commit_changes == 0);
+	
+	g_free(env);
+}
+
+static OSyncDebugGroup *_create_group9(char *testbed)
+{
+	osync_trace(TRACE_ENTRY, "%s(%s)", __func__, testbed);
+	
+	OSyncDebugGroup *debug = g_malloc0(sizeof(OSyncDebugGroup));
+	
+	OSyncError *error = NULL;
+	debug->group = osync_group_new(&error);
+	fail_unless(debug->group != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+
+	osync_group_set_configdir(debug->group, testbed);
+
+	debug->plugin = osync_plugin_new(&error);
+	fail_unless(debug->plugin != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+	
+	osync_plugin_set_name(debug->plugin, "mock-sync-foo");
+	osync_plugin_set_longname(debug->plugin, "Mock Sync Plugin");
+	osync_plugin_set_description(debug->plugin, "This is a pseudo plugin");
+	osync_plugin_set_start_type(debug->plugin, OSYNC_START_TYPE_EXTERNAL);
+	osync_plugin_set_config_type(debug->plugin, OSYNC_PLUGIN_NO_CONFIGURATION);
+	
+	osync_plugin_set_initialize_func(debug->plugin, initialize9);
+	osync_plugin_set_finalize_func(debug->plugin, finalize9);
+
+	debug->member1 = _create_member8(debug, testbed, 1, debug->plugin, "mockformat1", &debug->client1);
+	debug->member2 = _create_member8(debug, testbed, 2, debug->plugin, "mockformat1", &debug->client2);
+	
+	osync_trace(TRACE_EXIT, "%s: %p", __func__, debug);
+	return debug;
+}
+
+START_TEST (engine_sync_mapping_key)
+{
+	char *testbed = setup_testbed("sync_setup");
+	char *formatdir = g_strdup_printf("%s/formats",  testbed);
+	
+	OSyncError *error = NULL;
+	OSyncDebugGroup *debug = _create_group9(testbed);
+
+	OSyncEngine *engine = osync_engine_new(debug->group, &error);
+	fail_unless(engine != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+	osync_engine_set_formatdir(engine, formatdir);
+	osync_engine_set_schemadir(engine, testbed);
+
+	_engine_instrument_pluginenv(engine, debug);
+
+	fail_unless(osync_engine_initialize(engine, &error), NULL);
+	fail_unless(error == NULL, NULL);
+
+	/* Count the compares of the engine, the format keeps its mapping key */
+	OSyncObjFormat *format = osync_format_env_find_objformat(engine->formatenv, "mockformat1");
+	fail_unless(format != NULL, NULL);
+	fail_unless(osync_objformat_has_mapping_key(format), NULL);
+	osync_objformat_set_compare_func(format, compare_count9);
+	
+	fail_unless(osync_engine_synchronize_and_block(engine, &error), NULL);
+	fail_unless(error == NULL, NULL);
+
+	/* Each change of member 2 got compared with its counterpart. Without
+	 * the buckets it would have been compared with half the mappings on
+	 * average, about MAPPING_KEY_CHANGES^2 / 2 compares */
+	fail_unless(num_mapping_key_compares >= MAPPING_KEY_CHANGES, NULL);
+	fail_unless(num_mapping_key_compares <= 2 * MAPPING_KEY_CHANGES, NULL);
+	
+	fail_unless(osync_engine_finalize(engine, &error), NULL);
+	fail_unless(error == NULL, NULL);
+	
+	_free_group(debug);
+	
+	osync_engine_unref(engine);
+
+	g_free(formatdir);
+	
+	destroy_testbed(testbed);
+}
+END_TEST
+
+START_TEST (engine_change_store)
+{
+	char *testbed = setup_testbed(NULL);
+	char *buffer = NULL;
+	unsigned int size = 0;
+
+	OSyncError *error = NULL;
+	OSyncChangeStore *store = osync_change_store_new(testbed, 1, &error);
+	fail_unless(store != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+
+	OSyncObjFormat *format = osync_objformat_new("plain", "data", &error);
+	fail_unless(format != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+
+	OSyncData *data = osync_data_new(osync_strdup("abc"), 3, format, &error);
+	fail_unless(data != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+
+	OSyncChange *change = osync_change_new(&error);
+	fail_unless(change != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+	osync_change_set_data(change, data);
+
+	/* Over budget right away */
+	fail_unless(osync_change_store_add(store, change, &error), NULL);
+	fail_unless(error == NULL, NULL);
+	fail_unless(osync_change_store_get_num_spilled(store) == 1, NULL);
+	fail_unless(osync_change_store_get_resident(store) == 0, NULL);
+	fail_unless(osync_change_store_get_file_size(store) == 3, NULL);
+
+	/* Read back on access */
+	osync_data_get_data(data, &buffer, &size);
+	fail_unless(size == 3 && !memcmp(buffer, "abc", 3), NULL);
+	fail_unless(osync_change_store_get_resident(store) == 3, NULL);
+
+	/* Unchanged data keeps its place in the scratch file */
+	fail_unless(osync_change_store_trim(store, &error), NULL);
+	fail_unless(error == NULL, NULL);
+	fail_unless(osync_change_store_get_num_spilled(store) == 2, NULL);
+	fail_unless(osync_change_store_get_resident(store) == 0, NULL);
+	fail_unless(osync_change_store_get_file_size(store) == 3, NULL);
+
+	/* Replaced data gets written again */
+	osync_data_set_data(data, osync_strdup("defg"), 4);
+	fail_unless(osync_change_store_get_resident(store) == 4, NULL);
+
+	fail_unless(osync_change_store_trim(store, &error), NULL);
+	fail_unless(error == NULL, NULL);
+	fail_unless(osync_change_store_get_num_spilled(store) == 3, NULL);
+	fail_unless(osync_change_store_get_resident(store) == 0, NULL);
+	fail_unless(osync_change_store_get_file_size(store) == 7, NULL);
+
+	osync_data_get_data(data, &buffer, &size);
+	fail_unless(size == 4 && !memcmp(buffer, "defg", 4), NULL);
+
+	osync_change_unref(change);
+	osync_data_unref(data);
+	osync_objformat_unref(format);
+	osync_change_store_unref(store);
+
+	destroy_testbed(testbed);
+}
+END_TEST
+
 OSYNC_TESTCASE_START(engine)
 
 OSYNC_TESTCASE_ADD(engine_new)
@@ -2030,6 +2529,10 @@ OSYNC_TESTCASE_ADD(engine_sync_stress)
 OSYNC_TESTCASE_ADD(engine_sync_read_write)
 OSYNC_TESTCASE_ADD(engine_sync_read_write_stress)
 OSYNC_TESTCASE_ADD(engine_sync_read_write_stress2)
+OSYNC_TESTCASE_ADD(engine_sync_shared_conversion)
+OSYNC_TESTCASE_ADD(engine_sync_mapping_key)
+
+OSYNC_TESTCASE_ADD(engine_change_store)
 
 //connect problem
 //get_changes problem
@@ -9,12 +9,18 @@
 #include <opensync/opensync-client.h>
 #include <opensync/opensync-engine.h>
 #include <opensync/opensync-plugin.h>
+#include <opensync/opensync-capabilities.h>
 
 #include "opensync/engine/opensync_engine_internals.h"
 #include "opensync/engine/opensync_engine_private.h"
+#include "opensync/engine/opensync_obj_engine_internals.h"
+#include "opensync/engine/opensync_sink_engine_internals.h"
+#include "opensync/engine/opensync_mapping_engine_internals.h"
+#include "opensync/engine/opensync_mapping_entry_engine_internals.h"
 
 #include "opensync/group/opensync_group_internals.h"
 #include "opensync/client/opensync_client_internals.h"
+#include "opensync/client/opensync_client_proxy_internals.h"
 
 void conflict_callback_fail(OSyncEngine *engine, OSyncMappingEngine *mapping_engine, void *userdata)
 {
@@ -239,10 +245,336 @@ START_TEST (mapping_engine_same_similar_conflict_multi)
 }
 END_TEST
 
+static int num_compare = 0;
+
+static OSyncConvCmpResult compare_count(const char *leftdata, unsigned int leftsize, const char *rightdata, unsigned int rightsize, void *user_data, OSyncError **error)
+{
+	num_compare++;
+
+	if (leftsize == rightsize && !memcmp(leftdata, rightdata, leftsize))
+		return OSYNC_CONV_DATA_SAME;
+
+	return OSYNC_CONV_DATA_MISMATCH;
+}
+
+static OSyncChange *compare_change(OSyncObjFormat *format, const char *buffer)
+{
+	OSyncError *error = NULL;
+	OSyncChange *change = osync_change_new(&error);
+	fail_unless(change != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+
+	OSyncData *data = osync_data_new(osync_strdup(buffer), strlen(buffer), format, &error);
+	fail_unless(data != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+
+	osync_change_set_data(change, data);
+	osync_change_set_changetype(change, OSYNC_CHANGE_TYPE_ADDED);
+	osync_data_unref(data);
+
+	return change;
+}
+
+/* Unit Test: Compares of the same pair of changes get remembered
+ *
+ * The object format compare function only gets called once per pair,
+ * in either order, until the data of one of the changes gets replaced.
+ * Mismatches are not remembered.
+ */
+
+START_TEST (mapping_engine_compare_cache)
+{
+	char *testbed = setup_testbed(NULL);
+
+	OSyncError *error = NULL;
+	OSyncGroup *group = osync_group_new(&error);
+	fail_unless(group != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+
+	OSyncEngine *engine = osync_engine_new(group, &error);
+	fail_unless(engine != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+	osync_group_unref(group);
+
+	OSyncFormatEnv *formatenv = osync_format_env_new(&error);
+	fail_unless(formatenv != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+
+	OSyncObjEngine *objengine = osync_obj_engine_new(engine, "test", formatenv, &error);
+	fail_unless(objengine != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+
+	OSyncObjFormat *format = osync_objformat_new("test", "test", &error);
+	fail_unless(format != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+	osync_objformat_set_compare_func(format, compare_count);
+
+	OSyncChange *change1 = compare_change(format, "test");
+	OSyncChange *change2 = compare_change(format, "test");
+	OSyncChange *change3 = compare_change(format, "other");
+
+	num_compare = 0;
+	fail_unless(osync_obj_engine_compare_changes(objengine, change1, change2, &error) == OSYNC_CONV_DATA_SAME, NULL);
+	fail_unless(osync_obj_engine_compare_changes(objengine, change1, change2, &error) == OSYNC_CONV_DATA_SAME, NULL);
+	fail_unless(osync_obj_engine_compare_changes(objengine, change2, change1, &error) == OSYNC_CONV_DATA_SAME, NULL);
+	fail_unless(num_compare == 1, NULL);
+
+	fail_unless(osync_obj_engine_compare_changes(objengine, change1, change3, &error) == OSYNC_CONV_DATA_MISMATCH, NULL);
+	fail_unless(osync_obj_engine_compare_changes(objengine, change3, change1, &error) == OSYNC_CONV_DATA_MISMATCH, NULL);
+	fail_unless(num_compare == 3, NULL);
+	fail_unless(error == NULL, NULL);
+
+	/* New data of a change needs a new compare */
+	OSyncData *data = osync_data_new(osync_strdup("other"), strlen("other"), format, &error);
+	fail_unless(data != NULL, NULL);
+	osync_change_set_data(change2, data);
+	osync_data_unref(data);
+
+	fail_unless(osync_obj_engine_compare_changes(objengine, change1, change2, &error) == OSYNC_CONV_DATA_MISMATCH, NULL);
+	fail_unless(num_compare == 4, NULL);
+
+	/* The new data matches the other change */
+	fail_unless(osync_obj_engine_compare_changes(objengine, change2, change3, &error) == OSYNC_CONV_DATA_SAME, NULL);
+	fail_unless(osync_obj_engine_compare_changes(objengine, change3, change2, &error) == OSYNC_CONV_DATA_SAME, NULL);
+	fail_unless(num_compare == 5, NULL);
+
+	/* A new sync compares again */
+	osync_obj_engine_finalize(objengine);
+	fail_unless(osync_obj_engine_compare_changes(objengine, change2, change3, &error) == OSYNC_CONV_DATA_SAME, NULL);
+	fail_unless(num_compare == 6, NULL);
+
+	osync_change_unref(change1);
+	osync_change_unref(change2);
+	osync_change_unref(change3);
+	osync_objformat_unref(format);
+	osync_obj_engine_unref(objengine);
+	osync_format_env_unref(formatenv);
+	osync_engine_unref(engine);
+
+	destroy_testbed(testbed);
+}
+END_TEST
+
+static int num_demerge = 0;
+
+static osync_bool demerge_count(char **buf, unsigned int *size, OSyncCapabilities *caps, void *userdata, OSyncError **error)
+{
+	num_demerge++;
+	return TRUE;
+}
+
+/* Unit Test: Changes get demerged at most once per mapping run
+ *
+ * The clone of a change gets demerged once for the capabilities of each
+ * peer member. The next mapping run demerges again.
+ */
+
+START_TEST (mapping_engine_demerge_cache)
+{
+	char *testbed = setup_testbed(NULL);
+
+	OSyncError *error = NULL;
+	OSyncGroup *group = osync_group_new(&error);
+	fail_unless(group != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+
+	OSyncEngine *engine = osync_engine_new(group, &error);
+	fail_unless(engine != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+	osync_group_unref(group);
+
+	OSyncFormatEnv *formatenv = osync_format_env_new(&error);
+	fail_unless(formatenv != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+
+	OSyncObjFormat *format = osync_objformat_new("test", "test", &error);
+	fail_unless(format != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+	fail_unless(osync_format_env_register_objformat(formatenv, format, &error), NULL);
+
+	OSyncMerger *merger = osync_merger_new("test", "testcaps", &error);
+	fail_unless(merger != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+	osync_merger_set_demerge_func(merger, demerge_count);
+	fail_unless(osync_format_env_register_merger(formatenv, merger, &error), NULL);
+
+	OSyncCapabilities *caps1 = osync_capabilities_new("testcaps", &error);
+	fail_unless(caps1 != NULL, NULL);
+	OSyncCapabilities *caps2 = osync_capabilities_new("testcaps", &error);
+	fail_unless(caps2 != NULL, NULL);
+
+	OSyncObjEngine *objengine = osync_obj_engine_new(engine, "test", formatenv, &error);
+	fail_unless(objengine != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+
+	OSyncChange *change = compare_change(format, "test");
+
+	num_demerge = 0;
+	OSyncChange *clone = osync_obj_engine_demerged_change(objengine, caps1, change, &error);
+	fail_unless(clone != NULL, NULL);
+	fail_unless(clone != change, NULL);
+	fail_unless(osync_obj_engine_demerged_change(objengine, caps1, change, &error) == clone, NULL);
+	fail_unless(num_demerge == 1, NULL);
+
+	/* Another peer member gets its own clone */
+	fail_unless(osync_obj_engine_demerged_change(objengine, caps2, change, &error) != clone, NULL);
+	fail_unless(num_demerge == 2, NULL);
+	fail_unless(error == NULL, NULL);
+
+	/* The clones only live for the mapping run */
+	fail_unless(osync_obj_engine_map_changes(objengine, &error), NULL);
+	fail_unless(osync_obj_engine_demerged_change(objengine, caps1, change, &error) != NULL, NULL);
+	fail_unless(num_demerge == 3, NULL);
+	fail_unless(osync_obj_engine_map_changes(objengine, &error), NULL);
+	fail_unless(error == NULL, NULL);
+
+	osync_change_unref(change);
+	osync_obj_engine_unref(objengine);
+	osync_capabilities_unref(caps1);
+	osync_capabilities_unref(caps2);
+	osync_merger_unref(merger);
+	osync_objformat_unref(format);
+	osync_format_env_unref(formatenv);
+	osync_engine_unref(engine);
+
+	destroy_testbed(testbed);
+}
+END_TEST
+
+static OSyncMappingEngine *uid_mapping_engine(OSyncObjEngine *objengine, const char *uid)
+{
+	OSyncError *error = NULL;
+	OSyncMapping *mapping = osync_mapping_new(&error);
+	fail_unless(mapping != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+
+	OSyncMappingEntry *entry = osync_mapping_entry_new(&error);
+	fail_unless(entry != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+	osync_mapping_entry_set_member_id(entry, 0);
+	osync_mapping_entry_set_uid(entry, uid);
+	osync_mapping_add_entry(mapping, entry);
+	osync_mapping_entry_unref(entry);
+
+	OSyncMappingEngine *mapping_engine = osync_mapping_engine_new(objengine, mapping, &error);
+	fail_unless(mapping_engine != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+	osync_mapping_unref(mapping);
+
+	return mapping_engine;
+}
+
+static OSyncMappingEntryEngine *uid_find_entry(OSyncSinkEngine *sinkengine, const char *uid)
+{
+	OSyncError *error = NULL;
+	OSyncChange *change = osync_change_new(&error);
+	fail_unless(change != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+	osync_change_set_uid(change, uid);
+
+	OSyncMappingEntryEngine *entry_engine = osync_sink_engine_find_entry(sinkengine, change);
+	osync_change_unref(change);
+
+	return entry_engine;
+}
+
+/* Unit Test: Changes find their entry through the UID index
+ *
+ * Of two entries with the same UID the first one matches. Once the
+ * UID of an entry changes, like on a duplicate, the entry only gets
+ * found under the new UID after it got indexed again.
+ */
+
+START_TEST (mapping_engine_uid_index)
+{
+	char *testbed = setup_testbed(NULL);
+
+	OSyncError *error = NULL;
+	OSyncGroup *group = osync_group_new(&error);
+	fail_unless(group != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+
+	OSyncEngine *engine = osync_engine_new(group, &error);
+	fail_unless(engine != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+	osync_group_unref(group);
+
+	OSyncFormatEnv *formatenv = osync_format_env_new(&error);
+	fail_unless(formatenv != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+
+	OSyncObjEngine *objengine = osync_obj_engine_new(engine, "test", formatenv, &error);
+	fail_unless(objengine != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+
+	OSyncMember *member = osync_member_new(&error);
+	fail_unless(member != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+
+	OSyncClientProxy *proxy = osync_client_proxy_new(formatenv, member, &error);
+	fail_unless(proxy != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+
+	OSyncSinkEngine *sinkengine = osync_sink_engine_new(0, proxy, objengine, &error);
+	fail_unless(sinkengine != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+	objengine->sink_engines = osync_list_append(objengine->sink_engines, sinkengine);
+
+	OSyncMappingEngine *mapping1 = uid_mapping_engine(objengine, "uid1");
+	OSyncMappingEngine *mapping2 = uid_mapping_engine(objengine, "uid2");
+	OSyncMappingEngine *mapping3 = uid_mapping_engine(objengine, "uid1");
+
+	OSyncMappingEntryEngine *entry1 = osync_mapping_engine_get_entry(mapping1, sinkengine);
+	OSyncMappingEntryEngine *entry2 = osync_mapping_engine_get_entry(mapping2, sinkengine);
+	OSyncMappingEntryEngine *entry3 = osync_mapping_engine_get_entry(mapping3, sinkengine);
+	fail_unless(entry1 != NULL, NULL);
+	fail_unless(entry2 != NULL, NULL);
+	fail_unless(entry3 != NULL, NULL);
+
+	/* The first entry of a UID matches */
+	fail_unless(uid_find_entry(sinkengine, "uid1") == entry1, NULL);
+	fail_unless(uid_find_entry(sinkengine, "uid2") == entry2, NULL);
+	fail_unless(uid_find_entry(sinkengine, "uid3") == NULL, NULL);
+
+	/* The duplicated entry is not in the index until it got indexed again */
+	osync_mapping_entry_set_uid(entry3->entry, "uid1-dupe");
+	fail_unless(uid_find_entry(sinkengine, "uid1-dupe") == NULL, NULL);
+
+	osync_sink_engine_index_entry(sinkengine, entry3);
+	fail_unless(uid_find_entry(sinkengine, "uid1-dupe") == entry3, NULL);
+	fail_unless(uid_find_entry(sinkengine, "uid1") == entry1, NULL);
+
+	/* The old UID is gone once its last entry moved */
+	osync_mapping_entry_set_uid(entry1->entry, "uid3");
+	osync_sink_engine_index_entry(sinkengine, entry1);
+	fail_unless(uid_find_entry(sinkengine, "uid1") == NULL, NULL);
+	fail_unless(uid_find_entry(sinkengine, "uid3") == entry1, NULL);
+	fail_unless(uid_find_entry(sinkengine, "uid2") == entry2, NULL);
+
+	osync_mapping_engine_unref(mapping1);
+	osync_mapping_engine_unref(mapping2);
+	osync_mapping_engine_unref(mapping3);
+
+	/* The sink engine references the obj engine */
+	objengine->sink_engines = osync_list_remove(objengine->sink_engines, sinkengine);
+	osync_sink_engine_unref(sinkengine);
+
+	osync_client_proxy_unref(proxy);
+	osync_member_unref(member);
+	osync_obj_engine_unref(objengine);
+	osync_format_env_unref(formatenv);
+	osync_engine_unref(engine);
+
+	destroy_testbed(testbed);
+}
+END_TEST
 
 OSYNC_TESTCASE_START("mapping_engine")
 OSYNC_TESTCASE_ADD(mapping_engine_same_similar_conflict)
 OSYNC_TESTCASE_ADD(mapping_engine_same_similar_conflict2)
 OSYNC_TESTCASE_ADD(mapping_engine_same_similar_conflict_multi)
+OSYNC_TESTCASE_ADD(mapping_engine_compare_cache)
+OSYNC_TESTCASE_ADD(mapping_engine_demerge_cache)
+OSYNC_TESTCASE_ADD(mapping_engine_uid_index)
 OSYNC_TESTCASE_END
 
@@ -9,6 +9,9 @@ typedef struct OSyncDebugGroup {
 	OSyncMember *member2;
 	OSyncClient *client2;
 	
+	OSyncMember *member3;
+	OSyncClient *client3;
+	
 	OSyncPlugin *plugin;
 	OSyncPlugin *plugin2;
 } OSyncDebugGroup;
@@ -286,6 +286,53 @@ START_TEST (objformat_revision)
 }
 END_TEST
 
+static char *mapping_key_format(const char *data, unsigned int size, void *user_data, OSyncError **error)
+{
+	if (!strcmp(data, "nokey"))
+		return NULL;
+
+	if (!strcmp(data, "error")) {
+		osync_error_set(error, OSYNC_ERROR_GENERIC, "No key");
+		return NULL;
+	}
+
+	return osync_strdup_printf("%c", data[0]);
+}
+
+START_TEST (objformat_mapping_key)
+{
+	char *testbed = setup_testbed(NULL);
+	
+	OSyncError *error = NULL;
+	OSyncObjFormat *format = osync_objformat_new("format", "objtype", &error);
+	fail_unless(format != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+	fail_unless(osync_objformat_has_mapping_key(format) == FALSE, NULL);
+	fail_unless(osync_objformat_get_mapping_key(format, "test", 5, &error) == NULL, NULL);
+	fail_unless(error == NULL, NULL);
+
+	osync_objformat_set_mapping_key_func(format, mapping_key_format);
+	fail_unless(osync_objformat_has_mapping_key(format) == TRUE, NULL);
+
+	char *key = osync_objformat_get_mapping_key(format, "test", 5, &error);
+	fail_unless(error == NULL, NULL);
+	fail_unless(key != NULL, NULL);
+	fail_unless(!strcmp(key, "t"), NULL);
+	osync_free(key);
+
+	fail_unless(osync_objformat_get_mapping_key(format, "nokey", 6, &error) == NULL, NULL);
+	fail_unless(error == NULL, NULL);
+
+	fail_unless(osync_objformat_get_mapping_key(format, "error", 6, &error) == NULL, NULL);
+	fail_unless(error != NULL, NULL);
+	osync_error_unref(&error);
+	
+	osync_objformat_unref(format);
+	
+	destroy_testbed(testbed);
+}
+END_TEST
+
 START_TEST (objformat_marshal)
 {
 	char *testbed = setup_testbed(NULL);
@@ -362,6 +409,7 @@ OSYNC_TESTCASE_ADD(objformat_duplicate)
 OSYNC_TESTCASE_ADD(objformat_create)
 OSYNC_TESTCASE_ADD(objformat_print)
 OSYNC_TESTCASE_ADD(objformat_revision)
+OSYNC_TESTCASE_ADD(objformat_mapping_key)
 OSYNC_TESTCASE_ADD(objformat_marshal)
 OSYNC_TESTCASE_ADD(objformat_demarshal)
 OSYNC_TESTCASE_END
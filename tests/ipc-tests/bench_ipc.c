@@ -0,0 +1,540 @@
+/*
+ * bench_ipc - throughput and latency benchmark of the OpenSync queues
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ *
+ */
+
+/* Every run sends requests with a payload through a forward queue. An echo
+ * thread answers each of them with an empty reply through a backward queue.
+ * Up to depth requests are in flight. The results are written as JSON. */
+
+#include <opensync/opensync.h>
+#include <opensync/opensync_internals.h>
+#include <opensync/opensync-ipc.h>
+
+#include "opensync/common/opensync_marshal_internals.h"
+#include "opensync/ipc/opensync_message_internals.h"
+#include "opensync/ipc/opensync_queue_internals.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Requests in flight never hold more payload than this */
+#define BENCH_INFLIGHT_LIMIT (256 * 1024 * 1024)
+
+typedef enum {
+	BENCH_PIPES,
+	BENCH_FIFO,
+	BENCH_THREADCOM,
+	BENCH_SHM
+} BenchTransport;
+
+static const char *transport_names[] = { "pipes", "fifo", "threadcom", "shm" };
+
+typedef struct BenchPair {
+	BenchTransport transport;
+	/* Requests */
+	OSyncQueue *fwd_read;
+	OSyncQueue *fwd_write;
+	/* Replies */
+	OSyncQueue *back_read;
+	OSyncQueue *back_write;
+	char *fwd_path;
+	char *back_path;
+	GThread *echo;
+	OSyncError *echo_error;
+} BenchPair;
+
+typedef struct BenchOptions {
+	osync_bool transports[4];
+	unsigned int *sizes;
+	unsigned int num_sizes;
+	unsigned int *depths;
+	unsigned int num_depths;
+	unsigned long long int volume;
+	unsigned int max_messages;
+	osync_bool compact;
+} BenchOptions;
+
+static unsigned int default_sizes[] = {
+	64, 256, 1024, 4096, 16384, 65536, 262144,
+	1024 * 1024, 4 * 1024 * 1024, 16 * 1024 * 1024
+};
+static unsigned int default_depths[] = { 1, 4, 16, 64, 256, 1024 };
+static unsigned int quick_sizes[] = { 64, 4096, 65536 };
+static unsigned int quick_depths[] = { 1, 16 };
+
+static void usage(const char *name, int ecode)
+{
+	fprintf(stderr, "Usage: %s [options]\n", name);
+	fprintf(stderr, "[--transports <list>]\tComma separated list of pipes,fifo,threadcom,shm (default: all)\n");
+	fprintf(stderr, "[--sizes <list>]\tComma separated payload sizes in bytes (default: 64 to 16M)\n");
+	fprintf(stderr, "[--depths <list>]\tComma separated pipelining depths (default: 1 to 1024)\n");
+	fprintf(stderr, "[--volume <bytes>]\tPayload sent per run (default: 64M)\n");
+	fprintf(stderr, "[--messages <num>]\tMaximum number of messages per run (default: 20000)\n");
+	fprintf(stderr, "[--compact]\t\tUse the compact wire format\n");
+	fprintf(stderr, "[--quick]\t\tOnly a few small runs, as smoke test\n");
+	exit(ecode);
+}
+
+static unsigned int *parse_list(const char *arg, unsigned int *num)
+{
+	gchar **items = g_strsplit(arg, ",", 0);
+	unsigned int *values = NULL;
+	unsigned int i;
+
+	*num = g_strv_length(items);
+	values = g_malloc0(sizeof(unsigned int) * (*num ? *num : 1));
+
+	for (i = 0; i < *num; i++) {
+		char *end = NULL;
+		unsigned long value = strtoul(items[i], &end, 10);
+
+		if (end && (*end == 'k' || *end == 'K'))
+			value *= 1024;
+		else if (end && (*end == 'm' || *end == 'M'))
+			value *= 1024 * 1024;
+		values[i] = value;
+	}
+
+	g_strfreev(items);
+	return values;
+}
+
+static void print_json_string(const char *string)
+{
+	putchar('"');
+	for (; string && *string; string++) {
+		if (*string == '"' || *string == '\\')
+			printf("\\%c", *string);
+		else if ((unsigned char) *string < 0x20)
+			printf("\\u%04x", (unsigned char) *string);
+		else
+			putchar(*string);
+	}
+	putchar('"');
+}
+
+static long long int now_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long int) ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static int compare_latency(const void *a, const void *b)
+{
+	long long int x = *(const long long int *) a;
+	long long int y = *(const long long int *) b;
+
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static long long int percentile(long long int *sorted, unsigned int num, unsigned int pct)
+{
+	unsigned int index = (unsigned int) (((unsigned long long int) num * pct + 99) / 100);
+
+	if (index == 0)
+		index = 1;
+	return sorted[index - 1];
+}
+
+static gpointer bench_echo(gpointer data)
+{
+	BenchPair *pair = data;
+	OSyncMessage *message = NULL;
+	OSyncMessage *reply = NULL;
+
+	/* Opening a fifo blocks until the other side opened it as well */
+	if (pair->transport == BENCH_FIFO) {
+		if (!osync_queue_connect(pair->fwd_read, OSYNC_QUEUE_RECEIVER, &pair->echo_error))
+			return NULL;
+		if (!osync_queue_connect(pair->back_write, OSYNC_QUEUE_SENDER, &pair->echo_error))
+			return NULL;
+	}
+
+	for (;;) {
+		OSyncMessageCommand cmd;
+
+		message = osync_queue_get_message(pair->fwd_read);
+		cmd = osync_message_get_command(message);
+
+		if (cmd == OSYNC_MESSAGE_QUEUE_HUP || cmd == OSYNC_MESSAGE_QUEUE_ERROR) {
+			osync_error_set(&pair->echo_error, OSYNC_ERROR_IO_ERROR, "Request queue broke down");
+			osync_message_unref(message);
+			return NULL;
+		}
+
+		reply = osync_message_new_reply(message, &pair->echo_error);
+		osync_message_unref(message);
+		if (!reply)
+			return NULL;
+
+		if (!osync_queue_send_message(pair->back_write, NULL, reply, &pair->echo_error)) {
+			osync_message_unref(reply);
+			return NULL;
+		}
+		osync_message_unref(reply);
+
+		if (cmd == OSYNC_MESSAGE_DISCONNECT)
+			break;
+	}
+
+	return NULL;
+}
+
+static osync_bool bench_pair_setup(BenchPair *pair, BenchTransport transport, osync_bool compact, OSyncError **error)
+{
+	memset(pair, 0, sizeof(BenchPair));
+	pair->transport = transport;
+
+	switch (transport) {
+	case BENCH_PIPES:
+		if (!osync_queue_new_pipes(&pair->fwd_read, &pair->fwd_write, error))
+			return FALSE;
+		if (!osync_queue_new_pipes(&pair->back_read, &pair->back_write, error))
+			return FALSE;
+		break;
+	case BENCH_THREADCOM:
+		if (!osync_queue_new_threadcom(&pair->fwd_read, &pair->fwd_write, error))
+			return FALSE;
+		if (!osync_queue_new_threadcom(&pair->back_read, &pair->back_write, error))
+			return FALSE;
+		break;
+	case BENCH_SHM:
+		if (!osync_queue_new_shm_rings(&pair->fwd_read, &pair->fwd_write, error))
+			return FALSE;
+		if (!osync_queue_new_shm_rings(&pair->back_read, &pair->back_write, error))
+			return FALSE;
+		break;
+	case BENCH_FIFO:
+		pair->fwd_path = g_strdup_printf("%s/osync-bench-%d-fwd", g_get_tmp_dir(), (int) getpid());
+		pair->back_path = g_strdup_printf("%s/osync-bench-%d-back", g_get_tmp_dir(), (int) getpid());
+		pair->fwd_read = osync_queue_new(pair->fwd_path, error);
+		pair->fwd_write = osync_queue_new(pair->fwd_path, error);
+		pair->back_read = osync_queue_new(pair->back_path, error);
+		pair->back_write = osync_queue_new(pair->back_path, error);
+		if (!pair->fwd_read || !pair->fwd_write || !pair->back_read || !pair->back_write)
+			return FALSE;
+		if (!osync_queue_create(pair->fwd_write, error) || !osync_queue_create(pair->back_write, error))
+			return FALSE;
+		break;
+	}
+
+	if (compact)
+		osync_queue_set_wire_version(pair->fwd_write, OSYNC_QUEUE_WIRE_VERSION_COMPACT);
+
+	pair->echo = g_thread_create(bench_echo, pair, TRUE, NULL);
+
+	if (transport != BENCH_FIFO) {
+		if (!osync_queue_connect(pair->fwd_read, OSYNC_QUEUE_RECEIVER, error))
+			return FALSE;
+		if (!osync_queue_connect(pair->back_write, OSYNC_QUEUE_SENDER, error))
+			return FALSE;
+	}
+
+	if (!osync_queue_connect(pair->fwd_write, OSYNC_QUEUE_SENDER, error))
+		return FALSE;
+	if (!osync_queue_connect(pair->back_read, OSYNC_QUEUE_RECEIVER, error))
+		return FALSE;
+
+	return TRUE;
+}
+
+static void bench_queue_free(OSyncQueue *queue)
+{
+	if (!queue)
+		return;
+
+	if (osync_queue_is_connected(queue))
+		osync_queue_disconnect(queue, NULL);
+	osync_queue_unref(queue);
+}
+
+static void bench_pair_teardown(BenchPair *pair)
+{
+	if (pair->echo)
+		g_thread_join(pair->echo);
+
+	bench_queue_free(pair->fwd_read);
+	bench_queue_free(pair->back_read);
+	bench_queue_free(pair->fwd_write);
+	bench_queue_free(pair->back_write);
+
+	if (pair->fwd_path) {
+		unlink(pair->fwd_path);
+		g_free(pair->fwd_path);
+	}
+	if (pair->back_path) {
+		unlink(pair->back_path);
+		g_free(pair->back_path);
+	}
+
+	if (pair->echo_error)
+		osync_error_unref(&pair->echo_error);
+}
+
+static osync_bool bench_send(BenchPair *pair, OSyncMessageCommand cmd, const char *payload, unsigned int size, OSyncError **error)
+{
+	OSyncMessage *message = osync_message_new(cmd, size, error);
+	if (!message)
+		return FALSE;
+
+	osync_queue_prepare_message(pair->fwd_write, message);
+
+	/* Large payloads are referenced like the data of changes */
+	if (!osync_marshal_write_buffer_ref(osync_message_get_marshal(message), payload, size, NULL, NULL, error))
+		goto error;
+
+	if (!osync_queue_send_message(pair->fwd_write, NULL, message, error))
+		goto error;
+
+	osync_message_unref(message);
+	return TRUE;
+
+error:
+	osync_message_unref(message);
+	return FALSE;
+}
+
+static osync_bool bench_receive(BenchPair *pair, OSyncError **error)
+{
+	OSyncMessage *reply = osync_queue_get_message(pair->back_read);
+	OSyncMessageCommand cmd = osync_message_get_command(reply);
+
+	osync_message_unref(reply);
+
+	if (cmd != OSYNC_MESSAGE_REPLY) {
+		if (pair->echo_error)
+			osync_error_set(error, OSYNC_ERROR_IO_ERROR, "Echo failed: %s", osync_error_print(&pair->echo_error));
+		else
+			osync_error_set(error, OSYNC_ERROR_IO_ERROR, "Unexpected reply %i", cmd);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static osync_bool bench_run(BenchTransport transport, unsigned int size, unsigned int depth, const BenchOptions *options, const char *payload, osync_bool first)
+{
+	OSyncError *error = NULL;
+	BenchPair pair;
+	OSyncQueueStats stats;
+	unsigned int effective_depth = depth;
+	unsigned long long int num_messages = 0;
+	long long int *sent = NULL;
+	long long int *latency = NULL;
+	long long int start, elapsed;
+	unsigned int sent_count = 0, received = 0;
+	double seconds;
+
+	if (size && effective_depth > BENCH_INFLIGHT_LIMIT / size)
+		effective_depth = BENCH_INFLIGHT_LIMIT / size;
+	if (!effective_depth)
+		effective_depth = 1;
+
+	num_messages = size ? options->volume / size : options->max_messages;
+	if (num_messages > options->max_messages)
+		num_messages = options->max_messages;
+	if (num_messages < 2 * effective_depth)
+		num_messages = 2 * effective_depth;
+
+	printf("%s\t{\"transport\": \"%s\", \"payload_size\": %u, \"depth\": %u", first ? "" : ",\n", transport_names[transport], size, depth);
+
+	if (!bench_pair_setup(&pair, transport, options->compact, &error)) {
+		printf(", \"skipped\": ");
+		print_json_string(osync_error_print(&error));
+		printf("}");
+		osync_error_unref(&error);
+		bench_pair_teardown(&pair);
+		return TRUE;
+	}
+
+	sent = g_malloc0(sizeof(long long int) * effective_depth);
+	latency = g_malloc0(sizeof(long long int) * num_messages);
+
+	start = now_usec();
+	while (received < num_messages) {
+		while (sent_count < num_messages && sent_count - received < effective_depth) {
+			sent[sent_count % effective_depth] = now_usec();
+			if (!bench_send(&pair, OSYNC_MESSAGE_NOOP, payload, size, &error))
+				goto error;
+			sent_count++;
+		}
+
+		/* Replies arrive in order */
+		if (!bench_receive(&pair, &error))
+			goto error;
+		latency[received] = now_usec() - sent[received % effective_depth];
+		received++;
+	}
+	elapsed = now_usec() - start;
+
+	osync_queue_get_stats(pair.fwd_write, &stats);
+
+	if (!bench_send(&pair, OSYNC_MESSAGE_DISCONNECT, NULL, 0, &error))
+		goto error;
+	if (!bench_receive(&pair, &error))
+		goto error;
+	bench_pair_teardown(&pair);
+
+	qsort(latency, num_messages, sizeof(long long int), compare_latency);
+	seconds = elapsed > 0 ? elapsed / 1000000.0 : 1e-6;
+
+	printf(", \"effective_depth\": %u, \"messages\": %llu, \"seconds\": %.6f", effective_depth, num_messages, seconds);
+	printf(", \"messages_per_sec\": %.1f, \"mb_per_sec\": %.3f", num_messages / seconds, (double) num_messages * size / (1024.0 * 1024.0) / seconds);
+	printf(", \"wire_bytes\": %llu", stats.bytes_sent);
+	printf(", \"latency_usec\": {\"min\": %lld, \"p50\": %lld, \"p90\": %lld, \"p99\": %lld, \"max\": %lld}}",
+	       latency[0], percentile(latency, num_messages, 50), percentile(latency, num_messages, 90),
+	       percentile(latency, num_messages, 99), latency[num_messages - 1]);
+
+	g_free(sent);
+	g_free(latency);
+	return TRUE;
+
+error:
+	printf(", \"error\": ");
+	print_json_string(osync_error_print(&error));
+	printf("}");
+	osync_error_unref(&error);
+	g_free(sent);
+	g_free(latency);
+
+	/* The echo thread might still wait for requests, tear down the
+	 * queues first so it wakes up */
+	bench_queue_free(pair.fwd_write);
+	pair.fwd_write = NULL;
+	bench_pair_teardown(&pair);
+	return FALSE;
+}
+
+int main(int argc, char **argv)
+{
+	BenchOptions options;
+	char *payload = NULL;
+	unsigned int max_size = 0;
+	unsigned int t, i, j;
+	osync_bool first = TRUE;
+	osync_bool success = TRUE;
+	osync_bool any_transport = FALSE;
+
+	memset(&options, 0, sizeof(options));
+	options.sizes = default_sizes;
+	options.num_sizes = sizeof(default_sizes) / sizeof(default_sizes[0]);
+	options.depths = default_depths;
+	options.num_depths = sizeof(default_depths) / sizeof(default_depths[0]);
+	options.volume = 64 * 1024 * 1024;
+	options.max_messages = 20000;
+
+	for (i = 1; i < (unsigned int) argc; i++) {
+		char *arg = argv[i];
+		if (!strcmp(arg, "--transports")) {
+			gchar **names = NULL;
+			unsigned int k;
+			if (++i >= (unsigned int) argc)
+				usage(argv[0], 1);
+			names = g_strsplit(argv[i], ",", 0);
+			for (k = 0; names[k]; k++) {
+				for (t = 0; t < 4; t++) {
+					if (!strcmp(names[k], transport_names[t]))
+						break;
+				}
+				if (t == 4)
+					usage(argv[0], 1);
+				options.transports[t] = TRUE;
+				any_transport = TRUE;
+			}
+			g_strfreev(names);
+		} else if (!strcmp(arg, "--sizes")) {
+			if (++i >= (unsigned int) argc)
+				usage(argv[0], 1);
+			options.sizes = parse_list(argv[i], &options.num_sizes);
+		} else if (!strcmp(arg, "--depths")) {
+			if (++i >= (unsigned int) argc)
+				usage(argv[0], 1);
+			options.depths = parse_list(argv[i], &options.num_depths);
+		} else if (!strcmp(arg, "--volume")) {
+			if (++i >= (unsigned int) argc)
+				usage(argv[0], 1);
+			options.volume = strtoull(argv[i], NULL, 10);
+		} else if (!strcmp(arg, "--messages")) {
+			if (++i >= (unsigned int) argc)
+				usage(argv[0], 1);
+			options.max_messages = strtoul(argv[i], NULL, 10);
+		} else if (!strcmp(arg, "--compact")) {
+			options.compact = TRUE;
+		} else if (!strcmp(arg, "--quick")) {
+			options.sizes = quick_sizes;
+			options.num_sizes = sizeof(quick_sizes) / sizeof(quick_sizes[0]);
+			options.depths = quick_depths;
+			options.num_depths = sizeof(quick_depths) / sizeof(quick_depths[0]);
+			options.volume = 1024 * 1024;
+			options.max_messages = 200;
+		} else if (!strcmp(arg, "--help")) {
+			usage(argv[0], 0);
+		} else {
+			usage(argv[0], 1);
+		}
+	}
+
+	if (!any_transport) {
+		for (t = 0; t < 4; t++)
+			options.transports[t] = TRUE;
+	}
+
+	if (!options.max_messages)
+		options.max_messages = 1;
+
+	if (!g_thread_supported())
+		g_thread_init(NULL);
+
+	for (i = 0; i < options.num_sizes; i++)
+		max_size = MAX(max_size, options.sizes[i]);
+
+	payload = g_malloc(max_size ? max_size : 1);
+	for (i = 0; i < max_size; i++)
+		payload[i] = i % 251;
+
+	printf("{\n\"benchmark\": \"ipc\",\n\"wire_version\": %u,\n\"results\": [\n", options.compact ? OSYNC_QUEUE_WIRE_VERSION_COMPACT : OSYNC_QUEUE_WIRE_VERSION_PLAIN);
+
+	for (t = 0; t < 4; t++) {
+		if (!options.transports[t])
+			continue;
+
+		for (i = 0; i < options.num_sizes; i++) {
+			for (j = 0; j < options.num_depths; j++) {
+				if (!bench_run(t, options.sizes[i], options.depths[j], &options, payload, first))
+					success = FALSE;
+				first = FALSE;
+				fflush(stdout);
+			}
+		}
+	}
+
+	printf("\n]\n}\n");
+
+	g_free(payload);
+	if (options.sizes != default_sizes && options.sizes != quick_sizes)
+		g_free(options.sizes);
+	if (options.depths != default_depths && options.depths != quick_depths)
+		g_free(options.depths);
+
+	return success ? 0 : 1;
+}
@@ -4,8 +4,11 @@
 #endif
 
 #include <opensync/opensync-ipc.h>
+#include "opensync/common/opensync_marshal_internals.h"
+#include "opensync/common/opensync_wakeup_internals.h"
 #include "opensync/ipc/opensync_message_internals.h"
 #include "opensync/ipc/opensync_queue_internals.h"
+#include "opensync/ipc/opensync_shmring_internals.h"
 
 START_TEST (ipc_new)
 {
@@ -1831,6 +1834,1095 @@ START_TEST (ipc_pipes)
 }
 END_TEST
 
+static int num_idle_msgs = 0;
+
+static void idle_handler(OSyncMessage *message, void *user_data)
+{
+	osync_assert(osync_message_get_command(message) == OSYNC_MESSAGE_INITIALIZE);
+	num_idle_msgs++;
+}
+
+START_TEST (ipc_pipes_idle_wakeup)
+{	
+	char *testbed = setup_testbed(NULL);
+	
+	OSyncError *error = NULL;
+	OSyncQueue *read1 = NULL;
+	OSyncQueue *write1 = NULL;
+	GMainContext *context = g_main_context_new();
+	
+	osync_assert(osync_queue_new_pipes(&read1, &write1, &error));
+	osync_assert(error == NULL);
+
+	osync_queue_set_message_handler(read1, idle_handler, NULL);
+	fail_unless(osync_queue_setup_with_gmainloop(read1, context, &error), NULL);
+	fail_unless(error == NULL, NULL);
+		
+	fail_unless(osync_queue_connect(read1, OSYNC_QUEUE_RECEIVER, &error), NULL);
+	fail_unless(error == NULL, NULL);
+		
+	fail_unless(osync_queue_connect(write1, OSYNC_QUEUE_SENDER, &error), NULL);
+	fail_unless(error == NULL, NULL);
+
+	/* Nothing to do, the queue threads sleep */
+	fail_unless(!g_main_context_iteration(context, FALSE), NULL);
+	g_usleep(G_USEC_PER_SEC);
+		
+	OSyncMessage *message = osync_message_new(OSYNC_MESSAGE_INITIALIZE, 0, &error);
+	fail_unless(message != NULL, NULL);
+	
+	fail_unless(osync_queue_send_message(write1, NULL, message, &error), NULL);
+	fail_unless(!osync_error_is_set(&error), NULL);
+	osync_message_unref(message);
+
+	/* Blocks until the wakeup of the incoming queue got signaled */
+	while (num_idle_msgs == 0)
+		g_main_context_iteration(context, TRUE);
+
+	fail_unless(num_idle_msgs == 1, NULL);
+		
+	osync_assert(osync_queue_disconnect(read1, &error));
+	osync_assert(error == NULL);
+	
+	message = osync_queue_get_message(write1);
+	osync_assert(osync_message_get_command(message) == OSYNC_MESSAGE_QUEUE_HUP);
+	osync_message_unref(message);
+
+	osync_assert(osync_queue_disconnect(write1, &error));
+	osync_assert(error == NULL);
+	
+	osync_queue_unref(read1);
+	osync_queue_unref(write1);
+	g_main_context_unref(context);
+	
+	destroy_testbed(testbed);
+}
+END_TEST
+
+#define WAKEUP_NUM_ITEMS 100000
+
+typedef struct wakeupSource {
+	GSource source;
+	GAsyncQueue *queue;
+	OSyncWakeup *wakeup;
+	GPollFD *pollfd;
+	int dispatched;
+} wakeupSource;
+
+static gboolean wakeup_prepare(GSource *source, gint *timeout_)
+{
+	wakeupSource *ws = (wakeupSource *)source;
+
+	*timeout_ = OSYNC_WAKEUP_IDLE_TIMEOUT;
+	return g_async_queue_length(ws->queue) > 0;
+}
+
+/* Same as the check functions of the engine and queue sources */
+static gboolean wakeup_check(GSource *source)
+{
+	wakeupSource *ws = (wakeupSource *)source;
+
+	if (ws->pollfd && ws->pollfd->revents)
+		osync_wakeup_acknowledge(ws->wakeup);
+
+	return g_async_queue_length(ws->queue) > 0;
+}
+
+static gboolean wakeup_dispatch(GSource *source, GSourceFunc callback, gpointer user_data)
+{
+	wakeupSource *ws = (wakeupSource *)source;
+
+	/* Only one item per dispatch, to go through poll() as often as possible */
+	if (g_async_queue_try_pop(ws->queue))
+		ws->dispatched++;
+
+	return TRUE;
+}
+
+static GSourceFuncs wakeup_functions = {
+	wakeup_prepare,
+	wakeup_check,
+	wakeup_dispatch,
+	NULL
+};
+
+static gpointer wakeup_producer(gpointer userdata)
+{
+	wakeupSource *ws = userdata;
+	int i;
+
+	for (i = 0; i < WAKEUP_NUM_ITEMS; i++) {
+		g_async_queue_push(ws->queue, GINT_TO_POINTER(1));
+		osync_wakeup_signal(ws->wakeup);
+
+		/* Vary the timing against the acknowledge of the consumer */
+		if (!(i % 97))
+			g_thread_yield();
+	}
+
+	return NULL;
+}
+
+/* Items pushed by another thread while the consumer acknowledges the
+ * wakeup must all get dispatched. A lost signal leaves the consumer
+ * sleeping in poll() forever, so the test times out. */
+START_TEST (ipc_wakeup_concurrent_signal)
+{
+	char *testbed = setup_testbed(NULL);
+
+	OSyncError *error = NULL;
+	GMainContext *context = g_main_context_new();
+	wakeupSource *ws = (wakeupSource *)g_source_new(&wakeup_functions, sizeof(wakeupSource));
+
+	ws->queue = g_async_queue_new();
+	ws->wakeup = osync_wakeup_new(&error);
+	fail_unless(ws->wakeup != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+
+	fail_unless(osync_wakeup_attach(ws->wakeup, (GSource *)ws, &ws->pollfd, &error), NULL);
+	fail_unless(error == NULL, NULL);
+	g_source_attach((GSource *)ws, context);
+
+	GThread *thread = g_thread_create(wakeup_producer, ws, TRUE, NULL);
+	fail_unless(thread != NULL, NULL);
+
+	while (ws->dispatched < WAKEUP_NUM_ITEMS)
+		g_main_context_iteration(context, TRUE);
+
+	g_thread_join(thread);
+
+	fail_unless(ws->dispatched == WAKEUP_NUM_ITEMS, NULL);
+	fail_unless(g_async_queue_length(ws->queue) == 0, NULL);
+
+	osync_wakeup_detach((GSource *)ws, ws->pollfd);
+	g_source_destroy((GSource *)ws);
+	osync_wakeup_free(ws->wakeup);
+	g_async_queue_unref(ws->queue);
+	g_source_unref((GSource *)ws);
+	g_main_context_unref(context);
+
+	destroy_testbed(testbed);
+}
+END_TEST
+
+START_TEST (ipc_pipes_write_batch)
+{	
+	char *testbed = setup_testbed(NULL);
+	
+	OSyncError *error = NULL;
+	OSyncQueue *read1 = NULL;
+	OSyncQueue *write1 = NULL;
+	OSyncMessage *message = NULL;
+	char data[4096];
+	int num_msgs = 200;
+	int i;
+
+	for (i = 0; i < (int) sizeof(data); i++)
+		data[i] = i % 251;
+	
+	osync_assert(osync_queue_new_pipes(&read1, &write1, &error));
+	osync_assert(error == NULL);
+
+	/* Not a divisor of the number of messages, so the last batch is partial */
+	osync_queue_set_write_batch_size(write1, 7);
+		
+	fail_unless(osync_queue_connect(read1, OSYNC_QUEUE_RECEIVER, &error), NULL);
+	fail_unless(error == NULL, NULL);
+		
+	fail_unless(osync_queue_connect(write1, OSYNC_QUEUE_SENDER, &error), NULL);
+	fail_unless(error == NULL, NULL);
+
+	for (i = 0; i < num_msgs; i++) {
+		message = osync_message_new(OSYNC_MESSAGE_INITIALIZE, 0, &error);
+		fail_unless(message != NULL, NULL);
+
+		/* Every 10th message has no payload at all */
+		if (i % 10) {
+			osync_message_write_int(message, i, &error);
+			osync_message_write_data(message, data, (i * 37) % sizeof(data), &error);
+		}
+	
+		fail_unless(osync_queue_send_message(write1, NULL, message, &error), NULL);
+		fail_unless(!osync_error_is_set(&error), NULL);
+		osync_message_unref(message);
+	}
+
+	for (i = 0; i < num_msgs; i++) {
+		int int1;
+		void *databuf;
+
+		message = osync_queue_get_message(read1);
+		fail_unless(osync_message_get_command(message) == OSYNC_MESSAGE_INITIALIZE, NULL);
+
+		if (i % 10) {
+			osync_message_read_int(message, &int1, &error);
+			osync_message_read_const_data(message, &databuf, (i * 37) % sizeof(data), &error);
+			fail_unless(!osync_error_is_set(&error), NULL);
+
+			fail_unless(int1 == i, NULL);
+			fail_unless(!memcmp(databuf, data, (i * 37) % sizeof(data)), NULL);
+		} else {
+			fail_unless(osync_message_get_message_size(message) == 0, NULL);
+		}
+
+		osync_message_unref(message);
+	}
+		
+	osync_assert(osync_queue_disconnect(read1, &error));
+	osync_assert(error == NULL);
+	
+	message = osync_queue_get_message(write1);
+	osync_assert(osync_message_get_command(message) == OSYNC_MESSAGE_QUEUE_HUP);
+	osync_message_unref(message);
+
+	osync_assert(osync_queue_disconnect(write1, &error));
+	osync_assert(error == NULL);
+	
+	osync_queue_unref(read1);
+	osync_queue_unref(write1);
+	
+	destroy_testbed(testbed);
+}
+END_TEST
+
+static int num_payload_releases = 0;
+
+static void payload_release(void *owner)
+{
+	g_atomic_int_inc(&num_payload_releases);
+}
+
+START_TEST (ipc_pipes_payload_ref)
+{	
+	char *testbed = setup_testbed(NULL);
+	
+	OSyncError *error = NULL;
+	OSyncQueue *read1 = NULL;
+	OSyncQueue *write1 = NULL;
+	OSyncMessage *message = NULL;
+	char data[3 * OSYNC_MARSHAL_SEGMENT_MIN_SIZE];
+	unsigned int sizes[] = { 0, 17, OSYNC_MARSHAL_SEGMENT_MIN_SIZE - 1, OSYNC_MARSHAL_SEGMENT_MIN_SIZE, sizeof(data) };
+	int num_msgs = sizeof(sizes) / sizeof(sizes[0]);
+	int i;
+
+	for (i = 0; i < (int) sizeof(data); i++)
+		data[i] = i % 251;
+
+	num_payload_releases = 0;
+	
+	osync_assert(osync_queue_new_pipes(&read1, &write1, &error));
+	osync_assert(error == NULL);
+		
+	fail_unless(osync_queue_connect(read1, OSYNC_QUEUE_RECEIVER, &error), NULL);
+	fail_unless(error == NULL, NULL);
+		
+	fail_unless(osync_queue_connect(write1, OSYNC_QUEUE_SENDER, &error), NULL);
+	fail_unless(error == NULL, NULL);
+
+	for (i = 0; i < num_msgs; i++) {
+		OSyncMarshal *marshal = NULL;
+
+		message = osync_message_new(OSYNC_MESSAGE_INITIALIZE, 0, &error);
+		fail_unless(message != NULL, NULL);
+		marshal = osync_message_get_marshal(message);
+
+		/* Two referenced payloads with data in between and behind them */
+		osync_message_write_int(message, i, &error);
+		fail_unless(osync_marshal_write_buffer_ref(marshal, data, sizes[i], NULL, payload_release, &error), NULL);
+		osync_message_write_string(message, "between", &error);
+		fail_unless(osync_marshal_write_buffer_ref(marshal, data + 1, sizes[i], NULL, payload_release, &error), NULL);
+		osync_message_write_int(message, -i, &error);
+		fail_unless(!osync_error_is_set(&error), NULL);
+
+		fail_unless(osync_message_get_message_size(message) == 2 * sizeof(int) + 3 * sizeof(unsigned int) + 8 + 2 * sizes[i], NULL);
+	
+		fail_unless(osync_queue_send_message(write1, NULL, message, &error), NULL);
+		fail_unless(!osync_error_is_set(&error), NULL);
+		osync_message_unref(message);
+	}
+
+	for (i = 0; i < num_msgs; i++) {
+		int int1, int2;
+		char *string = NULL;
+		void *buf1 = NULL, *buf2 = NULL;
+		unsigned int size1, size2;
+
+		message = osync_queue_get_message(read1);
+		fail_unless(osync_message_get_command(message) == OSYNC_MESSAGE_INITIALIZE, NULL);
+
+		osync_message_read_int(message, &int1, &error);
+		osync_message_read_buffer(message, &buf1, &size1, &error);
+		osync_message_read_string(message, &string, &error);
+		osync_message_read_buffer(message, &buf2, &size2, &error);
+		osync_message_read_int(message, &int2, &error);
+		fail_unless(!osync_error_is_set(&error), NULL);
+
+		fail_unless(int1 == i, NULL);
+		fail_unless(int2 == -i, NULL);
+		fail_unless(!strcmp(string, "between"), NULL);
+		fail_unless(size1 == sizes[i], NULL);
+		fail_unless(size2 == sizes[i], NULL);
+		fail_unless(!size1 || !memcmp(buf1, data, size1), NULL);
+		fail_unless(!size2 || !memcmp(buf2, data + 1, size2), NULL);
+
+		osync_free(string);
+		if (buf1)
+			osync_free(buf1);
+		if (buf2)
+			osync_free(buf2);
+		osync_message_unref(message);
+	}
+		
+	osync_assert(osync_queue_disconnect(read1, &error));
+	osync_assert(error == NULL);
+	
+	message = osync_queue_get_message(write1);
+	osync_assert(osync_message_get_command(message) == OSYNC_MESSAGE_QUEUE_HUP);
+	osync_message_unref(message);
+
+	osync_assert(osync_queue_disconnect(write1, &error));
+	osync_assert(error == NULL);
+	
+	osync_queue_unref(read1);
+	osync_queue_unref(write1);
+
+	/* Every payload got released, whether it was copied or referenced */
+	fail_unless(num_payload_releases == 2 * num_msgs, NULL);
+	
+	destroy_testbed(testbed);
+}
+END_TEST
+
+START_TEST (ipc_pipes_compact)
+{	
+	char *testbed = setup_testbed(NULL);
+	
+	OSyncError *error = NULL;
+	OSyncQueue *read1 = NULL;
+	OSyncQueue *write1 = NULL;
+	OSyncMessage *message = NULL;
+	OSyncMessage *compact = NULL;
+	const char *formats[] = { "vcard30", "vevent20", "file" };
+	int num_msgs = 30;
+	int i;
+	
+	osync_assert(osync_queue_new_pipes(&read1, &write1, &error));
+	osync_assert(error == NULL);
+
+	osync_queue_set_wire_version(write1, OSYNC_QUEUE_WIRE_VERSION_COMPACT);
+		
+	fail_unless(osync_queue_connect(read1, OSYNC_QUEUE_RECEIVER, &error), NULL);
+	fail_unless(error == NULL, NULL);
+		
+	fail_unless(osync_queue_connect(write1, OSYNC_QUEUE_SENDER, &error), NULL);
+	fail_unless(error == NULL, NULL);
+
+	for (i = 0; i < num_msgs; i++) {
+		OSyncMarshal *marshal = NULL;
+
+		message = osync_message_new(OSYNC_MESSAGE_INITIALIZE, 0, &error);
+		fail_unless(message != NULL, NULL);
+		osync_queue_prepare_message(write1, message);
+		marshal = osync_message_get_marshal(message);
+		fail_unless(osync_marshal_is_compact(marshal), NULL);
+
+		/* Every other message is plain, both may be mixed on a queue */
+		if (i % 2) {
+			osync_message_unref(message);
+			message = osync_message_new(OSYNC_MESSAGE_INITIALIZE, 0, &error);
+			fail_unless(message != NULL, NULL);
+			marshal = osync_message_get_marshal(message);
+		}
+
+		osync_message_write_int(message, -i, &error);
+		osync_message_write_uint(message, 0xffffffffu - i, &error);
+		osync_message_write_long_long_int(message, -1000000000000LL * i, &error);
+		osync_marshal_write_interned_string(marshal, formats[i % 3], &error);
+		osync_marshal_write_interned_string(marshal, NULL, &error);
+		osync_message_write_string(message, "uid", &error);
+		osync_message_write_buffer(message, "data", 5, &error);
+		fail_unless(!osync_error_is_set(&error), NULL);
+	
+		fail_unless(osync_queue_send_message(write1, NULL, message, &error), NULL);
+		fail_unless(!osync_error_is_set(&error), NULL);
+
+		/* Small integers and known strings take less space */
+		if (i == 2)
+			compact = osync_message_ref(message);
+		if (i == 3)
+			fail_unless(osync_message_get_message_size(compact) < osync_message_get_message_size(message), NULL);
+
+		osync_message_unref(message);
+	}
+	osync_message_unref(compact);
+
+	for (i = 0; i < num_msgs; i++) {
+		int int1;
+		unsigned int uint1;
+		long long int long1;
+		char *format = NULL, *none = NULL, *uid = NULL;
+		void *buf = NULL;
+		unsigned int size;
+
+		message = osync_queue_get_message(read1);
+		fail_unless(osync_message_get_command(message) == OSYNC_MESSAGE_INITIALIZE, NULL);
+		fail_unless(osync_marshal_is_compact(osync_message_get_marshal(message)) == !(i % 2), NULL);
+
+		osync_message_read_int(message, &int1, &error);
+		osync_message_read_uint(message, &uint1, &error);
+		osync_message_read_long_long_int(message, &long1, &error);
+		osync_marshal_read_interned_string(osync_message_get_marshal(message), &format, &error);
+		osync_marshal_read_interned_string(osync_message_get_marshal(message), &none, &error);
+		osync_message_read_string(message, &uid, &error);
+		osync_message_read_buffer(message, &buf, &size, &error);
+		fail_unless(!osync_error_is_set(&error), NULL);
+
+		fail_unless(int1 == -i, NULL);
+		fail_unless(uint1 == 0xffffffffu - i, NULL);
+		fail_unless(long1 == -1000000000000LL * i, NULL);
+		fail_unless(!strcmp(format, formats[i % 3]), NULL);
+		fail_unless(none == NULL, NULL);
+		fail_unless(!strcmp(uid, "uid"), NULL);
+		fail_unless(size == 5 && !strcmp(buf, "data"), NULL);
+
+		osync_free(format);
+		osync_free(uid);
+		osync_free(buf);
+		osync_message_unref(message);
+	}
+		
+	osync_assert(osync_queue_disconnect(read1, &error));
+	osync_assert(error == NULL);
+	
+	message = osync_queue_get_message(write1);
+	osync_assert(osync_message_get_command(message) == OSYNC_MESSAGE_QUEUE_HUP);
+	osync_message_unref(message);
+
+	osync_assert(osync_queue_disconnect(write1, &error));
+	osync_assert(error == NULL);
+	
+	osync_queue_unref(read1);
+	osync_queue_unref(write1);
+	
+	destroy_testbed(testbed);
+}
+END_TEST
+
+START_TEST (ipc_message_pool)
+{
+	char *testbed = setup_testbed(NULL);
+
+	OSyncError *error = NULL;
+	OSyncMessage *message = NULL;
+	OSyncMessage *messages[100];
+	OSyncMarshal *marshal = NULL;
+	char data[1000];
+	char *large = NULL;
+	int i;
+
+	memset(data, 'x', sizeof(data));
+	osync_marshal_pool_flush();
+	fail_unless(osync_marshal_pool_get_size() == 0, NULL);
+
+	message = osync_message_new(OSYNC_MESSAGE_NOOP, 100, &error);
+	fail_unless(message != NULL, NULL);
+	marshal = osync_message_get_marshal(message);
+	osync_message_write_data(message, data, sizeof(data), &error);
+	osync_message_unref(message);
+	fail_unless(osync_marshal_pool_get_size() > 0, NULL);
+
+	/* A freed marshal is handed out again, without any leftovers */
+	message = osync_message_new(OSYNC_MESSAGE_NOOP, 100, &error);
+	fail_unless(message != NULL, NULL);
+	fail_unless(osync_message_get_marshal(message) == marshal, NULL);
+	fail_unless(osync_message_get_message_size(message) == 0, NULL);
+	fail_unless(!osync_marshal_is_compact(marshal), NULL);
+	osync_message_unref(message);
+
+	/* The pool does not grow beyond its limit */
+	for (i = 0; i < 100; i++) {
+		messages[i] = osync_message_new(OSYNC_MESSAGE_NOOP, 60000, &error);
+		fail_unless(messages[i] != NULL, NULL);
+	}
+	for (i = 0; i < 100; i++)
+		osync_message_unref(messages[i]);
+	fail_unless(osync_marshal_pool_get_size() <= OSYNC_MARSHAL_POOL_LIMIT, NULL);
+
+	osync_marshal_pool_flush();
+	fail_unless(osync_marshal_pool_get_size() == 0, NULL);
+
+	/* A buffer larger than its class counts with its full size */
+	large = g_malloc0(200000);
+	message = osync_message_new(OSYNC_MESSAGE_NOOP, 100, &error);
+	fail_unless(message != NULL, NULL);
+	osync_message_write_data(message, large, 200000, &error);
+	osync_message_unref(message);
+	fail_unless(osync_marshal_pool_get_size() >= 200000, NULL);
+	g_free(large);
+
+	osync_marshal_pool_flush();
+	fail_unless(osync_marshal_pool_get_size() == 0, NULL);
+
+	destroy_testbed(testbed);
+}
+END_TEST
+
+START_TEST (ipc_threadcom_reference)
+{
+	char *testbed = setup_testbed(NULL);
+
+	OSyncError *error = NULL;
+	OSyncQueue *read1 = NULL;
+	OSyncQueue *write1 = NULL;
+	OSyncQueue *read2 = NULL;
+	OSyncQueue *write2 = NULL;
+	OSyncMessage *message = NULL;
+	char object1[] = "object1";
+	char object2[] = "object2";
+	void *object = NULL;
+	int int1;
+
+	num_payload_releases = 0;
+
+	osync_assert(osync_queue_new_threadcom(&read1, &write1, &error));
+	osync_assert(error == NULL);
+
+	/* Only thread communication passes references */
+	osync_assert(osync_queue_new_pipes(&read2, &write2, &error));
+	osync_assert(error == NULL);
+	message = osync_message_new(OSYNC_MESSAGE_NOOP, 0, &error);
+	fail_unless(message != NULL, NULL);
+	osync_queue_prepare_message(write2, message);
+	fail_unless(!osync_message_is_by_reference(message), NULL);
+	osync_message_unref(message);
+	osync_queue_unref(read2);
+	osync_queue_unref(write2);
+
+	fail_unless(osync_queue_connect(read1, OSYNC_QUEUE_RECEIVER, &error), NULL);
+	fail_unless(error == NULL, NULL);
+
+	fail_unless(osync_queue_connect(write1, OSYNC_QUEUE_SENDER, &error), NULL);
+	fail_unless(error == NULL, NULL);
+
+	message = osync_message_new(OSYNC_MESSAGE_NOOP, 0, &error);
+	fail_unless(message != NULL, NULL);
+	osync_queue_prepare_message(write1, message);
+	fail_unless(osync_message_is_by_reference(message), NULL);
+
+	fail_unless(osync_message_write_reference(message, object1, payload_release, &error), NULL);
+	osync_message_write_int(message, 42, &error);
+	fail_unless(osync_message_write_reference(message, object2, payload_release, &error), NULL);
+	fail_unless(!osync_error_is_set(&error), NULL);
+
+	fail_unless(osync_queue_send_message(write1, NULL, message, &error), NULL);
+	fail_unless(!osync_error_is_set(&error), NULL);
+	osync_message_unref(message);
+
+	message = osync_queue_get_message(read1);
+	fail_unless(osync_message_get_command(message) == OSYNC_MESSAGE_NOOP, NULL);
+
+	/* The receiver gets the very same objects */
+	fail_unless(osync_message_read_reference(message, &object, &error), NULL);
+	fail_unless(object == object1, NULL);
+	osync_message_read_int(message, &int1, &error);
+	fail_unless(int1 == 42, NULL);
+	fail_unless(osync_message_read_reference(message, &object, &error), NULL);
+	fail_unless(object == object2, NULL);
+	fail_unless(!osync_error_is_set(&error), NULL);
+
+	/* The message holds the references until it is freed */
+	fail_unless(num_payload_releases == 0, NULL);
+	osync_message_unref(message);
+	fail_unless(num_payload_releases == 2, NULL);
+
+	osync_assert(osync_queue_disconnect(read1, &error));
+	osync_assert(error == NULL);
+
+	osync_assert(osync_queue_disconnect(write1, &error));
+	osync_assert(error == NULL);
+
+	osync_queue_unref(read1);
+	osync_queue_unref(write1);
+
+	destroy_testbed(testbed);
+}
+END_TEST
+
+START_TEST (ipc_queue_stats)
+{
+	char *testbed = setup_testbed(NULL);
+
+	OSyncError *error = NULL;
+	OSyncQueue *read1 = NULL;
+	OSyncQueue *write1 = NULL;
+	OSyncMessage *message = NULL;
+	OSyncQueueStats stats, total;
+	/* Frame header and the int of each message */
+	unsigned int frame_size = 3 * sizeof(int) + sizeof(long long int) + sizeof(int);
+	int num_msgs = 10;
+	int i;
+
+	osync_assert(osync_queue_new_pipes(&read1, &write1, &error));
+	osync_assert(error == NULL);
+
+	osync_queue_get_stats(write1, &stats);
+	fail_unless(stats.messages_sent == 0, NULL);
+	fail_unless(stats.bytes_sent == 0, NULL);
+
+	fail_unless(osync_queue_connect(read1, OSYNC_QUEUE_RECEIVER, &error), NULL);
+	fail_unless(error == NULL, NULL);
+
+	fail_unless(osync_queue_connect(write1, OSYNC_QUEUE_SENDER, &error), NULL);
+	fail_unless(error == NULL, NULL);
+
+	for (i = 0; i < num_msgs; i++) {
+		message = osync_message_new(OSYNC_MESSAGE_INITIALIZE, 0, &error);
+		fail_unless(message != NULL, NULL);
+		osync_message_write_int(message, i, &error);
+
+		fail_unless(osync_queue_send_message(write1, NULL, message, &error), NULL);
+		fail_unless(!osync_error_is_set(&error), NULL);
+		osync_message_unref(message);
+	}
+
+	for (i = 0; i < num_msgs; i++) {
+		message = osync_queue_get_message(read1);
+		fail_unless(osync_message_get_command(message) == OSYNC_MESSAGE_INITIALIZE, NULL);
+		osync_message_unref(message);
+	}
+
+	osync_queue_get_stats(write1, &stats);
+	fail_unless(stats.messages_sent == (unsigned int) num_msgs, NULL);
+	fail_unless(stats.bytes_sent == num_msgs * frame_size, NULL);
+	fail_unless(stats.outgoing_peak >= 1, NULL);
+	fail_unless(stats.pending_replies == 0, NULL);
+
+	osync_queue_get_stats(read1, &stats);
+	fail_unless(stats.messages_received == (unsigned int) num_msgs, NULL);
+	fail_unless(stats.bytes_received == num_msgs * frame_size, NULL);
+	fail_unless(stats.incoming_peak >= 1, NULL);
+	fail_unless(stats.incoming_depth == 0, NULL);
+	fail_unless(stats.timeouts == 0, NULL);
+
+	/* Aggregates sum up the counters but keep the largest peak */
+	memset(&total, 0, sizeof(total));
+	stats.latency[OSYNC_MESSAGE_CONNECT][3] = 2;
+	osync_queue_stats_merge(&total, &stats);
+	osync_queue_stats_merge(&total, &stats);
+	fail_unless(total.messages_received == 2 * stats.messages_received, NULL);
+	fail_unless(total.incoming_peak == stats.incoming_peak, NULL);
+	fail_unless(total.latency[OSYNC_MESSAGE_CONNECT][3] == 4, NULL);
+
+	osync_assert(osync_queue_disconnect(read1, &error));
+	osync_assert(error == NULL);
+
+	message = osync_queue_get_message(write1);
+	osync_assert(osync_message_get_command(message) == OSYNC_MESSAGE_QUEUE_HUP);
+	osync_message_unref(message);
+
+	osync_assert(osync_queue_disconnect(write1, &error));
+	osync_assert(error == NULL);
+
+	osync_queue_unref(read1);
+	osync_queue_unref(write1);
+
+	destroy_testbed(testbed);
+}
+END_TEST
+
+static void _write_frame_header(int fd, int size, int cmd, long long int id)
+{
+	char header[3 * sizeof(int) + sizeof(long long int)];
+	int timeout = 0;
+
+	memcpy(header, &size, sizeof(int));
+	memcpy(header + sizeof(int), &cmd, sizeof(int));
+	memcpy(header + 2 * sizeof(int), &id, sizeof(long long int));
+	memcpy(header + 2 * sizeof(int) + sizeof(long long int), &timeout, sizeof(int));
+
+	/* Split the header to test frames spanning multiple reads */
+	fail_unless(write(fd, header, 5) == 5, NULL);
+	g_usleep(10000);
+	fail_unless(write(fd, header + 5, sizeof(header) - 5) == sizeof(header) - 5, NULL);
+}
+
+START_TEST (ipc_pipes_partial_frames)
+{	
+	char *testbed = setup_testbed(NULL);
+	
+	OSyncError *error = NULL;
+	OSyncQueue *read1 = NULL;
+	OSyncMessage *message = NULL;
+	char *buffer = NULL;
+	int large_size = 100000;
+	int filedes[2];
+	int i;
+
+	fail_unless(pipe(filedes) == 0, NULL);
+
+	read1 = osync_queue_new_from_fd(filedes[0], &error);
+	fail_unless(read1 != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+		
+	fail_unless(osync_queue_connect(read1, OSYNC_QUEUE_RECEIVER, &error), NULL);
+	fail_unless(error == NULL, NULL);
+
+	/* A small payload arriving in pieces */
+	_write_frame_header(filedes[1], 10, OSYNC_MESSAGE_INITIALIZE, 1);
+	g_usleep(10000);
+	fail_unless(write(filedes[1], "0123", 4) == 4, NULL);
+	g_usleep(10000);
+	fail_unless(write(filedes[1], "456789", 6) == 6, NULL);
+
+	/* A large payload which gets read directly into the message */
+	buffer = g_malloc(large_size);
+	for (i = 0; i < large_size; i++)
+		buffer[i] = i % 253;
+
+	_write_frame_header(filedes[1], large_size, OSYNC_MESSAGE_FINALIZE, 2);
+	for (i = 0; i < large_size; i += 7000) {
+		int chunk = large_size - i < 7000 ? large_size - i : 7000;
+		fail_unless(write(filedes[1], buffer + i, chunk) == chunk, NULL);
+		g_usleep(1000);
+	}
+
+	/* An empty frame right behind it */
+	_write_frame_header(filedes[1], 0, OSYNC_MESSAGE_SYNC_DONE, 3);
+
+	message = osync_queue_get_message(read1);
+	fail_unless(osync_message_get_command(message) == OSYNC_MESSAGE_INITIALIZE, NULL);
+	fail_unless(osync_message_get_id(message) == 1, NULL);
+	fail_unless(osync_message_get_message_size(message) == 10, NULL);
+	osync_message_unref(message);
+
+	message = osync_queue_get_message(read1);
+	fail_unless(osync_message_get_command(message) == OSYNC_MESSAGE_FINALIZE, NULL);
+	fail_unless(osync_message_get_id(message) == 2, NULL);
+	fail_unless(osync_message_get_message_size(message) == (unsigned int) large_size, NULL);
+	{
+		char *data = NULL;
+		unsigned int length = 0;
+		fail_unless(osync_message_get_buffer(message, &data, &length, &error), NULL);
+		fail_unless(length == (unsigned int) large_size, NULL);
+		fail_unless(!memcmp(data, buffer, large_size), NULL);
+	}
+	osync_message_unref(message);
+
+	message = osync_queue_get_message(read1);
+	fail_unless(osync_message_get_command(message) == OSYNC_MESSAGE_SYNC_DONE, NULL);
+	fail_unless(osync_message_get_id(message) == 3, NULL);
+	fail_unless(osync_message_get_message_size(message) == 0, NULL);
+	osync_message_unref(message);
+
+	g_free(buffer);
+
+	close(filedes[1]);
+
+	message = osync_queue_get_message(read1);
+	fail_unless(osync_message_get_command(message) == OSYNC_MESSAGE_QUEUE_HUP, NULL);
+	osync_message_unref(message);
+		
+	osync_assert(osync_queue_disconnect(read1, &error));
+	osync_assert(error == NULL);
+	
+	osync_queue_unref(read1);
+	
+	destroy_testbed(testbed);
+}
+END_TEST
+
+#define NUM_OUT_OF_ORDER_MSGS 100
+static int out_of_order_replies[NUM_OUT_OF_ORDER_MSGS];
+static int num_out_of_order_replies = 0;
+
+static void out_of_order_reply_handler(OSyncMessage *message, void *user_data)
+{
+	int *slot = user_data;
+	int value = 0;
+	OSyncError *error = NULL;
+
+	osync_assert(osync_message_get_command(message) == OSYNC_MESSAGE_REPLY);
+	osync_assert(osync_message_read_int(message, &value, &error));
+
+	/* Each reply has to end up at the handler of its own command */
+	*slot = value;
+	num_out_of_order_replies++;
+}
+
+START_TEST (ipc_pipes_out_of_order_replies)
+{	
+	char *testbed = setup_testbed(NULL);
+	
+	OSyncError *error = NULL;
+	OSyncQueue *read1 = NULL, *write1 = NULL;
+	OSyncQueue *read2 = NULL, *write2 = NULL;
+	OSyncMessage *messages[NUM_OUT_OF_ORDER_MSGS];
+	OSyncMessage *message = NULL;
+	GMainContext *context = g_main_context_new();
+	int i;
+	
+	osync_assert(osync_queue_new_pipes(&read1, &write1, &error));
+	osync_assert(osync_queue_new_pipes(&read2, &write2, &error));
+	osync_assert(error == NULL);
+
+	fail_unless(osync_queue_setup_with_gmainloop(read2, context, &error), NULL);
+
+	fail_unless(osync_queue_connect(read1, OSYNC_QUEUE_RECEIVER, &error), NULL);
+	fail_unless(osync_queue_connect(write1, OSYNC_QUEUE_SENDER, &error), NULL);
+	fail_unless(osync_queue_connect(read2, OSYNC_QUEUE_RECEIVER, &error), NULL);
+	fail_unless(osync_queue_connect(write2, OSYNC_QUEUE_SENDER, &error), NULL);
+	fail_unless(error == NULL, NULL);
+
+	for (i = 0; i < NUM_OUT_OF_ORDER_MSGS; i++) {
+		out_of_order_replies[i] = -1;
+
+		message = osync_message_new(OSYNC_MESSAGE_INITIALIZE, 0, &error);
+		fail_unless(message != NULL, NULL);
+		osync_message_set_handler(message, out_of_order_reply_handler, &out_of_order_replies[i]);
+
+		fail_unless(osync_queue_send_message_with_timeout(write1, read2, message, 30, &error), NULL);
+		fail_unless(!osync_error_is_set(&error), NULL);
+		osync_message_unref(message);
+	}
+
+	for (i = 0; i < NUM_OUT_OF_ORDER_MSGS; i++)
+		messages[i] = osync_queue_get_message(read1);
+
+	/* Reply in reverse order */
+	for (i = NUM_OUT_OF_ORDER_MSGS - 1; i >= 0; i--) {
+		OSyncMessage *reply = osync_message_new_reply(messages[i], &error);
+		fail_unless(reply != NULL, NULL);
+		osync_message_write_int(reply, i, &error);
+
+		fail_unless(osync_queue_send_message(write2, NULL, reply, &error), NULL);
+		osync_message_unref(reply);
+		osync_message_unref(messages[i]);
+	}
+
+	while (num_out_of_order_replies < NUM_OUT_OF_ORDER_MSGS)
+		g_main_context_iteration(context, TRUE);
+
+	for (i = 0; i < NUM_OUT_OF_ORDER_MSGS; i++)
+		fail_unless(out_of_order_replies[i] == i, NULL);
+		
+	osync_assert(osync_queue_disconnect(read1, &error));
+	osync_assert(osync_queue_disconnect(write1, &error));
+	osync_assert(osync_queue_disconnect(read2, &error));
+	osync_assert(osync_queue_disconnect(write2, &error));
+	osync_assert(error == NULL);
+	
+	osync_queue_unref(read1);
+	osync_queue_unref(write1);
+	osync_queue_unref(read2);
+	osync_queue_unref(write2);
+	g_main_context_unref(context);
+	
+	destroy_testbed(testbed);
+}
+END_TEST
+
+START_TEST (ipc_shm_rings)
+{	
+	char *testbed = setup_testbed(NULL);
+	
+	OSyncError *error = NULL;
+	OSyncQueue *read1 = NULL;
+	OSyncQueue *write1 = NULL;
+	OSyncMessage *message = NULL;
+	char *spec = NULL;
+	char *data = NULL;
+	char *buffer = NULL;
+	unsigned int length = 0;
+	/* Larger than the ring, so the writer has to wait for the reader */
+	int size = 3 * OSYNC_SHM_RING_SIZE + 17;
+	int i;
+	
+	if (!osync_queue_new_shm_rings(&read1, &write1, &error)) {
+		/* Platforms without memfd fall back to pipes */
+		fail_unless(osync_error_get_type(&error) == OSYNC_ERROR_NOT_SUPPORTED, NULL);
+		osync_error_unref(&error);
+		destroy_testbed(testbed);
+		return;
+	}
+
+	spec = osync_queue_get_shm_spec(read1);
+	fail_unless(spec != NULL, NULL);
+
+	/* The ring only gets passed on to processes which should have it */
+	int fds[4];
+	fail_unless(sscanf(spec, "%i:%i:%i:%i", &fds[0], &fds[1], &fds[2], &fds[3]) == 4, NULL);
+	osync_free(spec);
+
+	for (i = 1; i < 4; i++)
+		fail_unless(fcntl(fds[i], F_GETFD) & FD_CLOEXEC, NULL);
+
+	fail_unless(osync_queue_set_shm_inheritable(read1, &error), NULL);
+	fail_unless(error == NULL, NULL);
+
+	for (i = 1; i < 4; i++)
+		fail_unless(!(fcntl(fds[i], F_GETFD) & FD_CLOEXEC), NULL);
+		
+	fail_unless(osync_queue_connect(read1, OSYNC_QUEUE_RECEIVER, &error), NULL);
+	fail_unless(error == NULL, NULL);
+		
+	fail_unless(osync_queue_connect(write1, OSYNC_QUEUE_SENDER, &error), NULL);
+	fail_unless(error == NULL, NULL);
+
+	data = g_malloc(size);
+	for (i = 0; i < size; i++)
+		data[i] = i % 241;
+
+	for (i = 0; i < 3; i++) {
+		message = osync_message_new(OSYNC_MESSAGE_INITIALIZE, 0, &error);
+		fail_unless(message != NULL, NULL);
+		osync_message_write_int(message, i, &error);
+		if (i == 1)
+			osync_message_write_buffer(message, data, size, &error);
+	
+		fail_unless(osync_queue_send_message(write1, NULL, message, &error), NULL);
+		fail_unless(!osync_error_is_set(&error), NULL);
+		osync_message_unref(message);
+	}
+
+	for (i = 0; i < 3; i++) {
+		int int1 = -1;
+
+		message = osync_queue_get_message(read1);
+		fail_unless(osync_message_get_command(message) == OSYNC_MESSAGE_INITIALIZE, NULL);
+
+		osync_message_read_int(message, &int1, &error);
+		fail_unless(int1 == i, NULL);
+
+		if (i == 1) {
+			osync_message_read_buffer(message, (void **) &buffer, &length, &error);
+			fail_unless(!osync_error_is_set(&error), NULL);
+			fail_unless(length == (unsigned int) size, NULL);
+			fail_unless(!memcmp(buffer, data, size), NULL);
+			osync_free(buffer);
+		}
+
+		osync_message_unref(message);
+	}
+
+	g_free(data);
+		
+	osync_assert(osync_queue_disconnect(read1, &error));
+	osync_assert(error == NULL);
+	
+	/* The pipe next to the ring reports the hangup */
+	message = osync_queue_get_message(write1);
+	osync_assert(osync_message_get_command(message) == OSYNC_MESSAGE_QUEUE_HUP);
+	osync_message_unref(message);
+
+	osync_assert(osync_queue_disconnect(write1, &error));
+	osync_assert(error == NULL);
+	
+	osync_queue_unref(read1);
+	osync_queue_unref(write1);
+	
+	destroy_testbed(testbed);
+}
+END_TEST
+
+#define NUM_CREDIT_MSGS 20
+#define CREDIT_WINDOW 4
+static int num_credit_sent = 0;
+static int num_credit_dispatched = 0;
+
+static gpointer credit_sender_thread(gpointer data)
+{
+	OSyncQueue *queue = data;
+	OSyncMessage *message = NULL;
+	OSyncError *error = NULL;
+	int i;
+
+	for (i = 0; i < NUM_CREDIT_MSGS; i++) {
+		message = osync_message_new(OSYNC_MESSAGE_NEW_CHANGE, 0, &error);
+		osync_assert(message != NULL);
+		osync_message_write_int(message, i, &error);
+
+		/* Blocks once the window is used up */
+		osync_assert(osync_queue_send_message(queue, NULL, message, &error));
+		osync_message_unref(message);
+
+		g_atomic_int_inc(&num_credit_sent);
+	}
+
+	return NULL;
+}
+
+static void credit_message_handler(OSyncMessage *message, void *user_data)
+{
+	int value = 0;
+	OSyncError *error = NULL;
+
+	osync_assert(osync_message_get_command(message) == OSYNC_MESSAGE_NEW_CHANGE);
+	osync_assert(osync_message_read_int(message, &value, &error));
+	osync_assert(value == num_credit_dispatched);
+
+	num_credit_dispatched++;
+}
+
+START_TEST (ipc_credit_window)
+{	
+	char *testbed = setup_testbed(NULL);
+	
+	OSyncError *error = NULL;
+	OSyncQueue *read1 = NULL, *write1 = NULL;
+	OSyncQueue *read2 = NULL, *write2 = NULL;
+	GMainContext *context = g_main_context_new();
+	GThread *thread = NULL;
+	
+	/* read1/write2 is the sending side, which receives the credits on read1 */
+	osync_assert(osync_queue_new_pipes(&read1, &write1, &error));
+	osync_assert(osync_queue_new_pipes(&read2, &write2, &error));
+	osync_assert(error == NULL);
+
+	osync_queue_set_message_handler(read2, credit_message_handler, NULL);
+	fail_unless(osync_queue_setup_with_gmainloop(read2, context, &error), NULL);
+
+	fail_unless(osync_queue_connect(read1, OSYNC_QUEUE_RECEIVER, &error), NULL);
+	fail_unless(osync_queue_connect(write1, OSYNC_QUEUE_SENDER, &error), NULL);
+	fail_unless(osync_queue_connect(read2, OSYNC_QUEUE_RECEIVER, &error), NULL);
+	fail_unless(osync_queue_connect(write2, OSYNC_QUEUE_SENDER, &error), NULL);
+	fail_unless(error == NULL, NULL);
+
+	osync_queue_cross_link(read1, write2);
+	osync_queue_set_credit_window(read2, write1, CREDIT_WINDOW);
+
+	/* Give the initial credits some time to arrive */
+	g_usleep(G_USEC_PER_SEC / 2);
+
+	thread = g_thread_create(credit_sender_thread, write2, TRUE, NULL);
+	fail_unless(thread != NULL, NULL);
+
+	/* Nothing gets dispatched, so the sender has to stop at the window */
+	g_usleep(G_USEC_PER_SEC / 2);
+	fail_unless(g_atomic_int_get(&num_credit_sent) == CREDIT_WINDOW, NULL);
+
+	while (num_credit_dispatched < NUM_CREDIT_MSGS)
+		g_main_context_iteration(context, TRUE);
+
+	g_thread_join(thread);
+	fail_unless(num_credit_sent == NUM_CREDIT_MSGS, NULL);
+		
+	osync_queue_remove_cross_link(read1);
+	osync_assert(osync_queue_disconnect(read1, &error));
+	osync_assert(osync_queue_disconnect(write1, &error));
+	osync_assert(osync_queue_disconnect(read2, &error));
+	osync_assert(osync_queue_disconnect(write2, &error));
+	osync_assert(error == NULL);
+	
+	osync_queue_unref(read1);
+	osync_queue_unref(write1);
+	osync_queue_unref(read2);
+	osync_queue_unref(write2);
+	g_main_context_unref(context);
+	
+	destroy_testbed(testbed);
+}
+END_TEST
+
 START_TEST (ipc_pipes_stress)
 {	
 	char *testbed = setup_testbed(NULL);
@@ -3198,6 +4290,18 @@ OSYNC_TESTCASE_ADD(ipc_callback_break)
 
 OSYNC_TESTCASE_ADD(ipc_pipes)
 OSYNC_TESTCASE_ADD(ipc_pipes_stress)
+OSYNC_TESTCASE_ADD(ipc_pipes_idle_wakeup)
+OSYNC_TESTCASE_ADD(ipc_wakeup_concurrent_signal)
+OSYNC_TESTCASE_ADD(ipc_pipes_write_batch)
+OSYNC_TESTCASE_ADD(ipc_pipes_payload_ref)
+OSYNC_TESTCASE_ADD(ipc_pipes_compact)
+OSYNC_TESTCASE_ADD(ipc_message_pool)
+OSYNC_TESTCASE_ADD(ipc_threadcom_reference)
+OSYNC_TESTCASE_ADD(ipc_queue_stats)
+OSYNC_TESTCASE_ADD(ipc_pipes_partial_frames)
+OSYNC_TESTCASE_ADD(ipc_pipes_out_of_order_replies)
+OSYNC_TESTCASE_ADD(ipc_shm_rings)
+OSYNC_TESTCASE_ADD(ipc_credit_window)
 OSYNC_TESTCASE_ADD(ipc_callback_break_pipes)
 
 OSYNC_TESTCASE_ADD(ipc_timeout)
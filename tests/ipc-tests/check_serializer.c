@@ -5,6 +5,10 @@
 #include "opensync/ipc/opensync_serializer_internals.h"
 #include <opensync/opensync-plugin.h>
 #include "opensync/plugin/opensync_plugin_config_internals.h"
+#include <opensync/opensync-data.h>
+#include <opensync/opensync-format.h>
+#include "opensync/data/opensync_change_internals.h"
+#include "opensync/data/opensync_data_internals.h"
 
 static osync_bool _compare_string(const void *string1, const void *string2)
 {
@@ -405,8 +409,79 @@ START_TEST (serializer_pluginconfig_full)
 }
 END_TEST
 
+START_TEST (serializer_change_by_reference)
+{
+	char *testbed = setup_testbed(NULL);
+	char *buffer = NULL;
+	unsigned int size = 0;
+	
+	OSyncError *error = NULL;
+	OSyncFormatEnv *env = osync_format_env_new(&error);
+	fail_unless(env != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+
+	OSyncObjFormat *format = osync_objformat_new("test", "test", &error);
+	fail_unless(format != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+	fail_unless(osync_format_env_register_objformat(env, format, &error), NULL);
+
+	OSyncData *data = osync_data_new(osync_strdup("test"), 4, format, &error);
+	fail_unless(data != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+
+	OSyncChange *change1 = osync_change_new(&error);
+	fail_unless(change1 != NULL, NULL);
+	osync_change_set_uid(change1, "uid");
+	osync_change_set_changetype(change1, OSYNC_CHANGE_TYPE_ADDED);
+	osync_change_set_data(change1, data);
+
+	OSyncMessage *message = osync_message_new(OSYNC_MESSAGE_COMMIT_CHANGE, 0, &error);
+	fail_unless(message != NULL, NULL);
+	osync_message_set_by_reference(message, TRUE);
+
+	fail_unless(osync_marshal_change(message, change1, &error), NULL);
+	fail_unless(error == NULL, NULL);
+
+	OSyncChange *change2 = NULL;
+	fail_unless(osync_demarshal_change(message, &change2, env, &error), NULL);
+	fail_unless(error == NULL, NULL);
+
+	/* Both sides got the very same data, which they must not modify */
+	fail_unless(osync_change_get_data(change2) == data, NULL);
+	fail_unless(osync_data_is_shared(data), NULL);
+
+	/* A side which needs to modify it works on a data object of its own,
+	 * which reads the shared buffer until it gets written */
+	char *shared_buffer = NULL;
+	osync_data_get_data(data, &shared_buffer, NULL);
+
+	fail_unless(osync_change_own_data(change2, &error), NULL);
+	fail_unless(error == NULL, NULL);
+	fail_unless(osync_change_get_data(change2) != data, NULL);
+	fail_unless(!osync_data_is_shared(osync_change_get_data(change2)), NULL);
+
+	osync_data_get_data(osync_change_get_data(change2), &buffer, &size);
+	fail_unless(buffer == shared_buffer, NULL);
+	fail_unless(size == 4 && !memcmp(buffer, "test", 4), NULL);
+
+	osync_data_set_data(osync_change_get_data(change2), osync_strdup("other"), 5);
+	osync_data_get_data(data, &buffer, &size);
+	fail_unless(size == 4 && !memcmp(buffer, "test", 4), NULL);
+
+	osync_message_unref(message);
+	osync_change_unref(change1);
+	osync_change_unref(change2);
+	osync_data_unref(data);
+	osync_objformat_unref(format);
+	osync_format_env_unref(env);
+	
+	destroy_testbed(testbed);
+}
+END_TEST
+
 OSYNC_TESTCASE_START("serializer")
 OSYNC_TESTCASE_ADD(serializer_pluginconfig)
 OSYNC_TESTCASE_ADD(serializer_pluginconfig_full)
+OSYNC_TESTCASE_ADD(serializer_change_by_reference)
 OSYNC_TESTCASE_END
 
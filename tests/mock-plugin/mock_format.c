@@ -76,6 +76,17 @@ static OSyncConvCmpResult compare_file(const char *leftdata, unsigned int leftsi
 	return OSYNC_CONV_DATA_MISMATCH;
 }
 
+static char *mapping_key_file(const char *data, unsigned int size, void *user_data, OSyncError **error)
+{
+	OSyncFileFormat *file = (OSyncFileFormat *)data;
+
+	/* Files with different paths might be compared as similar */
+	if (g_getenv("MOCK_FORMAT_PATH_COMPARE_NO") || !file->path)
+		return NULL;
+
+	return osync_strdup(file->path);
+}
+
 static osync_bool conv_mockformat1_to_mockformat2(char *input, unsigned int inpsize, char **output, unsigned int *outpsize, osync_bool *free_input, const char *config, void *userdata, OSyncError **error)
 {
 	osync_trace(TRACE_INTERNAL, "Converting file to plain");
@@ -302,6 +313,7 @@ error:
 static void _format_set_functions(OSyncObjFormat *format)
 {
 	osync_objformat_set_compare_func(format, compare_file);
+	osync_objformat_set_mapping_key_func(format, mapping_key_file);
 	osync_objformat_set_destroy_func(format, destroy_file);
 	osync_objformat_set_duplicate_func(format, duplicate_file);
 	osync_objformat_set_print_func(format, print_file);
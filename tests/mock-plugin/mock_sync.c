@@ -345,6 +345,23 @@ static void mock_report_dir(MockDir *directory, const char *subdir, OSyncContext
 				continue;
 			}
 
+			/* The engine reads the data with mock_read() once it needs it */
+			if (osync_objtype_sink_get_change_stubs(sink)) {
+				OSyncData *odata = osync_data_new(NULL, 0, directory->objformat, &error);
+				osync_assert(odata);
+
+				osync_data_set_objtype(odata, osync_objtype_sink_get_name(sink));
+				osync_change_set_data(change, odata);
+				osync_data_unref(odata);
+
+				osync_context_report_change(ctx, change);
+
+				osync_change_unref(change);
+				g_free(filename);
+				g_free(relative_filename);
+				continue;
+			}
+
 			OSyncFileFormat *file = osync_try_malloc0(sizeof(OSyncFileFormat), &error);
 			osync_assert(file);
 
@@ -383,6 +400,19 @@ static void mock_report_dir(MockDir *directory, const char *subdir, OSyncContext
 	osync_trace(TRACE_EXIT, "%s", __func__);
 }
 
+/* Reports the success of get_changes after GET_CHANGES_DELAY_SUCCESS msec,
+ * while the client is idle */
+static gpointer mock_get_changes_delayed_success(gpointer data)
+{
+	OSyncContext *ctx = data;
+
+	g_usleep(atoi(g_getenv("GET_CHANGES_DELAY_SUCCESS")) * 1000);
+
+	osync_context_report_success(ctx);
+	osync_context_unref(ctx);
+	return NULL;
+}
+
 static void mock_get_changes(OSyncObjTypeSink *sink, OSyncPluginInfo *info, OSyncContext *ctx, osync_bool slow_sync, void *data)
 {
 	osync_trace(TRACE_ENTRY, "%s(%p, %p, %p, %i, %p)", __func__, sink, info, ctx, slow_sync, data);
@@ -449,6 +479,13 @@ static void mock_get_changes(OSyncObjTypeSink *sink, OSyncPluginInfo *info, OSyn
 		osync_change_unref(change);
 	}
 
+	if (g_getenv("GET_CHANGES_DELAY_SUCCESS")) {
+		osync_context_ref(ctx);
+		osync_assert(g_thread_create(mock_get_changes_delayed_success, ctx, FALSE, NULL));
+		osync_trace(TRACE_EXIT, "%s: success delayed", __func__);
+		return;
+	}
+
 	osync_context_report_success(ctx);
 	osync_trace(TRACE_EXIT, "%s", __func__);
 }
@@ -497,6 +534,17 @@ static void mock_commit_change(OSyncObjTypeSink *sink, OSyncPluginInfo *info, OS
 	osync_trace(TRACE_EXIT, "%s", __func__);
 }
 
+static void mock_batch_commit(OSyncObjTypeSink *sink, OSyncPluginInfo *info, OSyncContext **contexts, OSyncChange **changes, void *data)
+{
+	unsigned int i;
+	osync_trace(TRACE_ENTRY, "%s(%p, %p, %p, %p, %p)", __func__, sink, info, contexts, changes, data);
+
+	for (i = 0; changes[i]; i++)
+		mock_commit_change(sink, info, contexts[i], changes[i], data);
+
+	osync_trace(TRACE_EXIT, "%s", __func__);
+}
+
 static void mock_committed_all(OSyncObjTypeSink *sink, OSyncPluginInfo *info, OSyncContext *context, void *data)
 {
 	osync_trace(TRACE_ENTRY, "%s(%p, %p, %p, %p)", __func__, sink, info, context, data);
@@ -638,6 +686,8 @@ static void *mock_initialize(OSyncPlugin *plugin, OSyncPluginInfo *info, OSyncEr
 
 		osync_objtype_sink_set_committed_all_func(sink, mock_committed_all);
 		osync_objtype_sink_set_commit_func(sink, mock_commit_change);
+		if (g_getenv("BATCH_COMMIT"))
+			osync_objtype_sink_set_batch_commit_func(sink, mock_batch_commit);
 		osync_objtype_sink_set_read_func(sink, mock_read);
 		osync_objtype_sink_set_sync_done_func(sink, mock_sync_done);
 
@@ -9,6 +9,11 @@
 #include "opensync/group/opensync_group_internals.h"
 #include "opensync/group/opensync_member_internals.h"
 #include "opensync/engine/opensync_engine_internals.h"
+#include "opensync/engine/opensync_engine_private.h"
+#include "opensync/engine/opensync_obj_engine_internals.h"
+#include "opensync/engine/opensync_change_store_internals.h"
+
+#include "../mock-plugin/mock_format.h"
 
 START_TEST (sync_setup_connect)
 {
@@ -2344,6 +2349,478 @@ START_TEST (sync_large)
 }
 END_TEST
 
+/* The setup of sync_easy_new, for the tests of the engine options.
+ * member 1 has file1 to file4, member 2 has file5 and file6 */
+/* The engine of the group of the testbed, with the status callbacks of
+ * the sync_easy tests */
+static OSyncEngine *_sync_engine_load(const char *testbed)
+{
+	char *formatdir = g_strdup_printf("%s/formats", testbed);
+	char *plugindir = g_strdup_printf("%s/plugins", testbed);
+	
+	OSyncError *error = NULL;
+	OSyncGroup *group = osync_group_new(&error);
+	fail_unless(group != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+	
+	osync_group_set_schemadir(group, testbed);
+	fail_unless(osync_group_load(group, "configs/group", &error), NULL);
+	fail_unless(error == NULL, NULL);
+	
+	OSyncEngine *engine = osync_engine_new(group, &error);
+	fail_unless(engine != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+	osync_group_unref(group);
+	
+	osync_engine_set_schemadir(engine, testbed);	
+	osync_engine_set_plugindir(engine, plugindir);
+	osync_engine_set_formatdir(engine, formatdir);
+	
+	osync_engine_set_conflict_callback(engine, conflict_handler_choose_first, GINT_TO_POINTER(2));
+	osync_engine_set_changestatus_callback(engine, entry_status, GINT_TO_POINTER(1));
+	osync_engine_set_mappingstatus_callback(engine, mapping_status, GINT_TO_POINTER(1));
+	osync_engine_set_enginestatus_callback(engine, engine_status, GINT_TO_POINTER(1));
+	osync_engine_set_memberstatus_callback(engine, member_status, GINT_TO_POINTER(1));
+
+	g_free(formatdir);
+	g_free(plugindir);
+
+	return engine;
+}
+
+static OSyncEngine *_sync_easy_engine_new(const char *testbed)
+{
+	create_random_file("data1/file1");
+	create_random_file("data1/file2");
+	create_random_file("data1/file3");
+	create_random_file("data1/file4");
+	
+	create_random_file("data2/file5");
+	create_random_file("data2/file6");
+
+	return _sync_engine_load(testbed);
+}
+
+/* Runs the engine of _sync_easy_engine_new() and checks that the outcome
+ * is the one of sync_easy_new */
+static void _sync_easy_run(OSyncEngine *engine, const char *testbed)
+{
+	OSyncError *error = NULL;
+
+	fail_unless(osync_engine_initialize(engine, &error), NULL);
+	fail_unless(error == NULL, NULL);
+	
+	fail_unless(osync_engine_synchronize_and_block(engine, &error), NULL);
+	fail_unless(error == NULL, NULL);
+	
+	fail_unless(osync_engine_finalize(engine, &error), NULL);
+	fail_unless(error == NULL, NULL);
+	
+	osync_engine_unref(engine);
+	
+	/* Client checks */
+	fail_unless(num_client_written == 2, NULL);
+	fail_unless(num_client_errors == 0, NULL);
+	
+	/* Engine checks */
+	fail_unless(num_engine_errors == 0, NULL);
+	fail_unless(num_engine_written == 1, NULL);
+	fail_unless(num_engine_successful == 1, NULL);
+
+	/* Change checks */
+	fail_unless(num_change_read == 6, NULL);
+	fail_unless(num_change_written == 6, NULL);
+	fail_unless(num_change_error == 0, NULL);
+
+	fail_unless(osync_testing_diff("data1", "data2"));
+	
+	char *path = g_strdup_printf("%s/configs/group/archive.db", testbed);
+	OSyncMappingTable *maptable = mappingtable_load(path, "mockobjtype1", 6);
+	g_free(path);
+	check_mapping(maptable, 1, -1, 2, "file1");
+	check_mapping(maptable, 2, -1, 2, "file1");
+	check_mapping(maptable, 1, -1, 2, "file4");
+	check_mapping(maptable, 2, -1, 2, "file4");
+	check_mapping(maptable, 1, -1, 2, "file6");
+	check_mapping(maptable, 2, -1, 2, "file6");
+	osync_mapping_table_close(maptable);
+	osync_mapping_table_unref(maptable);
+    
+	path = g_strdup_printf("%s/configs/group/1/hashtable.db", testbed);
+	OSyncHashTable *table = hashtable_load(path, "mockobjtype1", 6);
+	g_free(path);
+	check_hash(table, "file2");
+	check_hash(table, "file5");
+	osync_hashtable_unref(table);
+}
+
+START_TEST (sync_batch_commit)
+{
+	char *testbed = setup_testbed("sync");
+	
+	/* Commit through the batch_commit sink function of the mock-sync plugin */
+	g_setenv("BATCH_COMMIT", "1", TRUE);
+
+	OSyncEngine *engine = _sync_easy_engine_new(testbed);
+	_sync_easy_run(engine, testbed);
+
+	g_unsetenv("BATCH_COMMIT");
+
+	destroy_testbed(testbed);
+}
+END_TEST
+
+/* The mock plugin reports the changes of a member sorted by uid. They have
+ * to get read in that order, no matter which conversion finished first. */
+static char *conversion_last_uid[3];
+static unsigned int conversion_num_read[3];
+static unsigned int conversion_out_of_order = 0;
+
+static void conversion_entry_status(OSyncEngineChangeUpdate *status, void *user_data)
+{
+	if (osync_engine_change_update_get_event(status) == OSYNC_ENGINE_CHANGE_EVENT_READ) {
+		osync_memberid id = osync_member_get_id(osync_engine_change_update_get_member(status));
+		const char *uid = osync_change_get_uid(osync_engine_change_update_get_change(status));
+
+		osync_assert(id == 1 || id == 2);
+		if (conversion_last_uid[id] && strcmp(conversion_last_uid[id], uid) >= 0)
+			conversion_out_of_order++;
+
+		g_free(conversion_last_uid[id]);
+		conversion_last_uid[id] = g_strdup(uid);
+		conversion_num_read[id]++;
+	}
+
+	entry_status(status, user_data);
+}
+
+START_TEST (sync_conversion_threads)
+{
+	char *testbed = setup_testbed("sync");
+	OSyncEngine *engine = _sync_easy_engine_new(testbed);
+
+	/* Changes get converted concurrently, but mapped in order */
+	osync_engine_set_conversion_threads(engine, 4);
+	osync_engine_set_changestatus_callback(engine, conversion_entry_status, GINT_TO_POINTER(1));
+
+	_sync_easy_run(engine, testbed);
+
+	fail_unless(conversion_num_read[1] == 4, NULL);
+	fail_unless(conversion_num_read[2] == 2, NULL);
+	fail_unless(conversion_out_of_order == 0, NULL);
+	fail_unless(!strcmp(conversion_last_uid[1], "file4"), NULL);
+	fail_unless(!strcmp(conversion_last_uid[2], "file6"), NULL);
+
+	g_free(conversion_last_uid[1]);
+	g_free(conversion_last_uid[2]);
+
+	destroy_testbed(testbed);
+}
+END_TEST
+
+/* The number of new mappings of the object engine once all changes got read */
+static int incremental_read_new_mappings = -1;
+
+static void incremental_engine_status(OSyncEngineUpdate *status, void *user_data)
+{
+	OSyncEngine *engine = user_data;
+
+	if (osync_engine_update_get_event(status) == OSYNC_ENGINE_EVENT_READ)
+		incremental_read_new_mappings = osync_obj_engine_num_new_mappings(osync_engine_nth_objengine(engine, 0));
+
+	engine_status(status, GINT_TO_POINTER(1));
+}
+
+START_TEST (sync_incremental_mapping)
+{
+	char *testbed = setup_testbed("sync");
+	OSyncEngine *engine = _sync_easy_engine_new(testbed);
+
+	/* Changes get mapped as they arrive, conflicts get checked on MAP */
+	osync_engine_set_incremental_mapping(engine, TRUE);
+	osync_engine_set_enginestatus_callback(engine, incremental_engine_status, engine);
+
+	_sync_easy_run(engine, testbed);
+
+	/* All six changes got their own mapping before MAP */
+	fail_unless(incremental_read_new_mappings == 6, NULL);
+
+	destroy_testbed(testbed);
+}
+END_TEST
+
+/* The mock plugin reports stubs, the engine reads the data of the changes
+ * which need it. The second sync only reads the modified change. */
+START_TEST (sync_change_stubs)
+{
+	char *testbed = setup_testbed("sync");
+	OSyncEngine *engine = _sync_easy_engine_new(testbed);
+
+	osync_engine_set_change_stubs(engine, TRUE);
+
+	_sync_easy_run(engine, testbed);
+
+	/* The hashes of the mock plugin have a resolution of seconds */
+	g_usleep(2*G_USEC_PER_SEC);
+	create_random_file("data1/file2");
+
+	reset_counters();
+	engine = _sync_engine_load(testbed);
+	osync_engine_set_change_stubs(engine, TRUE);
+
+	OSyncError *error = NULL;
+	fail_unless(osync_engine_initialize(engine, &error), NULL);
+	fail_unless(error == NULL, NULL);
+
+	fail_unless(osync_engine_synchronize_and_block(engine, &error), NULL);
+	fail_unless(error == NULL, NULL);
+	
+	fail_unless(osync_engine_finalize(engine, &error), NULL);
+	fail_unless(error == NULL, NULL);
+	
+	osync_engine_unref(engine);
+
+	fail_unless(num_engine_errors == 0, NULL);
+	fail_unless(num_engine_successful == 1, NULL);
+	fail_unless(num_change_read == 1, NULL);
+	fail_unless(num_change_written == 1, NULL);
+	fail_unless(num_change_error == 0, NULL);
+
+	fail_unless(osync_testing_diff("data1", "data2"));
+	
+	char *path = g_strdup_printf("%s/configs/group/archive.db", testbed);
+	OSyncMappingTable *maptable = mappingtable_load(path, "mockobjtype1", 6);
+	g_free(path);
+	check_mapping(maptable, 1, -1, 2, "file2");
+	check_mapping(maptable, 2, -1, 2, "file2");
+	osync_mapping_table_close(maptable);
+	osync_mapping_table_unref(maptable);
+
+	destroy_testbed(testbed);
+}
+END_TEST
+
+/* The state of the change store of the engine once all changes got mapped */
+static unsigned long long change_store_mapped_resident = 0;
+static unsigned long long change_store_mapped_peak = 0;
+static unsigned int change_store_mapped_spilled = 0;
+
+static void change_store_engine_status(OSyncEngineUpdate *status, void *user_data)
+{
+	OSyncEngine *engine = user_data;
+
+	if (osync_engine_update_get_event(status) == OSYNC_ENGINE_EVENT_MAPPED) {
+		change_store_mapped_resident = osync_change_store_get_resident(engine->change_store);
+		change_store_mapped_peak = osync_change_store_get_peak(engine->change_store);
+		change_store_mapped_spilled = osync_change_store_get_num_spilled(engine->change_store);
+	}
+
+	engine_status(status, GINT_TO_POINTER(1));
+}
+
+/* With a budget of a single byte all received data gets spilled to
+ * the scratch file and read back for converting and writing. */
+START_TEST (sync_change_store)
+{
+	char *testbed = setup_testbed("sync");
+	OSyncEngine *engine = _sync_easy_engine_new(testbed);
+
+	osync_engine_set_change_store_budget(engine, 1);
+	osync_engine_set_enginestatus_callback(engine, change_store_engine_status, engine);
+
+	_sync_easy_run(engine, testbed);
+
+	/* All data got spilled when received. Mapping read some of it back,
+	 * which got spilled again after each mapped change */
+	fail_unless(change_store_mapped_spilled >= 6, NULL);
+	fail_unless(change_store_mapped_resident == 0, NULL);
+
+	/* While mapping, at most the mapped change and the one it got
+	 * compared with were in memory */
+	fail_unless(change_store_mapped_peak > 0, NULL);
+	fail_unless(change_store_mapped_peak <= 2 * sizeof(OSyncFileFormat), NULL);
+
+	destroy_testbed(testbed);
+}
+END_TEST
+
+START_TEST (sync_profile)
+{
+	char *testbed = setup_testbed("sync");
+	char *profile_file = g_strdup_printf("%s/profile.json", testbed);
+	OSyncError *error = NULL;
+	
+	OSyncEngine *engine = _sync_easy_engine_new(testbed);
+	osync_engine_set_profile_file(engine, profile_file);
+
+	fail_unless(osync_engine_get_profile(engine) == NULL, NULL);
+
+	/* Keep the engine for its profile */
+	osync_engine_ref(engine);
+	_sync_easy_run(engine, testbed);
+
+	OSyncEngineProfile *profile = osync_engine_get_profile(engine);
+	fail_unless(profile != NULL, NULL);
+	osync_engine_unref(engine);
+
+	fail_unless(osync_engine_profile_num_objtypes(profile) == 1, NULL);
+	fail_unless(!strcmp(osync_engine_profile_nth_objtype(profile, 0), "mockobjtype1"), NULL);
+	fail_unless(osync_engine_profile_nth_objtype(profile, 1) == NULL, NULL);
+
+	/* The whole engine */
+	fail_unless(osync_engine_profile_get_items(profile, NULL, 0, OSYNC_ENGINE_PHASE_CONNECT) == 2, NULL);
+	fail_unless(osync_engine_profile_get_items(profile, NULL, 0, OSYNC_ENGINE_PHASE_GET_CHANGES) == 6, NULL);
+	fail_unless(osync_engine_profile_get_items(profile, NULL, 0, OSYNC_ENGINE_PHASE_MAP) == 6, NULL);
+	fail_unless(osync_engine_profile_get_items(profile, NULL, 0, OSYNC_ENGINE_PHASE_MULTIPLY) == 6, NULL);
+	fail_unless(osync_engine_profile_get_items(profile, NULL, 0, OSYNC_ENGINE_PHASE_CONVERT) == 6, NULL);
+	fail_unless(osync_engine_profile_get_items(profile, NULL, 0, OSYNC_ENGINE_PHASE_WRITE) == 6, NULL);
+	fail_unless(osync_engine_profile_get_items(profile, NULL, 0, OSYNC_ENGINE_PHASE_SYNC_DONE) == 2, NULL);
+
+	/* The object type and its members */
+	fail_unless(osync_engine_profile_get_items(profile, "mockobjtype1", 0, OSYNC_ENGINE_PHASE_GET_CHANGES) == 6, NULL);
+	fail_unless(osync_engine_profile_get_items(profile, "mockobjtype1", 1, OSYNC_ENGINE_PHASE_GET_CHANGES) == 4, NULL);
+	fail_unless(osync_engine_profile_get_items(profile, "mockobjtype1", 2, OSYNC_ENGINE_PHASE_GET_CHANGES) == 2, NULL);
+	fail_unless(osync_engine_profile_get_items(profile, "mockobjtype1", 1, OSYNC_ENGINE_PHASE_WRITE) == 2, NULL);
+	fail_unless(osync_engine_profile_get_items(profile, "mockobjtype1", 2, OSYNC_ENGINE_PHASE_WRITE) == 4, NULL);
+	fail_unless(osync_engine_profile_get_items(profile, "mockobjtype2", 0, OSYNC_ENGINE_PHASE_WRITE) == 0, NULL);
+
+	int i;
+	for (i = 0; i < OSYNC_ENGINE_NUM_PHASES; i++) {
+		fail_unless(osync_engine_profile_get_wall_time(profile, NULL, 0, i) >= 0, NULL);
+		fail_unless(osync_engine_profile_get_wall_time(profile, NULL, 0, i) <= osync_engine_profile_get_total_wall_time(profile), NULL);
+		fail_unless(osync_engine_profile_get_cpu_time(profile, NULL, 0, i) >= 0, NULL);
+	}
+	fail_unless(osync_engine_profile_get_wall_time(profile, "mockobjtype1", 1, OSYNC_ENGINE_PHASE_CONNECT) > 0, NULL);
+
+	/* Members only get the CPU time of the work done on their behalf,
+	 * not the one of the process while they connected */
+	fail_unless(osync_engine_profile_get_cpu_time(profile, "mockobjtype1", 1, OSYNC_ENGINE_PHASE_CONNECT) == 0, NULL);
+	fail_unless(osync_engine_profile_get_cpu_time(profile, "mockobjtype1", 0, OSYNC_ENGINE_PHASE_CONNECT) == 0, NULL);
+
+	/* The same as written after the synchronization */
+	char *json = osync_engine_profile_to_json(profile);
+	char *written = NULL;
+	unsigned int size = 0;
+	fail_unless(osync_file_read(profile_file, &written, &size, &error), NULL);
+	fail_unless(error == NULL, NULL);
+	fail_unless(!strcmp(json, written), NULL);
+	fail_unless(strstr(json, "\"objtype\": \"mockobjtype1\"") != NULL, NULL);
+	fail_unless(strstr(json, "\"get_changes\": { \"wall_time\": ") != NULL, NULL);
+	osync_free(written);
+	osync_free(json);
+
+	osync_engine_profile_unref(profile);
+
+	g_free(profile_file);
+
+	destroy_testbed(testbed);
+}
+END_TEST
+
+/* Three objtypes get mapped, multiplied and prepared for writing
+ * by their object engines in threads of their own. */
+START_TEST (sync_parallel_objengines)
+{
+	char *testbed = setup_testbed("sync_multi");
+	char *formatdir = g_strdup_printf("%s/formats", testbed);
+	char *plugindir = g_strdup_printf("%s/plugins", testbed);
+	
+	osync_testing_system_abort("mkdir file-1");
+	osync_testing_system_abort("mkdir file2-1");
+	osync_testing_system_abort("mkdir file3-1");
+	
+	osync_testing_system_abort("mkdir file-2");
+	osync_testing_system_abort("mkdir file2-2");
+	osync_testing_system_abort("mkdir file3-2");
+	
+	create_random_file("file-1/file1");
+	create_random_file("file2-1/file2");
+	create_random_file("file3-2/file3");
+	
+	OSyncError *error = NULL;
+	OSyncGroup *group = osync_group_new(&error);
+	fail_unless(group != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+	
+	osync_group_set_schemadir(group, testbed);
+	fail_unless(osync_group_load(group, "configs/group", &error), NULL);
+	fail_unless(error == NULL, NULL);
+	
+	OSyncMember *member1 = osync_group_nth_member(group, 0);
+	OSyncPluginConfig *config1 = simple_plugin_config(NULL, "file-1", "mockobjtype1", "mockformat1", NULL);
+	simple_plugin_config(config1, "file2-1", "mockobjtype2", "mockformat2", NULL);
+	simple_plugin_config(config1, "file3-1", "mockobjtype3", "mockformat3", NULL);
+	osync_member_set_config(member1, config1);
+	osync_plugin_config_unref(config1);
+
+	OSyncMember *member2 = osync_group_nth_member(group, 1);
+	OSyncPluginConfig *config2 = simple_plugin_config(NULL, "file-2", "mockobjtype1", "mockformat1", NULL);
+	simple_plugin_config(config2, "file2-2", "mockobjtype2", "mockformat2", NULL);
+	simple_plugin_config(config2, "file3-2", "mockobjtype3", "mockformat3", NULL);
+	osync_member_set_config(member2, config2);
+	osync_plugin_config_unref(config2);
+	
+	OSyncEngine *engine = osync_engine_new(group, &error);
+	fail_unless(engine != NULL, NULL);
+	fail_unless(error == NULL, NULL);
+	osync_group_unref(group);
+
+	osync_engine_set_schemadir(engine, testbed);	
+	osync_engine_set_plugindir(engine, plugindir);
+	osync_engine_set_formatdir(engine, formatdir);
+
+	osync_engine_set_parallel_objengines(engine, TRUE);
+	
+	osync_engine_set_conflict_callback(engine, conflict_handler_choose_first, GINT_TO_POINTER(2));
+	osync_engine_set_changestatus_callback(engine, entry_status, GINT_TO_POINTER(1));
+	osync_engine_set_mappingstatus_callback(engine, mapping_status, GINT_TO_POINTER(1));
+	osync_engine_set_enginestatus_callback(engine, engine_status, GINT_TO_POINTER(1));
+	osync_engine_set_memberstatus_callback(engine, member_status, GINT_TO_POINTER(1));
+	
+	fail_unless(osync_engine_discover_and_block(engine, member1, &error), NULL);
+	fail_unless(osync_engine_discover_and_block(engine, member2, &error), NULL);
+	fail_unless(osync_group_num_objtypes(group) == 3, NULL);
+	
+	reset_counters();
+	fail_unless(osync_engine_initialize(engine, &error), NULL);
+	fail_unless(error == NULL, NULL);
+	
+	fail_unless(osync_engine_synchronize_and_block(engine, &error), NULL);
+	fail_unless(error == NULL, NULL);
+
+	fail_unless(osync_engine_finalize(engine, &error), NULL);
+	fail_unless(error == NULL, NULL);
+	
+	osync_engine_unref(engine);
+	
+	/* Client checks */
+	fail_unless(num_client_errors == 0, NULL);
+	
+	/* Engine checks */
+	fail_unless(num_engine_errors == 0, NULL);
+	fail_unless(num_engine_successful == 1, NULL);
+	fail_unless(num_engine_end_conflicts == 1, NULL);
+
+	/* Change checks */
+	fail_unless(num_change_read == 3, NULL);
+	fail_unless(num_change_written == 3, NULL);
+	fail_unless(num_change_error == 0, NULL);
+
+	/* Mapping checks */
+	fail_unless(num_mapping_errors == 0, NULL);
+	fail_unless(num_mapping_conflicts == 0, NULL);
+	
+	fail_unless(osync_testing_diff("file-1", "file-2"));
+	fail_unless(osync_testing_diff("file2-1", "file2-2"));
+	fail_unless(osync_testing_diff("file3-1", "file3-2"));
+
+	g_free(formatdir);
+	g_free(plugindir);
+	
+	destroy_testbed(testbed);
+}
+END_TEST
+
 /* We want to detect a single objtype "mockobjtype1"
  * 
  * - First we send the config to the plugin
@@ -3639,6 +4116,13 @@ OSYNC_TESTCASE_ADD(sync_moddel)
 OSYNC_TESTCASE_ADD(sync_conflict_moddel)
 OSYNC_TESTCASE_ADD(sync_easy_dualdel)
 OSYNC_TESTCASE_ADD(sync_large)
+OSYNC_TESTCASE_ADD(sync_batch_commit)
+OSYNC_TESTCASE_ADD(sync_conversion_threads)
+OSYNC_TESTCASE_ADD(sync_parallel_objengines)
+OSYNC_TESTCASE_ADD(sync_incremental_mapping)
+OSYNC_TESTCASE_ADD(sync_change_stubs)
+OSYNC_TESTCASE_ADD(sync_change_store)
+OSYNC_TESTCASE_ADD(sync_profile)
 OSYNC_TESTCASE_ADD(sync_detect_obj)
 OSYNC_TESTCASE_ADD(sync_detect_obj2)
 OSYNC_TESTCASE_ADD(sync_slowsync_connect)